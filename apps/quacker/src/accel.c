@@ -0,0 +1,267 @@
+/**
+ * Copyright 2016 ICE9 Consulting
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+/**
+ * Driver for the MMA7660FC accelerometer (U1) on I2C.
+ *
+ * The part has no sample FIFO.  What it does have is an on-chip tilt
+ * detector and auto-wake/sleep logic, so the driver runs it in two modes:
+ *
+ *     o Idle: the sensor samples slowly on its own and only raises INT when
+ *       its portrait/landscape or front/back classification changes.  The
+ *       accel task sleeps on the INT pin and no I2C traffic happens at all.
+ *     o Streaming: INT fires on every new measurement.  Each drain is a
+ *       single burst read of XOUT..TILT (four registers, one transaction),
+ *       which also clears the interrupt.
+ *
+ * The driver only talks to hal_i2c, so it builds against the mock device in
+ * accel_mock.c for host builds.
+ */
+
+#include <assert.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "bsp/bsp.h"
+#include "bsp/bsp_sysid.h"
+#include "hal/hal_i2c.h"
+
+#include "quacker.h"
+
+#define ACCEL_ADDR              0x4C
+
+/* Registers. */
+#define ACCEL_REG_XOUT          0x00
+#define ACCEL_REG_TILT          0x03
+#define ACCEL_REG_SPCNT         0x05
+#define ACCEL_REG_INTSU         0x06
+#define ACCEL_REG_MODE          0x07
+#define ACCEL_REG_SR            0x08
+
+/* XOUT/YOUT/ZOUT/TILT: register was being updated when read. */
+#define ACCEL_ALERT             0x40
+
+/* INTSU bits. */
+#define ACCEL_INTSU_FBINT       0x01
+#define ACCEL_INTSU_PLINT       0x02
+#define ACCEL_INTSU_ASINT       0x08
+#define ACCEL_INTSU_GINT        0x10
+
+/* MODE bits.  INT is push-pull, active low. */
+#define ACCEL_MODE_ACTIVE       0x01
+#define ACCEL_MODE_AWE          0x08
+#define ACCEL_MODE_ASE          0x10
+#define ACCEL_MODE_IPP          0x40
+
+/* SR: AMSR in bits 2:0, AWSR in 4:3, tilt debounce count in 7:5. */
+#define ACCEL_SR_AMSR_64        0x01
+#define ACCEL_SR_AMSR_16        0x03
+#define ACCEL_SR_AWSR_8         0x10
+#define ACCEL_SR_FILT(n)        ((n) << 5)
+
+/* Samples without a tilt change before the part drops to the wake rate. */
+#define ACCEL_SLEEP_COUNT       32
+
+/* Re-reads allowed when a register is caught mid-update. */
+#define ACCEL_ALERT_RETRIES     4
+
+static struct hal_i2c *accel_i2c;
+
+static int
+accel_write_reg(uint8_t reg, uint8_t val)
+{
+    struct hal_i2c_master_data data;
+    uint8_t buf[2];
+    int rc;
+
+    buf[0] = reg;
+    buf[1] = val;
+
+    data.address = ACCEL_ADDR;
+    data.len = sizeof buf;
+    data.buffer = buf;
+
+    hal_i2c_master_begin(accel_i2c);
+    rc = hal_i2c_master_write(accel_i2c, &data);
+    hal_i2c_master_end(accel_i2c);
+
+    return rc;
+}
+
+/**
+ * Reads a run of consecutive registers in one transaction; the part
+ * auto-increments the register pointer.
+ */
+static int
+accel_read_regs(uint8_t reg, uint8_t *buf, int len)
+{
+    struct hal_i2c_master_data data;
+    int rc;
+
+    data.address = ACCEL_ADDR;
+    data.len = 1;
+    data.buffer = &reg;
+
+    hal_i2c_master_begin(accel_i2c);
+    rc = hal_i2c_master_write(accel_i2c, &data);
+    if (rc == 0) {
+        data.len = len;
+        data.buffer = buf;
+        rc = hal_i2c_master_read(accel_i2c, &data);
+    }
+    hal_i2c_master_end(accel_i2c);
+
+    return rc;
+}
+
+static int8_t
+accel_sign_extend(uint8_t raw)
+{
+    return (int8_t)(raw << 2) >> 2;
+}
+
+/**
+ * Reconfigures the part.  Registers may only be written in standby, so the
+ * part is stopped, updated, and restarted.
+ */
+static int
+accel_configure(uint8_t sr, uint8_t intsu, uint8_t mode)
+{
+    int rc;
+
+    rc = accel_write_reg(ACCEL_REG_MODE, 0);
+    if (rc != 0) {
+        return rc;
+    }
+
+    rc = accel_write_reg(ACCEL_REG_SR, sr);
+    if (rc == 0) {
+        rc = accel_write_reg(ACCEL_REG_SPCNT, ACCEL_SLEEP_COUNT);
+    }
+    if (rc == 0) {
+        rc = accel_write_reg(ACCEL_REG_INTSU, intsu);
+    }
+    if (rc == 0) {
+        rc = accel_write_reg(ACCEL_REG_MODE,
+                             mode | ACCEL_MODE_IPP | ACCEL_MODE_ACTIVE);
+    }
+
+    return rc;
+}
+
+/**
+ * Switches between idle (interrupt on tilt change only) and streaming
+ * (interrupt on every sample) operation.
+ *
+ * @return                      0 on success; I2C error on failure.
+ */
+int
+accel_set_streaming(int streaming)
+{
+    if (streaming) {
+        return accel_configure(ACCEL_SR_AMSR_16 | ACCEL_SR_FILT(0),
+                               ACCEL_INTSU_GINT, 0);
+    } else {
+        return accel_configure(ACCEL_SR_AMSR_64 | ACCEL_SR_AWSR_8 |
+                                   ACCEL_SR_FILT(4),
+                               ACCEL_INTSU_FBINT | ACCEL_INTSU_PLINT |
+                                   ACCEL_INTSU_ASINT,
+                               ACCEL_MODE_AWE | ACCEL_MODE_ASE);
+    }
+}
+
+/**
+ * Drains the current measurement: X, Y, Z and the tilt status in a single
+ * burst.  Reading TILT also acknowledges the interrupt.
+ *
+ * @return                      0 on success; I2C error on failure.
+ */
+int
+accel_read(struct accel_sample *sample)
+{
+    uint8_t buf[4];
+    int tries;
+    int rc;
+    int i;
+
+    for (tries = 0; tries < ACCEL_ALERT_RETRIES; tries++) {
+        rc = accel_read_regs(ACCEL_REG_XOUT, buf, sizeof buf);
+        if (rc != 0) {
+            return rc;
+        }
+
+        for (i = 0; i < sizeof buf; i++) {
+            if (buf[i] & ACCEL_ALERT) {
+                break;
+            }
+        }
+        if (i == sizeof buf) {
+            break;
+        }
+    }
+
+    sample->x = accel_sign_extend(buf[0]);
+    sample->y = accel_sign_extend(buf[1]);
+    sample->z = accel_sign_extend(buf[2]);
+    sample->tilt = buf[ACCEL_REG_TILT] & ~ACCEL_ALERT;
+
+    return 0;
+}
+
+/**
+ * Puts the accelerometer in standby, where it draws a few microamps and
+ * raises no interrupts.  accel_set_streaming() brings it back.
+ *
+ * @return                      0 on success; I2C error on failure.
+ */
+int
+accel_sleep(void)
+{
+    /* Called on the way to System OFF whether or not init worked. */
+    if (accel_i2c == NULL) {
+        return -1;
+    }
+
+    return accel_write_reg(ACCEL_REG_MODE, 0);
+}
+
+/**
+ * Opens the I2C bus and puts the accelerometer in idle mode.  May be
+ * called again after a failure.
+ *
+ * @return                      0 on success; nonzero if the part doesn't
+ *                                  respond.
+ */
+int
+accel_init(void)
+{
+    accel_i2c = hal_i2c_init(I2C0);
+    if (accel_i2c == NULL) {
+        return -1;
+    }
+
+    if (hal_i2c_master_probe(accel_i2c, ACCEL_ADDR) != 0) {
+        accel_i2c = NULL;
+        return -1;
+    }
+
+    return accel_set_streaming(0);
+}
@@ -0,0 +1,197 @@
+/**
+ * Copyright 2016 ICE9 Consulting
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+/**
+ * A fake MMA7660FC behind the hal_i2c interface, for host builds where
+ * there is no I2C hardware.  Build with ACCEL_MOCK to link this in place of
+ * the MCU's hal_i2c.
+ *
+ * Samples queued with accel_mock_push() are presented one at a time.  Each
+ * read that reaches the TILT register consumes the current sample, as
+ * reading TILT on the real part acknowledges the interrupt.  The mock keeps
+ * the register file, the INT line and a count of bus transactions so a
+ * caller can check the driver's access pattern; test/test_accel.c does.
+ */
+
+#ifdef ACCEL_MOCK
+
+#include <assert.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "bsp/bsp_sysid.h"
+#include "hal/hal_i2c.h"
+
+#include "quacker.h"
+
+#define MOCK_ADDR           0x4C
+#define MOCK_NUM_REGS       11
+#define MOCK_REG_TILT       0x03
+#define MOCK_REG_MODE       0x07
+#define MOCK_QUEUE_LEN      64
+
+struct hal_i2c {
+    int unused;
+};
+
+static struct hal_i2c accel_mock_dev;
+
+static uint8_t accel_mock_regs[MOCK_NUM_REGS];
+static uint8_t accel_mock_ptr;
+static int accel_mock_in_xfer;
+
+static struct accel_sample accel_mock_queue[MOCK_QUEUE_LEN];
+static int accel_mock_head;
+static int accel_mock_tail;
+
+int accel_mock_transactions;
+int accel_mock_int;
+
+static void
+accel_mock_load(void)
+{
+    struct accel_sample *s;
+
+    if (accel_mock_head == accel_mock_tail) {
+        accel_mock_int = 0;
+        return;
+    }
+
+    s = accel_mock_queue + accel_mock_head;
+    accel_mock_regs[0] = s->x & 0x3f;
+    accel_mock_regs[1] = s->y & 0x3f;
+    accel_mock_regs[2] = s->z & 0x3f;
+    accel_mock_regs[MOCK_REG_TILT] = s->tilt;
+    accel_mock_int = 1;
+}
+
+/**
+ * Queues a measurement.  INT asserts while the queue is non-empty.
+ */
+void
+accel_mock_push(int8_t x, int8_t y, int8_t z, uint8_t tilt)
+{
+    int next;
+
+    next = (accel_mock_tail + 1) % MOCK_QUEUE_LEN;
+    assert(next != accel_mock_head);
+
+    accel_mock_queue[accel_mock_tail] =
+        (struct accel_sample){ .x = x, .y = y, .z = z, .tilt = tilt };
+    accel_mock_tail = next;
+
+    if (!accel_mock_int) {
+        accel_mock_load();
+    }
+}
+
+struct hal_i2c *
+hal_i2c_init(enum system_device_id sysid)
+{
+    memset(accel_mock_regs, 0, sizeof accel_mock_regs);
+    accel_mock_head = accel_mock_tail = 0;
+    accel_mock_transactions = 0;
+    accel_mock_int = 0;
+
+    return &accel_mock_dev;
+}
+
+int
+hal_i2c_master_begin(struct hal_i2c *i2c)
+{
+    assert(!accel_mock_in_xfer);
+    accel_mock_in_xfer = 1;
+    accel_mock_transactions++;
+    return 0;
+}
+
+int
+hal_i2c_master_end(struct hal_i2c *i2c)
+{
+    assert(accel_mock_in_xfer);
+    accel_mock_in_xfer = 0;
+    return 0;
+}
+
+int
+hal_i2c_master_probe(struct hal_i2c *i2c, uint8_t address)
+{
+    return address == MOCK_ADDR ? 0 : -1;
+}
+
+int
+hal_i2c_master_write(struct hal_i2c *i2c, struct hal_i2c_master_data *pdata)
+{
+    int i;
+
+    if (pdata->address != MOCK_ADDR || pdata->len == 0) {
+        return -1;
+    }
+
+    accel_mock_ptr = pdata->buffer[0];
+    for (i = 1; i < pdata->len; i++) {
+        if (accel_mock_ptr >= MOCK_NUM_REGS) {
+            return -1;
+        }
+
+        /* Like the real part, ignore writes outside standby except to
+         * MODE itself.
+         */
+        if (accel_mock_ptr == MOCK_REG_MODE ||
+            (accel_mock_regs[MOCK_REG_MODE] & 0x01) == 0) {
+            accel_mock_regs[accel_mock_ptr] = pdata->buffer[i];
+        }
+        accel_mock_ptr++;
+    }
+
+    return 0;
+}
+
+int
+hal_i2c_master_read(struct hal_i2c *i2c, struct hal_i2c_master_data *pdata)
+{
+    int tilt_read;
+    int i;
+
+    if (pdata->address != MOCK_ADDR) {
+        return -1;
+    }
+
+    tilt_read = 0;
+    for (i = 0; i < pdata->len; i++) {
+        if (accel_mock_ptr >= MOCK_NUM_REGS) {
+            return -1;
+        }
+        if (accel_mock_ptr == MOCK_REG_TILT) {
+            tilt_read = 1;
+        }
+        pdata->buffer[i] = accel_mock_regs[accel_mock_ptr++];
+    }
+
+    if (tilt_read && accel_mock_int) {
+        accel_mock_head = (accel_mock_head + 1) % MOCK_QUEUE_LEN;
+        accel_mock_load();
+    }
+
+    return 0;
+}
+
+#endif /* ACCEL_MOCK */
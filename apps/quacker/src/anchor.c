@@ -0,0 +1,205 @@
+/**
+ * Copyright 2016 ICE9 Consulting
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+/**
+ * Connection-event timing for tap reports.
+ *
+ * A notification waits in the link layer for the next connection event, so
+ * a report queued just after an anchor point pays nearly a whole interval.
+ * The controller knows when the next anchor is; this reads it for the
+ * active target's connection (see llconn.c) and lets the button task
+ * confirm the edge that sends a button's report a little early, when that
+ * gets the report onto the anchor before.  That is the press for a button
+ * that taps at once and the release for one that waits to tell a hold from
+ * a press (see hid.c).  The edge must still have been stable for
+ * ANCHOR_MIN_PRESS_MSEC or ANCHOR_MIN_RELEASE_MSEC, and the confirmation
+ * happens on a poll the button task was making anyway, so the badge wakes
+ * no more often than before.
+ *
+ * Each edge records how far its report's anchor was from the edge and
+ * where in the interval the report was queued.  A summary, with the anchor
+ * the report would have waited for otherwise, is logged every
+ * ANCHOR_LOG_EDGES edges; that log is the measure of what this saves.
+ */
+
+#include <assert.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "os/os.h"
+#include "hal/hal_cputime.h"
+#include "host/ble_hs.h"
+
+#include "quacker.h"
+
+/** Shortest press and release that may be confirmed ahead of the usual
+ * debounce; make and break bounce are over well within these.
+ */
+#define ANCHOR_MIN_PRESS_MSEC       50
+#define ANCHOR_MIN_RELEASE_MSEC     10
+
+/** Time the host and controller need between queueing a report and the
+ * anchor that carries it.
+ */
+#define ANCHOR_GUARD_USEC           1000
+
+#define ANCHOR_HIST_BINS            8
+#define ANCHOR_LOG_EDGES            32
+
+static struct {
+    uint32_t edges;
+    uint32_t early;
+    uint32_t usec;          /* Edge to anchor, summed. */
+    uint32_t usec_late;     /* Same, had the report not been scheduled. */
+    uint16_t hist[ANCHOR_HIST_BINS];    /* Queue to anchor, in eighths. */
+} anchor_stats;
+
+/**
+ * Finds the first anchor point of the active target's connection at or
+ * after t.
+ *
+ * @return                      0 on success; BLE_HS_ENOTCONN if there is
+ *                                  no connection.
+ */
+static int
+anchor_next(uint32_t t, uint32_t *out_anchor, uint32_t *out_itvl)
+{
+    uint16_t conn_handle;
+    uint32_t anchor;
+    uint32_t itvl;
+    int rc;
+
+    conn_handle = gatt_svr_active_conn();
+    if (conn_handle == BLE_HS_CONN_HANDLE_NONE) {
+        return BLE_HS_ENOTCONN;
+    }
+
+    rc = llconn_timing(conn_handle, &anchor, &itvl);
+    if (rc != 0) {
+        return rc;
+    }
+
+    if ((int32_t)(t - anchor) > 0) {
+        anchor += ((t - anchor + itvl - 1) / itvl) * itvl;
+    }
+
+    *out_anchor = anchor;
+    *out_itvl = itvl;
+    return 0;
+}
+
+/**
+ * Decides whether an edge still being debounced should be confirmed now.
+ * It should if the last anchor before the debounce would end is closer
+ * than the next poll, so that waiting would push the report to the anchor
+ * after.
+ *
+ * @param press                 A press, rather than a release.
+ * @param stable_usec           How long the button has read its new state.
+ * @param left_usec             Time until the debounce would confirm it.
+ * @param poll_usec             Time until the button task looks again.
+ */
+int
+anchor_confirm_early(int press, uint32_t stable_usec, uint32_t left_usec,
+                     uint32_t poll_usec)
+{
+    uint32_t anchor;
+    uint32_t itvl;
+    uint32_t last;
+    uint32_t now;
+
+    if (stable_usec < (press ? ANCHOR_MIN_PRESS_MSEC :
+                               ANCHOR_MIN_RELEASE_MSEC) * 1000) {
+        return 0;
+    }
+
+    now = cputime_get32();
+    if (anchor_next(now + ANCHOR_GUARD_USEC, &anchor, &itvl) != 0) {
+        return 0;
+    }
+
+    /* No anchor before the debounce ends; nothing to gain. */
+    if ((int32_t)(anchor - (now + left_usec)) >= 0) {
+        return 0;
+    }
+
+    /* The last one before it is the one to make. */
+    last = anchor + (now + left_usec - anchor - 1) / itvl * itvl;
+    return last - now < poll_usec + ANCHOR_GUARD_USEC;
+}
+
+/**
+ * Records a confirmed edge that sent a report.
+ *
+ * @param edge_time             When the button first read its new state.
+ * @param late_usec             How much later the debounce would have
+ *                                  confirmed it; 0 if it did.
+ */
+void
+anchor_edge(uint32_t edge_time, uint32_t late_usec)
+{
+    uint32_t anchor;
+    uint32_t late;
+    uint32_t itvl;
+    uint32_t now;
+    int bin;
+
+    now = cputime_get32();
+    if (anchor_next(now + ANCHOR_GUARD_USEC, &anchor, &itvl) != 0) {
+        return;
+    }
+
+    anchor_stats.edges++;
+    anchor_stats.usec += anchor - edge_time;
+    bin = (anchor - now) * ANCHOR_HIST_BINS / itvl;
+    if (bin >= ANCHOR_HIST_BINS) {
+        bin = ANCHOR_HIST_BINS - 1;
+    }
+    anchor_stats.hist[bin]++;
+
+    if (late_usec != 0) {
+        anchor_stats.early++;
+        anchor_next(now + late_usec + ANCHOR_GUARD_USEC, &late, &itvl);
+        anchor_stats.usec_late += late - edge_time;
+    } else {
+        anchor_stats.usec_late += anchor - edge_time;
+    }
+
+    if (anchor_stats.edges < ANCHOR_LOG_EDGES) {
+        return;
+    }
+
+    QUACKER_LOG(INFO, "anchor: %lu edges, %lu early; edge to anchor "
+                      "%lu usec avg, %lu unscheduled; interval %lu usec\n",
+                (unsigned long)anchor_stats.edges,
+                (unsigned long)anchor_stats.early,
+                (unsigned long)(anchor_stats.usec / anchor_stats.edges),
+                (unsigned long)(anchor_stats.usec_late /
+                                anchor_stats.edges),
+                (unsigned long)itvl);
+    QUACKER_LOG(INFO, "anchor: queued ahead in eighths %u %u %u %u %u %u "
+                      "%u %u\n",
+                anchor_stats.hist[0], anchor_stats.hist[1],
+                anchor_stats.hist[2], anchor_stats.hist[3],
+                anchor_stats.hist[4], anchor_stats.hist[5],
+                anchor_stats.hist[6], anchor_stats.hist[7]);
+    memset(&anchor_stats, 0, sizeof anchor_stats);
+}
@@ -0,0 +1,884 @@
+/**
+ * Copyright 2016 ICE9 Consulting
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+/**
+ * Edge-to-notification latency benchmark.
+ *
+ * When built with QUACKER_BENCH, the button task reads its inputs from this
+ * file instead of the GPIO pins.  Each run replays a switch-bounce waveform
+ * on one of the buttons and timestamps every HID report as it is handed to
+ * ble_gatts_chr_updated().  Latency is timed from the edge that sends the
+ * button's report (see hid.c): the make for a button that taps at once,
+ * the start of the break for one that waits for its release.  At the end
+ * of a pass the latency percentiles and the lost / duplicated / spurious
+ * keystroke counts are logged and compared against the baseline in NFFS.
+ * The first pass on a fresh filesystem becomes the baseline.
+ *
+ * At boot the orientation classifier is also run over the fixed
+ * accelerometer traces in orient_traces.h, checking both its answers and its
+ * per-sample cost.  The HID engine's scripted checks need no hardware and
+ * run on the host; see apps/quacker/test/test_hid.c.
+ *
+ * Before the latency pass the entropy pool is drained every
+ * BENCH_ENTROPY_STEP_MSEC for a second, checking how fast the RNG refills it
+ * and that about half the bits it hands out are ones.
+ *
+ * Each connection also logs what it took to become usable: the number of ATT
+ * requests the host made before the first keystroke was notified, when the
+ * last of them arrived, and when the keystroke went out.  On a fresh pairing
+ * that is the cost of discovery, so it shows whether the MTU exchange let the
+ * report map go out in one read.  The time to encryption is logged too,
+ * marked as a new pairing or a stored key; the host pairs with legacy
+ * pairing only.
+ *
+ * On request (OTA_OP_BENCH written to the OTA control characteristic), a
+ * firmware image is streamed into the OTA code over a simulated link
+ * (BENCH_OTA_PER_EVENT writes of BENCH_OTA_WRITE bytes every
+ * BENCH_OTA_ITVL_MSEC, within the window ota.c advertises) and the
+ * throughput to a verified image is logged.  A delta patch against the
+ * running image follows, for comparison.  This rewrites 16 KB of the second
+ * image slot, so it never runs by itself, and it never marks the slot for
+ * the bootloader.
+ */
+
+#ifdef QUACKER_BENCH
+
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "bsp/bsp.h"
+#include "os/os.h"
+#include "hal/hal_cputime.h"
+#include "hal/flash_map.h"
+#include "fs/fsutil.h"
+#include "mbedtls/sha256.h"
+
+#include "quacker.h"
+#include "orient_traces.h"
+
+/* Renamed whenever what latency is timed from changes, so an old baseline
+ * isn't compared against.
+ */
+#define BENCH_BASELINE_FILE "/bench_edge.bin"
+
+/** Number of presses replayed per pass. */
+#define BENCH_NUM_RUNS      32
+
+/** Time allotted to a single press, including the idle gap after it. */
+#define BENCH_SLOT_MSEC     500
+
+/** Regression thresholds relative to the baseline. */
+#define BENCH_SLACK_PCT     10
+#define BENCH_SLACK_USEC    1000
+
+/**
+ * A waveform is a list of (level, duration) segments starting at the moment
+ * the plunger first touches.  The buttons are active low, so level 0 is
+ * "pressed".  The line is idle-high before the first and after the last
+ * segment.
+ */
+struct bench_seg {
+    uint8_t level;
+    uint16_t usec;
+};
+
+#define BENCH_MAX_SEGS      24
+
+struct bench_wave {
+    struct bench_seg segs[BENCH_MAX_SEGS];
+    int num_segs;
+};
+
+/**
+ * Canned waveforms modelled on typical tactile switch bounce: a clean press,
+ * a press with a short burst of contact bounce, and a worst case with long
+ * bounce on both make and break.  Passes alternate between these and
+ * synthetic waveforms generated by bench_wave_synth().
+ */
+static const struct bench_wave bench_canned[] = {
+    {
+        .segs = { { 0, 60000 }, { 0, 60000 } },
+        .num_segs = 2,
+    },
+    {
+        .segs = {
+            { 0, 150 }, { 1, 90 }, { 0, 400 }, { 1, 40 }, { 0, 60000 },
+            { 0, 60000 }, { 1, 30 }, { 0, 120 },
+        },
+        .num_segs = 8,
+    },
+    {
+        .segs = {
+            { 0, 300 }, { 1, 800 }, { 0, 200 }, { 1, 1500 }, { 0, 900 },
+            { 1, 300 }, { 0, 2500 }, { 1, 100 }, { 0, 60000 }, { 0, 55000 },
+            { 1, 600 }, { 0, 400 }, { 1, 1200 }, { 0, 200 },
+        },
+        .num_segs = 14,
+    },
+};
+#define BENCH_NUM_CANNED (sizeof bench_canned / sizeof bench_canned[0])
+
+struct bench_result {
+    uint32_t p50;
+    uint32_t p90;
+    uint32_t p99;
+    uint32_t max;
+    uint16_t lost;
+    uint16_t dup;
+    uint16_t spurious;
+    uint16_t runs;
+};
+
+static struct os_eventq *bench_evq;
+static struct os_callout_func bench_callout;
+
+/* Waveform currently being replayed. */
+static struct bench_wave bench_cur_wave;
+static int bench_cur_button;
+static uint32_t bench_cur_start;
+static uint32_t bench_cur_edge;     /* usec from the start to the edge. */
+static int bench_cur_active;
+static int bench_cur_reports;
+
+static int bench_run;
+static uint32_t bench_latency[BENCH_NUM_RUNS];
+static int bench_num_latency;
+static struct bench_result bench_result;
+
+/**
+ * Generates a press with a random amount of bounce on make and break.
+ */
+static void
+bench_wave_synth(struct bench_wave *wave)
+{
+    int bounces;
+    int i;
+    int n;
+
+    n = 0;
+
+    /* Make: up to four bounces of 50-2000 usec each. */
+    bounces = rand() % 5;
+    for (i = 0; i < bounces; i++) {
+        wave->segs[n++] = (struct bench_seg){ 0, 50 + rand() % 1950 };
+        wave->segs[n++] = (struct bench_seg){ 1, 50 + rand() % 1950 };
+    }
+
+    /* Hold for 120-180 msec; longer than a uint16_t can carry, so split. */
+    wave->segs[n++] = (struct bench_seg){ 0, 60000 };
+    wave->segs[n++] = (struct bench_seg){ 0, 60000 };
+    wave->segs[n++] = (struct bench_seg){ 0, rand() % 60000 };
+
+    /* Break: same again. */
+    bounces = rand() % 5;
+    for (i = 0; i < bounces; i++) {
+        wave->segs[n++] = (struct bench_seg){ 1, 50 + rand() % 1950 };
+        wave->segs[n++] = (struct bench_seg){ 0, 50 + rand() % 1950 };
+    }
+
+    assert(n <= BENCH_MAX_SEGS);
+    wave->num_segs = n;
+}
+
+/**
+ * Finds where the break starts: the end of the longest run at level 0,
+ * which is the hold.
+ *
+ * @return                      Offset of the break from the start of the
+ *                                  waveform, in usec.
+ */
+static uint32_t
+bench_wave_break(const struct bench_wave *wave)
+{
+    uint32_t best_run;
+    uint32_t best_end;
+    uint32_t run;
+    uint32_t t;
+    int i;
+
+    best_run = 0;
+    best_end = 0;
+    run = 0;
+    t = 0;
+    for (i = 0; i < wave->num_segs; i++) {
+        t += wave->segs[i].usec;
+        if (wave->segs[i].level != 0) {
+            run = 0;
+            continue;
+        }
+
+        run += wave->segs[i].usec;
+        if (run > best_run) {
+            best_run = run;
+            best_end = t;
+        }
+    }
+
+    return best_end;
+}
+
+/**
+ * Called by the button task in place of hal_gpio_read().
+ */
+int
+bench_button_read(int pin)
+{
+    static const int button[] = { BUTTON1, BUTTON2 };
+    uint32_t elapsed;
+    int i;
+
+    if (!bench_cur_active || pin != button[bench_cur_button]) {
+        return 1;
+    }
+
+    elapsed = cputime_get32() - bench_cur_start;
+    for (i = 0; i < bench_cur_wave.num_segs; i++) {
+        if (elapsed < bench_cur_wave.segs[i].usec) {
+            return bench_cur_wave.segs[i].level;
+        }
+        elapsed -= bench_cur_wave.segs[i].usec;
+    }
+
+    return 1;
+}
+
+/**
+ * Called by the button task each time it hands a report to the host.
+ */
+void
+bench_report_sent(const uint8_t *report)
+{
+    uint32_t now;
+
+    now = cputime_get32();
+
+    if (report[2] == 0x00) {
+        /* Key up; not timed. */
+        return;
+    }
+
+    if (!bench_cur_active) {
+        bench_result.spurious++;
+        return;
+    }
+
+    bench_cur_reports++;
+    if (bench_cur_reports == 1) {
+        bench_latency[bench_num_latency++] =
+            now - bench_cur_start - bench_cur_edge;
+    }
+}
+
+static int
+bench_cmp_u32(const void *a, const void *b)
+{
+    uint32_t x = *(const uint32_t *)a;
+    uint32_t y = *(const uint32_t *)b;
+
+    return x < y ? -1 : x > y;
+}
+
+static uint32_t
+bench_percentile(int pct)
+{
+    int idx;
+
+    if (bench_num_latency == 0) {
+        return 0;
+    }
+
+    idx = (bench_num_latency * pct + 99) / 100 - 1;
+    if (idx < 0) {
+        idx = 0;
+    }
+    return bench_latency[idx];
+}
+
+static int
+bench_regressed(uint32_t cur, uint32_t base)
+{
+    return cur > base + base * BENCH_SLACK_PCT / 100 + BENCH_SLACK_USEC;
+}
+
+/**
+ * Reports the result of a pass and compares it against the stored baseline.
+ *
+ * @return                      0 if the pass is within the baseline; 1 on
+ *                                  regression.
+ */
+static int
+bench_finish(void)
+{
+    struct bench_result base;
+    uint32_t len;
+    int fail;
+    int rc;
+
+    qsort(bench_latency, bench_num_latency, sizeof bench_latency[0],
+          bench_cmp_u32);
+
+    bench_result.runs = BENCH_NUM_RUNS;
+    bench_result.p50 = bench_percentile(50);
+    bench_result.p90 = bench_percentile(90);
+    bench_result.p99 = bench_percentile(99);
+    bench_result.max = bench_percentile(100);
+
+    QUACKER_LOG(INFO, "bench: runs=%d p50=%lu p90=%lu p99=%lu max=%lu usec "
+                      "lost=%d dup=%d spurious=%d\n",
+                bench_result.runs,
+                (unsigned long)bench_result.p50,
+                (unsigned long)bench_result.p90,
+                (unsigned long)bench_result.p99,
+                (unsigned long)bench_result.max,
+                bench_result.lost, bench_result.dup, bench_result.spurious);
+
+    rc = fsutil_read_file(BENCH_BASELINE_FILE, 0, sizeof base, &base, &len);
+    if (rc != 0 || len != sizeof base) {
+        QUACKER_LOG(INFO, "bench: no baseline; saving this pass\n");
+        fsutil_write_file(BENCH_BASELINE_FILE, &bench_result,
+                          sizeof bench_result);
+        return 0;
+    }
+
+    fail = bench_regressed(bench_result.p50, base.p50) ||
+           bench_regressed(bench_result.p90, base.p90) ||
+           bench_regressed(bench_result.p99, base.p99) ||
+           bench_result.lost > base.lost ||
+           bench_result.dup > base.dup ||
+           bench_result.spurious > base.spurious;
+
+    QUACKER_LOG(INFO, "bench: baseline p50=%lu p90=%lu p99=%lu "
+                      "lost=%d dup=%d spurious=%d; %s\n",
+                (unsigned long)base.p50, (unsigned long)base.p90,
+                (unsigned long)base.p99, base.lost, base.dup, base.spurious,
+                fail ? "FAIL" : "PASS");
+
+    return fail;
+}
+
+/** Simulated link: a 7.5 ms interval (rounded up) carrying six 20 byte
+ * writes per event, about what a phone gives an nRF51 at the default MTU.
+ */
+#define BENCH_OTA_ITVL_MSEC     8
+#define BENCH_OTA_PER_EVENT     6
+#define BENCH_OTA_WRITE         20
+#define BENCH_OTA_SIZE          (16 * 1024)
+
+/**
+ * The delta run rebuilds the first BENCH_OTA_SIZE bytes of the running
+ * image with BENCH_OTA_DELTA_CHANGE bytes changed in every KB, as if a few
+ * functions had been edited.  Each KB takes one 20 byte record:
+ *
+ *     ADD 16, <16 bytes>, COPY 1008 from the same offset
+ */
+#define BENCH_OTA_DELTA_CHANGE  16
+#define BENCH_OTA_DELTA_REC     20
+#define BENCH_OTA_DELTA_SIZE    (BENCH_OTA_SIZE / 1024 * BENCH_OTA_DELTA_REC)
+
+static struct os_callout_func bench_ota_callout;
+static struct os_callout_func bench_ota_start_callout;
+static const struct flash_area *bench_ota_base;
+static uint32_t bench_ota_size;     /* Bytes streamed. */
+static uint32_t bench_ota_sent;
+static uint32_t bench_ota_start_usec;
+static uint32_t bench_ota_xfer_usec;
+static uint32_t bench_ota_full_usec;
+static int bench_ota_delta;
+static int bench_ota_finishing;
+
+/** Synthetic image contents. */
+static uint8_t
+bench_ota_byte(uint32_t off)
+{
+    return (off * 2654435761UL) >> 24;
+}
+
+/** Byte off of the delta run's patch. */
+static uint8_t
+bench_ota_patch_byte(uint32_t off)
+{
+    uint32_t kb;
+    uint32_t r;
+
+    kb = off / BENCH_OTA_DELTA_REC;
+    r = off % BENCH_OTA_DELTA_REC;
+    if (r == 0) {
+        return BENCH_OTA_DELTA_CHANGE << 2;                 /* ADD */
+    } else if (r <= BENCH_OTA_DELTA_CHANGE) {
+        return bench_ota_byte(kb * 1024 + r - 1);
+    }
+
+    switch (r - BENCH_OTA_DELTA_CHANGE - 1) {
+    case 0:
+        return 0x80 | (((1024 - BENCH_OTA_DELTA_CHANGE) << 2 | 1) & 0x7f);
+    case 1:
+        return ((1024 - BENCH_OTA_DELTA_CHANGE) << 2 | 1) >> 7;  /* COPY */
+    default:
+        return 0;                                           /* +0 */
+    }
+}
+
+static void bench_ota_start(int delta);
+
+static void
+bench_ota_step(void *arg)
+{
+    const struct ota_status *st;
+    uint8_t pkt[BENCH_OTA_WRITE];
+    uint8_t finish[2];
+    uint32_t verify_usec;
+    uint32_t bps;
+    int n;
+    int i;
+    int j;
+
+    st = ota_get_status();
+
+    if (bench_ota_finishing) {
+        if (st->state == OTA_VERIFYING) {
+            os_callout_reset(&bench_ota_callout.cf_c,
+                             BENCH_OTA_ITVL_MSEC * OS_TICKS_PER_SEC / 1000);
+            return;
+        }
+
+        verify_usec = cputime_get32() - bench_ota_start_usec -
+                      bench_ota_xfer_usec;
+        if (!bench_ota_delta) {
+            bps = (uint64_t)BENCH_OTA_SIZE * 1000000 / bench_ota_xfer_usec;
+            QUACKER_LOG(INFO, "bench: ota %d bytes in %lu msec = "
+                              "%lu.%02lu KB/s, verify %lu msec; %s\n",
+                        BENCH_OTA_SIZE,
+                        (unsigned long)bench_ota_xfer_usec / 1000,
+                        (unsigned long)bps / 1024,
+                        (unsigned long)(bps % 1024) * 100 / 1024,
+                        (unsigned long)verify_usec / 1000,
+                        st->state == OTA_DONE ? "PASS" : "FAIL");
+
+            bench_ota_full_usec = bench_ota_xfer_usec;
+            if (st->state == OTA_DONE) {
+                bench_ota_start(1);
+            }
+            return;
+        }
+
+        QUACKER_LOG(INFO, "bench: ota delta %d byte patch for %d bytes in "
+                          "%lu msec (full image %lu msec), verify %lu msec; "
+                          "%s\n",
+                    BENCH_OTA_DELTA_SIZE, BENCH_OTA_SIZE,
+                    (unsigned long)bench_ota_xfer_usec / 1000,
+                    (unsigned long)bench_ota_full_usec / 1000,
+                    (unsigned long)verify_usec / 1000,
+                    st->state == OTA_DONE ? "PASS" : "FAIL");
+        return;
+    }
+
+    if (st->state != OTA_RECEIVING) {
+        QUACKER_LOG(INFO, "bench: ota state=%d error=%d; FAIL\n",
+                    st->state, st->error);
+        return;
+    }
+
+    if (st->acked == bench_ota_size) {
+        bench_ota_xfer_usec = cputime_get32() - bench_ota_start_usec;
+        bench_ota_finishing = 1;
+        finish[0] = OTA_OP_FINISH;
+        finish[1] = 0;
+        ota_ctrl(finish, sizeof finish);
+        os_callout_reset(&bench_ota_callout.cf_c, 0);
+        return;
+    }
+
+    /* Rewind if anything was dropped. */
+    if (st->offset < bench_ota_sent) {
+        bench_ota_sent = st->offset;
+    }
+
+    for (i = 0; i < BENCH_OTA_PER_EVENT; i++) {
+        n = BENCH_OTA_WRITE - sizeof bench_ota_sent;
+        if (n > bench_ota_size - bench_ota_sent) {
+            n = bench_ota_size - bench_ota_sent;
+        }
+        if (n == 0 || bench_ota_sent + n > st->acked + st->window) {
+            break;
+        }
+
+        memcpy(pkt, &bench_ota_sent, sizeof bench_ota_sent);
+        for (j = 0; j < n; j++) {
+            pkt[sizeof bench_ota_sent + j] = bench_ota_delta ?
+                bench_ota_patch_byte(bench_ota_sent + j) :
+                bench_ota_byte(bench_ota_sent + j);
+        }
+        ota_data(pkt, sizeof bench_ota_sent + n);
+        bench_ota_sent += n;
+    }
+
+    os_callout_reset(&bench_ota_callout.cf_c,
+                     BENCH_OTA_ITVL_MSEC * OS_TICKS_PER_SEC / 1000);
+}
+
+/**
+ * Starts an OTA throughput run on the benchmark's event queue: the full
+ * synthetic image, or the delta run against the running image.
+ */
+static void
+bench_ota_start(int delta)
+{
+    mbedtls_sha256_context ctx;
+    uint8_t start[1 + 2 * sizeof(uint32_t) + 2 * 32];
+    uint8_t *p;
+    uint32_t size;
+    uint32_t base_size;
+    uint32_t off;
+    uint8_t b;
+    int rc;
+
+    bench_ota_delta = delta;
+    if (delta) {
+        rc = flash_area_open(FLASH_AREA_IMAGE_0, &bench_ota_base);
+        assert(rc == 0);
+    }
+
+    /* Hash of the image the run should produce. */
+    mbedtls_sha256_init(&ctx);
+    mbedtls_sha256_starts(&ctx, 0);
+    for (off = 0; off < BENCH_OTA_SIZE; off++) {
+        if (!delta || off % 1024 < BENCH_OTA_DELTA_CHANGE) {
+            b = bench_ota_byte(off);
+        } else {
+            flash_area_read(bench_ota_base, off, &b, 1);
+        }
+        mbedtls_sha256_update(&ctx, &b, 1);
+    }
+
+    p = start;
+    *p++ = delta ? OTA_OP_START_DELTA : OTA_OP_START;
+    bench_ota_size = delta ? BENCH_OTA_DELTA_SIZE : BENCH_OTA_SIZE;
+    memcpy(p, &bench_ota_size, sizeof bench_ota_size);
+    p += sizeof bench_ota_size;
+    if (delta) {
+        size = BENCH_OTA_SIZE;
+        memcpy(p, &size, sizeof size);
+        p += sizeof size;
+    }
+    mbedtls_sha256_finish(&ctx, p);
+    p += 32;
+    if (delta) {
+        rc = delta_base_hash(p, &base_size);
+        if (rc != 0) {
+            QUACKER_LOG(INFO, "bench: ota delta needs a bootable image in "
+                              "slot 0; skipped\n");
+            return;
+        }
+        p += 32;
+    }
+
+    bench_ota_sent = 0;
+    bench_ota_finishing = 0;
+    bench_ota_start_usec = cputime_get32();
+    ota_ctrl(start, p - start);
+
+    os_callout_reset(&bench_ota_callout.cf_c, 0);
+}
+
+static void
+bench_ota_start_cb(void *arg)
+{
+    bench_ota_start(0);
+}
+
+/**
+ * Starts the OTA throughput run; called from ota_ctrl() for OTA_OP_BENCH.
+ */
+void
+bench_ota_request(void)
+{
+    os_callout_reset(&bench_ota_start_callout.cf_c, 0);
+}
+
+/**
+ * Closes out the press that was being replayed and starts the next one.
+ */
+static void
+bench_step(void *arg)
+{
+    const struct bench_wave *wave;
+
+    if (bench_cur_active) {
+        if (bench_cur_reports == 0) {
+            bench_result.lost++;
+        } else if (bench_cur_reports > 1) {
+            bench_result.dup += bench_cur_reports - 1;
+        }
+        bench_cur_active = 0;
+    }
+
+    if (bench_run == BENCH_NUM_RUNS) {
+        bench_finish();
+        return;
+    }
+
+    if (bench_run % 2 == 0) {
+        wave = bench_canned + (bench_run / 2) % BENCH_NUM_CANNED;
+        bench_cur_wave = *wave;
+    } else {
+        bench_wave_synth(&bench_cur_wave);
+    }
+
+    bench_cur_button = bench_run % 2;
+    bench_cur_edge = hid_button_waits(bench_cur_button) ?
+                     bench_wave_break(&bench_cur_wave) : 0;
+    bench_cur_reports = 0;
+    bench_cur_start = cputime_get32();
+    bench_cur_active = 1;
+    bench_run++;
+
+    os_callout_reset(&bench_callout.cf_c,
+                     BENCH_SLOT_MSEC * OS_TICKS_PER_SEC / 1000);
+}
+
+/**
+ * Runs the classifier over the fixed traces in orient_traces.h and logs the
+ * result of each, plus the mean time per sample against ORIENT_BUDGET_NSEC.
+ * apps/quacker/test checks the same answers on the host.
+ *
+ * @return                      0 if every trace classified correctly within
+ *                                  budget; 1 otherwise.
+ */
+static int
+bench_orient(void)
+{
+    const struct orient_trace *trace;
+    enum orientation_t result;
+    uint32_t samples;
+    uint32_t usec;
+    uint32_t start;
+    uint32_t nsec;
+    int fail;
+    int i;
+    int j;
+
+    fail = 0;
+    samples = 0;
+    usec = 0;
+
+    for (i = 0; i < ORIENT_NUM_TRACES; i++) {
+        trace = orient_traces + i;
+        orient_init();
+        result = NONE;
+
+        for (j = 0; j < trace->num_samples; j++) {
+            start = cputime_get32();
+            result = orient_update(trace->samples + j);
+            usec += cputime_get32() - start;
+            samples++;
+        }
+
+        if (result != trace->expect) {
+            fail = 1;
+        }
+        QUACKER_LOG(INFO, "bench: orient %s: got=%d expect=%d\n",
+                    trace->name, result, trace->expect);
+    }
+    orient_init();
+
+    /* cputime only has 1 usec resolution; the mean over all samples is
+     * what counts.
+     */
+    nsec = usec * 1000 / samples;
+    if (nsec > ORIENT_BUDGET_NSEC) {
+        fail = 1;
+    }
+
+    QUACKER_LOG(INFO, "bench: orient samples=%lu mean=%lu nsec budget=%d; "
+                      "%s\n",
+                (unsigned long)samples, (unsigned long)nsec,
+                ORIENT_BUDGET_NSEC, fail ? "FAIL" : "PASS");
+
+    return fail;
+}
+
+/** The pool refills in well under a step, so every step drains a full
+ * pool and the RNG runs from empty to full each time.
+ */
+#define BENCH_ENTROPY_STEP_MSEC     50
+#define BENCH_ENTROPY_STEPS         20
+
+/** Slowest acceptable refill rate.  Bias correction makes the time per
+ * byte vary, so this is a generous bound rather than a measured figure.
+ */
+#define BENCH_ENTROPY_MAX_USEC      2000
+
+static struct os_callout_func bench_entropy_callout;
+static struct entropy_stats bench_entropy_start;
+static uint32_t bench_entropy_bits;
+static uint32_t bench_entropy_ones;
+static int bench_entropy_step_num;
+
+static void
+bench_entropy_step(void *arg)
+{
+    const struct entropy_stats *st;
+    uint8_t buf[16];
+    uint32_t usec_per_byte;
+    uint32_t ones_pct10;
+    uint32_t filled;
+    int pass;
+    int n;
+    int i;
+
+    if (bench_entropy_step_num == 0) {
+        bench_entropy_start = *entropy_get_stats();
+    }
+
+    while ((n = entropy_read(buf, sizeof buf)) > 0) {
+        for (i = 0; i < n; i++) {
+            bench_entropy_ones += __builtin_popcount(buf[i]);
+        }
+        bench_entropy_bits += n * 8;
+    }
+
+    if (++bench_entropy_step_num <= BENCH_ENTROPY_STEPS) {
+        os_callout_reset(&bench_entropy_callout.cf_c,
+                         BENCH_ENTROPY_STEP_MSEC * OS_TICKS_PER_SEC / 1000);
+        return;
+    }
+
+    st = entropy_get_stats();
+    filled = st->fill_bytes - bench_entropy_start.fill_bytes;
+    usec_per_byte = filled == 0 ? UINT32_MAX :
+        (st->fill_usec - bench_entropy_start.fill_usec) / filled;
+    ones_pct10 = bench_entropy_bits == 0 ? 0 :
+        (uint64_t)bench_entropy_ones * 1000 / bench_entropy_bits;
+
+    pass = usec_per_byte <= BENCH_ENTROPY_MAX_USEC &&
+           ones_pct10 >= 480 && ones_pct10 <= 520;
+    QUACKER_LOG(INFO, "bench: entropy %lu bytes at %lu usec/byte, "
+                      "%lu.%lu%% ones, %lu short reads; %s\n",
+                (unsigned long)bench_entropy_bits / 8,
+                (unsigned long)usec_per_byte,
+                (unsigned long)ones_pct10 / 10,
+                (unsigned long)ones_pct10 % 10,
+                (unsigned long)(st->short_reads -
+                                bench_entropy_start.short_reads),
+                pass ? "PASS" : "FAIL");
+}
+
+static uint32_t bench_conn_start;
+static uint32_t bench_att_last;
+static int bench_att_requests;
+static int bench_conn_active;
+static int bench_conn_ltk;
+
+/**
+ * Called when a connection comes up.
+ */
+void
+bench_conn_up(void)
+{
+    bench_conn_start = cputime_get32();
+    bench_att_last = bench_conn_start;
+    bench_att_requests = 0;
+    bench_conn_active = 1;
+    bench_conn_ltk = 0;
+}
+
+/**
+ * Called when the stack finds a stored key to encrypt with, rather than
+ * pairing afresh.
+ */
+void
+bench_ltk_found(void)
+{
+    bench_conn_ltk = 1;
+}
+
+/**
+ * Called when encryption comes up.  The host never says when it sent the
+ * pairing request, but it sends it as soon as it connects, so the time from
+ * connect stands in.
+ */
+void
+bench_encrypted(void)
+{
+    QUACKER_LOG_FAST("bench: encrypted at %lu usec (%s)\n",
+                     (unsigned long)(cputime_get32() - bench_conn_start),
+                     bench_conn_ltk ? "stored key" : "new pairing");
+}
+
+/**
+ * Called by the GATT server for every attribute access, including each Read
+ * Blob of a long value.
+ */
+void
+bench_att_request(void)
+{
+    if (bench_conn_active) {
+        bench_att_requests++;
+        bench_att_last = cputime_get32();
+    }
+}
+
+/**
+ * Called by the GATT server when the stack reads a report for notification.
+ */
+void
+bench_report_read(const uint8_t *report)
+{
+    uint32_t now;
+
+    if (!bench_conn_active || report[2] == 0x00) {
+        return;
+    }
+
+    now = cputime_get32();
+    bench_conn_active = 0;
+
+    /* The report read itself was counted as a request. */
+    QUACKER_LOG_FAST("bench: %d ATT requests, last at %lu usec; "
+                     "first keystroke at %lu usec\n",
+                     bench_att_requests - 1,
+                     bench_att_last - bench_conn_start,
+                     now - bench_conn_start);
+}
+
+/**
+ * Schedules a benchmark pass on the specified event queue.  The pass starts
+ * a couple of seconds after boot so that it doesn't overlap with startup.
+ */
+void
+bench_init(struct os_eventq *evq)
+{
+    bench_evq = evq;
+    os_callout_func_init(&bench_ota_callout, evq, bench_ota_step, NULL);
+    os_callout_func_init(&bench_ota_start_callout, evq, bench_ota_start_cb,
+                         NULL);
+    bench_orient();
+
+    os_callout_func_init(&bench_entropy_callout, evq, bench_entropy_step,
+                         NULL);
+    os_callout_reset(&bench_entropy_callout.cf_c, OS_TICKS_PER_SEC / 2);
+
+    os_callout_func_init(&bench_callout, evq, bench_step, NULL);
+    os_callout_reset(&bench_callout.cf_c, 2 * OS_TICKS_PER_SEC);
+}
+
+#endif /* QUACKER_BENCH */
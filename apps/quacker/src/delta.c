@@ -0,0 +1,401 @@
+/**
+ * Copyright 2016 ICE9 Consulting
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+/**
+ * Streaming delta patch applier for OTA updates.
+ *
+ * A patch rebuilds the new image from the running one (FLASH_AREA_IMAGE_0)
+ * and is a sequence of commands, each starting with a varint
+ * (len << 2 | op):
+ *
+ *     DELTA_ADD   len literal bytes follow.
+ *     DELTA_COPY  a zigzag varint follows: the source offset in the running
+ *                 image, relative to the current output offset.
+ *     DELTA_RUN   one byte follows, repeated len times.
+ *
+ * Varints are little-endian base 128.  tools/quacker_delta.py generates
+ * patches.  Commands may be split anywhere across delta_feed() calls; the
+ * decoder keeps its place in a few words.  Output goes through a
+ * DELTA_OUT_SIZE buffer to ota_program(), and COPY reads the running image
+ * straight into that buffer, so the only RAM beyond the OTA window is the
+ * buffer itself.  The running image is never written, so no scratch area
+ * is needed.
+ */
+
+#include <assert.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "os/os.h"
+#include "hal/flash_map.h"
+#include "bootutil/image.h"
+
+#include "quacker.h"
+
+#define DELTA_OUT_SIZE      256
+
+enum delta_op {
+    DELTA_ADD = 0,
+    DELTA_COPY,
+    DELTA_RUN,
+};
+
+enum delta_state {
+    DELTA_S_CMD = 0,
+    DELTA_S_SRC,
+    DELTA_S_ADD,
+    DELTA_S_RUN,
+};
+
+static struct {
+    const struct flash_area *base;
+    uint32_t base_size;
+    uint32_t out_size;
+    uint32_t out_off;           /* Bytes decoded, buffered or not. */
+
+    uint8_t state;              /* DELTA_S_* */
+    uint8_t op;
+    uint8_t shift;
+    uint32_t val;
+    uint32_t len;
+} delta;
+
+static uint8_t delta_out[DELTA_OUT_SIZE];
+static int delta_out_len;
+
+static int
+delta_flush(void)
+{
+    int rc;
+
+    if (delta_out_len == 0) {
+        return 0;
+    }
+
+    rc = ota_program(delta.out_off - delta_out_len, delta_out,
+                     delta_out_len);
+    delta_out_len = 0;
+    return rc != 0 ? OTA_E_FLASH : OTA_E_NONE;
+}
+
+static int
+delta_emit(const uint8_t *src, int run, uint32_t len)
+{
+    uint32_t n;
+    int rc;
+
+    while (len > 0) {
+        n = DELTA_OUT_SIZE - delta_out_len;
+        if (n > len) {
+            n = len;
+        }
+
+        if (run >= 0) {
+            memset(delta_out + delta_out_len, run, n);
+        } else {
+            memcpy(delta_out + delta_out_len, src, n);
+            src += n;
+        }
+        delta_out_len += n;
+        delta.out_off += n;
+        len -= n;
+
+        if (delta_out_len == DELTA_OUT_SIZE) {
+            rc = delta_flush();
+            if (rc != 0) {
+                return rc;
+            }
+        }
+    }
+
+    return 0;
+}
+
+static int
+delta_copy(uint32_t src, uint32_t len)
+{
+    uint32_t n;
+    int rc;
+
+    while (len > 0) {
+        n = DELTA_OUT_SIZE - delta_out_len;
+        if (n > len) {
+            n = len;
+        }
+
+        rc = flash_area_read(delta.base, src, delta_out + delta_out_len, n);
+        if (rc != 0) {
+            return OTA_E_FLASH;
+        }
+        delta_out_len += n;
+        delta.out_off += n;
+        src += n;
+        len -= n;
+
+        if (delta_out_len == DELTA_OUT_SIZE) {
+            rc = delta_flush();
+            if (rc != 0) {
+                return rc;
+            }
+        }
+    }
+
+    return 0;
+}
+
+/**
+ * Accumulates one varint byte.
+ *
+ * @return                      1 when the varint is complete; 0 if more
+ *                                  bytes follow; -1 if it is too long.
+ */
+static int
+delta_varint(uint8_t b)
+{
+    if (delta.shift > 28) {
+        return -1;
+    }
+
+    delta.val |= (uint32_t)(b & 0x7f) << delta.shift;
+    delta.shift += 7;
+    return !(b & 0x80);
+}
+
+/**
+ * Finds the SHA-256 of the running image in its TLVs.
+ *
+ * @return                      0 on success, with the size of the running
+ *                                  image (header and TLVs included) in
+ *                                  *out_size; else OTA_E_BASE.
+ */
+int
+delta_base_hash(uint8_t *out_hash, uint32_t *out_size)
+{
+    const struct flash_area *fa;
+    struct image_header hdr;
+    struct image_tlv tlv;
+    uint32_t off;
+    uint32_t end;
+    int rc;
+
+    rc = flash_area_open(FLASH_AREA_IMAGE_0, &fa);
+    if (rc != 0) {
+        return OTA_E_BASE;
+    }
+
+    rc = flash_area_read(fa, 0, &hdr, sizeof hdr);
+    if (rc != 0 || hdr.ih_magic != IMAGE_MAGIC) {
+        return OTA_E_BASE;
+    }
+
+    off = hdr.ih_hdr_size + hdr.ih_img_size;
+    end = off + hdr.ih_tlv_size;
+    if (end > fa->fa_size) {
+        return OTA_E_BASE;
+    }
+
+    while (off + sizeof tlv <= end) {
+        rc = flash_area_read(fa, off, &tlv, sizeof tlv);
+        if (rc != 0) {
+            return OTA_E_BASE;
+        }
+        off += sizeof tlv;
+
+        if (tlv.it_type == IMAGE_TLV_SHA256 && tlv.it_len == 32) {
+            rc = flash_area_read(fa, off, out_hash, 32);
+            if (rc != 0) {
+                return OTA_E_BASE;
+            }
+            *out_size = end;
+            return 0;
+        }
+        off += tlv.it_len;
+    }
+
+    return OTA_E_BASE;
+}
+
+/**
+ * Checks that a patch was made from the running image.
+ *
+ * @return                      0 on a match, with the size of the running
+ *                                  image in *out_size; else OTA_E_BASE.
+ */
+int
+delta_base_check(const uint8_t *hash, uint32_t *out_size)
+{
+    uint8_t buf[32];
+    int rc;
+
+    rc = delta_base_hash(buf, out_size);
+    if (rc != 0 || memcmp(buf, hash, sizeof buf) != 0) {
+        return OTA_E_BASE;
+    }
+
+    return 0;
+}
+
+/**
+ * Starts decoding a patch that rebuilds an out_size byte image from the
+ * first base_size bytes of the running image.
+ */
+void
+delta_start(uint32_t base_size, uint32_t out_size)
+{
+    int rc;
+
+    memset(&delta, 0, sizeof delta);
+    rc = flash_area_open(FLASH_AREA_IMAGE_0, &delta.base);
+    assert(rc == 0);
+
+    delta.base_size = base_size;
+    delta.out_size = out_size;
+    delta_out_len = 0;
+}
+
+/**
+ * Decodes the next len bytes of the patch, programming the output as it
+ * goes.
+ *
+ * @return                      0 on success; OTA_E_PATCH or OTA_E_FLASH.
+ */
+int
+delta_feed(const uint8_t *data, int len)
+{
+    uint32_t src;
+    uint32_t n;
+    int rc;
+
+    while (len > 0) {
+        switch (delta.state) {
+        case DELTA_S_CMD:
+        case DELTA_S_SRC:
+            rc = delta_varint(*data);
+            data++;
+            len--;
+            if (rc < 0) {
+                return OTA_E_PATCH;
+            }
+            if (rc == 0) {
+                break;
+            }
+
+            if (delta.state == DELTA_S_SRC) {
+                /* Zigzag: 0, -1, 1, -2, ... */
+                src = delta.out_off +
+                      ((delta.val >> 1) ^ -(int32_t)(delta.val & 1));
+                if (src >= delta.base_size ||
+                    delta.len > delta.base_size - src) {
+
+                    return OTA_E_PATCH;
+                }
+                rc = delta_copy(src, delta.len);
+                if (rc != 0) {
+                    return rc;
+                }
+                delta.state = DELTA_S_CMD;
+            } else {
+                delta.op = delta.val & 3;
+                delta.len = delta.val >> 2;
+                if (delta.len == 0 ||
+                    delta.len > delta.out_size - delta.out_off) {
+
+                    return OTA_E_PATCH;
+                }
+
+                switch (delta.op) {
+                case DELTA_ADD:
+                    delta.state = DELTA_S_ADD;
+                    break;
+                case DELTA_COPY:
+                    delta.state = DELTA_S_SRC;
+                    break;
+                case DELTA_RUN:
+                    delta.state = DELTA_S_RUN;
+                    break;
+                default:
+                    return OTA_E_PATCH;
+                }
+            }
+            delta.val = 0;
+            delta.shift = 0;
+            break;
+
+        case DELTA_S_ADD:
+            n = delta.len;
+            if (n > len) {
+                n = len;
+            }
+            rc = delta_emit(data, -1, n);
+            if (rc != 0) {
+                return rc;
+            }
+            data += n;
+            len -= n;
+            delta.len -= n;
+            if (delta.len == 0) {
+                delta.state = DELTA_S_CMD;
+            }
+            break;
+
+        case DELTA_S_RUN:
+            rc = delta_emit(NULL, *data, delta.len);
+            if (rc != 0) {
+                return rc;
+            }
+            data++;
+            len--;
+            delta.state = DELTA_S_CMD;
+            break;
+
+        default:
+            assert(0);
+            return OTA_E_PATCH;
+        }
+    }
+
+    return 0;
+}
+
+/**
+ * Programs what is left in the output buffer.
+ *
+ * @return                      0 if the patch ended cleanly and produced the
+ *                                  whole image; OTA_E_PATCH or OTA_E_FLASH.
+ */
+int
+delta_finish(void)
+{
+    int rc;
+
+    rc = delta_flush();
+    if (rc != 0) {
+        return rc;
+    }
+
+    if (delta.state != DELTA_S_CMD || delta.shift != 0 ||
+        delta.out_off != delta.out_size) {
+
+        return OTA_E_PATCH;
+    }
+
+    return 0;
+}
@@ -0,0 +1,237 @@
+/**
+ * Copyright 2016 ICE9 Consulting
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+/**
+ * Entropy pool fed by the RNG peripheral.
+ *
+ * The RNG runs with its digital error correction on, which removes the
+ * bias of the raw noise source, and its interrupt pushes each byte into a
+ * ring.  When the ring is full the RNG stops (it draws current while
+ * running) and starts again once readers take it below the low-water mark,
+ * so it only runs for the few milliseconds after a burst of reads, while
+ * the CPU otherwise sleeps.
+ *
+ * entropy_read() never waits: it copies out whatever is there and says how
+ * much that was.  The host's random numbers (the security manager's
+ * pairing values, keys and EDIV/Rand, and private addresses) all come
+ * through ble_hci_util_rand(), which would send LE Rand to a controller
+ * that answers it from rand().  The app links with --wrap for it (see
+ * pkg.yml), and __wrap_ble_hci_util_rand() serves them straight from the
+ * pool instead, waiting up to ENTROPY_HOST_WAIT_MSEC for the RNG if the
+ * pool runs short.  rand() is left for things that only need to look
+ * random, and is reseeded from the pool at startup and whenever a
+ * connection comes up.  Nothing else here touches the RNG peripheral.
+ */
+
+#include <assert.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "os/os.h"
+#include "hal/hal_cputime.h"
+#include "host/ble_hs.h"
+#include "bsp/cmsis_nvic.h"
+#include "mcu/nrf51.h"
+#include "mcu/nrf51_bitfields.h"
+
+#include "quacker.h"
+
+/* A power of two, so the indexes can run free. */
+#define ENTROPY_POOL_SIZE       64
+#define ENTROPY_LOW_WATER       (ENTROPY_POOL_SIZE / 2)
+
+/** Longest a host request waits for the RNG; a pairing draws well under a
+ * full pool, so this only runs out if the RNG has stopped.
+ */
+#define ENTROPY_HOST_WAIT_MSEC  100
+
+static uint8_t entropy_pool[ENTROPY_POOL_SIZE];
+static volatile uint8_t entropy_head;       /* Written by the interrupt. */
+static volatile uint8_t entropy_tail;
+static volatile int entropy_running;
+static uint32_t entropy_start_usec;
+static uint32_t entropy_start_generated;
+
+static struct entropy_stats entropy_stats;
+
+static void
+entropy_start(void)
+{
+    if (!entropy_running) {
+        entropy_running = 1;
+        entropy_start_usec = cputime_get32();
+        entropy_start_generated = entropy_stats.generated;
+        NRF_RNG->TASKS_START = 1;
+    }
+}
+
+static void
+entropy_irq_handler(void)
+{
+    uint8_t len;
+
+    NRF_RNG->EVENTS_VALRDY = 0;
+
+    len = entropy_head - entropy_tail;
+    if (len < ENTROPY_POOL_SIZE) {
+        entropy_pool[entropy_head % ENTROPY_POOL_SIZE] = NRF_RNG->VALUE;
+        entropy_head++;
+        entropy_stats.generated++;
+        len++;
+    }
+
+    if (len == ENTROPY_POOL_SIZE) {
+        NRF_RNG->TASKS_STOP = 1;
+        entropy_running = 0;
+        entropy_stats.fill_usec += cputime_get32() - entropy_start_usec;
+        entropy_stats.fill_bytes += entropy_stats.generated -
+                                    entropy_start_generated;
+    }
+}
+
+/**
+ * Takes up to len bytes out of the pool, restarting the RNG below the
+ * low-water mark.
+ *
+ * @return                      The number of bytes copied.
+ */
+static int
+entropy_take(uint8_t *buf, int len)
+{
+    uint8_t avail;
+    os_sr_t sr;
+    int n;
+    int i;
+
+    OS_ENTER_CRITICAL(sr);
+    avail = entropy_head - entropy_tail;
+    n = len < avail ? len : avail;
+    for (i = 0; i < n; i++) {
+        buf[i] = entropy_pool[entropy_tail % ENTROPY_POOL_SIZE];
+        entropy_tail++;
+    }
+
+    entropy_stats.read += n;
+    if (avail - n < ENTROPY_LOW_WATER) {
+        entropy_start();
+    }
+    OS_EXIT_CRITICAL(sr);
+
+    return n;
+}
+
+/**
+ * Copies up to len bytes out of the pool.
+ *
+ * @return                      The number of bytes copied, which is less
+ *                                  than len if the pool ran short.
+ */
+int
+entropy_read(void *buf, int len)
+{
+    int n;
+
+    n = entropy_take(buf, len);
+    if (n < len) {
+        entropy_stats.short_reads++;
+    }
+
+    return n;
+}
+
+/**
+ * Replaces the host's LE Rand: fills dst with len bytes from the pool,
+ * waiting for the RNG as needed.  Called from the host task.
+ *
+ * @return                      0 on success; BLE_HS_ETIMEOUT if the RNG
+ *                                  didn't deliver in time, which fails the
+ *                                  procedure rather than fall back to
+ *                                  rand().
+ */
+int
+__wrap_ble_hci_util_rand(void *dst, int len)
+{
+    os_time_t start;
+    uint8_t *p;
+    int waited;
+    int n;
+
+    p = dst;
+    waited = 0;
+    start = os_time_get();
+    while (1) {
+        n = entropy_take(p, len);
+        p += n;
+        len -= n;
+        if (len == 0) {
+            return 0;
+        }
+
+        if (!waited) {
+            waited = 1;
+            entropy_stats.host_waits++;
+        }
+        if (os_time_get() - start >=
+            ENTROPY_HOST_WAIT_MSEC * OS_TICKS_PER_SEC / 1000) {
+
+            entropy_stats.host_timeouts++;
+            return BLE_HS_ETIMEOUT;
+        }
+        os_time_delay(1);
+    }
+}
+
+/**
+ * Reseeds rand() from the pool, if it has four bytes.  The previous state
+ * is mixed in, so a short pool never makes the sequence more predictable.
+ */
+void
+entropy_reseed(void)
+{
+    uint32_t seed;
+
+    if (entropy_read(&seed, sizeof seed) == sizeof seed) {
+        srand(seed ^ rand());
+    }
+}
+
+/**
+ * Counters for checking the pool; fill_usec over fill_bytes gives the time
+ * per byte while the RNG is running.
+ */
+const struct entropy_stats *
+entropy_get_stats(void)
+{
+    return &entropy_stats;
+}
+
+void
+entropy_init(void)
+{
+    NRF_RNG->CONFIG = RNG_CONFIG_DERCEN_Msk;
+    NRF_RNG->EVENTS_VALRDY = 0;
+    NRF_RNG->INTENSET = RNG_INTENSET_VALRDY_Msk;
+    NVIC_SetVector(RNG_IRQn, (uint32_t)entropy_irq_handler);
+    NVIC_EnableIRQ(RNG_IRQn);
+
+    entropy_start();
+}
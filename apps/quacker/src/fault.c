@@ -0,0 +1,341 @@
+/**
+ * Copyright 2016 ICE9 Consulting
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+/**
+ * Crash recovery.
+ *
+ * The watchdog (see the BSP) is reloaded from the idle task for as long as
+ * the quacker task keeps checking in, so a task that spins or a quacker
+ * task that stops both end in a reset.  A HardFault, a failed
+ * QUACKER_ASSERT, or the watchdog's last-moment interrupt writes what was
+ * running into a record in RAM that the reset leaves alone (.noinit), then
+ * resets.  At boot the record is read back, along with the reset reason
+ * for the cases that never got to write one, logged, and reported in the
+ * stats characteristic.  main() takes a shorter path to advertising after
+ * a fault, and the time from the fault to connectable is recorded too.
+ *
+ * assert() in the OS and the stack ends in the OS's own handler and a
+ * system reset, which can't be intercepted; it shows up as FAULT_SYSRESET
+ * with no location.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "os/os.h"
+#include "bsp/bsp.h"
+#include "bsp/cmsis_nvic.h"
+#include "mcu/nrf51.h"
+#include "mcu/nrf51_bitfields.h"
+
+#include "quacker.h"
+
+#define FAULT_MAGIC     0x51464c54      /* "QFLT" */
+
+#define FAULT_STR(x)    #x
+#define FAULT_XSTR(x)   FAULT_STR(x)
+
+struct fault_record {
+    uint32_t magic;
+    uint8_t cause;
+    uint8_t task_prio;
+    uint16_t line;
+    uint32_t pc;
+    uint32_t lr;
+    uint32_t uptime;            /* OS ticks. */
+    uint32_t count;             /* Faults since power-on. */
+    char task[8];
+    uint32_t check;             /* Complement of the sum of the above. */
+};
+
+static struct fault_record fault_record sec_noinit;
+
+/** The record as the last reset left it. */
+static struct fault_record fault_last;
+static int fault_warm;
+
+static const char *const fault_names[] = {
+    [FAULT_NONE]        = "none",
+    [FAULT_HARDFAULT]   = "hard fault",
+    [FAULT_ASSERT]      = "assert",
+    [FAULT_WATCHDOG]    = "watchdog",
+    [FAULT_LOCKUP]      = "lockup",
+    [FAULT_SYSRESET]    = "system reset",
+    [FAULT_PLANNED]     = "planned reset",
+};
+
+static uint32_t
+fault_sum(void)
+{
+    const uint32_t *p;
+    uint32_t sum;
+    int i;
+
+    p = (const uint32_t *)&fault_record;
+    sum = 0;
+    for (i = 0; i < offsetof(struct fault_record, check) / 4; i++) {
+        sum += p[i];
+    }
+
+    return ~sum;
+}
+
+static void
+fault_seal(void)
+{
+    fault_record.magic = FAULT_MAGIC;
+    fault_record.check = fault_sum();
+}
+
+/**
+ * Fills in the record, unless something already did since boot: the first
+ * fault is the one worth knowing about.  Runs in exception context.
+ */
+static void
+fault_record_set(int cause, uint32_t pc, uint32_t lr, int line)
+{
+    struct os_task *t;
+
+    if (fault_record.cause != FAULT_NONE) {
+        return;
+    }
+
+    fault_record.cause = cause;
+    fault_record.pc = pc;
+    fault_record.lr = lr;
+    fault_record.line = line;
+    fault_record.uptime = os_time_get();
+    fault_record.count++;
+
+    t = os_sched_get_current_task();
+    if (t != NULL) {
+        fault_record.task_prio = t->t_prio;
+        strncpy(fault_record.task, t->t_name, sizeof fault_record.task);
+    } else {
+        fault_record.task_prio = 0xff;
+        fault_record.task[0] = '\0';
+    }
+
+    fault_seal();
+}
+
+/**
+ * Called from the exception shims with the stacked frame (r0-r3, r12, lr,
+ * pc, xpsr) of whatever was interrupted.
+ */
+static void __attribute__((used))
+fault_exception(uint32_t *frame, int cause)
+{
+    fault_record_set(cause, frame[6], frame[5], 0);
+
+    if (cause == FAULT_WATCHDOG) {
+        /* The reset is two 32 kHz cycles away. */
+        while (1) {
+        }
+    }
+
+    NVIC_SystemReset();
+}
+
+/*
+ * Exception entry: finds the frame on whichever stack was in use (bit 2 of
+ * EXC_RETURN; tasks run on the PSP) and passes it on.  Cortex-M0, so no
+ * conditional execution and low registers only.
+ */
+#define FAULT_SHIM(name, cause)                                         \
+static void __attribute__((naked))                                      \
+name(void)                                                              \
+{                                                                       \
+    __asm volatile(                                                     \
+        "movs r0, #4\n"                                                 \
+        "mov r1, lr\n"                                                  \
+        "tst r0, r1\n"                                                  \
+        "beq 1f\n"                                                      \
+        "mrs r0, psp\n"                                                 \
+        "b 2f\n"                                                        \
+        "1:\n"                                                          \
+        "mrs r0, msp\n"                                                 \
+        "2:\n"                                                          \
+        "movs r1, #" FAULT_XSTR(cause) "\n"                             \
+        "ldr r2, 3f\n"                                                  \
+        "bx r2\n"                                                       \
+        ".align 2\n"                                                    \
+        "3:\n"                                                          \
+        ".word fault_exception\n");                                     \
+}
+
+FAULT_SHIM(fault_hardfault_isr, FAULT_HARDFAULT)
+FAULT_SHIM(fault_watchdog_isr, FAULT_WATCHDOG)
+
+/**
+ * Reads back and clears what the last reset left.  Called first thing in
+ * main(), before anything can fault again.
+ *
+ * @param resetreas             NRF_POWER->RESETREAS as found at reset.
+ *
+ * @return                      1 if the last reset was a fault; 0 if it was
+ *                                  a power-on, wakeup or planned reset.
+ */
+int
+fault_init(uint32_t resetreas)
+{
+    if (fault_record.magic != FAULT_MAGIC ||
+        fault_record.check != fault_sum()) {
+
+        /* Power-on; RAM holds garbage. */
+        memset(&fault_record, 0, sizeof fault_record);
+    }
+
+    if (fault_record.cause == FAULT_NONE) {
+        /* Nothing got to write the record: a hang with interrupts masked,
+         * a fault while handling a fault, or the OS's assert handler.
+         */
+        if (resetreas & POWER_RESETREAS_DOG_Msk) {
+            fault_record.cause = FAULT_WATCHDOG;
+        } else if (resetreas & POWER_RESETREAS_LOCKUP_Msk) {
+            fault_record.cause = FAULT_LOCKUP;
+        } else if (resetreas & POWER_RESETREAS_SREQ_Msk) {
+            fault_record.cause = FAULT_SYSRESET;
+        }
+        if (fault_record.cause != FAULT_NONE) {
+            fault_record.pc = 0;
+            fault_record.lr = 0;
+            fault_record.line = 0;
+            fault_record.uptime = 0;
+            fault_record.task_prio = 0xff;
+            fault_record.task[0] = '\0';
+            fault_record.count++;
+        }
+    }
+
+    fault_last = fault_record;
+    fault_record.cause = FAULT_NONE;
+    fault_seal();
+
+    fault_warm = fault_last.cause != FAULT_NONE &&
+                 fault_last.cause != FAULT_PLANNED;
+
+    quacker_stats.fault_cause = fault_last.cause;
+    if (fault_warm) {
+        quacker_stats.fault_task = fault_last.task_prio;
+        quacker_stats.fault_line = fault_last.line;
+        quacker_stats.fault_pc = fault_last.pc;
+        quacker_stats.fault_lr = fault_last.lr;
+    }
+
+    return fault_warm;
+}
+
+/**
+ * Takes over the HardFault vector from the OS and starts the watchdog.
+ * Called once os_init() has set up the vector table.
+ */
+void
+fault_start(uint32_t wdt_msec)
+{
+    NVIC_SetVector(HardFault_IRQn, (uint32_t)fault_hardfault_isr);
+    bsp_watchdog_init(wdt_msec, fault_watchdog_isr);
+}
+
+/**
+ * Logs the fault the last reset recovered from, if any.
+ */
+void
+fault_report(void)
+{
+    if (!fault_warm) {
+        return;
+    }
+
+    QUACKER_LOG(ERROR, "fault: %s in %s (prio %d) pc=0x%08lx lr=0x%08lx "
+                       "line %d, %lu s after boot; %lu since power-on\n",
+                fault_names[fault_last.cause],
+                fault_last.task[0] != '\0' ? fault_last.task : "?",
+                fault_last.task_prio, (unsigned long)fault_last.pc,
+                (unsigned long)fault_last.lr, fault_last.line,
+                (unsigned long)(fault_last.uptime / OS_TICKS_PER_SEC),
+                (unsigned long)fault_last.count);
+}
+
+/**
+ * @return                      Faults since power-on, the last reset's
+ *                                  included.
+ */
+uint32_t
+fault_count(void)
+{
+    return fault_last.count;
+}
+
+/**
+ * Records how long recovery took, given the time from reset to
+ * connectable.  A hang also costs the watchdog timeout before the reset;
+ * the bootloader's time is not counted.
+ */
+void
+fault_connectable(uint32_t usec)
+{
+    if (!fault_warm) {
+        return;
+    }
+
+    if (fault_last.cause == FAULT_WATCHDOG) {
+        usec += bsp_watchdog_msec() * 1000;
+    }
+    quacker_stats.fault_recover_usec = usec;
+    QUACKER_LOG(INFO, "fault: connectable %lu usec after the %s\n",
+                (unsigned long)usec, fault_names[fault_last.cause]);
+}
+
+/**
+ * Backs QUACKER_ASSERT: records the caller and the line, and resets.
+ */
+void
+fault_assert(int line)
+{
+    __disable_irq();
+    fault_record_set(FAULT_ASSERT,
+                     (uint32_t)__builtin_return_address(0) & ~1UL, 0, line);
+    NVIC_SystemReset();
+    while (1) {
+    }
+}
+
+/**
+ * Resets on purpose, as after an update.  The watchdog survives a soft
+ * reset and nothing reloads it in the bootloader, whose image swap takes
+ * longer than the timeout; a watchdog reset stops it.  So this stops
+ * reloading it and waits, up to one timeout.
+ */
+void
+fault_reset(void)
+{
+    __disable_irq();
+    fault_record.cause = FAULT_PLANNED;
+    fault_seal();
+
+    if (bsp_watchdog_msec() == 0) {
+        NVIC_SystemReset();
+    }
+    while (1) {
+    }
+}
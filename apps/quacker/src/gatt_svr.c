@@ -25,8 +25,30 @@
 #include <string.h>
 #include "bsp/bsp.h"
 #include "console/console.h"
+#include "fs/fsutil.h"
+#include "hal/hal_cputime.h"
 #include "host/ble_hs.h"
 #include "quacker.h"
+#include "hid_map.h"
+
+/* Hash of the attribute table as last registered; see gatt_svr_init(). */
+#define GATT_SVR_DB_FILE        "/gatt_db.bin"
+
+/* The connection benchmark counts every attribute access. */
+#ifdef QUACKER_BENCH
+#define GATT_SVR_ATT_REQUEST()  bench_att_request()
+#else
+#define GATT_SVR_ATT_REQUEST()
+#endif
+
+/* Whatever a host sends, an access callback answers with an ATT error
+ * rather than asserting; an assert resets the badge mid-talk.
+ */
+#define GATT_SVR_CHECK_OP(op, want) do {                                \
+    if ((op) != (want)) {                                               \
+        return BLE_ATT_ERR_UNLIKELY;                                    \
+    }                                                                   \
+} while (0)
 
 /**
  * Vendor-specific slide quacker service.
@@ -45,6 +67,32 @@ const uint8_t gatt_svr_chr_quacker_orientation[16] = {
     0xC5, 0x49, 0x1E, 0xB2, 0xB6, 0x06, 0xE1, 0x1B,
 };
 
+/* 4C0B8E2A-7D15-4F63-B9A1-6E2D5C3F8A17 */
+const uint8_t gatt_svr_chr_quacker_stats[16] = {
+    0x17, 0x8A, 0x3F, 0x5C, 0x2D, 0x6E, 0xA1, 0xB9,
+    0x63, 0x4F, 0x15, 0x7D, 0x2A, 0x8E, 0x0B, 0x4C,
+};
+
+/* 9D41F6B2-3C8E-4A57-8E19-C2B7D05A64F3 */
+const uint8_t gatt_svr_chr_quacker_ota_ctrl[16] = {
+    0xF3, 0x64, 0x5A, 0xD0, 0xB7, 0xC2, 0x19, 0x8E,
+    0x57, 0x4A, 0x8E, 0x3C, 0xB2, 0xF6, 0x41, 0x9D,
+};
+
+/* 9D41F6B3-3C8E-4A57-8E19-C2B7D05A64F3 */
+const uint8_t gatt_svr_chr_quacker_ota_data[16] = {
+    0xF3, 0x64, 0x5A, 0xD0, 0xB7, 0xC2, 0x19, 0x8E,
+    0x57, 0x4A, 0x8E, 0x3C, 0xB3, 0xF6, 0x41, 0x9D,
+};
+
+#ifdef QUACKER_TRACE
+/* A7E3C1D4-6B2F-4E89-9D05-3F1C8B7A2E64 */
+const uint8_t gatt_svr_chr_quacker_trace[16] = {
+    0x64, 0x2E, 0x7A, 0x8B, 0x1C, 0x3F, 0x05, 0x9D,
+    0x89, 0x4E, 0x2F, 0x6B, 0xD4, 0xC1, 0xE3, 0xA7,
+};
+#endif
+
 static int
 gatt_svr_chr_access_gap(uint16_t conn_handle, uint16_t attr_handle, uint8_t op,
                         union ble_gatt_access_ctxt *ctxt, void *arg);
@@ -77,6 +125,26 @@ gatt_svr_dsc_access_quacker(uint16_t conn_handle, uint16_t attr_handle,
                                 uint8_t op, union ble_gatt_access_ctxt *ctxt,
                                 void *arg);
 
+/**
+ * One Report characteristic per entry in HID_REPORTS(); arg is the report's
+ * index.
+ */
+#define GATT_SVR_HID_REPORT_CHR(name, id, type, size, desc) {           \
+    .uuid128 = BLE_UUID16(GATT_SVR_CHR_REPORT),                         \
+    .access_cb = gatt_svr_chr_access_hid,                               \
+    .arg = (void *)HID_ ## name,                                        \
+    .flags = BLE_GATT_CHR_F_READ | BLE_GATT_CHR_F_READ_ENC |            \
+             BLE_GATT_CHR_F_NOTIFY,                                     \
+    .descriptors = (struct ble_gatt_dsc_def[]) { {                      \
+        .uuid128 = BLE_UUID16(GATT_SVR_DSC_REPORT_REFERENCE),           \
+        .att_flags = BLE_ATT_F_READ | BLE_ATT_F_READ_ENC,               \
+        .access_cb = gatt_svr_dsc_access_hid,                           \
+        .arg = (void *)HID_ ## name,                                    \
+    }, {                                                                \
+        0, /* No more descriptors in this characteristic. */            \
+    } },                                                                \
+},
+
 static const struct ble_gatt_svc_def gatt_svr_svcs[] = {
     {
         /*** Service: GAP. */
@@ -158,31 +226,9 @@ static const struct ble_gatt_svc_def gatt_svr_svcs[] = {
             .uuid128 = BLE_UUID16(GATT_SVR_CHR_BOOT_KEYBOARD_INPUT_MAP),
             .access_cb = gatt_svr_chr_access_hid,
             .flags = BLE_GATT_CHR_F_READ | BLE_GATT_CHR_F_READ_ENC | BLE_GATT_CHR_F_NOTIFY,
-        }, {
-            .uuid128 = BLE_UUID16(GATT_SVR_CHR_REPORT),
-            .access_cb = gatt_svr_chr_access_hid,
-            .flags = BLE_GATT_CHR_F_READ | BLE_GATT_CHR_F_READ_ENC | BLE_GATT_CHR_F_NOTIFY,
-            .descriptors = (struct ble_gatt_dsc_def[]) { {
-                .uuid128 = BLE_UUID16(GATT_SVR_DSC_REPORT_REFERENCE),
-                .att_flags = BLE_ATT_F_READ | BLE_ATT_F_READ_ENC,
-                .access_cb = gatt_svr_dsc_access_hid,
-                .arg = (void *)0,
-            }, {
-                0, /* No more descriptors in this characteristic. */
-            } },
-        }, {
-            .uuid128 = BLE_UUID16(GATT_SVR_CHR_REPORT),
-            .access_cb = gatt_svr_chr_access_hid,
-            .flags = BLE_GATT_CHR_F_READ | BLE_GATT_CHR_F_READ_ENC | BLE_GATT_CHR_F_NOTIFY,
-            .descriptors = (struct ble_gatt_dsc_def[]) { {
-                .uuid128 = BLE_UUID16(GATT_SVR_DSC_REPORT_REFERENCE),
-                .att_flags = BLE_ATT_F_READ | BLE_ATT_F_READ_ENC,
-                .access_cb = gatt_svr_dsc_access_hid,
-                .arg = (void *)1,
-            }, {
-                0, /* No more descriptors in this characteristic. */
-            } },
-        }, {
+        },
+        HID_REPORTS(GATT_SVR_HID_REPORT_CHR)
+        {
             .uuid128 = BLE_UUID16(GATT_SVR_CHR_HID_CONTROL_POINT),
             .access_cb = gatt_svr_chr_access_hid,
             .flags = BLE_GATT_CHR_F_WRITE_NO_RSP,
@@ -213,7 +259,35 @@ static const struct ble_gatt_svc_def gatt_svr_svcs[] = {
             }, {
                 0, /* No more descriptors in this characteristic. */
             } },
+        }, {
+            /*** Characteristic: runtime counters; see stats.c. */
+            .uuid128 = (void *)gatt_svr_chr_quacker_stats,
+            .access_cb = gatt_svr_chr_access_quacker,
+            .flags = BLE_GATT_CHR_F_READ | BLE_GATT_CHR_F_NOTIFY,
+        }, {
+            /*** Characteristic: firmware update control; see ota.c. */
+            .uuid128 = (void *)gatt_svr_chr_quacker_ota_ctrl,
+            .access_cb = gatt_svr_chr_access_quacker,
+            .flags = BLE_GATT_CHR_F_READ | BLE_GATT_CHR_F_READ_ENC |
+                     BLE_GATT_CHR_F_WRITE | BLE_GATT_CHR_F_WRITE_ENC |
+                     BLE_GATT_CHR_F_NOTIFY,
+        }, {
+            /*** Characteristic: firmware update data. */
+            .uuid128 = (void *)gatt_svr_chr_quacker_ota_data,
+            .access_cb = gatt_svr_chr_access_quacker,
+            .flags = BLE_GATT_CHR_F_WRITE_NO_RSP | BLE_GATT_CHR_F_WRITE_ENC,
 
+            /* Build-dependent attributes go last so that every other handle
+             * is the same in every build.
+             */
+#ifdef QUACKER_TRACE
+        }, {
+            /*** Characteristic: event trace ring; see trace.c. */
+            .uuid128 = (void *)gatt_svr_chr_quacker_trace,
+            .access_cb = gatt_svr_chr_access_quacker,
+            .flags = BLE_GATT_CHR_F_READ | BLE_GATT_CHR_F_READ_ENC |
+                     BLE_GATT_CHR_F_WRITE | BLE_GATT_CHR_F_WRITE_ENC,
+#endif
         }, {
             0, /* No more characteristics in this service. */
         } },
@@ -229,7 +303,7 @@ gatt_svr_chr_write(uint8_t op, union ble_gatt_access_ctxt *ctxt,
                    uint16_t min_len, uint16_t max_len, void *dst,
                    uint16_t *len)
 {
-    assert(op == BLE_GATT_ACCESS_OP_WRITE_CHR);
+    GATT_SVR_CHECK_OP(op, BLE_GATT_ACCESS_OP_WRITE_CHR);
     if (ctxt->chr_access.len < min_len ||
         ctxt->chr_access.len > max_len) {
         return BLE_ATT_ERR_INVALID_ATTR_VALUE_LEN;
@@ -248,30 +322,32 @@ gatt_svr_chr_access_gap(uint16_t conn_handle, uint16_t attr_handle, uint8_t op,
 {
     uint16_t uuid16;
 
+    GATT_SVR_ATT_REQUEST();
+
     uuid16 = ble_uuid_128_to_16(ctxt->chr_access.chr->uuid128);
     assert(uuid16 != 0);
 
     switch (uuid16) {
     case BLE_GAP_CHR_UUID16_DEVICE_NAME:
-        assert(op == BLE_GATT_ACCESS_OP_READ_CHR);
+        GATT_SVR_CHECK_OP(op, BLE_GATT_ACCESS_OP_READ_CHR);
         ctxt->chr_access.data = (void *)quacker_device_name;
         ctxt->chr_access.len = strlen(quacker_device_name);
         break;
 
     case BLE_GAP_CHR_UUID16_APPEARANCE:
-        assert(op == BLE_GATT_ACCESS_OP_READ_CHR);
+        GATT_SVR_CHECK_OP(op, BLE_GATT_ACCESS_OP_READ_CHR);
         ctxt->chr_access.data = (void *)&quacker_appearance;
         ctxt->chr_access.len = sizeof quacker_appearance;
         break;
 
     case BLE_GAP_CHR_UUID16_PERIPH_PRIV_FLAG:
-        assert(op == BLE_GATT_ACCESS_OP_READ_CHR);
+        GATT_SVR_CHECK_OP(op, BLE_GATT_ACCESS_OP_READ_CHR);
         ctxt->chr_access.data = (void *)&quacker_privacy_flag;
         ctxt->chr_access.len = sizeof quacker_privacy_flag;
         break;
 
     case BLE_GAP_CHR_UUID16_RECONNECT_ADDR:
-        assert(op == BLE_GATT_ACCESS_OP_WRITE_CHR);
+        GATT_SVR_CHECK_OP(op, BLE_GATT_ACCESS_OP_WRITE_CHR);
         if (ctxt->chr_access.len != sizeof quacker_reconnect_addr) {
             return BLE_ATT_ERR_INVALID_ATTR_VALUE_LEN;
         }
@@ -280,14 +356,13 @@ gatt_svr_chr_access_gap(uint16_t conn_handle, uint16_t attr_handle, uint8_t op,
         break;
 
     case BLE_GAP_CHR_UUID16_PERIPH_PREF_CONN_PARAMS:
-        assert(op == BLE_GATT_ACCESS_OP_READ_CHR);
+        GATT_SVR_CHECK_OP(op, BLE_GATT_ACCESS_OP_READ_CHR);
         ctxt->chr_access.data = (void *)&quacker_pref_conn_params;
         ctxt->chr_access.len = sizeof quacker_pref_conn_params;
         break;
 
     default:
-        assert(0);
-        break;
+        return BLE_ATT_ERR_UNLIKELY;
     }
 
     return 0;
@@ -299,6 +374,8 @@ gatt_svr_chr_access_gatt(uint16_t conn_handle, uint16_t attr_handle, uint8_t op,
 {
     uint16_t uuid16;
 
+    GATT_SVR_ATT_REQUEST();
+
     uuid16 = ble_uuid_128_to_16(ctxt->chr_access.chr->uuid128);
     assert(uuid16 != 0);
 
@@ -317,8 +394,7 @@ gatt_svr_chr_access_gatt(uint16_t conn_handle, uint16_t attr_handle, uint8_t op,
         break;
 
     default:
-        assert(0);
-        break;
+        return BLE_ATT_ERR_UNLIKELY;
     }
 
     return 0;
@@ -335,82 +411,729 @@ gatt_svr_chr_access_device_information(uint16_t conn_handle, uint16_t attr_handl
     static const char manufacturer[] = "ICE9 Consulting";
     static const char model_number[] = "Wrong Island Con Slide Quacker";
 
+    GATT_SVR_ATT_REQUEST();
+
     uuid16 = ble_uuid_128_to_16(ctxt->chr_access.chr->uuid128);
     assert(uuid16 != 0);
 
     switch (uuid16) {
     case GATT_SVR_CHR_MANUFACTURER_NAME_UUID:
-        assert(op == BLE_GATT_ACCESS_OP_READ_CHR);
+        GATT_SVR_CHECK_OP(op, BLE_GATT_ACCESS_OP_READ_CHR);
         ctxt->chr_access.data = (void *)manufacturer;
         ctxt->chr_access.len = sizeof manufacturer;
         return 0;
 
     case GATT_SVR_CHR_MODEL_NUMBER_UUID:
-        assert(op == BLE_GATT_ACCESS_OP_READ_CHR);
+        GATT_SVR_CHECK_OP(op, BLE_GATT_ACCESS_OP_READ_CHR);
         ctxt->chr_access.data = (void *)model_number;
         ctxt->chr_access.len = sizeof model_number;
         return 0;
 
     default:
-        assert(0);
         return BLE_ATT_ERR_UNLIKELY;
     }
 
     return 0;
 }
 
-/* both of these shamelessly stolen from BLE keyboard */
+/* shamelessly stolen from BLE keyboard */
 static const uint8_t gatt_svr_hid_information[] = { 0x01, 0x01, 0x00, 0x02, };
-static const uint8_t gatt_svr_report_map[] = {
-  0x05, 0x01, 0x09, 0x06, 0xa1, 0x01, 0x85, 0x01, 0x05, 0x07, 0x19, 0xe0, 0x29,
-  0xe7, 0x15, 0x00, 0x25, 0x01, 0x75, 0x01, 0x95, 0x08, 0x81, 0x02, 0x95, 0x01,
-  0x75, 0x08, 0x81, 0x03, 0x95, 0x05, 0x75, 0x01, 0x05, 0x08, 0x19, 0x01, 0x29,
-  0x05, 0x91, 0x02, 0x95, 0x01, 0x75, 0x03, 0x91, 0x03, 0x95, 0x06, 0x75, 0x08,
-  0x15, 0x00, 0x26, 0xff, 0x00, 0x05, 0x07, 0x19, 0x00, 0x2a, 0xff, 0x00, 0x81,
-  0x00, 0xc0, 0x06, 0x00, 0xff, 0x09, 0x02, 0xa1, 0x01, 0x85, 0x02, 0x75, 0x08,
-  0x95, 0x01, 0x15, 0x01, 0x25, 0x64, 0x09, 0x20, 0x81, 0x00, 0xc0, 0x05, 0x0c,
-  0x09, 0x01, 0xa1, 0x01, 0x85, 0x03, 0x75, 0x10, 0x95, 0x01, 0x15, 0x01, 0x26,
-  0xff, 0x02, 0x19, 0x01, 0x2a, 0xff, 0x02, 0x81, 0x60, 0xc0 };
-
-static const uint8_t gatt_svr_boot_keyboard_input_map[8] = { 0x00, };
-uint8_t gatt_svr_hid_report[8] = { 0x00, };
+
+/* Generated from HID_REPORTS(); see hid_map.h. */
+static const uint8_t gatt_svr_report_map[] = HID_REPORT_MAP;
+static const uint8_t gatt_svr_hid_report_ref[][2] = HID_REPORT_REFS;
+
 static uint8_t gatt_svr_hid_control_point = 0x00;
-static uint8_t gatt_svr_protocol_mode = 0x01;
+
+/** Handles captured at registration; see gatt_svr_register_cb(). */
+static uint16_t gatt_svr_report_def_handle[HID_NUM_REPORTS];
+static uint16_t gatt_svr_report_val_handle[HID_NUM_REPORTS];
+static uint16_t gatt_svr_boot_input_def_handle;
+static uint16_t gatt_svr_boot_input_val_handle;
+static uint16_t gatt_svr_svc_changed_val_handle;
+static uint32_t gatt_svr_db_hash;
+
+/**
+ * GATT state of each connection.
+ *
+ * The stack keeps each connection's CCCDs but doesn't report writes to
+ * them, or keep them past the connection.  What it does do is build a
+ * notification only for a connection whose CCCD has notifications on,
+ * reading the value through gatt_svr_chr_access_hid() as it goes.  So a
+ * report read made inside ble_gatts_chr_updated() shows the host's CCCD is
+ * on right now, and its absence shows it is off.  That is tracked in
+ * subscribed, and stored with the bond.
+ *
+ * A bonded host expects its subscription to outlive the connection.  Until
+ * it writes the CCCD again, a connection whose bond was subscribed is
+ * marked restored, and reports go straight to it with
+ * ble_gattc_notify_custom().  Seeing the host's CCCD on and then off means
+ * it wrote 0; both flags and the bond's copy are then cleared.
+ *
+ * Reports only go to the active target; the others keep the last reports
+ * they were sent, which is what they read back.  ble_gatts_chr_updated()
+ * would notify every subscribed connection, so the others fail the read
+ * the stack makes to build theirs, and the stack skips them.
+ */
+struct gatt_svr_conn {
+    uint16_t conn_handle;       /* BLE_HS_CONN_HANDLE_NONE if free. */
+    uint16_t conn_itvl;
+    uint16_t conn_latency;
+    uint16_t ediv;
+    uint64_t rand_num;
+    uint8_t protocol_mode;
+    uint8_t report[HID_NUM_REPORTS][HID_MAX_SIZE];
+    uint8_t peer_irk[16];       /* Held until the bond is stored. */
+    unsigned ltk_found:1;       /* ediv and rand_num name the LTK in use. */
+    unsigned identified:1;      /* ediv and rand_num name the host's bond. */
+    unsigned bonded:1;
+    unsigned subscribed:1;      /* CCCD seen on during this connection. */
+    unsigned restored:1;        /* The bond was subscribed. */
+    unsigned notified:1;        /* The stack built a notification for it. */
+    unsigned irk_pending:1;
+};
+
+static struct gatt_svr_conn gatt_svr_conns[QUACKER_MAX_CONNS];
+static int gatt_svr_active = -1;    /* Index in gatt_svr_conns. */
+static uint16_t gatt_svr_ota_conn = BLE_HS_CONN_HANDLE_NONE;
+
+/** The task inside ble_gatts_chr_updated() for a report, if any.  A report
+ * read from that task is the stack building a notification; any other read
+ * is the host reading the characteristic.
+ */
+static struct os_task *gatt_svr_notify_task;
+
+/** When the target last changed, until its first report goes out. */
+static uint32_t gatt_svr_switch_time;
+static int gatt_svr_switch_pending;
+
+/** The bond of the host last made the target by connecting first or by the
+ * chord.  It takes the target back when it reconnects, whatever address it
+ * uses then.
+ */
+static uint16_t gatt_svr_target_ediv;
+static uint64_t gatt_svr_target_rand;
+static int gatt_svr_target_known;
+
+/** What a connection reads before its first report. */
+static const uint8_t gatt_svr_report_none[HID_MAX_SIZE];
+
+static struct gatt_svr_conn *
+gatt_svr_conn_find(uint16_t conn_handle)
+{
+    int i;
+
+    for (i = 0; i < QUACKER_MAX_CONNS; i++) {
+        if (gatt_svr_conns[i].conn_handle == conn_handle) {
+            return gatt_svr_conns + i;
+        }
+    }
+
+    return NULL;
+}
+
+/**
+ * Makes the connection at index idx (or none, if -1) the target of every
+ * report.
+ */
+static void
+gatt_svr_set_active(int idx)
+{
+    struct gatt_svr_conn *conn;
+
+    gatt_svr_active = idx;
+    gatt_svr_switch_pending = 0;
+    hid_conn_reset();
+
+    if (idx < 0) {
+        stats_conn(0, 0);
+        return;
+    }
+
+    conn = gatt_svr_conns + idx;
+    stats_conn(conn->conn_itvl, conn->conn_latency);
+}
+
+/**
+ * Records the active connection's host as the chosen target.  A host whose
+ * bond isn't known yet is recorded when it is; see
+ * gatt_svr_conn_identified().
+ */
+static void
+gatt_svr_target_remember(struct gatt_svr_conn *conn)
+{
+    gatt_svr_target_known = conn->identified;
+    gatt_svr_target_ediv = conn->ediv;
+    gatt_svr_target_rand = conn->rand_num;
+}
+
+/**
+ * Notes which bond a connection's host is, from its resolvable address at
+ * connection time or from the key it encrypts with.  The chosen host gets
+ * the target back.
+ */
+static void
+gatt_svr_conn_identified(struct gatt_svr_conn *conn, uint16_t ediv,
+                         uint64_t rand_num)
+{
+    int idx;
+
+    conn->ediv = ediv;
+    conn->rand_num = rand_num;
+    conn->identified = 1;
+
+    idx = conn - gatt_svr_conns;
+    if (!gatt_svr_target_known) {
+        if (idx == gatt_svr_active) {
+            gatt_svr_target_remember(conn);
+        }
+        return;
+    }
+
+    if (idx != gatt_svr_active &&
+        ediv == gatt_svr_target_ediv && rand_num == gatt_svr_target_rand) {
+
+        gatt_svr_set_active(idx);
+        QUACKER_LOG_FAST("target handle=%d; chosen host is back\n",
+                         conn->conn_handle);
+    }
+}
+
+/**
+ * Accounts for a report notified to the host, by whichever path.  Plain
+ * reads of the characteristic don't count.
+ */
+static void
+gatt_svr_report_sent(int which, const uint8_t *report)
+{
+    TRACE(REPORT_READ, which == HID_KEYBOARD ? report[2] : report[0]);
+    quacker_stats.notify_sent++;
+#ifdef QUACKER_BENCH
+    if (which == HID_KEYBOARD) {
+        bench_report_read(report);
+    }
+#endif
+}
+
+/**
+ * Called when an input report is read, either by the host or by the stack
+ * building a notification.
+ *
+ * @return                      The connection's value of the report;
+ *                                  NULL if the stack is building a
+ *                                  notification for a connection that
+ *                                  isn't the active target.
+ */
+static const uint8_t *
+gatt_svr_report_read(uint16_t conn_handle, int which)
+{
+    struct gatt_svr_conn *conn;
+    int notify;
+
+    notify = gatt_svr_notify_task == os_sched_get_current_task();
+    conn = gatt_svr_conn_find(conn_handle);
+    if (conn == NULL) {
+        return notify ? NULL : gatt_svr_report_none;
+    }
+
+    if (notify) {
+        if (conn - gatt_svr_conns != gatt_svr_active) {
+            return NULL;
+        }
+        conn->notified = 1;
+        gatt_svr_report_sent(which, conn->report[which]);
+    }
+
+    return conn->report[which];
+}
+
+/**
+ * Records what a send through the stack showed about a connection's CCCD.
+ * The keyboard report stands for all of them, since HID hosts subscribe to
+ * every input report.
+ */
+static void
+gatt_svr_cccd_seen(struct gatt_svr_conn *conn, int on)
+{
+    int rc;
+
+    if (on) {
+        if (conn->subscribed) {
+            return;
+        }
+        conn->subscribed = 1;
+    } else {
+        if (!conn->subscribed) {
+            return;
+        }
+        /* It was on earlier in this connection; the host turned it off. */
+        conn->subscribed = 0;
+        conn->restored = 0;
+    }
+
+    if (conn->bonded) {
+        rc = keystore_set_flags(conn->ediv, conn->rand_num,
+                                on ? KEYSTORE_F_SUBSCRIBED : 0,
+                                on ? 0 : KEYSTORE_F_SUBSCRIBED);
+        if (rc != 0) {
+            QUACKER_LOG_FAST("error saving subscription; rc=%d\n", rc);
+        }
+    }
+}
+
+/**
+ * Logs how long the first report after a change of target took: from the
+ * switch to the report reaching the stack, and from there to the
+ * connection event that carries it, as the link layer has it scheduled.
+ */
+static void
+gatt_svr_switch_done(struct gatt_svr_conn *conn)
+{
+    uint32_t since;
+    uint32_t itvl;
+    uint32_t anchor;
+    uint32_t now;
+
+    if (!gatt_svr_switch_pending) {
+        return;
+    }
+    gatt_svr_switch_pending = 0;
+
+    now = cputime_get32();
+    if (llconn_timing(conn->conn_handle, &anchor, &itvl) != 0 ||
+        llconn_since_anchor(conn->conn_handle, now, &since) != 0) {
+
+        return;
+    }
+
+    QUACKER_LOG_FAST("target handle=%d; first report %lu usec after the "
+                     "switch, %lu usec before its event\n", conn->conn_handle,
+                     (unsigned long)(now - gatt_svr_switch_time),
+                     (unsigned long)(since == 0 ? 0 : itvl - since));
+}
+
+/**
+ * Stores a new value for an input report and notifies the active target.
+ *
+ * @param which                 The report's index in HID_REPORTS().
+ *
+ * @return                      0 if the report was handed to the stack;
+ *                                  BLE_HS_ENOTCONN if there is no host;
+ *                                  BLE_HS_ENOENT if the host isn't
+ *                                  subscribed, so nothing was sent.
+ */
+int
+gatt_svr_report_notify(int which, const void *data, int len)
+{
+    struct gatt_svr_conn *conn;
+    uint16_t def_handle;
+    uint16_t val_handle;
+    int active;
+    int rc;
+
+    assert(which < HID_NUM_REPORTS);
+    assert(len == hid_report_size(which));
+
+    /* Connections come and go in the host task, which can preempt this;
+     * at worst the stack refuses a handle that just went away.
+     */
+    active = gatt_svr_active;
+    if (active < 0) {
+        return BLE_HS_ENOTCONN;
+    }
+    conn = gatt_svr_conns + active;
+    memcpy(conn->report[which], data, len);
+
+    /* A host in boot protocol mode only listens to the boot keyboard input
+     * characteristic.  It carries the same eight bytes, so the keyboard
+     * report goes there instead.
+     */
+    if (which == HID_KEYBOARD && conn->protocol_mode == 0) {
+        def_handle = gatt_svr_boot_input_def_handle;
+        val_handle = gatt_svr_boot_input_val_handle;
+    } else {
+        def_handle = gatt_svr_report_def_handle[which];
+        val_handle = gatt_svr_report_val_handle[which];
+    }
+
+    /* The stack builds a notification for every subscribed peer before
+     * returning, reading each one's value through gatt_svr_chr_access_hid(),
+     * which refuses all but this one.
+     */
+    conn->notified = 0;
+    gatt_svr_notify_task = os_sched_get_current_task();
+    ble_gatts_chr_updated(def_handle);
+    gatt_svr_notify_task = NULL;
+
+    if (which == HID_KEYBOARD) {
+        gatt_svr_cccd_seen(conn, conn->notified);
+    }
+    if (conn->notified) {
+        gatt_svr_switch_done(conn);
+        return 0;
+    }
+
+    /* A bonded host that hasn't rewritten its CCCD yet. */
+    if (conn->restored) {
+        rc = ble_gattc_notify_custom(conn->conn_handle, val_handle,
+                                     conn->report[which], len);
+        if (rc == 0) {
+            gatt_svr_report_sent(which, conn->report[which]);
+            gatt_svr_switch_done(conn);
+        }
+        return rc;
+    }
+
+    return BLE_HS_ENOENT;
+}
+
+static int
+gatt_svr_svc_changed_cb(uint16_t conn_handle, struct ble_gatt_error *error,
+                        struct ble_gatt_attr *attr, void *arg)
+{
+    struct gatt_svr_conn *conn;
+    int rc;
+
+    conn = gatt_svr_conn_find(conn_handle);
+    if (error != NULL || conn == NULL) {
+        return 0;
+    }
+
+    /* Acknowledged; the host has rediscovered or will. */
+    rc = keystore_set_flags(conn->ediv, conn->rand_num,
+                            0, KEYSTORE_F_DB_STALE);
+    if (rc != 0) {
+        QUACKER_LOG_FAST("error clearing db_stale; rc=%d\n", rc);
+    }
+
+    return 0;
+}
+
+/**
+ * Makes the next connection after the active one the target of every
+ * report.
+ *
+ * @return                      0 if the target changed; BLE_HS_ENOTCONN if
+ *                                  there is no other connection.
+ */
+static int
+gatt_svr_switch(void)
+{
+    struct gatt_svr_conn *conn;
+    int active;
+    int idx;
+    int i;
+
+    active = gatt_svr_active;
+    for (i = 1; i <= QUACKER_MAX_CONNS; i++) {
+        idx = (active + i + QUACKER_MAX_CONNS) % QUACKER_MAX_CONNS;
+        if (idx != active &&
+            gatt_svr_conns[idx].conn_handle != BLE_HS_CONN_HANDLE_NONE) {
+
+            break;
+        }
+    }
+    if (i > QUACKER_MAX_CONNS) {
+        return BLE_HS_ENOTCONN;
+    }
+
+    gatt_svr_set_active(idx);
+    conn = gatt_svr_conns + idx;
+
+    /* Timed to the first report; see gatt_svr_switch_done(). */
+    gatt_svr_switch_time = cputime_get32();
+    gatt_svr_switch_pending = 1;
+    QUACKER_LOG_FAST("target handle=%d\n", conn->conn_handle);
+    return 0;
+}
+
+/**
+ * Records a new connection.  The first one becomes the active target, as
+ * does the chosen host coming back; others wait for gatt_svr_next_target().
+ *
+ * @param identified            ediv and rand_num name the host's bond,
+ *                                  resolved from its private address.
+ */
+void
+gatt_svr_conn_up(struct ble_gap_conn_desc *desc, int identified,
+                 uint16_t ediv, uint64_t rand_num)
+{
+    struct gatt_svr_conn *conn;
+
+    conn = gatt_svr_conn_find(BLE_HS_CONN_HANDLE_NONE);
+    if (conn == NULL) {
+        /* The host is configured for QUACKER_MAX_CONNS. */
+        assert(0);
+        return;
+    }
+
+    memset(conn, 0, sizeof *conn);
+    conn->conn_handle = desc->conn_handle;
+    conn->conn_itvl = desc->conn_itvl;
+    conn->conn_latency = desc->conn_latency;
+
+    /* Report mode is the default for every connection. */
+    conn->protocol_mode = 0x01;
+
+    if (gatt_svr_active < 0) {
+        gatt_svr_set_active(conn - gatt_svr_conns);
+        gatt_svr_target_remember(conn);
+    }
+    if (identified) {
+        gatt_svr_conn_identified(conn, ediv, rand_num);
+    }
+}
+
+/**
+ * Records new connection parameters.
+ */
+void
+gatt_svr_conn_updated(struct ble_gap_conn_desc *desc)
+{
+    struct gatt_svr_conn *conn;
+
+    conn = gatt_svr_conn_find(desc->conn_handle);
+    if (conn == NULL) {
+        return;
+    }
+
+    conn->conn_itvl = desc->conn_itvl;
+    conn->conn_latency = desc->conn_latency;
+    if (conn - gatt_svr_conns == gatt_svr_active) {
+        stats_conn(conn->conn_itvl, conn->conn_latency);
+    }
+}
+
+/**
+ * Which bond a connection's host is, once known.
+ *
+ * @return                      0 on success; BLE_HS_ENOENT if the host
+ *                                  isn't identified yet.
+ */
+int
+gatt_svr_conn_identity(uint16_t conn_handle, uint16_t *out_ediv,
+                       uint64_t *out_rand_num)
+{
+    struct gatt_svr_conn *conn;
+
+    conn = gatt_svr_conn_find(conn_handle);
+    if (conn == NULL || !conn->identified) {
+        return BLE_HS_ENOENT;
+    }
+
+    *out_ediv = conn->ediv;
+    *out_rand_num = conn->rand_num;
+    return 0;
+}
+
+/**
+ * Forgets a connection.  If it was the active target, the next connection
+ * stands in until the chosen host is back.
+ *
+ * @return                      0 if the connection was up; BLE_HS_ENOTCONN
+ *                                  if it was never counted (a failed
+ *                                  connection attempt).
+ */
+int
+gatt_svr_conn_down(uint16_t conn_handle)
+{
+    struct gatt_svr_conn *conn;
+
+    if (conn_handle == gatt_svr_ota_conn) {
+        gatt_svr_ota_conn = BLE_HS_CONN_HANDLE_NONE;
+        ota_conn_down();
+    }
+
+    conn = gatt_svr_conn_find(conn_handle);
+    if (conn == NULL) {
+        return BLE_HS_ENOTCONN;
+    }
+    conn->conn_handle = BLE_HS_CONN_HANDLE_NONE;
+
+    /* The stack forgets the CCCDs with the connection; a bond keeps its
+     * copy in the keystore.
+     */
+    conn->subscribed = 0;
+    conn->restored = 0;
+
+    if (conn - gatt_svr_conns == gatt_svr_active) {
+        /* A stand-in; the chosen host takes over again when it is back. */
+        if (gatt_svr_switch() != 0) {
+            gatt_svr_set_active(-1);
+        }
+    }
+    return 0;
+}
+
+/**
+ * @return                      The active target's connection handle;
+ *                                  BLE_HS_CONN_HANDLE_NONE if there is none.
+ */
+uint16_t
+gatt_svr_active_conn(void)
+{
+    int active;
+
+    active = gatt_svr_active;
+    if (active < 0) {
+        return BLE_HS_CONN_HANDLE_NONE;
+    }
+    return gatt_svr_conns[active].conn_handle;
+}
+
+/**
+ * Switches the target on the user's say-so; the new host is the one that
+ * gets it back on reconnecting.  Called for a long chord on the buttons.
+ *
+ * @return                      0 if the target changed; BLE_HS_ENOTCONN if
+ *                                  there is no other connection.
+ */
+int
+gatt_svr_next_target(void)
+{
+    int rc;
+
+    rc = gatt_svr_switch();
+    if (rc != 0) {
+        return rc;
+    }
+
+    gatt_svr_target_remember(gatt_svr_conns + gatt_svr_active);
+    return 0;
+}
+
+/**
+ * Notes the key a connection is about to be encrypted with; see
+ * gatt_svr_conn_encrypted().
+ */
+void
+gatt_svr_conn_ltk(uint16_t conn_handle, uint16_t ediv, uint64_t rand_num)
+{
+    struct gatt_svr_conn *conn;
+
+    conn = gatt_svr_conn_find(conn_handle);
+    if (conn == NULL) {
+        return;
+    }
+
+    conn->ltk_found = 1;
+    gatt_svr_conn_identified(conn, ediv, rand_num);
+}
+
+/**
+ * Called when encryption comes up.  Re-encrypted with a stored key, the
+ * connection gets its bond's GATT state back.
+ */
+void
+gatt_svr_conn_encrypted(uint16_t conn_handle)
+{
+    struct gatt_svr_conn *conn;
+
+    conn = gatt_svr_conn_find(conn_handle);
+    if (conn == NULL || !conn->ltk_found) {
+        return;
+    }
+
+    gatt_svr_conn_bonded(conn_handle, conn->ediv, conn->rand_num);
+}
+
+/**
+ * Called once the connection is encrypted with the bond identified by ediv
+ * and rand_num.  Restores the bond's subscription and, if the attribute
+ * table changed since the host last saw it, tells it so.
+ */
+void
+gatt_svr_conn_bonded(uint16_t conn_handle, uint16_t ediv, uint64_t rand_num)
+{
+    struct gatt_svr_conn *conn;
+    uint8_t flags;
+    int rc;
+
+    conn = gatt_svr_conn_find(conn_handle);
+    if (conn == NULL) {
+        return;
+    }
+
+    rc = keystore_get_flags(ediv, rand_num, &flags);
+    if (rc != 0) {
+        return;
+    }
+
+    conn->bonded = 1;
+    gatt_svr_conn_identified(conn, ediv, rand_num);
+
+    if (conn->irk_pending) {
+        gatt_svr_conn_irk(conn_handle, conn->peer_irk);
+    }
+
+    if (flags & KEYSTORE_F_SUBSCRIBED) {
+        conn->restored = 1;
+    } else if (conn->subscribed) {
+        /* Subscribed before this bond was made. */
+        rc = keystore_set_flags(ediv, rand_num, KEYSTORE_F_SUBSCRIBED, 0);
+        if (rc != 0) {
+            QUACKER_LOG_FAST("error saving subscription; rc=%d\n", rc);
+        }
+    }
+
+    if (flags & KEYSTORE_F_DB_STALE) {
+        QUACKER_LOG_FAST("attribute table changed; indicating\n");
+        rc = ble_gattc_indicate(conn_handle, gatt_svr_svc_changed_val_handle,
+                                gatt_svr_svc_changed_cb, NULL);
+        if (rc != 0) {
+            QUACKER_LOG_FAST("service changed failed; rc=%d\n", rc);
+        }
+    }
+}
 
 static int
 gatt_svr_chr_access_hid(uint16_t conn_handle, uint16_t attr_handle,
                             uint8_t op, union ble_gatt_access_ctxt *ctxt,
                             void *arg)
 {
+    struct gatt_svr_conn *conn;
     uint16_t uuid16;
+    int which;
     int rc;
 
+    GATT_SVR_ATT_REQUEST();
+
     uuid16 = ble_uuid_128_to_16(ctxt->chr_access.chr->uuid128);
     assert(uuid16 != 0);
 
     switch (uuid16) {
     case GATT_SVR_CHR_HID_INFORMATION:
-        assert(op == BLE_GATT_ACCESS_OP_READ_CHR);
+        GATT_SVR_CHECK_OP(op, BLE_GATT_ACCESS_OP_READ_CHR);
         ctxt->chr_access.data = (void *)gatt_svr_hid_information;
         ctxt->chr_access.len = sizeof gatt_svr_hid_information;
         return 0;
 
     case GATT_SVR_CHR_REPORT_MAP:
-        assert(op == BLE_GATT_ACCESS_OP_READ_CHR);
+        GATT_SVR_CHECK_OP(op, BLE_GATT_ACCESS_OP_READ_CHR);
         ctxt->chr_access.data = (void *)gatt_svr_report_map;
         ctxt->chr_access.len = sizeof gatt_svr_report_map;
         return 0;
 
     case GATT_SVR_CHR_BOOT_KEYBOARD_INPUT_MAP:
-        assert(op == BLE_GATT_ACCESS_OP_READ_CHR);
-        ctxt->chr_access.data = (void *)gatt_svr_boot_keyboard_input_map;
-        ctxt->chr_access.len = sizeof gatt_svr_boot_keyboard_input_map;
+        GATT_SVR_CHECK_OP(op, BLE_GATT_ACCESS_OP_READ_CHR);
+        ctxt->chr_access.data =
+            (void *)gatt_svr_report_read(conn_handle, HID_KEYBOARD);
+        if (ctxt->chr_access.data == NULL) {
+            return BLE_ATT_ERR_UNLIKELY;
+        }
+        ctxt->chr_access.len = HID_SIZE_KEYBOARD;
         return 0;
 
     case GATT_SVR_CHR_REPORT:
-        assert(op == BLE_GATT_ACCESS_OP_READ_CHR);
-        ctxt->chr_access.data = (void *)gatt_svr_hid_report;
-        ctxt->chr_access.len = sizeof gatt_svr_hid_report;
+        GATT_SVR_CHECK_OP(op, BLE_GATT_ACCESS_OP_READ_CHR);
+        which = (int)arg;
+        assert(which < HID_NUM_REPORTS);
+        ctxt->chr_access.data = (void *)gatt_svr_report_read(conn_handle,
+                                                             which);
+        if (ctxt->chr_access.data == NULL) {
+            return BLE_ATT_ERR_UNLIKELY;
+        }
+        ctxt->chr_access.len = hid_report_size(which);
         return 0;
 
     case GATT_SVR_CHR_HID_CONTROL_POINT:
@@ -423,18 +1146,21 @@ gatt_svr_chr_access_hid(uint16_t conn_handle, uint16_t attr_handle,
         return rc;
 
     case GATT_SVR_CHR_PROTOCOL_MODE:
+        conn = gatt_svr_conn_find(conn_handle);
+        if (conn == NULL) {
+            return BLE_ATT_ERR_UNLIKELY;
+        }
         if (op == BLE_GATT_ACCESS_OP_WRITE_CHR) {
             rc = gatt_svr_chr_write(op, ctxt, 1, 1,
-                                  &gatt_svr_protocol_mode, NULL);
+                                  &conn->protocol_mode, NULL);
             return rc;
         } else if (op == BLE_GATT_ACCESS_OP_READ_CHR) {
-            ctxt->chr_access.data = (void *)&gatt_svr_protocol_mode;
-            ctxt->chr_access.len = sizeof gatt_svr_protocol_mode;
+            ctxt->chr_access.data = (void *)&conn->protocol_mode;
+            ctxt->chr_access.len = sizeof conn->protocol_mode;
             return 0;
         }
 
     default:
-        assert(0);
         return BLE_ATT_ERR_UNLIKELY;
     }
 
@@ -442,11 +1168,6 @@ gatt_svr_chr_access_hid(uint16_t conn_handle, uint16_t attr_handle,
     return BLE_ATT_ERR_UNLIKELY;
 }
 
-static const uint8_t gatt_svr_hid_report_ref[][2] = {
-    { 0x00, 0x01, },
-    { 0x01, 0x01, },
-};
-
 static int
 gatt_svr_dsc_access_hid(uint16_t conn_handle, uint16_t attr_handle,
                             uint8_t op, union ble_gatt_access_ctxt *ctxt,
@@ -455,21 +1176,22 @@ gatt_svr_dsc_access_hid(uint16_t conn_handle, uint16_t attr_handle,
     uint16_t uuid16;
     int which;
 
+    GATT_SVR_ATT_REQUEST();
+
     uuid16 = ble_uuid_128_to_16(ctxt->chr_access.chr->uuid128);
     assert(uuid16 != 0);
 
     which = (int)arg;
-    assert(which == 0 || which == 1);
+    assert(which < HID_NUM_REPORTS);
 
     switch (uuid16) {
     case GATT_SVR_DSC_REPORT_REFERENCE:
-        assert(op == BLE_GATT_ACCESS_OP_READ_DSC);
+        GATT_SVR_CHECK_OP(op, BLE_GATT_ACCESS_OP_READ_DSC);
         ctxt->chr_access.data = (void *)gatt_svr_hid_report_ref[which];
         ctxt->chr_access.len = 2;
         return 0;
 
     default:
-        assert(0);
         return BLE_ATT_ERR_UNLIKELY;
     }
 
@@ -490,6 +1212,8 @@ gatt_svr_chr_access_quacker(uint16_t conn_handle, uint16_t attr_handle,
         "none", "flat", "upright", "rubber",
     };
 
+    GATT_SVR_ATT_REQUEST();
+
     uuid128 = ctxt->chr_access.chr->uuid128;
 
     /* Determine which characteristic is being accessed by examining its
@@ -526,6 +1250,50 @@ gatt_svr_chr_access_quacker(uint16_t conn_handle, uint16_t attr_handle,
         }
     }
 
+    if (memcmp(uuid128, gatt_svr_chr_quacker_stats, 16) == 0) {
+        if (op == BLE_GATT_ACCESS_OP_READ_CHR) {
+            stats_sample();
+            ctxt->chr_access.data = (void *)&quacker_stats;
+            ctxt->chr_access.len = sizeof quacker_stats;
+            return 0;
+        }
+    }
+
+    if (memcmp(uuid128, gatt_svr_chr_quacker_ota_ctrl, 16) == 0) {
+        if (op == BLE_GATT_ACCESS_OP_READ_CHR) {
+            ctxt->chr_access.data = (void *)ota_get_status();
+            ctxt->chr_access.len = sizeof(struct ota_status);
+            return 0;
+        } else if (op == BLE_GATT_ACCESS_OP_WRITE_CHR) {
+            gatt_svr_ota_conn = conn_handle;
+            return ota_ctrl(ctxt->chr_access.data, ctxt->chr_access.len);
+        }
+    }
+
+    if (memcmp(uuid128, gatt_svr_chr_quacker_ota_data, 16) == 0) {
+        if (op == BLE_GATT_ACCESS_OP_WRITE_CHR) {
+            gatt_svr_ota_conn = conn_handle;
+            ota_data(ctxt->chr_access.data, ctxt->chr_access.len);
+            return 0;
+        }
+    }
+
+#ifdef QUACKER_TRACE
+    if (memcmp(uuid128, gatt_svr_chr_quacker_trace, 16) == 0) {
+        if (op == BLE_GATT_ACCESS_OP_READ_CHR) {
+            ctxt->chr_access.data = (void *)trace_data(&ctxt->chr_access.len);
+            return 0;
+        } else if (op == BLE_GATT_ACCESS_OP_WRITE_CHR) {
+            if (ctxt->chr_access.len != 1 ||
+                trace_control(((uint8_t *)ctxt->chr_access.data)[0]) != 0) {
+
+                return BLE_ATT_ERR_INVALID_ATTR_VALUE_LEN;
+            }
+            return 0;
+        }
+    }
+#endif
+
     return BLE_ATT_ERR_UNLIKELY;
 }
 
@@ -537,18 +1305,19 @@ gatt_svr_dsc_access_quacker(uint16_t conn_handle, uint16_t attr_handle,
 {
     uint16_t uuid16;
 
+    GATT_SVR_ATT_REQUEST();
+
     uuid16 = ble_uuid_128_to_16(ctxt->chr_access.chr->uuid128);
     assert(uuid16 != 0);
 
     switch (uuid16) {
     case GATT_SVR_DSC_DESCRIPTION:
-        assert(op == BLE_GATT_ACCESS_OP_READ_DSC);
+        GATT_SVR_CHECK_OP(op, BLE_GATT_ACCESS_OP_READ_DSC);
         ctxt->chr_access.data = (void *)gatt_svr_quacker_description;
         ctxt->chr_access.len = strlen(gatt_svr_quacker_description);
         return 0;
 
     default:
-        assert(0);
         return BLE_ATT_ERR_UNLIKELY;
     }
 
@@ -577,13 +1346,32 @@ gatt_svr_uuid128_to_s(void *uuid128, char *dst)
     return dst;
 }
 
+/**
+ * Folds data into the attribute table hash (32-bit FNV-1a).
+ */
+static void
+gatt_svr_db_hash_add(const void *data, int len)
+{
+    const uint8_t *p;
+    int i;
+
+    p = data;
+    for (i = 0; i < len; i++) {
+        gatt_svr_db_hash = (gatt_svr_db_hash ^ p[i]) * 16777619;
+    }
+}
+
 static void
 gatt_svr_register_cb(uint8_t op, union ble_gatt_register_ctxt *ctxt, void *arg)
 {
+    uint16_t uuid16;
     char buf[40];
+    int which;
 
     switch (op) {
     case BLE_GATT_REGISTER_OP_SVC:
+        gatt_svr_db_hash_add(&ctxt->svc_reg.handle, 2);
+        gatt_svr_db_hash_add(ctxt->svc_reg.svc->uuid128, 16);
         QUACKER_LOG(DEBUG, "registered service %s with handle=%d\n",
                     gatt_svr_uuid128_to_s(ctxt->svc_reg.svc->uuid128, buf),
                     ctxt->svc_reg.handle);
@@ -595,6 +1383,32 @@ gatt_svr_register_cb(uint8_t op, union ble_gatt_register_ctxt *ctxt, void *arg)
                     gatt_svr_uuid128_to_s(ctxt->chr_reg.chr->uuid128, buf),
                     ctxt->chr_reg.def_handle,
                     ctxt->chr_reg.val_handle);
+        gatt_svr_db_hash_add(&ctxt->chr_reg.def_handle, 2);
+        gatt_svr_db_hash_add(ctxt->chr_reg.chr->uuid128, 16);
+        gatt_svr_db_hash_add(&ctxt->chr_reg.chr->flags,
+                             sizeof ctxt->chr_reg.chr->flags);
+
+        uuid16 = ble_uuid_128_to_16(ctxt->chr_reg.chr->uuid128);
+        if (uuid16 == BLE_GATT_CHR_SERVICE_CHANGED_UUID16) {
+            gatt_svr_svc_changed_val_handle = ctxt->chr_reg.val_handle;
+        }
+        if (uuid16 == GATT_SVR_CHR_BOOT_KEYBOARD_INPUT_MAP) {
+            gatt_svr_boot_input_def_handle = ctxt->chr_reg.def_handle;
+            gatt_svr_boot_input_val_handle = ctxt->chr_reg.val_handle;
+        }
+        if (uuid16 == GATT_SVR_CHR_REPORT) {
+            which = (int)ctxt->chr_reg.chr->arg;
+            gatt_svr_report_def_handle[which] = ctxt->chr_reg.def_handle;
+            gatt_svr_report_val_handle[which] = ctxt->chr_reg.val_handle;
+        }
+        if (memcmp(ctxt->chr_reg.chr->uuid128,
+                   gatt_svr_chr_quacker_stats, 16) == 0) {
+            stats_set_chr_handle(ctxt->chr_reg.def_handle);
+        }
+        if (memcmp(ctxt->chr_reg.chr->uuid128,
+                   gatt_svr_chr_quacker_ota_ctrl, 16) == 0) {
+            ota_set_chr_handle(ctxt->chr_reg.def_handle);
+        }
         break;
 
     case BLE_GATT_REGISTER_OP_DSC:
@@ -603,6 +1417,8 @@ gatt_svr_register_cb(uint8_t op, union ble_gatt_register_ctxt *ctxt, void *arg)
                     gatt_svr_uuid128_to_s(ctxt->dsc_reg.dsc->uuid128, buf),
                     ctxt->dsc_reg.dsc_handle,
                     ctxt->dsc_reg.chr_def_handle);
+        gatt_svr_db_hash_add(&ctxt->dsc_reg.dsc_handle, 2);
+        gatt_svr_db_hash_add(ctxt->dsc_reg.dsc->uuid128, 16);
         break;
 
     default:
@@ -615,8 +1431,91 @@ void
 gatt_svr_init(void)
 {
     int rc;
+    int i;
+
+    for (i = 0; i < QUACKER_MAX_CONNS; i++) {
+        gatt_svr_conns[i].conn_handle = BLE_HS_CONN_HANDLE_NONE;
+    }
+    QUACKER_LOG(INFO, "gatt: %d connections, %d bytes each\n",
+                QUACKER_MAX_CONNS, (int)sizeof(struct gatt_svr_conn));
 
+    gatt_svr_db_hash = 2166136261;
     rc = ble_gatts_register_svcs(gatt_svr_svcs, gatt_svr_register_cb, NULL);
-    if (rc != 0) { while (1) ; }
-    assert(rc == 0);
+    if (rc != 0) {
+        QUACKER_LOG(ERROR, "error registering services; rc=%d\n", rc);
+    }
+    QUACKER_ASSERT(rc == 0);
+
+    /* Any change is announced as covering the whole table. */
+    quacker_gatt_service_changed[0] = 0x01;
+    quacker_gatt_service_changed[1] = 0x00;
+    quacker_gatt_service_changed[2] = 0xff;
+    quacker_gatt_service_changed[3] = 0xff;
+}
+
+/**
+ * Compares the attribute table with the one from the last boot.  Bonded
+ * hosts cache the table, so if it changed each of them is owed a Service
+ * Changed indication.  Otherwise none is sent and the host's cache stays
+ * valid.  Needs NFFS; after a warm boot it runs once advertising is up.
+ */
+void
+gatt_svr_db_check(void)
+{
+    uint32_t saved_hash;
+    uint32_t len;
+    int rc;
+
+    rc = fsutil_read_file(GATT_SVR_DB_FILE, 0, sizeof saved_hash,
+                          &saved_hash, &len);
+    if (rc == 0 && len == sizeof saved_hash &&
+        saved_hash == gatt_svr_db_hash) {
+
+        return;
+    }
+
+    if (rc == 0) {
+        QUACKER_LOG(INFO, "attribute table changed (0x%08lx -> 0x%08lx)\n",
+                    (unsigned long)saved_hash,
+                    (unsigned long)gatt_svr_db_hash);
+        keystore_set_flags_all(KEYSTORE_F_DB_STALE);
+    }
+
+    TRACE(FLASH_BEGIN, TRACE_FLASH_GATT_DB);
+    rc = fsutil_write_file(GATT_SVR_DB_FILE, &gatt_svr_db_hash,
+                           sizeof gatt_svr_db_hash);
+    TRACE(FLASH_END, TRACE_FLASH_GATT_DB);
+    quacker_stats.flash_writes++;
+    if (rc != 0) {
+        QUACKER_LOG(ERROR, "error saving attribute table hash; rc=%d\n", rc);
+    }
+}
+
+/**
+ * Stores the IRK a host sent while pairing with its bond.  The host may
+ * send it before the bond exists, in which case it waits for
+ * gatt_svr_conn_bonded().
+ */
+void
+gatt_svr_conn_irk(uint16_t conn_handle, const uint8_t *irk)
+{
+    struct gatt_svr_conn *conn;
+    int rc;
+
+    conn = gatt_svr_conn_find(conn_handle);
+    if (conn == NULL) {
+        return;
+    }
+
+    if (!conn->bonded) {
+        memcpy(conn->peer_irk, irk, sizeof conn->peer_irk);
+        conn->irk_pending = 1;
+        return;
+    }
+
+    conn->irk_pending = 0;
+    rc = keystore_set_irk(conn->ediv, conn->rand_num, irk);
+    if (rc != 0) {
+        QUACKER_LOG_FAST("error saving irk; rc=%d\n", rc);
+    }
 }
@@ -0,0 +1,359 @@
+/**
+ * Copyright 2016 ICE9 Consulting
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+/**
+ * HID report engine.
+ *
+ * The button task hands debounced edges to hid_button(); this file turns
+ * them into actions, and each action into a code in one of the reports
+ * declared in hid_map.h:
+ *
+ *     Press left / right          Keyboard Left / Right arrow
+ *     Hold left                   Vendor: blank screen
+ *     Hold left, press right      Consumer: volume up
+ *     Press left, then right      Vendor: laser pointer
+ *     Hold both                   Switch to the next connected host
+ *
+ * The bindings are HID_BUTTONS() in hid_map.h.  Every action is sent as a
+ * tap: the press report and the release report go to the stack back to
+ * back, so they normally leave in the same connection event, and the host
+ * never sees a key held long enough to autorepeat.
+ *
+ * A button with no hold action taps on the press edge.  One with a hold
+ * action waits for the release, once it is known which action the press
+ * was: released before HID_HOLD_MSEC it sends its press action, after it
+ * its hold action.  While it waits, a press of the other button is decided
+ * on the spot: a volume step if this one is already held, which then gives
+ * up its own action, or else a chord, sent on release.
+ *
+ * Keys are tracked as a set and the keyboard report is built from it (six
+ * key rollover), so keys that are down at the same time appear together.
+ * The last report sent on each channel is kept for the current connection,
+ * and a report identical to it is not sent again.
+ */
+
+#include <assert.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "os/os.h"
+#include "host/ble_hs.h"
+
+#include "quacker.h"
+#include "hid_map.h"
+
+#define HID_NUM_BUTTONS     2
+
+/** How long a button must be held for its hold action. */
+#define HID_HOLD_MSEC       800
+
+/** How long both buttons must be held to switch hosts. */
+#define HID_SWITCH_MSEC     2000
+
+struct hid_action {
+    uint8_t report;             /* Index in HID_REPORTS(); HID_NUM_REPORTS
+                                 * for none. */
+    uint16_t code;
+};
+
+static const struct hid_action hid_press_action[HID_NUM_BUTTONS] = {
+    HID_BUTTONS(HID_MAP_PRESS)
+};
+
+static const struct hid_action hid_hold_action[HID_NUM_BUTTONS] = {
+    HID_BUTTONS(HID_MAP_HOLD)
+};
+
+static const struct hid_action hid_step_action[HID_NUM_BUTTONS] = {
+    HID_BUTTONS(HID_MAP_STEP)
+};
+
+static const struct hid_action hid_chord_action = HID_CHORD_ACTION;
+
+/* Keys currently down, in the order they went down. */
+static uint8_t hid_keys[6];
+static int hid_num_keys;
+
+/* Last report sent on each channel this connection. */
+static uint8_t hid_last[HID_NUM_REPORTS][HID_MAX_SIZE];
+static uint8_t hid_last_valid;
+
+static hid_sink_fn *hid_sink = gatt_svr_report_notify;
+static hid_switch_fn *hid_switch = gatt_svr_next_target;
+
+static struct {
+    uint16_t held_msec;
+    unsigned down:1;
+    unsigned held:1;            /* Down for HID_HOLD_MSEC. */
+    unsigned used:1;            /* Sent, or taken by a chord or a step. */
+} hid_buttons[HID_NUM_BUTTONS];
+
+/* Both buttons down and the chord not yet acted on. */
+static int hid_chord;
+static uint16_t hid_chord_msec;
+
+/**
+ * Hands a report to the sink unless the host already has it.
+ */
+static void
+hid_send_report(int which, const uint8_t *report)
+{
+    int len;
+    int rc;
+
+    len = hid_report_size(which);
+    if ((hid_last_valid & (1 << which)) &&
+        memcmp(hid_last[which], report, len) == 0) {
+
+        quacker_stats.notify_suppressed++;
+        return;
+    }
+
+    TRACE(REPORT_QUEUED, which == HID_KEYBOARD ? report[2] : report[0]);
+    rc = hid_sink(which, report, len);
+    TRACE(CHR_UPDATED, 0);
+
+    if (rc != 0) {
+        quacker_stats.notify_dropped++;
+        return;
+    }
+
+    memcpy(hid_last[which], report, len);
+    hid_last_valid |= 1 << which;
+
+#ifdef QUACKER_BENCH
+    if (which == HID_KEYBOARD) {
+        bench_report_sent(report);
+    }
+#endif
+}
+
+/**
+ * Presses or releases a key and sends the resulting keyboard report.  A key
+ * that is already in the requested state changes nothing, and beyond six
+ * keys further presses are ignored.
+ */
+void
+hid_key(uint8_t code, int down)
+{
+    uint8_t report[HID_MAX_SIZE];
+    int i;
+
+    for (i = 0; i < hid_num_keys; i++) {
+        if (hid_keys[i] == code) {
+            break;
+        }
+    }
+
+    if (down && i == hid_num_keys && hid_num_keys < sizeof hid_keys) {
+        hid_keys[hid_num_keys++] = code;
+    } else if (!down && i < hid_num_keys) {
+        hid_num_keys--;
+        memmove(hid_keys + i, hid_keys + i + 1, hid_num_keys - i);
+    }
+
+    memset(report, 0, sizeof report);
+    memcpy(report + 2, hid_keys, hid_num_keys);
+    hid_send_report(HID_KEYBOARD, report);
+}
+
+static void
+hid_send(const struct hid_action *action, int press)
+{
+    uint8_t report[HID_MAX_SIZE];
+
+    memset(report, 0, sizeof report);
+
+    switch (action->report) {
+    case HID_KEYBOARD:
+        hid_key(action->code, press);
+        return;
+
+    case HID_CONSUMER:
+        if (press) {
+            report[0] = action->code;
+            report[1] = action->code >> 8;
+        }
+        break;
+
+    case HID_VENDOR:
+        if (press) {
+            report[0] = action->code;
+        }
+        break;
+
+    default:
+        assert(0);
+        return;
+    }
+
+    hid_send_report(action->report, report);
+}
+
+static void
+hid_tap(const struct hid_action *action)
+{
+    if (action->report == HID_NUM_REPORTS) {
+        return;
+    }
+
+    hid_send(action, 1);
+    hid_send(action, 0);
+}
+
+/**
+ * Whether a button's press action waits for the release, because the
+ * button has a hold action.  The button task schedules whichever edge
+ * sends the report; see anchor.c.
+ */
+int
+hid_button_waits(int button)
+{
+    assert(button < HID_NUM_BUTTONS);
+    return hid_hold_action[button].report != HID_NUM_REPORTS;
+}
+
+/**
+ * Forgets what the host has seen; called when a connection comes up.
+ */
+void
+hid_conn_reset(void)
+{
+    hid_last_valid = 0;
+}
+
+/**
+ * Redirects reports, for the host tests; NULL restores the GATT server.
+ */
+void
+hid_set_sink(hid_sink_fn *sink)
+{
+    hid_sink = sink != NULL ? sink : gatt_svr_report_notify;
+    hid_conn_reset();
+}
+
+/**
+ * Redirects host switches, for the host tests; NULL restores the GATT
+ * server.
+ */
+void
+hid_set_switch(hid_switch_fn *fn)
+{
+    hid_switch = fn != NULL ? fn : gatt_svr_next_target;
+}
+
+/**
+ * Takes a debounced edge from the button task.
+ */
+void
+hid_button(int button, int down)
+{
+    int other;
+
+    assert(button < HID_NUM_BUTTONS);
+    other = !button;
+
+    if (!down) {
+        if (!hid_buttons[button].down) {
+            return;
+        }
+        hid_buttons[button].down = 0;
+
+        if (hid_chord) {
+            hid_chord = 0;
+            hid_tap(&hid_chord_action);
+        } else if (!hid_buttons[button].used) {
+            hid_tap(hid_buttons[button].held ? &hid_hold_action[button] :
+                                               &hid_press_action[button]);
+        }
+        return;
+    }
+
+    hid_buttons[button].down = 1;
+    hid_buttons[button].held = 0;
+    hid_buttons[button].used = 1;   /* Unless it waits; see below. */
+    hid_buttons[button].held_msec = 0;
+
+    /* Only a button that waits is ever held or still unused. */
+    if (hid_buttons[other].down && hid_buttons[other].held &&
+        hid_step_action[button].report != HID_NUM_REPORTS) {
+
+        /* The held button becomes a modifier and gives up its own action. */
+        hid_buttons[other].used = 1;
+        hid_tap(&hid_step_action[button]);
+        return;
+    }
+    if (hid_buttons[other].down && !hid_buttons[other].held &&
+        !hid_buttons[other].used) {
+
+        hid_buttons[other].used = 1;
+        hid_chord = 1;
+        hid_chord_msec = 0;
+        return;
+    }
+
+    if (hid_button_waits(button)) {
+        hid_buttons[button].used = 0;
+    } else {
+        hid_tap(&hid_press_action[button]);
+    }
+}
+
+/**
+ * Advances the hold timers by msec.
+ *
+ * @return                      Nonzero while a hold is still being timed; the
+ *                                  button task keeps polling until then.
+ */
+int
+hid_poll(int msec)
+{
+    int pending;
+    int i;
+
+    pending = 0;
+    if (hid_chord) {
+        hid_chord_msec += msec;
+        if (hid_chord_msec >= HID_SWITCH_MSEC) {
+            hid_chord = 0;
+            hid_switch();
+        } else {
+            pending = 1;
+        }
+    }
+
+    for (i = 0; i < HID_NUM_BUTTONS; i++) {
+        if (!hid_buttons[i].down || hid_buttons[i].held ||
+            hid_buttons[i].used) {
+
+            continue;
+        }
+
+        hid_buttons[i].held_msec += msec;
+        if (hid_buttons[i].held_msec >= HID_HOLD_MSEC) {
+            hid_buttons[i].held = 1;
+        } else {
+            pending = 1;
+        }
+    }
+
+    return pending;
+}
@@ -0,0 +1,205 @@
+/**
+ * Copyright 2016 ICE9 Consulting
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#ifndef H_HID_MAP_
+#define H_HID_MAP_
+
+/**
+ * The HID reports the badge sends, declared once.
+ *
+ * HID_REPORTS() lists every report as
+ *
+ *     X(name, id, type, size, descriptor)
+ *
+ * and everything else is generated from it: the report map served to the
+ * host, the report IDs and sizes, the Report Reference descriptors and one
+ * Report characteristic per entry.  descriptor names a macro that takes the
+ * report ID and expands to the report's top-level collection.
+ *
+ * Only list reports the firmware actually fills in; every entry costs the
+ * host discovery time and a characteristic.
+ */
+
+/** Report Reference types (HID over GATT 3.6). */
+#define HID_REPORT_TYPE_INPUT       1
+#define HID_REPORT_TYPE_OUTPUT      2
+#define HID_REPORT_TYPE_FEATURE     3
+
+/**
+ * Keyboard: a modifier byte, a reserved byte and six key codes (the boot
+ * keyboard layout).  No LED output report; there is no characteristic to
+ * receive it and no LEDs to light.
+ */
+#define HID_DESC_KEYBOARD(id)                                           \
+    0x05, 0x01,         /* Usage Page (Generic Desktop) */              \
+    0x09, 0x06,         /* Usage (Keyboard) */                          \
+    0xa1, 0x01,         /* Collection (Application) */                  \
+    0x85, (id),         /*   Report ID */                               \
+    0x05, 0x07,         /*   Usage Page (Key Codes) */                  \
+    0x19, 0xe0,         /*   Usage Minimum (Left Control) */            \
+    0x29, 0xe7,         /*   Usage Maximum (Right GUI) */               \
+    0x15, 0x00,         /*   Logical Minimum (0) */                     \
+    0x25, 0x01,         /*   Logical Maximum (1) */                     \
+    0x75, 0x01,         /*   Report Size (1) */                         \
+    0x95, 0x08,         /*   Report Count (8) */                        \
+    0x81, 0x02,         /*   Input (Data, Variable, Absolute) */        \
+    0x95, 0x01,         /*   Report Count (1) */                        \
+    0x75, 0x08,         /*   Report Size (8) */                         \
+    0x81, 0x03,         /*   Input (Constant) */                        \
+    0x95, 0x06,         /*   Report Count (6) */                        \
+    0x75, 0x08,         /*   Report Size (8) */                         \
+    0x15, 0x00,         /*   Logical Minimum (0) */                     \
+    0x26, 0xff, 0x00,   /*   Logical Maximum (255) */                   \
+    0x05, 0x07,         /*   Usage Page (Key Codes) */                  \
+    0x19, 0x00,         /*   Usage Minimum (0) */                       \
+    0x2a, 0xff, 0x00,   /*   Usage Maximum (255) */                     \
+    0x81, 0x00,         /*   Input (Data, Array) */                     \
+    0xc0                /* End Collection */
+
+/**
+ * Consumer control: one 16-bit usage (volume, mute, ...), zero when
+ * released.
+ */
+#define HID_DESC_CONSUMER(id)                                           \
+    0x05, 0x0c,         /* Usage Page (Consumer) */                     \
+    0x09, 0x01,         /* Usage (Consumer Control) */                  \
+    0xa1, 0x01,         /* Collection (Application) */                  \
+    0x85, (id),         /*   Report ID */                               \
+    0x15, 0x00,         /*   Logical Minimum (0) */                     \
+    0x26, 0xff, 0x03,   /*   Logical Maximum (1023) */                  \
+    0x19, 0x00,         /*   Usage Minimum (0) */                       \
+    0x2a, 0xff, 0x03,   /*   Usage Maximum (1023) */                    \
+    0x75, 0x10,         /*   Report Size (16) */                        \
+    0x95, 0x01,         /*   Report Count (1) */                        \
+    0x81, 0x00,         /*   Input (Data, Array) */                     \
+    0xc0                /* End Collection */
+
+/**
+ * Presenter commands with no standard usage (HID_VENDOR_*), one byte, zero
+ * when released.  The host needs a small helper to act on these.
+ */
+#define HID_DESC_VENDOR(id)                                             \
+    0x06, 0x00, 0xff,   /* Usage Page (Vendor 0xFF00) */                \
+    0x09, 0x01,         /* Usage (1) */                                 \
+    0xa1, 0x01,         /* Collection (Application) */                  \
+    0x85, (id),         /*   Report ID */                               \
+    0x09, 0x02,         /*   Usage (2) */                               \
+    0x15, 0x00,         /*   Logical Minimum (0) */                     \
+    0x26, 0xff, 0x00,   /*   Logical Maximum (255) */                   \
+    0x75, 0x08,         /*   Report Size (8) */                         \
+    0x95, 0x01,         /*   Report Count (1) */                        \
+    0x81, 0x00,         /*   Input (Data, Array) */                     \
+    0xc0                /* End Collection */
+
+#define HID_REPORTS(X)                                                  \
+    X(KEYBOARD, 1, HID_REPORT_TYPE_INPUT, 8, HID_DESC_KEYBOARD)         \
+    X(CONSUMER, 2, HID_REPORT_TYPE_INPUT, 2, HID_DESC_CONSUMER)         \
+    X(VENDOR,   3, HID_REPORT_TYPE_INPUT, 1, HID_DESC_VENDOR)
+
+/** Codes sent in the reports above. */
+#define HID_KEY_RIGHT               0x4f
+#define HID_KEY_LEFT                0x50
+
+#define HID_CONSUMER_MUTE           0x00e2
+#define HID_CONSUMER_VOLUME_UP      0x00e9
+#define HID_CONSUMER_VOLUME_DOWN    0x00ea
+
+#define HID_VENDOR_BLANK            0x01    /* Toggle a blank screen. */
+#define HID_VENDOR_LASER            0x02    /* Toggle the laser pointer. */
+
+/**
+ * What each button does, left first:
+ *
+ *     X(press, hold, step)
+ *
+ * each an action written HID_ACTION(report, code) or HID_ACTION_NONE.  press
+ * is a short press, hold a press longer than the hold time, and step a
+ * press while the other button is held, for volume.
+ *
+ * A button with no hold action sends its press action on the press edge,
+ * so only the debounce stands between the finger and the report.  A button
+ * with one has to wait for the release to know which the press was, which
+ * adds the time it is down; only such a button can be held to make the
+ * other one step, or start a chord.  Right, which advances the slides, is
+ * the one that shouldn't wait; giving it a hold action (mute, say) makes
+ * its press wait too, and lets it be held for left's step.
+ */
+#define HID_ACTION(report, code)    { HID_ ## report, (code) }
+#define HID_ACTION_NONE             { HID_NUM_REPORTS, 0 }
+
+#define HID_BUTTONS(X)                                                  \
+    X(HID_ACTION(KEYBOARD, HID_KEY_LEFT),                               \
+      HID_ACTION(VENDOR, HID_VENDOR_BLANK),                             \
+      HID_ACTION(CONSUMER, HID_CONSUMER_VOLUME_DOWN))                   \
+    X(HID_ACTION(KEYBOARD, HID_KEY_RIGHT),                              \
+      HID_ACTION_NONE,                                                  \
+      HID_ACTION(CONSUMER, HID_CONSUMER_VOLUME_UP))
+
+/** Pressing both buttons, starting with one that waits. */
+#define HID_CHORD_ACTION            HID_ACTION(VENDOR, HID_VENDOR_LASER)
+
+/** Generators. */
+#define HID_MAP_IDX(name, id, type, size, desc)     HID_ ## name,
+#define HID_MAP_ID(name, id, type, size, desc)      HID_ID_ ## name = (id),
+#define HID_MAP_SIZE(name, id, type, size, desc)    HID_SIZE_ ## name = (size),
+#define HID_MAP_MAX(name, id, type, size, desc)     uint8_t name[size];
+#define HID_MAP_DESC(name, id, type, size, desc)    desc(id),
+#define HID_MAP_REF(name, id, type, size, desc)     { (id), (type) },
+#define HID_MAP_CASE_SIZE(name, id, type, size, desc) \
+    case HID_ ## name: return (size);
+#define HID_MAP_PRESS(press, hold, step)            press,
+#define HID_MAP_HOLD(press, hold, step)             hold,
+#define HID_MAP_STEP(press, hold, step)             step,
+
+/** Index of each report in table order, for arrays generated below. */
+enum hid_report_idx {
+    HID_REPORTS(HID_MAP_IDX)
+    HID_NUM_REPORTS
+};
+
+enum {
+    HID_REPORTS(HID_MAP_ID)
+};
+
+enum {
+    HID_REPORTS(HID_MAP_SIZE)
+    HID_MAX_SIZE = sizeof(union { HID_REPORTS(HID_MAP_MAX) }),
+};
+
+/** Initializers. */
+#define HID_REPORT_MAP              { HID_REPORTS(HID_MAP_DESC) }
+#define HID_REPORT_REFS             { HID_REPORTS(HID_MAP_REF) }
+
+/**
+ * Size in bytes of report which (a HID_REPORTS() index), without the
+ * report ID.
+ */
+static inline int
+hid_report_size(int which)
+{
+    switch (which) {
+    HID_REPORTS(HID_MAP_CASE_SIZE)
+    default:
+        return 0;
+    }
+}
+
+#endif
@@ -26,7 +26,14 @@
  * the encryption procedure (bonding).
  *
  * This has been modified from the original version from 0.9.0 to write data to
- * a file in NFFS.
+ * a file in NFFS.  Each entry also carries the GATT state the host expects a
+ * bond to keep (see KEYSTORE_F_*), so a bonded host doesn't have to
+ * rediscover or resubscribe after a reconnect or reboot.  A host's identity
+ * resolving key, if it sent one, is kept with its bond for rpa.c; the IRKs
+ * follow the entries in the file, so older files load without them.
+ *
+ * Every save also goes to the state kept across a warm boot (retain.c), so
+ * after a soft reset the keystore comes up without reading the file.
  */
 
 #include <assert.h>
@@ -37,6 +44,7 @@
 #include <fs/fsutil.h>
 
 #include "host/ble_hs.h"
+#include "quacker.h"
 
 #define KEYSTORE_FILE "/keystore.bin"
 
@@ -49,14 +57,34 @@ struct keystore_entry {
 
     unsigned authenticated:1;
 
+    /* KEYSTORE_F_* flags.  These share a word with authenticated, so the
+     * file layout is unchanged and older files load with them clear.
+     */
+    unsigned subscribed:1;
+    unsigned db_stale:1;
+
     /* XXX: authreq. */
 };
 
 static struct keystore_entry keystore_entries[KEYSTORE_MAX_ENTRIES];
 static int keystore_num_entries;
 
+/** All zeros for a bond without one. */
+static uint8_t keystore_irks[KEYSTORE_MAX_ENTRIES][16];
+
+#define KEYSTORE_FILE_LEN \
+    (sizeof(keystore_num_entries) + sizeof(keystore_entries) + \
+     sizeof(keystore_irks))
+
+/* The file is retained whole across a warm boot; see retain.c. */
+typedef char keystore_retain_fits[KEYSTORE_FILE_LEN == RETAIN_KEYSTORE_LEN ?
+                                  1 : -1];
+
 static int keystore_load(void);
 static int keystore_save(void);
+static void keystore_pack(unsigned char *file);
+static int keystore_unpack(const unsigned char *file, uint32_t len);
+static void keystore_retain(void);
 
 /**
  * Searches the database for a long-term key matching the specified criteria.
@@ -84,6 +112,185 @@ keystore_lookup(uint16_t ediv, uint64_t rand_num,
     return BLE_HS_ENOENT;
 }
 
+static struct keystore_entry *
+keystore_find(uint16_t ediv, uint64_t rand_num)
+{
+    struct keystore_entry *entry;
+    int i;
+
+    for (i = 0; i < keystore_num_entries; i++) {
+        entry = keystore_entries + i;
+        if (entry->ediv == ediv && entry->rand_num == rand_num) {
+            return entry;
+        }
+    }
+
+    return NULL;
+}
+
+static uint8_t
+keystore_entry_flags(struct keystore_entry *entry)
+{
+    return (entry->subscribed ? KEYSTORE_F_SUBSCRIBED : 0) |
+           (entry->db_stale ? KEYSTORE_F_DB_STALE : 0);
+}
+
+/**
+ * Looks up the GATT flags of the bond with the specified key.
+ *
+ * @return                      0 if the bond was found; else BLE_HS_ENOENT.
+ */
+int
+keystore_get_flags(uint16_t ediv, uint64_t rand_num, uint8_t *out_flags)
+{
+    struct keystore_entry *entry;
+
+    entry = keystore_find(ediv, rand_num);
+    if (entry == NULL) {
+        return BLE_HS_ENOENT;
+    }
+
+    *out_flags = keystore_entry_flags(entry);
+    return 0;
+}
+
+static int
+keystore_update_flags(struct keystore_entry *entry, uint8_t set, uint8_t clear)
+{
+    uint8_t flags;
+
+    flags = (keystore_entry_flags(entry) | set) & ~clear;
+    if (flags == keystore_entry_flags(entry)) {
+        return 0;
+    }
+
+    entry->subscribed = (flags & KEYSTORE_F_SUBSCRIBED) != 0;
+    entry->db_stale = (flags & KEYSTORE_F_DB_STALE) != 0;
+    return 1;
+}
+
+/**
+ * Sets and clears GATT flags on the bond with the specified key, saving the
+ * database only if something changed.
+ *
+ * @return                      0 on success; BLE_HS_ENOENT if there is no
+ *                                  such bond; fs error on failure.
+ */
+int
+keystore_set_flags(uint16_t ediv, uint64_t rand_num, uint8_t set,
+                   uint8_t clear)
+{
+    struct keystore_entry *entry;
+
+    entry = keystore_find(ediv, rand_num);
+    if (entry == NULL) {
+        return BLE_HS_ENOENT;
+    }
+
+    if (!keystore_update_flags(entry, set, clear)) {
+        return 0;
+    }
+
+    return keystore_save();
+}
+
+/**
+ * Sets GATT flags on every bond.
+ *
+ * @return                      0 on success; fs error on failure.
+ */
+int
+keystore_set_flags_all(uint8_t set)
+{
+    int changed;
+    int i;
+
+    changed = 0;
+    for (i = 0; i < keystore_num_entries; i++) {
+        changed |= keystore_update_flags(keystore_entries + i, set, 0);
+    }
+
+    if (!changed) {
+        return 0;
+    }
+
+    return keystore_save();
+}
+
+static int
+keystore_has_irk(int idx)
+{
+    static const uint8_t none[16];
+
+    return memcmp(keystore_irks[idx], none, sizeof none) != 0;
+}
+
+static void
+keystore_remove(int idx)
+{
+    memmove(keystore_entries + idx, keystore_entries + idx + 1,
+            sizeof(struct keystore_entry) * (keystore_num_entries - idx - 1));
+    memmove(keystore_irks + idx, keystore_irks + idx + 1,
+            sizeof keystore_irks[0] * (keystore_num_entries - idx - 1));
+    keystore_num_entries--;
+}
+
+/**
+ * Stores the IRK a host sent when it bonded.  If an older bond has the same
+ * IRK, the host has paired again and that bond is dropped.
+ *
+ * @return                      0 on success; BLE_HS_ENOENT if there is no
+ *                                  such bond; fs error on failure.
+ */
+int
+keystore_set_irk(uint16_t ediv, uint64_t rand_num, const uint8_t *irk)
+{
+    struct keystore_entry *entry;
+    int idx;
+    int i;
+
+    entry = keystore_find(ediv, rand_num);
+    if (entry == NULL) {
+        return BLE_HS_ENOENT;
+    }
+    idx = entry - keystore_entries;
+    memcpy(keystore_irks[idx], irk, sizeof keystore_irks[idx]);
+
+    for (i = 0; i < keystore_num_entries; i++) {
+        if (i != idx && memcmp(keystore_irks[i], irk, 16) == 0) {
+            keystore_remove(i);
+            break;
+        }
+    }
+
+    return keystore_save();
+}
+
+/**
+ * Reads the nth stored IRK, counting only bonds that have one.
+ *
+ * @return                      0 on success, with the bond's key in
+ *                                  *out_ediv and *out_rand_num;
+ *                                  BLE_HS_ENOENT if there are fewer.
+ */
+int
+keystore_get_irk(int n, uint8_t *out_irk, uint16_t *out_ediv,
+                 uint64_t *out_rand_num)
+{
+    int i;
+
+    for (i = 0; i < keystore_num_entries; i++) {
+        if (keystore_has_irk(i) && n-- == 0) {
+            memcpy(out_irk, keystore_irks[i], sizeof keystore_irks[i]);
+            *out_ediv = keystore_entries[i].ediv;
+            *out_rand_num = keystore_entries[i].rand_num;
+            return 0;
+        }
+    }
+
+    return BLE_HS_ENOENT;
+}
+
 /**
  * Adds the specified key to the database and saves the database to NFFS.
  *
@@ -95,9 +302,7 @@ keystore_add(uint16_t ediv, uint64_t rand_num, uint8_t *ltk, int authenticated)
     struct keystore_entry *entry;
 
     if (keystore_num_entries >= KEYSTORE_MAX_ENTRIES) {
-        memmove(keystore_entries, keystore_entries + 1,
-                sizeof(struct keystore_entry) * (KEYSTORE_MAX_ENTRIES - 1));
-        keystore_num_entries = KEYSTORE_MAX_ENTRIES - 1;
+        keystore_remove(0);
     }
 
     entry = keystore_entries + keystore_num_entries;
@@ -107,6 +312,10 @@ keystore_add(uint16_t ediv, uint64_t rand_num, uint8_t *ltk, int authenticated)
     entry->rand_num = rand_num;
     memcpy(entry->ltk, ltk, sizeof entry->ltk);
     entry->authenticated = authenticated;
+    entry->subscribed = 0;
+    entry->db_stale = 0;
+    memset(keystore_irks[keystore_num_entries - 1], 0,
+           sizeof keystore_irks[0]);
 
     return keystore_save();
 }
@@ -127,32 +336,99 @@ keystore_init(void)
         // create a new blank keystore if one doesn't exist
         keystore_num_entries = 0;
         memset(keystore_entries, 0, sizeof(keystore_entries));
+        memset(keystore_irks, 0, sizeof(keystore_irks));
         rc = keystore_save();
+    } else {
+        keystore_retain();
     }
 
     return rc;
 }
 
 /**
- * Load the keystore from NFFS.
+ * Takes the keystore from the copy that survived a warm boot, without
+ * touching NFFS.  keystore_verify() later checks the file against it.
  *
- * @return                      0 on success; -1 or fs error on failure
+ * @return                      0 on success; nonzero if the copy doesn't
+ *                                  unpack, in which case it is left as it
+ *                                  is and the caller reads the file with
+ *                                  keystore_init() instead.
  */
-static int
-keystore_load(void) {
+int
+keystore_restore(void)
+{
     int rc;
-    unsigned char file[sizeof(keystore_num_entries) + sizeof(keystore_entries)];
 
-    rc = fsutil_read_file(KEYSTORE_FILE, 0, sizeof(file), file, NULL);
+    rc = keystore_unpack(retain_get()->keystore, KEYSTORE_FILE_LEN);
     if (rc != 0) {
-        return rc;
+        QUACKER_LOG(ERROR, "keystore: retained copy is corrupt; "
+                           "reading flash\n");
+    }
+    return rc;
+}
+
+/**
+ * Compares the keystore file with the retained copy the keystore came from
+ * after a warm boot.  That copy is written first, so where they differ, the
+ * file missed the last save before the reset and is rewritten.
+ */
+void
+keystore_verify(void)
+{
+    unsigned char file[KEYSTORE_FILE_LEN];
+    const uint8_t *cur;
+    uint32_t len;
+    int rc;
+
+    cur = retain_get()->keystore;
+    rc = fsutil_read_file(KEYSTORE_FILE, 0, sizeof(file), file, &len);
+    if (rc == 0 && len == sizeof(file) && memcmp(file, cur, len) == 0) {
+        return;
+    }
+
+    QUACKER_LOG(INFO, "keystore: file out of date; rewriting\n");
+    TRACE(FLASH_BEGIN, TRACE_FLASH_KEYSTORE);
+    rc = fsutil_write_file(KEYSTORE_FILE, cur, KEYSTORE_FILE_LEN);
+    TRACE(FLASH_END, TRACE_FLASH_KEYSTORE);
+    quacker_stats.flash_writes++;
+    if (rc != 0) {
+        QUACKER_LOG(ERROR, "error saving keystore; rc=%d\n", rc);
+    }
+}
+
+static void
+keystore_pack(unsigned char *file)
+{
+    memcpy(file, &keystore_num_entries, sizeof(keystore_num_entries));
+    memcpy(file + sizeof(keystore_num_entries),
+            keystore_entries, sizeof(keystore_entries));
+    memcpy(file + KEYSTORE_FILE_LEN - sizeof(keystore_irks),
+            keystore_irks, sizeof(keystore_irks));
+}
+
+/**
+ * @return                      0 on success; -1 if file is not a keystore.
+ */
+static int
+keystore_unpack(const unsigned char *file, uint32_t len)
+{
+    if (len < KEYSTORE_FILE_LEN - sizeof(keystore_irks)) {
+        return -1;
     }
 
     memcpy(&keystore_num_entries, file, sizeof(keystore_num_entries));
     memcpy(keystore_entries, file + sizeof(keystore_num_entries),
             sizeof(keystore_entries));
 
-    if (keystore_num_entries > KEYSTORE_MAX_ENTRIES)
+    // files from before IRKs were kept end here
+    memset(keystore_irks, 0, sizeof(keystore_irks));
+    if (len == KEYSTORE_FILE_LEN) {
+        memcpy(keystore_irks, file + KEYSTORE_FILE_LEN - sizeof(keystore_irks),
+               sizeof(keystore_irks));
+    }
+
+    if (keystore_num_entries < 0 ||
+        keystore_num_entries > KEYSTORE_MAX_ENTRIES)
     {
         return -1;
     }
@@ -161,20 +437,55 @@ keystore_load(void) {
 }
 
 /**
- * Save the keystore to NFFS.
+ * Copies the keystore into the state kept across a warm boot.
+ */
+static void
+keystore_retain(void)
+{
+    unsigned char file[KEYSTORE_FILE_LEN];
+
+    keystore_pack(file);
+    RETAIN_SET(keystore, file);
+}
+
+/**
+ * Load the keystore from NFFS.
+ *
+ * @return                      0 on success; -1 or fs error on failure
+ */
+static int
+keystore_load(void) {
+    int rc;
+    uint32_t len;
+    unsigned char file[KEYSTORE_FILE_LEN];
+
+    rc = fsutil_read_file(KEYSTORE_FILE, 0, sizeof(file), file, &len);
+    if (rc != 0) {
+        return rc;
+    }
+
+    return keystore_unpack(file, len);
+}
+
+/**
+ * Save the keystore to NFFS, and to the copy kept across a warm boot
+ * first, so that copy is never the older one.
  *
  * @return                      0 on success; fs error on failure
  */
 static int
 keystore_save(void) {
     int rc;
-    unsigned char file[sizeof(keystore_num_entries) + sizeof(keystore_entries)];
+    unsigned char file[KEYSTORE_FILE_LEN];
 
-    memcpy(file, &keystore_num_entries, sizeof(keystore_num_entries));
-    memcpy(file + sizeof(keystore_num_entries),
-            keystore_entries, sizeof(keystore_entries));
+    keystore_pack(file);
+    keystore_retain();
 
-    // save keys
+    // save keys; NFFS isn't mounted until advertising is up after a warm boot
+    quacker_fs_wait();
+    TRACE(FLASH_BEGIN, TRACE_FLASH_KEYSTORE);
     rc = fsutil_write_file(KEYSTORE_FILE, file, sizeof(file));
+    TRACE(FLASH_END, TRACE_FLASH_KEYSTORE);
+    quacker_stats.flash_writes++;
     return rc;
 }
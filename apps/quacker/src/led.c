@@ -17,8 +17,10 @@
 #include <ctype.h>
 #include <stdint.h>
 
+#include "bsp/bsp.h"
 #include "os/os.h"
 #include "hal/hal_gpio.h"
+#include "quacker.h"
 
 // speedhack
 #include "mcu/nrf51.h"
@@ -122,7 +124,7 @@ led_scroll(char *message)
     uint16_t display = 0;
     char *next;
 
-#define SHOW NRF_GPIO->OUTCLR = ~display & 0x3fff; NRF_GPIO->OUTSET = display; os_time_delay(500)
+#define SHOW NRF_GPIO->OUTCLR = ~display & 0x3fff; NRF_GPIO->OUTSET = display; TRACE(LED_FRAME, 0); os_time_delay(bsp_coalesce_ticks(500))
 
     SHOW;
     for (next = message; *next; ++next) {
@@ -168,7 +170,8 @@ led_spinner(void)
         next = (state + 1) % (sizeof(led_order) / sizeof(int));
         hal_gpio_clear(led_order[state]);
         hal_gpio_set(led_order[next]);
-        os_time_delay(100);
+        TRACE(LED_FRAME, 1);
+        os_time_delay(bsp_coalesce_ticks(100));
         state = next;
     } while (state > 0);
 }
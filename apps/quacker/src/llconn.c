@@ -0,0 +1,106 @@
+/**
+ * Copyright 2016 ICE9 Consulting
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+/**
+ * The app's one window into the link layer's connection state.
+ *
+ * The host API has no way to ask when a connection's next event is, so this
+ * reads it from the controller's connection state machine.  Nothing else in
+ * the app includes controller headers; if the controller changes, only this
+ * file has to follow.
+ */
+
+#include <stdint.h>
+
+#include "os/os.h"
+#include "host/ble_hs.h"
+#include "controller/ble_ll_conn.h"
+
+#include "quacker.h"
+
+/* Not in the controller's public headers. */
+struct ble_ll_conn_sm *ble_ll_conn_find_active_conn(uint16_t handle);
+
+/**
+ * Reads a connection's anchor point and interval.  The anchor is the one the
+ * link layer has scheduled: the next connection event, or the current one
+ * while it is in progress.  Safe to call from an interrupt.
+ *
+ * @param out_anchor            The anchor point, in cputime (usec).
+ * @param out_itvl              The connection interval, in usec.
+ *
+ * @return                      0 on success; BLE_HS_ENOTCONN if the link
+ *                                  layer has no such connection.
+ */
+int
+llconn_timing(uint16_t conn_handle, uint32_t *out_anchor, uint32_t *out_itvl)
+{
+    struct ble_ll_conn_sm *connsm;
+    uint32_t anchor;
+    uint32_t itvl;
+    os_sr_t sr;
+
+    /* The link layer moves the anchor from its interrupt. */
+    OS_ENTER_CRITICAL(sr);
+    connsm = ble_ll_conn_find_active_conn(conn_handle);
+    if (connsm != NULL) {
+        anchor = connsm->anchor_point;
+        itvl = connsm->conn_itvl * 1250;
+    }
+    OS_EXIT_CRITICAL(sr);
+
+    if (connsm == NULL || itvl == 0) {
+        return BLE_HS_ENOTCONN;
+    }
+
+    *out_anchor = anchor;
+    *out_itvl = itvl;
+    return 0;
+}
+
+/**
+ * Returns how long before t the connection's most recent anchor point was,
+ * in [0, interval).
+ *
+ * @return                      0 on success; BLE_HS_ENOTCONN if the link
+ *                                  layer has no such connection.
+ */
+int
+llconn_since_anchor(uint16_t conn_handle, uint32_t t, uint32_t *out_usec)
+{
+    uint32_t anchor;
+    uint32_t itvl;
+    uint32_t ahead;
+    int rc;
+
+    rc = llconn_timing(conn_handle, &anchor, &itvl);
+    if (rc != 0) {
+        return rc;
+    }
+
+    if ((int32_t)(t - anchor) >= 0) {
+        *out_usec = (t - anchor) % itvl;
+    } else {
+        ahead = (anchor - t) % itvl;
+        *out_usec = ahead == 0 ? 0 : itvl - ahead;
+    }
+    return 0;
+}
@@ -18,7 +18,6 @@
  * specific language governing permissions and limitations
  * under the License.
  */
-#include <assert.h>
 #include <string.h>
 #include <stdio.h>
 #include <errno.h>
@@ -34,9 +33,14 @@
 #include "fs/fs.h"
 #include "fs/fsutil.h"
 #include "nffs/nffs.h"
+#include "bsp/cmsis_nvic.h"
+#include "mcu/nrf51.h"
+#include "mcu/nrf51_bitfields.h"
 
 /* BLE */
 #include "nimble/ble.h"
+#include "nimble/nimble_opt.h"
+#include "nimble/hci_common.h"
 #include "host/host_hci.h"
 #include "host/ble_hs.h"
 #include "host/ble_hs_adv.h"
@@ -55,9 +59,27 @@ enum orientation_t orientation;
 
 #define BSWAP16(x)  ((uint16_t)(((x) << 8) | (((x) & 0xff00) >> 8)))
 
-/** Mbuf settings. */
-#define MBUF_NUM_MBUFS      (12)
+/** ATT MTU requested on every connection.  At the default of 23 the report
+ * map takes a chain of Read Blob round trips; with a larger MTU it goes out
+ * in one read, as does the rest of discovery.
+ */
+#ifndef QUACKER_ATT_MTU
+#define QUACKER_ATT_MTU     BLE_ATT_MTU_MAX
+#endif
+
+#if NIMBLE_OPT_MAX_CONNECTIONS < QUACKER_MAX_CONNS
+#error "the controller supports fewer than QUACKER_MAX_CONNS connections"
+#endif
+
+/** Mbuf settings.  Each connection gets four mbufs for notifications in
+ * flight plus room for a full-MTU ATT PDU (and its L2CAP header) in each
+ * direction, on top of a shared base.
+ */
 #define MBUF_BUF_SIZE       OS_ALIGN(BLE_MBUF_PAYLOAD_SIZE, 4)
+#define MBUF_PER_ATT_PDU    ((QUACKER_ATT_MTU + BLE_L2CAP_HDR_SZ + \
+                              MBUF_BUF_SIZE - 1) / MBUF_BUF_SIZE)
+#define MBUF_PER_CONN       (4 + 2 * MBUF_PER_ATT_PDU)
+#define MBUF_NUM_MBUFS      (6 + QUACKER_MAX_CONNS * MBUF_PER_CONN)
 #define MBUF_MEMBLOCK_SIZE  (MBUF_BUF_SIZE + BLE_MBUF_MEMBLOCK_OVERHEAD)
 #define MBUF_MEMPOOL_SIZE   OS_MEMPOOL_SIZE(MBUF_NUM_MBUFS, MBUF_MEMBLOCK_SIZE)
 
@@ -66,7 +88,7 @@ struct os_mbuf_pool quacker_mbuf_pool;
 struct os_mempool quacker_mbuf_mpool;
 
 /** Log data. */
-static struct log_handler quacker_log_console_handler;
+static struct log_handler quacker_log_handler;
 struct log quacker_log;
 
 /** Priority of the nimble host and controller tasks. */
@@ -88,6 +110,16 @@ struct log quacker_log;
 #define ACCEL_TASK_PRIO             4
 #define ACCEL_STACK_SIZE            (OS_STACK_ALIGN(128))
 
+/** Drains the deferred log; runs after everything else. */
+#define QLOG_TASK_PRIO              5
+#define QLOG_STACK_SIZE             (OS_STACK_ALIGN(112))
+
+/** Programs firmware updates; below even the log, since every flash erase
+ * stalls the CPU.  The stack holds a SHA-256 context and its schedule.
+ */
+#define OTA_TASK_PRIO               6
+#define OTA_STACK_SIZE              (OS_STACK_ALIGN(192))
+
 struct os_eventq quacker_evq;
 struct os_task quacker_task;
 bssnz_t os_stack_t quacker_stack[QUACKER_STACK_SIZE];
@@ -105,6 +137,12 @@ bssnz_t os_stack_t power_led_stack[POWER_LED_STACK_SIZE];
 struct os_task accel_task;
 bssnz_t os_stack_t accel_stack[ACCEL_STACK_SIZE];
 
+struct os_task qlog_task;
+bssnz_t os_stack_t qlog_stack[QLOG_STACK_SIZE];
+
+struct os_task ota_task;
+bssnz_t os_stack_t ota_stack[OTA_STACK_SIZE];
+
 /** Our global device address (public) */
 uint8_t g_dev_addr[BLE_DEV_ADDR_LEN] = {0x0a, 0x0a, 0x0a, 0x0a, 0x0a, 0x0a};
 
@@ -116,59 +154,204 @@ const char *quacker_device_name = "Slide Quacker";
 
 /** Device properties - exposed by GAP service. */
 const uint16_t quacker_appearance = 961; // BSWAP16(961); // HID keyboard
+#ifdef QUACKER_PRIVACY
+const uint8_t quacker_privacy_flag = 1;
+#else
 const uint8_t quacker_privacy_flag = 0;
+#endif
 uint8_t quacker_reconnect_addr[6];
 uint8_t quacker_pref_conn_params[8];
 uint8_t quacker_gatt_service_changed[4];
 
+void *_sbrk(int incr);
+
 static int _nffs_init(void);
 static int load_orientation(void);
 static int save_orientation(void);
+static void quacker_fs_verify(void);
+static void quacker_boot_cold(void);
 
 static int quacker_gap_event(int event, int status,
                              struct ble_gap_conn_ctxt *ctxt, void *arg);
 
+/** Power management. */
+#ifndef QUACKER_SLEEP_IDLE_SEC
+#define QUACKER_SLEEP_IDLE_SEC      (15 * 60)
+#endif
+#define QUACKER_SLEEP_CHECK_SEC     30
+
+/* The watchdog resets the badge if the idle task doesn't run for this long,
+ * or if two sleep checks in a row are missed.
+ */
+#ifndef QUACKER_WDT_MSEC
+#define QUACKER_WDT_MSEC            4000
+#endif
+#define QUACKER_WDT_CHECKIN_TICKS   \
+    ((2 * QUACKER_SLEEP_CHECK_SEC + 1) * OS_TICKS_PER_SEC)
+
+/* Advertise fast for a while after boot, wakeup or disconnect so the host
+ * reconnects quickly, then back off.  Units of 0.625 ms.
+ */
+#define QUACKER_ADV_FAST_SEC        30
+#define QUACKER_ADV_ITVL_FAST       (30 * 1000 / BLE_HCI_ADV_ITVL)
+#define QUACKER_ADV_ITVL_SLOW       (1000 * 1000 / BLE_HCI_ADV_ITVL)
+
+/* With QUACKER_PRIVACY, every advertising start gets a new address, and
+ * advertising that runs this long is restarted to get one.
+ */
+#ifndef QUACKER_RPA_SEC
+#define QUACKER_RPA_SEC             (15 * 60)
+#endif
+
+/* Faults since the last cold boot after which the retained state is
+ * dropped; state that keeps crashing the badge doesn't survive the reset.
+ */
+#ifndef QUACKER_WARM_FAULTS_MAX
+#define QUACKER_WARM_FAULTS_MAX     3
+#endif
+
+static struct os_callout_func quacker_adv_callout;
+#ifdef QUACKER_PRIVACY
+static struct os_callout_func quacker_rpa_callout;
+#endif
+static struct os_callout_func quacker_sleep_callout;
+static os_time_t quacker_last_activity;
+static int quacker_num_conns;
+static int quacker_ever_connected;
+static int quacker_woke_from_off;
+static int quacker_fault_boot;          /* Recovering from a fault. */
+static int quacker_warm_boot;           /* State kept; see retain.c. */
+int quacker_fs_ready;
+static int quacker_advertising;
+static int quacker_adv_fast;
+static int quacker_adv_first = 1;
+
 /**
- * Utility function to log an array of bytes.
+ * Logs information about a connection.  This runs from GAP event callbacks,
+ * so it uses the deferred log.
  */
 static void
-quacker_print_bytes(uint8_t *bytes, int len)
+quacker_print_conn_desc(struct ble_gap_conn_desc *desc)
 {
-    int i;
+    QUACKER_LOG_FAST("  handle=%d peer_addr_type=%d "
+                     "peer_addr=%02x:%02x:%02x:%02x:%02x:%02x\n",
+                     desc->conn_handle, desc->peer_addr_type,
+                     desc->peer_addr[0], desc->peer_addr[1],
+                     desc->peer_addr[2], desc->peer_addr[3],
+                     desc->peer_addr[4], desc->peer_addr[5]);
+    QUACKER_LOG_FAST("  conn_itvl=%d conn_latency=%d supervision_timeout=%d "
+                     "encrypted=%d authenticated=%d\n",
+                     desc->conn_itvl,
+                     desc->conn_latency,
+                     desc->supervision_timeout,
+                     desc->sec_state.enc_enabled,
+                     desc->sec_state.authenticated);
+}
+
+/**
+ * Keeps the last host to connect, and its connection parameters, across a
+ * warm boot.  When that host is the first back after one, it gets the
+ * parameters it had before the reset rather than the stack's defaults.
+ *
+ * @param up                    A new connection, rather than new parameters
+ *                                  for one; only the last host's count.
+ */
+static void
+quacker_retain_peer(struct ble_gap_conn_desc *desc, int up)
+{
+    struct ble_gap_upd_params params;
+    const struct retain_peer *last;
+    struct retain_peer peer;
+    uint64_t rand_num;
+    uint16_t ediv;
+    int bonded;
+    int same;
+    int rc;
+
+    /* A bonded host is known by its bond; a private address changes. */
+    bonded = gatt_svr_conn_identity(desc->conn_handle, &ediv,
+                                    &rand_num) == 0;
+    last = &retain_get()->peer;
+    if (!last->valid) {
+        same = 0;
+    } else if (last->bonded && bonded) {
+        same = last->ediv == ediv && last->rand_num == rand_num;
+    } else {
+        same = last->addr_type == desc->peer_addr_type &&
+               memcmp(last->addr, desc->peer_addr, sizeof last->addr) == 0;
+    }
+
+    if (!up && !same) {
+        return;
+    }
+
+    if (up && !quacker_ever_connected && quacker_warm_boot && same) {
+        QUACKER_LOG_FAST("warm: last peer back %lu ms after reset\n",
+                         (unsigned long)os_time_get() * 1000 /
+                         OS_TICKS_PER_SEC);
+
+        if (desc->conn_itvl != last->conn_itvl ||
+            desc->conn_latency != last->conn_latency ||
+            desc->supervision_timeout != last->supervision_timeout) {
+
+            memset(&params, 0, sizeof params);
+            params.itvl_min = last->conn_itvl;
+            params.itvl_max = last->conn_itvl;
+            params.latency = last->conn_latency;
+            params.supervision_timeout = last->supervision_timeout;
+            rc = ble_gap_update_params(desc->conn_handle, &params);
+            if (rc != 0) {
+                QUACKER_LOG_FAST("warm: conn params not restored; rc=%d\n",
+                                 rc);
+            }
+            return;
+        }
+    }
 
-    for (i = 0; i < len; i++) {
-        QUACKER_LOG(INFO, "%s0x%02x", i != 0 ? ":" : "", bytes[i]);
+    memset(&peer, 0, sizeof peer);
+    peer.valid = 1;
+    peer.addr_type = desc->peer_addr_type;
+    memcpy(peer.addr, desc->peer_addr, sizeof peer.addr);
+    if (bonded) {
+        peer.bonded = 1;
+        peer.ediv = ediv;
+        peer.rand_num = rand_num;
     }
+    peer.conn_itvl = desc->conn_itvl;
+    peer.conn_latency = desc->conn_latency;
+    peer.supervision_timeout = desc->supervision_timeout;
+    RETAIN_SET(peer, &peer);
 }
 
 /**
- * Logs information about a connection to the console.
+ * Called when an MTU exchange completes.
  */
-static void
-quacker_print_conn_desc(struct ble_gap_conn_desc *desc)
+static int
+quacker_mtu_cb(uint16_t conn_handle, struct ble_gatt_error *error,
+               uint16_t mtu, void *arg)
 {
-    QUACKER_LOG(INFO, "handle=%d peer_addr_type=%d peer_addr=",
-                desc->conn_handle,
-                desc->peer_addr_type);
-    quacker_print_bytes(desc->peer_addr, 6);
-    QUACKER_LOG(INFO, " conn_itvl=%d conn_latency=%d supervision_timeout=%d "
-                      "encrypted=%d authenticated=%d",
-                desc->conn_itvl,
-                desc->conn_latency,
-                desc->supervision_timeout,
-                desc->sec_state.enc_enabled,
-                desc->sec_state.authenticated);
+    if (error != NULL) {
+        QUACKER_LOG_FAST("mtu exchange failed; status=%d\n", error->status);
+    } else {
+        QUACKER_LOG_FAST("mtu=%d\n", mtu);
+    }
+
+    return 0;
 }
 
 /**
  * Enables advertising with the following parameters:
  *     o General discoverable mode.
  *     o Undirected connectable mode.
+ *     o 30 ms interval if fast is set; 1 s otherwise.  Fast advertising drops
+ *       to slow after QUACKER_ADV_FAST_SEC.
  */
 static void
-quacker_advertise(void)
+quacker_advertise(int fast)
 {
     struct ble_hs_adv_fields fields;
+    struct hci_adv_params params;
+    uint32_t usec;
     int rc;
 
     /**
@@ -200,14 +383,96 @@ quacker_advertise(void)
         return;
     }
 
+    memset(&params, 0, sizeof params);
+    params.adv_itvl_min = fast ? QUACKER_ADV_ITVL_FAST : QUACKER_ADV_ITVL_SLOW;
+    params.adv_itvl_max = params.adv_itvl_min;
+#ifdef QUACKER_PRIVACY
+    /* The controller advertises from g_random_addr. */
+    if (rpa_local_addr(g_random_addr) == 0) {
+        params.own_addr_type = BLE_HCI_ADV_OWN_ADDR_RANDOM;
+    } else {
+        QUACKER_LOG(INFO, "no irk yet; advertising the public address\n");
+        params.own_addr_type = BLE_HCI_ADV_OWN_ADDR_PUBLIC;
+    }
+#else
+    params.own_addr_type = BLE_HCI_ADV_OWN_ADDR_PUBLIC;
+#endif
+    params.adv_channel_map = BLE_HCI_ADV_CHANMASK_DEF;
+    params.adv_filter_policy = BLE_HCI_ADV_FILT_NONE;
+
     /* Begin advertising. */
     rc = ble_gap_adv_start(BLE_GAP_DISC_MODE_GEN, BLE_GAP_CONN_MODE_UND,
-                           NULL, 0, NULL, quacker_gap_event, NULL);
+                           NULL, 0, &params, quacker_gap_event, NULL);
     if (rc != 0) {
         QUACKER_LOG(ERROR, "error enabling advertisement; rc=%d\n", rc);
         return;
     }
+
+    quacker_advertising = 1;
+    quacker_adv_fast = fast;
+#ifdef QUACKER_PRIVACY
+    os_callout_reset(&quacker_rpa_callout.cf_c,
+                     bsp_coalesce_ticks(QUACKER_RPA_SEC * OS_TICKS_PER_SEC));
+#endif
+    if (fast) {
+        os_callout_reset(&quacker_adv_callout.cf_c,
+                         QUACKER_ADV_FAST_SEC * OS_TICKS_PER_SEC);
+    }
+
+    if (quacker_adv_first) {
+        /* cputime starts early in main(), so this covers everything but the
+         * reset vector and os_init().
+         */
+        usec = cputime_get32();
+        QUACKER_LOG(INFO, "connectable %lu usec after %s\n",
+                    (unsigned long)usec,
+                    quacker_fault_boot ? "fault" :
+                    quacker_woke_from_off ? "wakeup" : "reset");
+        fault_connectable(usec);
+
+        /* What skipping NFFS saves is the difference from a cold boot. */
+        if (quacker_warm_boot) {
+            QUACKER_LOG(INFO, "warm boot; last cold boot took %lu usec\n",
+                        (unsigned long)retain_get()->cold_adv_usec);
+        } else {
+            RETAIN_SET(cold_adv_usec, &usec);
+        }
+        quacker_adv_first = 0;
+    }
+}
+
+/**
+ * Drops from fast to slow advertising if nobody connected in time.
+ */
+static void
+quacker_adv_timeout(void *arg)
+{
+    if (!quacker_advertising || !quacker_adv_fast) {
+        return;
+    }
+
+    if (ble_gap_adv_stop() == 0) {
+        quacker_advertise(0);
+    }
+}
+
+#ifdef QUACKER_PRIVACY
+/**
+ * Restarts advertising, and so changes address, once QUACKER_RPA_SEC have
+ * passed on the current one.
+ */
+static void
+quacker_rpa_timeout(void *arg)
+{
+    if (!quacker_advertising) {
+        return;
+    }
+
+    if (ble_gap_adv_stop() == 0) {
+        quacker_advertise(quacker_adv_fast);
+    }
 }
+#endif
 
 /**
  * The nimble host executes this callback when a GAP event occurs.  The
@@ -230,7 +495,10 @@ static int
 quacker_gap_event(int event, int status, struct ble_gap_conn_ctxt *ctxt,
                   void *arg)
 {
+    uint64_t rand_num;
+    uint16_t ediv;
     int authenticated;
+    int identified;
     int rc;
 
     switch (event) {
@@ -238,22 +506,68 @@ quacker_gap_event(int event, int status, struct ble_gap_conn_ctxt *ctxt,
         /* A new connection has been established or an existing one has been
          * terminated.
          */
-        QUACKER_LOG(INFO, "connection %s; status=%d ",
-                    status == 0 ? "up" : "down", status);
+        QUACKER_LOG_FAST("connection %s; status=%d\n",
+                         status == 0 ? "up" : "down", status);
         quacker_print_conn_desc(ctxt->desc);
-        QUACKER_LOG(INFO, "\n");
 
-        if (status != 0) {
-            /* Connection terminated; resume advertising. */
-            quacker_advertise();
+        if (status == 0) {
+            /* Which bond a host with a private address is, before anything
+             * goes by its identity; resolution logs its cost.
+             */
+            identified =
+                rpa_is_resolvable(ctxt->desc->peer_addr_type,
+                                  ctxt->desc->peer_addr) &&
+                rpa_resolve(ctxt->desc->peer_addr, &ediv, &rand_num) == 0;
+            if (identified) {
+                QUACKER_LOG_FAST("peer is bonded; ediv=0x%02x\n", ediv);
+            }
+            gatt_svr_conn_up(ctxt->desc, identified, ediv, rand_num);
+
+            quacker_retain_peer(ctxt->desc, 1);
+            if (quacker_ever_connected) {
+                quacker_stats.reconnects++;
+                quacker_stats.last_reconnect = os_time_get() / OS_TICKS_PER_SEC;
+            }
+            quacker_ever_connected = 1;
+            quacker_num_conns++;
+
+            /* Fresh rand() state; pairing draws from the pool itself. */
+            entropy_reseed();
+            quacker_advertising = 0;
+
+#ifdef QUACKER_BENCH
+            bench_conn_up();
+#endif
+
+            /* Get the MTU up before the host starts discovery.  Hosts that
+             * send their own exchange first make this a no-op.
+             */
+            rc = ble_gattc_exchange_mtu(ctxt->desc->conn_handle,
+                                        quacker_mtu_cb, NULL);
+            if (rc != 0) {
+                QUACKER_LOG_FAST("mtu exchange not started; rc=%d\n", rc);
+            }
+        } else if (gatt_svr_conn_down(ctxt->desc->conn_handle) == 0) {
+            /* A failed connection attempt was never counted. */
+            quacker_num_conns--;
+        }
+
+        quacker_activity();
+
+        /* Stay connectable for the next host until every slot is taken. */
+        if (quacker_num_conns < QUACKER_MAX_CONNS && !quacker_advertising) {
+            quacker_advertise(1);
         }
         return 0;
 
     case BLE_GAP_EVENT_CONN_UPDATED:
         /* The central has updated the connection parameters. */
-        QUACKER_LOG(INFO, "connection updated; status=%d ", status);
+        QUACKER_LOG_FAST("connection updated; status=%d\n", status);
         quacker_print_conn_desc(ctxt->desc);
-        QUACKER_LOG(INFO, "\n");
+        if (status == 0) {
+            quacker_retain_peer(ctxt->desc, 0);
+            gatt_svr_conn_updated(ctxt->desc);
+        }
         return 0;
 
     case BLE_GAP_EVENT_LTK_REQUEST:
@@ -261,8 +575,10 @@ quacker_gap_event(int event, int status, struct ble_gap_conn_ctxt *ctxt,
          * stack is asking us to look in our key database for a long-term key
          * corresponding to the specified ediv and random number.
          */
-        QUACKER_LOG(INFO, "looking up ltk with ediv=0x%02x rand=0x%llx\n",
-                    ctxt->ltk_params->ediv, ctxt->ltk_params->rand_num);
+        QUACKER_LOG_FAST("looking up ltk with ediv=0x%02x rand=0x%llx\n",
+                         ctxt->ltk_params->ediv,
+                         (uint32_t)ctxt->ltk_params->rand_num,
+                         (uint32_t)(ctxt->ltk_params->rand_num >> 32));
 
         /* Perform a key lookup and populate the context object with the
          * result.  The nimble stack will use this key if this function returns
@@ -272,13 +588,18 @@ quacker_gap_event(int event, int status, struct ble_gap_conn_ctxt *ctxt,
                              ctxt->ltk_params->rand_num, ctxt->ltk_params->ltk,
                              &authenticated);
         if (rc == 0) {
+            gatt_svr_conn_ltk(ctxt->desc->conn_handle,
+                              ctxt->ltk_params->ediv,
+                              ctxt->ltk_params->rand_num);
+#ifdef QUACKER_BENCH
+            bench_ltk_found();
+#endif
+
             ctxt->ltk_params->authenticated = authenticated;
-            QUACKER_LOG(INFO, "ltk=");
-            quacker_print_bytes(ctxt->ltk_params->ltk,
-                                sizeof ctxt->ltk_params->ltk);
-            QUACKER_LOG(INFO, " authenticated=%d\n", authenticated);
+            QUACKER_LOG_FAST("ltk found; authenticated=%d\n",
+                             authenticated);
         } else {
-            QUACKER_LOG(INFO, "no matching ltk\n");
+            QUACKER_LOG_FAST("no matching ltk\n");
         }
 
         /* Indicate whether we were able to find an appropriate key. */
@@ -300,21 +621,102 @@ quacker_gap_event(int event, int status, struct ble_gap_conn_ctxt *ctxt,
                               ctxt->desc->sec_state.authenticated);
             if (rc != 0) {
                 QUACKER_LOG(INFO, "error persisting LTK; status=%d\n", rc);
+            } else {
+                gatt_svr_conn_bonded(ctxt->desc->conn_handle,
+                                     ctxt->key_params->ediv,
+                                     ctxt->key_params->rand_val);
             }
         }
+
+        /* The host's identity resolving key, for rpa_resolve(). */
+        if (!ctxt->key_params->is_ours && ctxt->key_params->irk_valid) {
+            gatt_svr_conn_irk(ctxt->desc->conn_handle,
+                              ctxt->key_params->irk);
+        }
         return 0;
 
     case BLE_GAP_EVENT_SECURITY:
         /* Encryption has been enabled or disabled for this connection. */
-        QUACKER_LOG(INFO, "security event; status=%d ", status);
+        QUACKER_LOG_FAST("security event; status=%d\n", status);
         quacker_print_conn_desc(ctxt->desc);
-        QUACKER_LOG(INFO, "\n");
+
+        if (status == 0 && ctxt->desc->sec_state.enc_enabled) {
+            gatt_svr_conn_encrypted(ctxt->desc->conn_handle);
+#ifdef QUACKER_BENCH
+            bench_encrypted();
+#endif
+        }
         return 0;
     }
 
     return 0;
 }
 
+/** Idle wakeup statistics are logged once a minute. */
+static struct os_callout_func quacker_idle_callout;
+
+static void
+quacker_idle_report(void *arg)
+{
+    QUACKER_LOG(INFO, "idle wakeups/min=%lu\n",
+                (unsigned long)bsp_idle_wakeups_per_min());
+    os_callout_reset(&quacker_idle_callout.cf_c,
+                     bsp_coalesce_ticks(60 * OS_TICKS_PER_SEC));
+}
+
+/**
+ * Records user or host activity, postponing System OFF.
+ */
+void
+quacker_activity(void)
+{
+    quacker_last_activity = os_time_get();
+}
+
+/**
+ * Saves state and powers the badge down.  Only a button press brings it
+ * back, via a reset.
+ */
+static void
+quacker_system_off(void)
+{
+    static const int button[] = { BUTTON1, BUTTON2 };
+    static const int released[] = { 1, 1 };
+
+    QUACKER_LOG(INFO, "idle for %d s; powering off\n", QUACKER_SLEEP_IDLE_SEC);
+
+    ble_gap_adv_stop();
+    save_orientation();
+    accel_sleep();
+
+    /* Let the console drain. */
+    os_time_delay(OS_TICKS_PER_SEC / 10);
+
+    /* Pin levels are retained in System OFF. */
+    led_static("  ");
+    hal_gpio_clear(LED_EYE1);
+    hal_gpio_clear(LED_EYE2);
+
+    sense_system_off(button, released, 2);
+}
+
+static void
+quacker_sleep_check(void *arg)
+{
+    bsp_watchdog_checkin(QUACKER_WDT_CHECKIN_TICKS);
+
+    if (quacker_num_conns == 0 &&
+        os_time_get() - quacker_last_activity >=
+            QUACKER_SLEEP_IDLE_SEC * OS_TICKS_PER_SEC) {
+
+        quacker_system_off();
+    }
+
+    os_callout_reset(&quacker_sleep_callout.cf_c,
+                     bsp_coalesce_ticks(QUACKER_SLEEP_CHECK_SEC *
+                                        OS_TICKS_PER_SEC));
+}
+
 /**
  * Event loop for the main quacker task.
  */
@@ -325,37 +727,77 @@ quacker_task_handler(void *unused)
     struct os_callout_func *cf;
     int rc;
 
+    /* The RNG has had all of init to fill the pool.  The controller still
+     * uses rand() for its own timing jitter; the host's random numbers come
+     * from the pool (see entropy.c).
+     */
+    entropy_reseed();
+
     rc = ble_hs_start();
-    assert(rc == 0);
+    QUACKER_ASSERT(rc == 0);
+
+    os_callout_func_init(&quacker_adv_callout, &quacker_evq,
+                         quacker_adv_timeout, NULL);
+#ifdef QUACKER_PRIVACY
+    os_callout_func_init(&quacker_rpa_callout, &quacker_evq,
+                         quacker_rpa_timeout, NULL);
+#endif
 
     /* Begin advertising. */
-    quacker_advertise();
+    quacker_advertise(1);
+
+    /* A warm boot left NFFS for now; see retain.c. */
+    if (!quacker_fs_ready) {
+        quacker_fs_verify();
+    }
+
+    quacker_activity();
+    bsp_watchdog_checkin(QUACKER_WDT_CHECKIN_TICKS);
+    os_callout_func_init(&quacker_sleep_callout, &quacker_evq,
+                         quacker_sleep_check, NULL);
+    os_callout_reset(&quacker_sleep_callout.cf_c,
+                     QUACKER_SLEEP_CHECK_SEC * OS_TICKS_PER_SEC);
+
+    os_callout_func_init(&quacker_idle_callout, &quacker_evq,
+                         quacker_idle_report, NULL);
+    os_callout_reset(&quacker_idle_callout.cf_c, 60 * OS_TICKS_PER_SEC);
 
     while (1) {
         ev = os_eventq_get(&quacker_evq);
         switch (ev->ev_type) {
         case OS_EVENT_T_TIMER:
             cf = (struct os_callout_func *)ev;
-            assert(cf->cf_func);
+            QUACKER_ASSERT(cf->cf_func);
             cf->cf_func(CF_ARG(cf));
             break;
         default:
-            assert(0);
+            QUACKER_ASSERT(0);
             break;
         }
     }
 }
 
-// FIXME - find a better way to inject HID reports
-extern uint8_t gatt_svr_hid_report[8];
+/* The latency benchmark replays bounce waveforms in place of the pins. */
+#ifdef QUACKER_BENCH
+#define button_read(pin)        bench_button_read(pin)
+#define BUTTON_CAN_SLEEP        0
+#else
+#define button_read(pin)        hal_gpio_read(pin)
+#define BUTTON_CAN_SLEEP        1
+#endif
+
+static struct os_sem button_sem;
 
 static void
 button_task_handler(void *unused)
 {
-    static const uint8_t report_char[] = { 0x50, 0x4F }; // left and right
     static const int button[] = { BUTTON1, BUTTON2 };
     int state[] = { 1, 1 };
     int count[] = { 0, 0 };
+    uint32_t edge_time[2];
+    uint32_t left;
+    int settled;
+    int sends;
     int i;
 
 #define CHECK_MSEC 5
@@ -364,33 +806,90 @@ button_task_handler(void *unused)
 
     hal_gpio_init_out(LED_EYE1, 0);
 
-    hal_gpio_init_in(BUTTON1, GPIO_PULL_DOWN);
-    hal_gpio_init_in(BUTTON2, GPIO_PULL_DOWN);
+    /* The buttons switch to ground against external 2.2k pull-ups (R8, R9
+     * on the WIC2016 schematic).  An internal pull-up would only add a
+     * parallel path while the button is held, and a pull-down would fight
+     * the external one.
+     */
+    hal_gpio_init_in(BUTTON1, GPIO_PULL_NONE);
+    hal_gpio_init_in(BUTTON2, GPIO_PULL_NONE);
+
+    os_sem_init(&button_sem, 0);
 
     while (1) {
+        settled = 1;
         for (i = 0; i < 2; ++i) {
-            int val = hal_gpio_read(button[i]);
+            int val = button_read(button[i]);
+            /* The edge that sends the button's report may be confirmed a
+             * little early to catch a connection event; see anchor.c.
+             */
             if (state[i] == 0 && val > 0) {
                 ++count[i];
-                if (count[i] > PRESS_MSEC / CHECK_MSEC) {
-                    gatt_svr_hid_report[2] = 0x00;
-                    ble_gatts_chr_updated(0x21);
+                if (count[i] == 1) {
+                    edge_time[i] = cputime_get32();
+                }
+
+                sends = hid_button_waits(i);
+                left = (PRESS_MSEC / CHECK_MSEC + 1 - count[i]) *
+                       CHECK_MSEC * 1000;
+                if (count[i] > PRESS_MSEC / CHECK_MSEC ||
+                    (sends &&
+                     anchor_confirm_early(0, count[i] * CHECK_MSEC * 1000,
+                                          left, CHECK_MSEC * 1000))) {
+
+                    TRACE(DEBOUNCE, i << 4);
+                    hid_button(i, 0);
+                    if (sends) {
+                        anchor_edge(edge_time[i], left);
+                    }
                     hal_gpio_clear(LED_EYE1);
                     state[i] = 1;
                     count[i] = 0;
                 }
             } else if (state[i] == 1 && val == 0) {
                 ++count[i];
-                if (count[i] > RELEASE_MSEC / CHECK_MSEC) {
-                    gatt_svr_hid_report[2] = report_char[i];
-                    ble_gatts_chr_updated(0x21);
+                if (count[i] == 1) {
+                    edge_time[i] = cputime_get32();
+                }
+
+                sends = !hid_button_waits(i);
+                left = (RELEASE_MSEC / CHECK_MSEC + 1 - count[i]) *
+                       CHECK_MSEC * 1000;
+                if (count[i] > RELEASE_MSEC / CHECK_MSEC ||
+                    (sends &&
+                     anchor_confirm_early(1, count[i] * CHECK_MSEC * 1000,
+                                          left, CHECK_MSEC * 1000))) {
+
+                    TRACE(DEBOUNCE, i << 4 | 1);
+                    quacker_stats.keypresses++;
+                    hid_button(i, 1);
+                    if (sends) {
+                        anchor_edge(edge_time[i], left);
+                    }
+                    quacker_activity();
                     hal_gpio_set(LED_EYE1);
                     state[i] = 0;
                     count[i] = 0;
                 }
             }
+            if (val != state[i]) {
+                settled = 0;
+            }
+        }
+
+        /* Hold actions need the clock while a button is down. */
+        if (hid_poll(CHECK_MSEC)) {
+            settled = 0;
+        }
+
+        /* Only poll while a button is moving or being timed; otherwise sleep
+         * until an edge so an idle badge doesn't wake up 200 times a second.
+         */
+        if (settled && BUTTON_CAN_SLEEP) {
+            sense_wait(&button_sem, button, state, 2);
+        } else {
+            os_time_delay(OS_TICKS_PER_SEC / 200);
         }
-        os_time_delay(OS_TICKS_PER_SEC / 200);
     }
 }
 
@@ -403,17 +902,17 @@ led_task_handler(void *unused)
         case FLAT:
             led_scroll("FLAT");
             led_static("FL");
-            os_time_delay(5000);
+            os_time_delay(bsp_coalesce_ticks(5000));
             break;
         case UPRIGHT:
             led_scroll("UPRIGHT");
             led_static("UP");
-            os_time_delay(5000);
+            os_time_delay(bsp_coalesce_ticks(5000));
             break;
         case RUBBER:
             led_scroll("rubber");
             led_static("ru");
-            os_time_delay(5000);
+            os_time_delay(bsp_coalesce_ticks(5000));
             if ((rand() % 5) == 0)
                 led_scroll("dspill_is_odious");
             break;
@@ -438,19 +937,109 @@ power_led_task_handler(void *unused)
         hal_gpio_set(LED_EYE2);
         os_time_delay(OS_TICKS_PER_SEC / 30);
         hal_gpio_clear(LED_EYE2);
-        os_time_delay(3 * OS_TICKS_PER_SEC);
+        os_time_delay(bsp_coalesce_ticks(3 * OS_TICKS_PER_SEC));
     }
 }
 
+/* Samples without a tilt change before the accelerometer goes back to idle;
+ * comfortably longer than the classifier needs to settle.
+ */
+#define ACCEL_STREAM_SAMPLES    48
+
+/* How often to look for an accelerometer that didn't answer at boot. */
+#define ACCEL_RETRY_SEC         60
+
+static struct os_sem accel_sem;
+
 static void
 accel_task_handler(void *unused)
 {
-    // hal_i2c_init(0);
+    static const int accel_int[] = { ACCEL_INT };
+    static const int deasserted[] = { 1 };
+    struct accel_sample sample;
+    enum orientation_t o;
+    uint8_t last_tilt;
+    int streaming;
+    int quiet;
+    int rc;
+
+    os_sem_init(&accel_sem, 0);
+    hal_gpio_init_in(ACCEL_INT, GPIO_PULL_NONE);
+    orient_init();
+
+    /* Without it the buttons work as ever, and the orientation stays as
+     * saved until a host writes it.
+     */
+    rc = accel_init();
+    if (rc != 0) {
+        QUACKER_LOG(ERROR, "accelerometer not responding; rc=%d; "
+                           "orientation is manual\n", rc);
+        do {
+            os_time_delay(bsp_coalesce_ticks(ACCEL_RETRY_SEC *
+                                             OS_TICKS_PER_SEC));
+            rc = accel_init();
+        } while (rc != 0);
+        QUACKER_LOG(INFO, "accelerometer found\n");
+    }
+
+    /* Stream from the start so the boot posture gets classified. */
+    accel_set_streaming(1);
+    last_tilt = 0;
+    streaming = 1;
+    quiet = 0;
+
     while (1) {
-        os_time_delay(OS_TICKS_PER_SEC);
+        /* The part holds INT low until TILT is read. */
+        if (hal_gpio_read(ACCEL_INT) != 0) {
+            sense_wait(&accel_sem, accel_int, deasserted, 1);
+            continue;
+        }
+
+        rc = accel_read(&sample);
+        if (rc != 0) {
+            QUACKER_LOG(ERROR, "accelerometer read failed; rc=%d\n", rc);
+            continue;
+        }
+
+        if (!streaming) {
+            /* Activity: sample continuously until things settle. */
+            accel_set_streaming(1);
+            streaming = 1;
+            quiet = 0;
+            orient_reset(&sample);
+            continue;
+        }
+
+        o = orient_update(&sample);
+        if (o != NONE && o != orientation) {
+            QUACKER_LOG(INFO, "orientation %d -> %d\n", orientation, o);
+            set_orientation(o);
+        }
+
+        if (sample.tilt != last_tilt) {
+            QUACKER_LOG(DEBUG, "tilt=0x%02x x=%d y=%d z=%d\n",
+                        sample.tilt, sample.x, sample.y, sample.z);
+            last_tilt = sample.tilt;
+            quiet = 0;
+        } else if (++quiet >= ACCEL_STREAM_SAMPLES) {
+            accel_set_streaming(0);
+            streaming = 0;
+        }
     }
 }
 
+static void
+qlog_task_handler(void *unused)
+{
+    qlog_drain();
+}
+
+static void
+ota_task_handler(void *unused)
+{
+    ota_run();
+}
+
 /**
  * main
  *
@@ -464,22 +1053,34 @@ int
 main(void)
 {
     struct ble_hs_cfg cfg;
+    uint32_t resetreas;
     uint32_t seed;
+    char *heap;
     int rc;
     int i;
 
+    /* A button press out of System OFF comes in as a reset, and so does
+     * a fault; note which, then clear the latched reasons.
+     */
+    resetreas = NRF_POWER->RESETREAS;
+    NRF_POWER->RESETREAS = resetreas;
+    quacker_woke_from_off = (resetreas & POWER_RESETREAS_OFF_Msk) != 0;
+    quacker_fault_boot = fault_init(resetreas);
+
     g_dev_addr[0] = NRF_FICR->DEVICEADDRTYPE;
     memcpy(g_dev_addr, (void *)NRF_FICR->DEVICEADDR + 2, 6);
 
     /* Initialize OS */
     os_init();
+    fault_start(QUACKER_WDT_MSEC);
 
     /* Set cputime to count at 1 usec increments */
     rc = cputime_init(1000000);
-    assert(rc == 0);
+    QUACKER_ASSERT(rc == 0);
 
     /* Seed random number generator with least significant bytes of device
-     * address.
+     * address.  This only holds until the entropy pool has a few bytes; see
+     * quacker_task_handler().
      */
     seed = 0;
     for (i = 0; i < 4; ++i) {
@@ -487,30 +1088,57 @@ main(void)
         seed <<= 8;
     }
     srand(seed);
+    entropy_init();
 
     /* Initialize msys mbufs. */
     rc = os_mempool_init(&quacker_mbuf_mpool, MBUF_NUM_MBUFS,
                          MBUF_MEMBLOCK_SIZE, quacker_mbuf_mpool_data,
                          "quacker_mbuf_data");
-    assert(rc == 0);
+    QUACKER_ASSERT(rc == 0);
 
     rc = os_mbuf_pool_init(&quacker_mbuf_pool, &quacker_mbuf_mpool,
                            MBUF_MEMBLOCK_SIZE, MBUF_NUM_MBUFS);
-    assert(rc == 0);
+    QUACKER_ASSERT(rc == 0);
 
     rc = os_msys_register(&quacker_mbuf_pool);
-    assert(rc == 0);
+    QUACKER_ASSERT(rc == 0);
 
-    /* NFFS */
-    _nffs_init();
+    rc = hal_flash_init();
+    QUACKER_ASSERT(rc == 0);
 
     /* LEDs */
     led_init();
 
+    /* Pin-change wakeups (buttons, accelerometer) */
+    sense_init();
+
+    /* Initialize the console (for log output). */
+    rc = qcons_init();
+    QUACKER_ASSERT(rc == 0);
+
     /* Initialize the logging system. */
     log_init();
-    log_console_handler_init(&quacker_log_console_handler);
-    log_register("quacker", &quacker_log, &quacker_log_console_handler);
+    qcons_log_handler_init(&quacker_log_handler);
+    log_register("quacker", &quacker_log, &quacker_log_handler);
+    qlog_init();
+    fault_report();
+
+    /* NFFS, unless everything read from it survived the reset.  An update
+     * resets through fault_reset(), and the new image reads flash afresh.
+     */
+    quacker_warm_boot = retain_init(quacker_stats.fault_cause !=
+                                    FAULT_PLANNED);
+    if (!quacker_warm_boot) {
+        quacker_boot_cold();
+    } else if (fault_count() - retain_get()->cold_faults >=
+               QUACKER_WARM_FAULTS_MAX) {
+
+        QUACKER_LOG(ERROR, "retain: %lu faults since the last cold boot; "
+                           "dropped\n",
+                    (unsigned long)(fault_count() -
+                                    retain_get()->cold_faults));
+        quacker_boot_cold();
+    }
 
     os_task_init(&quacker_task, "quacker", quacker_task_handler,
                  NULL, QUACKER_TASK_PRIO, OS_WAIT_FOREVER,
@@ -532,55 +1160,109 @@ main(void)
                  NULL, ACCEL_TASK_PRIO, OS_WAIT_FOREVER,
                  accel_stack, ACCEL_STACK_SIZE);
 
-    /* Initialize the keystore */
-    rc = keystore_init();
-    assert(rc == 0);
+    os_task_init(&qlog_task, "qlog", qlog_task_handler,
+                 NULL, QLOG_TASK_PRIO, OS_WAIT_FOREVER,
+                 qlog_stack, QLOG_STACK_SIZE);
+
+    os_task_init(&ota_task, "ota", ota_task_handler,
+                 NULL, OTA_TASK_PRIO, OS_WAIT_FOREVER,
+                 ota_stack, OTA_STACK_SIZE);
+
+    /* Stack usage is reported in this order; see tools/quacker_stats.py. */
+    stats_task_register(&quacker_task);
+    stats_task_register(&button_task);
+    stats_task_register(&led_task);
+    stats_task_register(&power_led_task);
+    stats_task_register(&accel_task);
+    stats_task_register(&qlog_task);
+    stats_task_register(&ota_task);
+
+    /* Initialize the keystore.  A retained copy that doesn't unpack is not
+     * trusted over the file; the boot goes cold and reads it.
+     */
+    if (quacker_warm_boot && keystore_restore() != 0) {
+        quacker_boot_cold();
+    }
+    if (!quacker_warm_boot) {
+        rc = keystore_init();
+        QUACKER_ASSERT(rc == 0);
+    }
 
     /* Initialize the BLE LL */
     rc = ble_ll_init(BLE_LL_TASK_PRI, MBUF_NUM_MBUFS, BLE_MBUF_PAYLOAD_SIZE);
-    assert(rc == 0);
+    QUACKER_ASSERT(rc == 0);
 
     /* Initialize the BLE host. */
     cfg = ble_hs_cfg_dflt;
     cfg.max_hci_bufs = 3;
-    cfg.max_connections = 1;
-    cfg.max_attrs = 50;
+    cfg.max_connections = QUACKER_MAX_CONNS;
+    cfg.max_attrs = 60;
     cfg.max_services = 6;
-    cfg.max_client_configs = 10;
-    cfg.max_gattc_procs = 2;
-    cfg.max_l2cap_chans = 3;
-    cfg.max_l2cap_sig_procs = 1;
+    cfg.max_client_configs = 10 * QUACKER_MAX_CONNS;
+    cfg.max_gattc_procs = 2 * QUACKER_MAX_CONNS;
+    cfg.max_l2cap_chans = 3 * QUACKER_MAX_CONNS;
+    cfg.max_l2cap_sig_procs = QUACKER_MAX_CONNS;
     cfg.sm_bonding = 1;
     cfg.sm_our_key_dist = BLE_L2CAP_SM_PAIR_KEY_DIST_ENC;
-    cfg.sm_their_key_dist = BLE_L2CAP_SM_PAIR_KEY_DIST_ENC;
+    cfg.sm_their_key_dist = BLE_L2CAP_SM_PAIR_KEY_DIST_ENC |
+                            BLE_L2CAP_SM_PAIR_KEY_DIST_ID;
 
     /* Initialize eventq */
     os_eventq_init(&quacker_evq);
 
+    /* The host allocates its pools from the heap.  Building with another
+     * QUACKER_MAX_CONNS and comparing this line gives the cost of a
+     * connection.
+     */
+    heap = _sbrk(0);
     rc = ble_hs_init(&quacker_evq, &cfg);
-    assert(rc == 0);
+    QUACKER_ASSERT(rc == 0);
+    QUACKER_LOG(INFO, "ram: %d connections; host pools %d bytes, "
+                      "mbufs %d bytes\n",
+                QUACKER_MAX_CONNS, (int)((char *)_sbrk(0) - heap),
+                (int)sizeof quacker_mbuf_mpool_data);
+
+    rc = ble_att_set_preferred_mtu(QUACKER_ATT_MTU);
+    QUACKER_ASSERT(rc == 0);
+
+    stats_init(&quacker_evq, &quacker_mbuf_mpool);
+    ota_init(&quacker_evq);
+
+#ifdef QUACKER_BENCH
+    /* Not again after a fault, in case it was the benchmark's. */
+    if (!quacker_fault_boot) {
+        bench_init(&quacker_evq);
+    }
+#endif
+
+#ifdef QUACKER_TRACE
+    trace_init(&quacker_evq);
+#endif
 
     /* Initialize LED eventq */
     os_eventq_init(&led_evq);
 
-    /* Initialize the console (for log output). */
-    rc = console_init(NULL);
-    assert(rc == 0);
-
     /* orientation */
-    load_orientation();
-
+    if (quacker_warm_boot) {
+        set_orientation(retain_get()->orientation);
+    } else {
+        load_orientation();
+    }
 
     /* Register GATT attributes (services, characteristics, and
      * descriptors).
      */
     gatt_svr_init();
+    if (!quacker_warm_boot) {
+        gatt_svr_db_check();
+        retain_seal();
+    }
 
     /* Start the OS */
     os_start();
 
     /* os start should never return. If it does, this should be an error */
-    assert(0);
+    QUACKER_ASSERT(0);
 
     return 0;
 }
@@ -592,36 +1274,30 @@ _nffs_init(void)
     int rc;
     int cnt;
 
-    rc = hal_flash_init();
-    assert(rc == 0);
-
     rc = nffs_init();
-    assert(rc == 0);
+    QUACKER_ASSERT(rc == 0);
 
     cnt = NFFS_AREA_MAX;
     rc = flash_area_to_nffs_desc(FLASH_AREA_NFFS, &cnt, descs);
-    assert(rc == 0);
+    QUACKER_ASSERT(rc == 0);
     if (nffs_detect(descs) == FS_ECORRUPT) {
         rc = nffs_format(descs);
-        assert(rc == 0);
+        QUACKER_ASSERT(rc == 0);
     }
 
     return rc;
 }
 
-static int
-load_orientation(void)
+/**
+ * Sets the orientation and the string exposed over GATT.  The LED task
+ * notices the change and persists it.
+ */
+void
+set_orientation(enum orientation_t o)
 {
-    int rc;
     char *str;
 
-    rc = fsutil_read_file(ORIENTATION_FILE, 0, sizeof(orientation), &orientation, NULL);
-    if (rc != 0) {
-        // create a new file if necessary
-        rc = save_orientation();
-    }
-
-    switch (orientation) {
+    switch (o) {
     case FLAT:
         str = "flat";
         break;
@@ -633,19 +1309,104 @@ load_orientation(void)
         break;
     case NONE:
     default:
+        o = NONE;
         str = "none";
     }
+
+    orientation = o;
     strcpy(quacker_orientation, str);
+}
+
+static int
+load_orientation(void)
+{
+    int rc;
+
+    rc = fsutil_read_file(ORIENTATION_FILE, 0, sizeof(orientation), &orientation, NULL);
+    if (rc != 0) {
+        // create a new file if necessary
+        rc = save_orientation();
+    }
+
+    set_orientation(orientation);
+    RETAIN_SET(orientation, &orientation);
 
     return rc;
 }
 
+/**
+ * Reads state from flash rather than RAM: after a reset that lost RAM, or
+ * when the retained copy is not to be trusted.  Warm boots from here on
+ * count their faults from this one.
+ */
+static void
+quacker_boot_cold(void)
+{
+    uint32_t faults;
+
+    if (quacker_warm_boot) {
+        quacker_warm_boot = retain_init(0);
+    }
+
+    faults = fault_count();
+    RETAIN_SET(cold_faults, &faults);
+
+    _nffs_init();
+    quacker_fs_ready = 1;
+}
+
+/**
+ * Mounts NFFS after a warm boot, once advertising is up, and checks the
+ * files against the state main() took from RAM instead.
+ */
+static void
+quacker_fs_verify(void)
+{
+    enum orientation_t saved;
+    uint32_t start;
+    int rc;
+
+    start = cputime_get32();
+    _nffs_init();
+    quacker_fs_ready = 1;
+
+    keystore_verify();
+
+    rc = fsutil_read_file(ORIENTATION_FILE, 0, sizeof(saved), &saved, NULL);
+    if (rc != 0 || saved != orientation) {
+        save_orientation();
+    }
+
+    gatt_svr_db_check();
+
+    QUACKER_LOG(INFO, "warm: flash verified in %lu usec\n",
+                (unsigned long)(cputime_get32() - start));
+}
+
+/**
+ * Waits for NFFS to be mounted.  Only tasks other than quacker's can
+ * wait, since after a warm boot quacker's mounts it.
+ */
+void
+quacker_fs_wait(void)
+{
+    while (!quacker_fs_ready) {
+        os_time_delay(OS_TICKS_PER_SEC / 100);
+    }
+}
+
 static int
 save_orientation(void)
 {
     int rc;
 
+    RETAIN_SET(orientation, &orientation);
+
     // save keys
+    quacker_fs_wait();
+    TRACE(FLASH_BEGIN, TRACE_FLASH_ORIENTATION);
     rc = fsutil_write_file(ORIENTATION_FILE, &orientation, sizeof(orientation));
+    TRACE(FLASH_END, TRACE_FLASH_ORIENTATION);
+    quacker_stats.flash_writes++;
     return rc;
 }
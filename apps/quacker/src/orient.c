@@ -0,0 +1,178 @@
+/**
+ * Copyright 2016 ICE9 Consulting
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+/**
+ * Streaming orientation classifier.
+ *
+ * Each accelerometer sample goes through a single-pole low-pass filter kept
+ * in Q8 fixed point, then the filtered gravity vector is classified:
+ *
+ *     FLAT     Z carries gravity (lying on a table, either face).
+ *     UPRIGHT  Gravity along -Y (hanging from the lanyard, bill up).
+ *     RUBBER   Gravity along +Y or X (upside down or on its side).
+ *
+ * A posture has to clear ORIENT_ENTER to be picked and only loses out once
+ * it falls under ORIENT_EXIT, so noise near a boundary doesn't flap between
+ * two classes.  The result must then hold for ORIENT_STABLE_SAMPLES before
+ * it is reported.
+ *
+ * Cycle budget: the Cortex-M0 has no FPU and no divider, so the update is
+ * shifts, adds and compares only; no multiply or divide.  It must stay under
+ * ORIENT_BUDGET_NSEC per sample (160 cycles at 16 MHz); the QUACKER_BENCH
+ * build measures it at boot.
+ */
+
+#include <stdint.h>
+
+#include "quacker.h"
+
+/* MMA7660 at +/-1.5 g: 21.33 counts per g. */
+#define ORIENT_1G               21
+
+/* Filter coefficient: y += (x - y) >> ORIENT_SHIFT. */
+#define ORIENT_SHIFT            2
+
+/* Class thresholds, in Q8 counts (about 0.8 g and 0.6 g). */
+#define ORIENT_ENTER            ((ORIENT_1G * 4 / 5) << 8)
+#define ORIENT_EXIT             ((ORIENT_1G * 3 / 5) << 8)
+
+#define ORIENT_ABS(v)           ((v) < 0 ? -(v) : (v))
+
+/* One second at the streaming rate. */
+#define ORIENT_STABLE_SAMPLES   16
+
+static int32_t orient_fx;
+static int32_t orient_fy;
+static int32_t orient_fz;
+
+/* Class the filtered vector is in, and how long it has been there. */
+static enum orientation_t orient_class;
+static uint8_t orient_count;
+
+/* Last class that held for ORIENT_STABLE_SAMPLES. */
+static enum orientation_t orient_stable;
+
+/**
+ * Returns the component that defines the given class.  Positive values mean
+ * the vector is pointing the right way for it.
+ */
+static int32_t
+orient_strength(enum orientation_t class)
+{
+    int32_t ax;
+    int32_t ay;
+
+    switch (class) {
+    case FLAT:
+        return ORIENT_ABS(orient_fz);
+    case UPRIGHT:
+        return -orient_fy;
+    case RUBBER:
+        ax = ORIENT_ABS(orient_fx);
+        ay = orient_fy;
+        return ax > ay ? ax : ay;
+    case NONE:
+    default:
+        return 0;
+    }
+}
+
+static enum orientation_t
+orient_classify(void)
+{
+    enum orientation_t best;
+    int32_t best_str;
+    int32_t str;
+    int class;
+
+    /* Stick with the current class until it is clearly gone. */
+    if (orient_class != NONE &&
+        orient_strength(orient_class) >= ORIENT_EXIT) {
+        return orient_class;
+    }
+
+    best = NONE;
+    best_str = ORIENT_ENTER - 1;
+    for (class = FLAT; class <= RUBBER; class++) {
+        str = orient_strength(class);
+        if (str > best_str) {
+            best = class;
+            best_str = str;
+        }
+    }
+
+    return best;
+}
+
+/**
+ * Forgets everything, including the last stable result.
+ */
+void
+orient_init(void)
+{
+    orient_fx = orient_fy = orient_fz = 0;
+    orient_class = NONE;
+    orient_count = 0;
+    orient_stable = NONE;
+}
+
+/**
+ * Restarts the filter from the specified sample, e.g. when the accelerometer
+ * starts streaming after being idle.  The last stable result is kept.
+ */
+void
+orient_reset(const struct accel_sample *sample)
+{
+    orient_fx = (int32_t)sample->x << 8;
+    orient_fy = (int32_t)sample->y << 8;
+    orient_fz = (int32_t)sample->z << 8;
+    orient_class = NONE;
+    orient_count = 0;
+}
+
+/**
+ * Feeds one sample to the classifier.
+ *
+ * @return                      The current stable orientation; NONE until a
+ *                                  posture has held for a second.
+ */
+enum orientation_t
+orient_update(const struct accel_sample *sample)
+{
+    enum orientation_t class;
+
+    orient_fx += (((int32_t)sample->x << 8) - orient_fx) >> ORIENT_SHIFT;
+    orient_fy += (((int32_t)sample->y << 8) - orient_fy) >> ORIENT_SHIFT;
+    orient_fz += (((int32_t)sample->z << 8) - orient_fz) >> ORIENT_SHIFT;
+
+    class = orient_classify();
+    if (class != orient_class) {
+        orient_class = class;
+        orient_count = 0;
+    } else if (orient_count < ORIENT_STABLE_SAMPLES) {
+        orient_count++;
+        if (orient_count == ORIENT_STABLE_SAMPLES && class != NONE) {
+            orient_stable = class;
+        }
+    }
+
+    return orient_stable;
+}
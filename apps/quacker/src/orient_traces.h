@@ -0,0 +1,335 @@
+/**
+ * Copyright 2016 ICE9 Consulting
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+/* Generated by tools/orient_traces.py; edit the traces there. */
+
+#ifndef H_ORIENT_TRACES_
+#define H_ORIENT_TRACES_
+
+/**
+ * Fixed accelerometer traces for the orientation classifier, with the
+ * stable result each must end on.  Synthetic: each posture is held with
+ * +/-2 counts of seeded noise.  Included by the host test and by the
+ * QUACKER_BENCH timing run only.
+ */
+struct orient_trace {
+    const char *name;
+    const struct accel_sample *samples;
+    int num_samples;
+    enum orientation_t expect;
+};
+
+static const struct accel_sample orient_trace_flat[] = {
+    { 1, 2, 23, 0 },
+    { -2, -2, 23, 0 },
+    { -2, -2, 23, 0 },
+    { -2, -1, 20, 0 },
+    { -1, -1, 23, 0 },
+    { 1, -2, 19, 0 },
+    { -2, 1, 21, 0 },
+    { 1, 2, 23, 0 },
+    { 2, 0, 22, 0 },
+    { -1, 0, 23, 0 },
+    { 1, 2, 20, 0 },
+    { 1, 0, 22, 0 },
+    { -1, -2, 22, 0 },
+    { 1, 1, 23, 0 },
+    { 2, -1, 20, 0 },
+    { -2, -1, 22, 0 },
+    { 2, -2, 21, 0 },
+    { -2, 1, 20, 0 },
+    { 1, -2, 21, 0 },
+    { -2, -2, 19, 0 },
+    { -1, 2, 22, 0 },
+    { -1, 1, 23, 0 },
+    { 1, 0, 23, 0 },
+    { -1, -2, 22, 0 },
+    { -1, 0, 19, 0 },
+    { -1, -2, 22, 0 },
+    { 0, 0, 22, 0 },
+    { 1, 2, 19, 0 },
+    { 1, -2, 21, 0 },
+    { 1, 2, 21, 0 },
+    { 0, 0, 19, 0 },
+    { -2, 1, 20, 0 },
+    { 0, 1, 20, 0 },
+    { -2, -1, 20, 0 },
+    { -1, -1, 20, 0 },
+    { 2, -2, 21, 0 },
+    { 2, 0, 19, 0 },
+    { -1, 2, 23, 0 },
+    { -1, -1, 22, 0 },
+    { -2, -1, 21, 0 },
+};
+
+static const struct accel_sample orient_trace_upright[] = {
+    { -1, -22, 0, 0 },
+    { 3, -20, 2, 0 },
+    { 0, -23, 0, 0 },
+    { 3, -23, 3, 0 },
+    { -1, -23, 4, 0 },
+    { 1, -20, 0, 0 },
+    { 3, -19, 4, 0 },
+    { 1, -21, 2, 0 },
+    { -1, -19, 4, 0 },
+    { 1, -21, 0, 0 },
+    { 1, -20, 3, 0 },
+    { -1, -19, 1, 0 },
+    { 3, -22, 4, 0 },
+    { 0, -19, 1, 0 },
+    { 1, -19, 2, 0 },
+    { 1, -19, 3, 0 },
+    { 0, -19, 0, 0 },
+    { 3, -23, 2, 0 },
+    { -1, -21, 3, 0 },
+    { 0, -20, 4, 0 },
+    { 2, -23, 3, 0 },
+    { 0, -19, 3, 0 },
+    { 0, -20, 1, 0 },
+    { 0, -21, 3, 0 },
+    { 0, -20, 4, 0 },
+    { -1, -23, 1, 0 },
+    { 3, -23, 4, 0 },
+    { 3, -23, 4, 0 },
+    { 0, -19, 4, 0 },
+    { 3, -22, 2, 0 },
+    { 1, -23, 1, 0 },
+    { 3, -23, 3, 0 },
+    { 3, -23, 3, 0 },
+    { -1, -21, 3, 0 },
+    { 0, -22, 1, 0 },
+    { 0, -20, 0, 0 },
+    { 3, -23, 3, 0 },
+    { 1, -21, 2, 0 },
+    { 2, -23, 2, 0 },
+    { 0, -21, 1, 0 },
+};
+
+static const struct accel_sample orient_trace_flip[] = {
+    { 1, -2, -20, 0 },
+    { -2, -2, -19, 0 },
+    { 2, 2, -22, 0 },
+    { 0, -1, -23, 0 },
+    { -2, -2, -21, 0 },
+    { 2, -1, -19, 0 },
+    { 1, 1, -22, 0 },
+    { 0, 1, -19, 0 },
+    { 0, 1, -21, 0 },
+    { 2, 1, -21, 0 },
+    { 2, 2, -22, 0 },
+    { -1, 0, -21, 0 },
+    { 1, 2, -22, 0 },
+    { 0, 0, -23, 0 },
+    { 1, 1, -22, 0 },
+    { 2, 2, -22, 0 },
+    { -1, -2, -22, 0 },
+    { 1, -2, -22, 0 },
+    { 0, -2, -20, 0 },
+    { 2, 2, -21, 0 },
+    { 0, 20, 2, 0 },
+    { 0, 21, -1, 0 },
+    { 1, 20, 1, 0 },
+    { 1, 19, -2, 0 },
+    { 2, 20, 2, 0 },
+    { 2, 21, 2, 0 },
+    { 1, 19, 2, 0 },
+    { 1, 19, -2, 0 },
+    { 0, 22, -1, 0 },
+    { 1, 23, -1, 0 },
+    { 2, 22, 2, 0 },
+    { 0, 23, -1, 0 },
+    { -1, 23, -2, 0 },
+    { -1, 23, -2, 0 },
+    { 0, 20, 2, 0 },
+    { 1, 20, -1, 0 },
+    { 1, 21, -2, 0 },
+    { 1, 22, 0, 0 },
+    { 0, 21, -2, 0 },
+    { 0, 21, 1, 0 },
+    { -2, 23, -2, 0 },
+    { 1, 21, -2, 0 },
+    { 2, 21, 1, 0 },
+    { 1, 21, -2, 0 },
+    { 0, 19, -2, 0 },
+    { 0, 19, 1, 0 },
+    { 2, 19, -1, 0 },
+    { 0, 22, -1, 0 },
+    { 1, 23, 1, 0 },
+    { -2, 23, 1, 0 },
+    { -1, 23, -1, 0 },
+    { 1, 21, -1, 0 },
+    { 2, 19, -1, 0 },
+    { -2, 19, 0, 0 },
+    { 2, 22, 0, 0 },
+    { 1, 20, -2, 0 },
+    { 2, 19, 2, 0 },
+    { -2, 21, -2, 0 },
+    { 2, 22, -2, 0 },
+    { 2, 21, 0, 0 },
+};
+
+/* Swaying around 45 degrees must not leave UPRIGHT. */
+static const struct accel_sample orient_trace_wobble[] = {
+    { -1, -21, -2, 0 },
+    { -1, -22, 1, 0 },
+    { 2, -19, -1, 0 },
+    { -1, -23, -1, 0 },
+    { -2, -19, 1, 0 },
+    { 2, -22, -1, 0 },
+    { 0, -22, 1, 0 },
+    { -1, -19, 1, 0 },
+    { 2, -22, -1, 0 },
+    { 1, -21, -1, 0 },
+    { -2, -20, -1, 0 },
+    { 2, -22, 1, 0 },
+    { -2, -21, 2, 0 },
+    { 2, -21, -2, 0 },
+    { 1, -23, -1, 0 },
+    { 0, -19, -1, 0 },
+    { -1, -19, 1, 0 },
+    { 0, -23, -1, 0 },
+    { 2, -21, 1, 0 },
+    { -2, -21, 0, 0 },
+    { 1, -20, -1, 0 },
+    { -1, -21, 2, 0 },
+    { 2, -23, -2, 0 },
+    { 2, -22, 2, 0 },
+    { 1, -23, -2, 0 },
+    { 1, -22, 1, 0 },
+    { 1, -22, 1, 0 },
+    { 0, -21, -2, 0 },
+    { -1, -19, 1, 0 },
+    { -2, -22, -2, 0 },
+    { -1, -17, 14, 0 },
+    { -1, -16, 13, 0 },
+    { 0, -14, 13, 0 },
+    { 1, -16, 14, 0 },
+    { -2, -15, 12, 0 },
+    { 0, -19, 10, 0 },
+    { -1, -16, 11, 0 },
+    { 1, -18, 11, 0 },
+    { -1, -16, 16, 0 },
+    { -2, -13, 15, 0 },
+    { -2, -14, 16, 0 },
+    { 1, -13, 15, 0 },
+    { 0, -16, 10, 0 },
+    { -1, -19, 10, 0 },
+    { -2, -17, 10, 0 },
+    { 1, -18, 10, 0 },
+    { -1, -15, 16, 0 },
+    { -2, -15, 13, 0 },
+    { 2, -17, 14, 0 },
+    { 0, -14, 16, 0 },
+    { 0, -16, 11, 0 },
+    { 0, -19, 11, 0 },
+    { -1, -15, 10, 0 },
+    { 1, -15, 14, 0 },
+    { 0, -18, 13, 0 },
+    { 0, -17, 15, 0 },
+    { 2, -15, 13, 0 },
+    { 2, -17, 14, 0 },
+};
+
+/* A short jolt sideways must not register. */
+static const struct accel_sample orient_trace_jolt[] = {
+    { 2, -23, -1, 0 },
+    { -1, -23, -2, 0 },
+    { 1, -22, 0, 0 },
+    { 0, -20, 0, 0 },
+    { -1, -23, 0, 0 },
+    { -1, -21, 1, 0 },
+    { 2, -19, -2, 0 },
+    { 2, -22, -1, 0 },
+    { -1, -19, -2, 0 },
+    { -1, -19, 2, 0 },
+    { 2, -21, 1, 0 },
+    { 0, -20, 2, 0 },
+    { 0, -20, 1, 0 },
+    { -2, -23, -2, 0 },
+    { -1, -21, -2, 0 },
+    { -2, -20, 0, 0 },
+    { 2, -21, -1, 0 },
+    { -2, -19, 1, 0 },
+    { -2, -20, 1, 0 },
+    { 1, -22, 1, 0 },
+    { 1, -23, 2, 0 },
+    { 1, -21, 1, 0 },
+    { 0, -20, 1, 0 },
+    { 2, -19, 2, 0 },
+    { 1, -23, 1, 0 },
+    { 1, -20, 0, 0 },
+    { -2, -19, -1, 0 },
+    { 1, -23, 1, 0 },
+    { -2, -19, -2, 0 },
+    { 2, -20, 0, 0 },
+    { 20, -2, 0, 0 },
+    { 23, 0, -2, 0 },
+    { 20, 2, 2, 0 },
+    { 22, 1, 0, 0 },
+    { 21, 0, 1, 0 },
+    { -1, -19, -2, 0 },
+    { -2, -22, 2, 0 },
+    { 2, -23, -1, 0 },
+    { -2, -22, 0, 0 },
+    { -2, -19, 0, 0 },
+    { 1, -21, -1, 0 },
+    { 0, -22, -2, 0 },
+    { -2, -23, 1, 0 },
+    { 2, -23, -2, 0 },
+    { 1, -21, 1, 0 },
+    { -1, -22, 0, 0 },
+    { -2, -22, -2, 0 },
+    { -2, -22, 2, 0 },
+    { 0, -22, -2, 0 },
+    { -1, -19, -2, 0 },
+    { -2, -19, 0, 0 },
+    { 2, -23, 2, 0 },
+    { 2, -23, 1, 0 },
+    { -2, -23, -1, 0 },
+    { 0, -22, 2, 0 },
+    { 1, -21, -1, 0 },
+    { 1, -20, 1, 0 },
+    { 2, -23, 2, 0 },
+    { -2, -22, 1, 0 },
+    { 1, -23, 2, 0 },
+    { 1, -23, -1, 0 },
+    { -1, -21, 2, 0 },
+    { -1, -22, -2, 0 },
+    { 0, -23, 2, 0 },
+    { 2, -19, -2, 0 },
+};
+
+#define ORIENT_TRACE(name, expect)                                       \
+    { #name, orient_trace_##name,                                       \
+      sizeof orient_trace_##name / sizeof orient_trace_##name[0],       \
+      (expect) }
+
+static const struct orient_trace orient_traces[] = {
+    ORIENT_TRACE(flat, FLAT),
+    ORIENT_TRACE(upright, UPRIGHT),
+    ORIENT_TRACE(flip, RUBBER),
+    ORIENT_TRACE(wobble, UPRIGHT),
+    ORIENT_TRACE(jolt, UPRIGHT),
+};
+#define ORIENT_NUM_TRACES \
+    (sizeof orient_traces / sizeof orient_traces[0])
+
+#endif
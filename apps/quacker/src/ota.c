@@ -0,0 +1,772 @@
+/**
+ * Copyright 2016 ICE9 Consulting
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+/**
+ * Over-the-air firmware update into FLASH_AREA_IMAGE_1.
+ *
+ * The uploader writes OTA_OP_START with the image size and its SHA-256 to
+ * the OTA control characteristic, then streams the image to the OTA data
+ * characteristic as write-without-response chunks, each prefixed with its
+ * 32-bit offset.  Chunks land in a window of two OTA_BUF_SIZE buffers: one
+ * fills while the ota task programs the other.  Erases and writes stall
+ * the CPU, so the ota task runs below everything else and times each one
+ * against the active target's connection events (see ota_wait_gap()):
+ * writes go out in OTA_WRITE_CHUNK pieces that fit between two events, and
+ * an erase starts just after one.
+ *
+ * Each time a buffer is programmed the control characteristic is notified
+ * with struct ota_status.  The uploader keeps at most status.window bytes
+ * beyond status.acked in flight; a chunk that arrives at the wrong offset
+ * (an overrun, or a resend after a reconnect) is dropped and the status is
+ * notified so the uploader can rewind to status.offset.
+ *
+ * OTA_OP_START_DELTA starts a patch against the running image instead (see
+ * delta.c).  The window then carries the patch, which the ota task decodes
+ * as it goes; status.size and the offsets count patch bytes.
+ *
+ * A disconnect keeps the session.  Writing the same start request again
+ * resumes it from status.offset; a different one starts over.
+ *
+ * OTA_OP_FINISH has the ota task read the image back from flash and check
+ * its SHA-256.  With OTA_FINISH_F_TEST it also checks the image header and
+ * its ECDSA-224 signature against the key in ota_key.h, and only then marks
+ * the slot for the bootloader to test on the next reset, which OTA_OP_RESET
+ * performs.  The time from the start to the verified image is logged with
+ * the throughput and the part spent waiting for connection events.
+ */
+
+#include <assert.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "os/os.h"
+#include "hal/flash_map.h"
+#include "hal/hal_cputime.h"
+#include "host/ble_hs.h"
+#include "bootutil/image.h"
+#include "bootutil/bootutil_misc.h"
+#include "mbedtls/sha256.h"
+#include "mbedtls/ecdsa.h"
+
+#include "quacker.h"
+#include "ota_key.h"
+
+#if !defined(MBEDTLS_ECDSA_C) || !defined(MBEDTLS_ECP_DP_SECP224R1_ENABLED)
+#error "ota.c needs mbedtls built with ECDSA and secp224r1"
+#endif
+
+/** nRF51 flash page; erases happen a page at a time. */
+#define OTA_PAGE_SIZE       1024
+
+/** Worst-case nRF51 NVMC timings: a page erase and a 32-bit write. */
+#define OTA_ERASE_USEC      22300
+#define OTA_WORD_USEC       47
+
+/** Bytes written at a time; about 0.75 msec, so one fits between events. */
+#define OTA_WRITE_CHUNK     64
+
+/** Left clear after an anchor point for the connection event itself. */
+#define OTA_EVENT_USEC      2500
+
+/** Largest DER ECDSA-224 signature: two 29-byte integers and framing. */
+#define OTA_SIG_MAX         72
+
+/** A window buffer.  Half a page keeps the window to 1 KB of RAM. */
+#define OTA_BUF_SIZE        512
+#define OTA_NUM_BUFS        2
+
+struct ota_buf {
+    uint8_t data[OTA_BUF_SIZE];
+    uint32_t off;
+    uint16_t len;
+    uint8_t busy;               /* Owned by the ota task. */
+};
+
+static struct ota_buf ota_bufs[OTA_NUM_BUFS];
+static int ota_fill;            /* Buffer taking data. */
+static int ota_flush;           /* Next buffer to program. */
+
+static struct ota_status ota_status;
+static uint8_t ota_hash[32];            /* Of the image, not the patch. */
+static uint32_t ota_image_size;
+static int ota_delta;
+static int ota_desync;          /* Status already sent for a bad offset. */
+static int ota_finish_flags;    /* OTA_FINISH_F_* */
+static int ota_reset;
+static os_time_t ota_start_time;
+static uint32_t ota_gap_usec;   /* Spent waiting for connection events. */
+
+static const uint8_t ota_key[] = OTA_KEY;
+
+static const struct flash_area *ota_fa;
+static struct os_sem ota_sem;
+static struct os_callout_func ota_notify_callout;
+static uint16_t ota_chr_handle;
+
+static void
+ota_notify(void *arg)
+{
+    if (ota_chr_handle != 0) {
+        ble_gatts_chr_updated(ota_chr_handle);
+    }
+}
+
+/**
+ * Has the quacker task notify the status; safe from the ota task.
+ */
+static void
+ota_notify_soon(void)
+{
+    os_callout_reset(&ota_notify_callout.cf_c, 0);
+}
+
+static void
+ota_fail(int error)
+{
+    ota_status.state = OTA_FAILED;
+    ota_status.error = error;
+    QUACKER_LOG(ERROR, "ota failed at offset %lu; error=%d\n",
+                (unsigned long)ota_status.acked, error);
+}
+
+/**
+ * Hands the fill buffer to the ota task.
+ */
+static void
+ota_submit(void)
+{
+    ota_bufs[ota_fill].busy = 1;
+    ota_fill = (ota_fill + 1) % OTA_NUM_BUFS;
+    os_sem_release(&ota_sem);
+}
+
+static int
+ota_busy(void)
+{
+    int i;
+
+    for (i = 0; i < OTA_NUM_BUFS; i++) {
+        if (ota_bufs[i].busy) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static int
+ota_start(const uint8_t *req, int len)
+{
+    const uint8_t *hash;
+    uint32_t base_size;
+    uint32_t image_size;
+    uint32_t size;
+    int delta;
+    int rc;
+
+    delta = req[0] == OTA_OP_START_DELTA;
+    if (len != 1 + sizeof size + sizeof ota_hash +
+               (delta ? sizeof image_size + sizeof ota_hash : 0)) {
+
+        return BLE_ATT_ERR_INVALID_ATTR_VALUE_LEN;
+    }
+
+    memcpy(&size, req + 1, sizeof size);
+    if (delta) {
+        memcpy(&image_size, req + 1 + sizeof size, sizeof image_size);
+        hash = req + 1 + sizeof size + sizeof image_size;
+    } else {
+        image_size = size;
+        hash = req + 1 + sizeof size;
+    }
+
+    if (ota_status.state == OTA_RECEIVING && delta == ota_delta &&
+        size == ota_status.size && image_size == ota_image_size &&
+        memcmp(hash, ota_hash, sizeof ota_hash) == 0) {
+
+        QUACKER_LOG(INFO, "ota resuming at offset %lu of %lu\n",
+                    (unsigned long)ota_status.offset, (unsigned long)size);
+        ota_desync = 0;
+        ota_notify_soon();
+        return 0;
+    }
+
+    /* Don't pull the window out from under the ota task. */
+    if (ota_busy() || ota_status.state == OTA_VERIFYING) {
+        ota_status.error = OTA_E_BUSY;
+        ota_notify_soon();
+        return 0;
+    }
+
+    if (size == 0 || image_size == 0 || image_size > ota_fa->fa_size) {
+        ota_fail(OTA_E_SIZE);
+        ota_notify_soon();
+        return 0;
+    }
+
+    if (delta) {
+        rc = delta_base_check(hash + sizeof ota_hash, &base_size);
+        if (rc != 0) {
+            ota_fail(rc);
+            ota_notify_soon();
+            return 0;
+        }
+        delta_start(base_size, image_size);
+    }
+
+    memcpy(ota_hash, hash, sizeof ota_hash);
+    memset(ota_bufs, 0, sizeof ota_bufs);
+    ota_fill = 0;
+    ota_flush = 0;
+    ota_desync = 0;
+    ota_delta = delta;
+    ota_image_size = image_size;
+
+    ota_status.state = OTA_RECEIVING;
+    ota_status.error = OTA_E_NONE;
+    ota_status.offset = 0;
+    ota_status.acked = 0;
+    ota_status.size = size;
+    ota_start_time = os_time_get();
+    ota_gap_usec = 0;
+
+    QUACKER_LOG(INFO, "ota receiving %lu bytes%s\n", (unsigned long)size,
+                delta ? " of patch" : "");
+    ota_notify_soon();
+    return 0;
+}
+
+/**
+ * Handles a write to the control characteristic.
+ *
+ * @return                      0 or an ATT error code.
+ */
+int
+ota_ctrl(const void *data, int len)
+{
+    const uint8_t *req;
+
+    req = data;
+    if (len < 1) {
+        return BLE_ATT_ERR_INVALID_ATTR_VALUE_LEN;
+    }
+
+    switch (req[0]) {
+    case OTA_OP_START:
+    case OTA_OP_START_DELTA:
+        return ota_start(req, len);
+
+    case OTA_OP_FINISH:
+        if (len != 2) {
+            return BLE_ATT_ERR_INVALID_ATTR_VALUE_LEN;
+        }
+        if (ota_status.state != OTA_RECEIVING ||
+            ota_status.acked != ota_status.size) {
+
+            ota_status.error = OTA_E_STATE;
+            ota_notify_soon();
+            return 0;
+        }
+        ota_status.state = OTA_VERIFYING;
+        ota_status.error = OTA_E_NONE;
+        ota_finish_flags = req[1];
+        os_sem_release(&ota_sem);
+        return 0;
+
+    case OTA_OP_ABORT:
+        if (ota_status.state == OTA_VERIFYING) {
+            ota_status.error = OTA_E_BUSY;
+        } else {
+            ota_status.state = OTA_IDLE;
+            ota_status.error = OTA_E_NONE;
+        }
+        ota_notify_soon();
+        return 0;
+
+#ifdef QUACKER_BENCH
+    case OTA_OP_BENCH:
+        if (ota_status.state == OTA_RECEIVING ||
+            ota_status.state == OTA_VERIFYING) {
+
+            ota_status.error = OTA_E_BUSY;
+            ota_notify_soon();
+            return 0;
+        }
+        bench_ota_request();
+        return 0;
+#endif
+
+    case OTA_OP_RESET:
+        if (ota_status.state != OTA_DONE) {
+            ota_status.error = OTA_E_STATE;
+            ota_notify_soon();
+            return 0;
+        }
+        ota_reset = 1;
+        os_sem_release(&ota_sem);
+        return 0;
+
+    default:
+        return BLE_ATT_ERR_REQ_NOT_SUPPORTED;
+    }
+}
+
+/**
+ * Handles a write to the data characteristic: a 32-bit offset followed by
+ * image bytes.
+ */
+void
+ota_data(const void *data, int len)
+{
+    const uint8_t *p;
+    struct ota_buf *buf;
+    uint32_t off;
+    int n;
+
+    if (ota_status.state != OTA_RECEIVING || len <= sizeof off) {
+        return;
+    }
+
+    p = data;
+    memcpy(&off, p, sizeof off);
+    p += sizeof off;
+    len -= sizeof off;
+
+    if (off != ota_status.offset ||
+        len > ota_status.size - ota_status.offset) {
+
+        if (!ota_desync) {
+            ota_desync = 1;
+            ota_notify_soon();
+        }
+        return;
+    }
+
+    while (len > 0) {
+        buf = ota_bufs + ota_fill;
+        if (buf->busy) {
+            /* The uploader overran the window. */
+            ota_desync = 1;
+            ota_notify_soon();
+            return;
+        }
+        if (buf->len == 0) {
+            buf->off = ota_status.offset;
+        }
+
+        n = OTA_BUF_SIZE - buf->len;
+        if (n > len) {
+            n = len;
+        }
+        memcpy(buf->data + buf->len, p, n);
+        buf->len += n;
+        ota_status.offset += n;
+        ota_desync = 0;
+        p += n;
+        len -= n;
+
+        if (buf->len == OTA_BUF_SIZE ||
+            ota_status.offset == ota_status.size) {
+
+            ota_submit();
+        }
+    }
+}
+
+/**
+ * Called when the connection goes down.  Bytes that didn't fill a buffer are
+ * dropped; the uploader resends them after resuming.
+ */
+void
+ota_conn_down(void)
+{
+    struct ota_buf *buf;
+
+    buf = ota_bufs + ota_fill;
+    if (ota_status.state == OTA_RECEIVING && !buf->busy) {
+        ota_status.offset -= buf->len;
+        buf->len = 0;
+    }
+}
+
+const struct ota_status *
+ota_get_status(void)
+{
+    ota_status.window = OTA_BUF_SIZE * OTA_NUM_BUFS;
+    return &ota_status;
+}
+
+void
+ota_set_chr_handle(uint16_t def_handle)
+{
+    ota_chr_handle = def_handle;
+}
+
+/**
+ * Waits until a flash operation of usec can run without stalling the CPU
+ * through one of the active target's connection events: after the current
+ * event, and finished before the next.  One that can't fit (an erase on a
+ * short interval) starts right after an event, so it costs as few as it
+ * can.  Returns at once with no connection.
+ */
+static void
+ota_wait_gap(uint32_t usec)
+{
+    uint16_t conn_handle;
+    uint32_t anchor;
+    uint32_t start;
+    uint32_t since;
+    uint32_t itvl;
+    uint32_t wait;
+    uint32_t tick;
+    int fits;
+
+    conn_handle = gatt_svr_active_conn();
+    if (conn_handle == BLE_HS_CONN_HANDLE_NONE) {
+        return;
+    }
+
+    tick = 1000000 / OS_TICKS_PER_SEC;
+    start = cputime_get32();
+    while (1) {
+        if (llconn_timing(conn_handle, &anchor, &itvl) != 0 ||
+            llconn_since_anchor(conn_handle, cputime_get32(), &since) != 0) {
+
+            break;
+        }
+
+        fits = OTA_EVENT_USEC + usec <= itvl;
+        if (since >= OTA_EVENT_USEC &&
+            (fits ? since + usec <= itvl : since < OTA_EVENT_USEC + tick)) {
+
+            break;
+        }
+
+        if (since < OTA_EVENT_USEC) {
+            wait = OTA_EVENT_USEC - since;
+        } else {
+            wait = itvl - since + OTA_EVENT_USEC;
+        }
+
+        /* Sleep off whole ticks; spin the rest, since the ota task only
+         * runs when nothing else wants the CPU anyway.
+         */
+        if (wait > 2 * tick) {
+            os_time_delay(wait / tick - 1);
+        }
+    }
+    ota_gap_usec += cputime_get32() - start;
+}
+
+/**
+ * Programs part of the image, erasing each page as the image reaches it.
+ * Writes must come in order.
+ */
+int
+ota_program(uint32_t off, const void *data, uint32_t len)
+{
+    const uint8_t *p;
+    uint32_t n;
+    int rc;
+
+    rc = 0;
+    if (off % OTA_PAGE_SIZE == 0) {
+        ota_wait_gap(OTA_ERASE_USEC);
+        TRACE(FLASH_BEGIN, TRACE_FLASH_OTA);
+        rc = flash_area_erase(ota_fa, off, OTA_PAGE_SIZE);
+        TRACE(FLASH_END, TRACE_FLASH_OTA);
+    }
+
+    p = data;
+    for (; rc == 0 && len > 0; off += n, p += n, len -= n) {
+        n = len < OTA_WRITE_CHUNK ? len : OTA_WRITE_CHUNK;
+        ota_wait_gap((n + 3) / 4 * OTA_WORD_USEC);
+        TRACE(FLASH_BEGIN, TRACE_FLASH_OTA);
+        rc = flash_area_write(ota_fa, off, (void *)p, n);
+        TRACE(FLASH_END, TRACE_FLASH_OTA);
+    }
+
+    return rc;
+}
+
+/**
+ * Consumes one window buffer: programs it, or decodes it if it holds
+ * patch bytes.
+ *
+ * @return                      OTA_E_NONE or an OTA_E_* code.
+ */
+static int
+ota_consume(struct ota_buf *buf)
+{
+    int rc;
+
+    if (!ota_delta) {
+        rc = ota_program(buf->off, buf->data, buf->len);
+        return rc != 0 ? OTA_E_FLASH : OTA_E_NONE;
+    }
+
+    rc = delta_feed(buf->data, buf->len);
+    if (rc == 0 && buf->off + buf->len == ota_status.size) {
+        rc = delta_finish();
+    }
+    return rc;
+}
+
+/**
+ * Checks the image's ECDSA-224 signature TLV against ota_key.  newt
+ * create-image signs the SHA-256 of the header and body, the same hash its
+ * SHA-256 TLV carries.
+ *
+ * @return                      OTA_E_NONE or an OTA_E_* code.
+ */
+static int
+ota_check_signature(const struct image_header *hdr)
+{
+    mbedtls_sha256_context sha;
+    mbedtls_ecdsa_context ecdsa;
+    struct image_tlv tlv;
+    uint8_t sig[OTA_SIG_MAX];
+    uint8_t hash[32];
+    uint32_t body;
+    uint32_t off;
+    uint32_t end;
+    uint32_t n;
+    int sig_len;
+    int rc;
+
+    if (OTA_KEY_LEN == 0) {
+        QUACKER_LOG(ERROR, "ota: no signing key built in; see "
+                           "tools/ota_key.py\n");
+        return OTA_E_SIGNATURE;
+    }
+
+    body = hdr->ih_hdr_size + hdr->ih_img_size;
+    end = body + hdr->ih_tlv_size;
+
+    sig_len = 0;
+    for (off = body; off + sizeof tlv <= end; off += tlv.it_len) {
+        rc = flash_area_read(ota_fa, off, &tlv, sizeof tlv);
+        if (rc != 0) {
+            return OTA_E_FLASH;
+        }
+        off += sizeof tlv;
+
+        if (tlv.it_type == IMAGE_TLV_ECDSA224 && tlv.it_len <= sizeof sig &&
+            off + tlv.it_len <= end) {
+
+            rc = flash_area_read(ota_fa, off, sig, tlv.it_len);
+            if (rc != 0) {
+                return OTA_E_FLASH;
+            }
+            sig_len = tlv.it_len;
+            break;
+        }
+    }
+    if (sig_len == 0) {
+        return OTA_E_SIGNATURE;
+    }
+
+    mbedtls_sha256_init(&sha);
+    mbedtls_sha256_starts(&sha, 0);
+    for (off = 0; off < body; off += n) {
+        n = body - off;
+        if (n > OTA_BUF_SIZE) {
+            n = OTA_BUF_SIZE;
+        }
+        rc = flash_area_read(ota_fa, off, ota_bufs[0].data, n);
+        if (rc != 0) {
+            return OTA_E_FLASH;
+        }
+        mbedtls_sha256_update(&sha, ota_bufs[0].data, n);
+    }
+    mbedtls_sha256_finish(&sha, hash);
+
+    mbedtls_ecdsa_init(&ecdsa);
+    rc = mbedtls_ecp_group_load(&ecdsa.grp, MBEDTLS_ECP_DP_SECP224R1);
+    if (rc == 0) {
+        rc = mbedtls_ecp_point_read_binary(&ecdsa.grp, &ecdsa.Q, ota_key,
+                                           OTA_KEY_LEN);
+    }
+    if (rc == 0) {
+        rc = mbedtls_ecdsa_read_signature(&ecdsa, hash, sizeof hash, sig,
+                                          sig_len);
+    }
+    mbedtls_ecdsa_free(&ecdsa);
+
+    return rc == 0 ? OTA_E_NONE : OTA_E_SIGNATURE;
+}
+
+/**
+ * Reads the image back, checks its hash and, if asked, its header and
+ * signature, then marks it for the bootloader.
+ */
+static int
+ota_verify(int flags)
+{
+    mbedtls_sha256_context ctx;
+    struct image_header hdr;
+    uint8_t hash[32];
+    uint32_t off;
+    uint32_t n;
+    int rc;
+
+    mbedtls_sha256_init(&ctx);
+    mbedtls_sha256_starts(&ctx, 0);
+    for (off = 0; off < ota_image_size; off += n) {
+        n = ota_image_size - off;
+        if (n > OTA_BUF_SIZE) {
+            n = OTA_BUF_SIZE;
+        }
+        rc = flash_area_read(ota_fa, off, ota_bufs[0].data, n);
+        if (rc != 0) {
+            return OTA_E_FLASH;
+        }
+        mbedtls_sha256_update(&ctx, ota_bufs[0].data, n);
+    }
+    mbedtls_sha256_finish(&ctx, hash);
+
+    if (memcmp(hash, ota_hash, sizeof hash) != 0) {
+        return OTA_E_HASH;
+    }
+
+    if (!(flags & OTA_FINISH_F_TEST)) {
+        return OTA_E_NONE;
+    }
+
+    rc = flash_area_read(ota_fa, 0, &hdr, sizeof hdr);
+    if (rc != 0) {
+        return OTA_E_FLASH;
+    }
+    if (hdr.ih_magic != IMAGE_MAGIC ||
+        hdr.ih_hdr_size + hdr.ih_img_size + hdr.ih_tlv_size >
+        ota_image_size) {
+
+        return OTA_E_IMAGE;
+    }
+
+    rc = ota_check_signature(&hdr);
+    if (rc != OTA_E_NONE) {
+        return rc;
+    }
+
+    rc = boot_vect_write_test(&hdr.ih_ver);
+    quacker_stats.flash_writes++;
+    if (rc != 0) {
+        return OTA_E_FLASH;
+    }
+
+    QUACKER_LOG(INFO, "ota image %d.%d.%d.%lu marked for test\n",
+                hdr.ih_ver.iv_major, hdr.ih_ver.iv_minor,
+                hdr.ih_ver.iv_revision,
+                (unsigned long)hdr.ih_ver.iv_build_num);
+    return OTA_E_NONE;
+}
+
+/**
+ * Logs the time from the start request to the verified image, and the
+ * throughput over the link that gives.
+ */
+static void
+ota_log_done(void)
+{
+    uint32_t msec;
+    uint32_t bps;
+
+    msec = (os_time_get() - ota_start_time) * 1000 / OS_TICKS_PER_SEC;
+    bps = msec == 0 ? 0 : (uint64_t)ota_status.size * 1000 / msec;
+
+    QUACKER_LOG(INFO, "ota verified %lu bytes from %lu sent in %lu msec, "
+                      "%lu bytes/sec; %lu msec waiting for connection "
+                      "events\n",
+                (unsigned long)ota_image_size,
+                (unsigned long)ota_status.size, (unsigned long)msec,
+                (unsigned long)bps, (unsigned long)(ota_gap_usec / 1000));
+}
+
+/**
+ * Body of the ota task.
+ */
+void
+ota_run(void)
+{
+    struct ota_buf *buf;
+    os_sr_t sr;
+    int rc;
+
+    while (1) {
+        os_sem_pend(&ota_sem, OS_TIMEOUT_NEVER);
+
+        if (ota_reset) {
+            /* Let the write response and the log get out first.  The
+             * reset itself waits for the watchdog; see fault_reset().
+             */
+            os_time_delay(OS_TICKS_PER_SEC / 2);
+            fault_reset();
+        }
+
+        if (ota_status.state == OTA_VERIFYING) {
+            rc = ota_verify(ota_finish_flags);
+            if (rc == OTA_E_NONE) {
+                ota_status.state = OTA_DONE;
+                ota_log_done();
+            } else {
+                ota_fail(rc);
+            }
+            ota_notify_soon();
+            continue;
+        }
+
+        buf = ota_bufs + ota_flush;
+        if (!buf->busy) {
+            continue;
+        }
+
+        if (ota_status.state == OTA_RECEIVING) {
+            rc = ota_consume(buf);
+            if (rc != OTA_E_NONE) {
+                ota_fail(rc);
+            } else {
+                ota_status.acked = buf->off + buf->len;
+            }
+        }
+
+        /* ota_data() may preempt us; it must never see busy clear with
+         * the old length.
+         */
+        OS_ENTER_CRITICAL(sr);
+        buf->len = 0;
+        buf->busy = 0;
+        OS_EXIT_CRITICAL(sr);
+        ota_flush = (ota_flush + 1) % OTA_NUM_BUFS;
+        ota_notify_soon();
+    }
+}
+
+void
+ota_init(struct os_eventq *evq)
+{
+    int rc;
+
+    rc = flash_area_open(FLASH_AREA_IMAGE_1, &ota_fa);
+    assert(rc == 0);
+
+    os_sem_init(&ota_sem, 0);
+    os_callout_func_init(&ota_notify_callout, evq, ota_notify, NULL);
+}
@@ -0,0 +1,34 @@
+/**
+ * Copyright 2016 ICE9 Consulting
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+/* Generated by tools/ota_key.py. */
+
+#ifndef H_OTA_KEY_
+#define H_OTA_KEY_
+
+/**
+ * Public half of the key OTA images are signed with, as an uncompressed
+ * secp224r1 point.  OTA_KEY_LEN is 0 when no key is built in.
+ */
+#define OTA_KEY_LEN 0
+#define OTA_KEY { 0 }
+
+#endif
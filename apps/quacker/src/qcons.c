@@ -0,0 +1,239 @@
+/**
+ * Copyright 2016 ICE9 Consulting
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+/**
+ * Non-blocking console output.
+ *
+ * Writers copy into a fixed ring and return; the UART TX-ready interrupt
+ * pulls bytes out one at a time.  Nothing ever waits on the UART, so logging
+ * from a GAP callback costs a memcpy rather than a millisecond per line.
+ *
+ * Each write is treated as a line and is either queued whole or dropped
+ * whole.  Drops are counted, and once there is room again a
+ * "[N lines dropped]" marker goes out ahead of the next line.
+ *
+ * This replaces the full console package; the app depends on the console
+ * stub, so stray console_printf() calls from libraries are discarded.
+ */
+
+#include <assert.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "os/os.h"
+#include "bsp/bsp.h"
+#include "hal/hal_uart.h"
+#include "log/log.h"
+
+#include "quacker.h"
+
+#define QCONS_UART          CONSOLE_UART
+#define QCONS_BAUD          115200
+
+/* Must be a power of two. */
+#define QCONS_BUF_SIZE      512
+#define QCONS_BUF_MASK      (QCONS_BUF_SIZE - 1)
+
+static uint8_t qcons_buf[QCONS_BUF_SIZE];
+static uint32_t qcons_head;
+static uint32_t qcons_tail;
+
+/* Lines dropped since the last marker went out. */
+static uint32_t qcons_pending_drops;
+
+static struct qcons_stats qcons_stats;
+
+/**
+ * UART TX-ready callback; runs in interrupt context.
+ *
+ * @return                      The next byte to send; -1 if the ring is
+ *                                  empty.
+ */
+static int
+qcons_tx_char(void *arg)
+{
+    if (qcons_head == qcons_tail) {
+        return -1;
+    }
+
+    return qcons_buf[qcons_tail++ & QCONS_BUF_MASK];
+}
+
+/* Console input isn't used. */
+static int
+qcons_rx_char(void *arg, uint8_t byte)
+{
+    return 0;
+}
+
+static void
+qcons_put(const char *data, int len)
+{
+    int i;
+
+    for (i = 0; i < len; i++) {
+        qcons_buf[qcons_head++ & QCONS_BUF_MASK] = data[i];
+    }
+}
+
+/**
+ * Formats the drop marker into buf.
+ *
+ * @return                      The length of the marker.
+ */
+static int
+qcons_drop_marker(char *buf, uint32_t drops)
+{
+    static const char suffix[] = " lines dropped]\n";
+    char digits[10];
+    int len;
+    int n;
+
+    n = 0;
+    do {
+        digits[n++] = '0' + drops % 10;
+        drops /= 10;
+    } while (drops != 0);
+
+    len = 0;
+    buf[len++] = '[';
+    while (n > 0) {
+        buf[len++] = digits[--n];
+    }
+    memcpy(buf + len, suffix, sizeof suffix - 1);
+
+    return len + sizeof suffix - 1;
+}
+
+/**
+ * Queues a line for output.  Never blocks.
+ *
+ * @return                      0 if the line was queued; -1 if it was
+ *                                  dropped for lack of space.
+ */
+int
+qcons_write(const char *data, int len)
+{
+    char marker[32];
+    uint32_t used;
+    uint32_t sr;
+    int marker_len;
+    int rc;
+
+    OS_ENTER_CRITICAL(sr);
+
+    marker_len = 0;
+    if (qcons_pending_drops != 0) {
+        marker_len = qcons_drop_marker(marker, qcons_pending_drops);
+    }
+
+    used = qcons_head - qcons_tail;
+    if (used + marker_len + len > QCONS_BUF_SIZE) {
+        qcons_pending_drops++;
+        qcons_stats.dropped++;
+        rc = -1;
+    } else {
+        if (marker_len != 0) {
+            qcons_put(marker, marker_len);
+            qcons_pending_drops = 0;
+        }
+        qcons_put(data, len);
+
+        used += marker_len + len;
+        if (used > qcons_stats.high_water) {
+            qcons_stats.high_water = used;
+        }
+        qcons_stats.lines++;
+        qcons_stats.bytes += len;
+        rc = 0;
+    }
+
+    OS_EXIT_CRITICAL(sr);
+
+    if (rc == 0) {
+        hal_uart_start_tx(QCONS_UART);
+    }
+
+    return rc;
+}
+
+/**
+ * Returns the number of bytes that could be queued right now.  Background
+ * writers that would rather wait than drop use this to pace themselves.
+ */
+int
+qcons_room(void)
+{
+    return QCONS_BUF_SIZE - (qcons_head - qcons_tail);
+}
+
+/**
+ * Copies out the enqueue and drop counters.
+ */
+void
+qcons_get_stats(struct qcons_stats *stats)
+{
+    uint32_t sr;
+
+    OS_ENTER_CRITICAL(sr);
+    *stats = qcons_stats;
+    OS_EXIT_CRITICAL(sr);
+}
+
+static int
+qcons_log_append(struct log *log, void *buf, int len)
+{
+    int hlen;
+
+    hlen = sizeof(struct log_entry_hdr);
+    qcons_write((char *)buf + hlen, len - hlen);
+
+    return 0;
+}
+
+/**
+ * Sets up a log handler that writes entries through qcons, in place of
+ * log_console_handler_init().
+ */
+int
+qcons_log_handler_init(struct log_handler *handler)
+{
+    memset(handler, 0, sizeof *handler);
+    handler->log_type = LOG_TYPE_STREAM;
+    handler->log_append = qcons_log_append;
+
+    return 0;
+}
+
+int
+qcons_init(void)
+{
+    int rc;
+
+    rc = hal_uart_init_cbs(QCONS_UART, qcons_tx_char, NULL,
+                           qcons_rx_char, NULL);
+    if (rc != 0) {
+        return rc;
+    }
+
+    return hal_uart_config(QCONS_UART, QCONS_BAUD, 8, 1,
+                           HAL_UART_PARITY_NONE, HAL_UART_FLOW_CTL_NONE);
+}
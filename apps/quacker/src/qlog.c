@@ -0,0 +1,229 @@
+/**
+ * Copyright 2016 ICE9 Consulting
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+/**
+ * Deferred binary log.
+ *
+ * QUACKER_LOG_FAST() doesn't format anything.  It copies the address of the
+ * format string, a timestamp and the raw 32-bit arguments into a RAM ring and
+ * returns.  A low-priority task later drains the ring to the console as hex
+ * lines of the form
+ *
+ *     ~Q <usec> <header> <arg0> <arg1> ...
+ *
+ * where the header holds the argument count in its top byte and the format
+ * string address in the rest.  tools/qlog_decode.py looks the format strings
+ * up in the ELF and rebuilds the text.  Lines that don't start with ~Q pass
+ * through untouched, so this mixes freely with QUACKER_LOG output.
+ *
+ * Because formatting happens on the host, format strings must be literals
+ * (they live in flash) and so must anything printed with %s.  Arguments are
+ * 32 bits; a 64-bit value is passed as two arguments, low word first, and
+ * printed with %ll.
+ *
+ * When the ring is full new records are dropped and counted; the drain
+ * reports the count as "~Q! <n>".
+ */
+
+#include <assert.h>
+#include <stdarg.h>
+#include <stdint.h>
+
+#include "os/os.h"
+#include "hal/hal_cputime.h"
+
+#include "quacker.h"
+
+/* Ring size in 32-bit words; must be a power of two. */
+#define QLOG_RING_WORDS     256
+#define QLOG_RING_MASK      (QLOG_RING_WORDS - 1)
+
+/* Header and timestamp. */
+#define QLOG_HDR_WORDS      2
+
+#define QLOG_HDR(fmt, n)    (((uint32_t)(n) << 24) | \
+                             ((uint32_t)(fmt) & 0x00ffffff))
+#define QLOG_HDR_NARGS(hdr) ((hdr) >> 24)
+
+/* How long the drain backs off when the console is full. */
+#define QLOG_BACKOFF_TICKS  (OS_TICKS_PER_SEC / 100)
+
+static uint32_t qlog_ring[QLOG_RING_WORDS];
+static uint32_t qlog_head;
+static uint32_t qlog_tail;
+static uint32_t qlog_dropped;
+
+static struct os_sem qlog_sem;
+
+/**
+ * Appends a record to the ring.  Use QUACKER_LOG_FAST() rather than calling
+ * this directly.
+ */
+void
+qlog_write(const char *fmt, int nargs, ...)
+{
+    va_list ap;
+    uint32_t ts;
+    uint32_t sr;
+    uint32_t h;
+    int was_empty;
+    int i;
+
+    assert(nargs <= QLOG_MAX_ARGS);
+
+    ts = cputime_get32();
+
+    OS_ENTER_CRITICAL(sr);
+    if (QLOG_RING_WORDS - (qlog_head - qlog_tail) <
+        QLOG_HDR_WORDS + nargs) {
+
+        qlog_dropped++;
+        OS_EXIT_CRITICAL(sr);
+        return;
+    }
+
+    was_empty = qlog_head == qlog_tail;
+    h = qlog_head;
+    qlog_ring[h++ & QLOG_RING_MASK] = QLOG_HDR(fmt, nargs);
+    qlog_ring[h++ & QLOG_RING_MASK] = ts;
+
+    va_start(ap, nargs);
+    for (i = 0; i < nargs; i++) {
+        qlog_ring[h++ & QLOG_RING_MASK] = va_arg(ap, uint32_t);
+    }
+    va_end(ap);
+
+    qlog_head = h;
+    OS_EXIT_CRITICAL(sr);
+
+    /* The drain task only needs a kick when the ring goes non-empty. */
+    if (was_empty) {
+        os_sem_release(&qlog_sem);
+    }
+}
+
+static char *
+qlog_put_hex(char *p, uint32_t val)
+{
+    static const char hex[] = "0123456789abcdef";
+    int shift;
+
+    *p++ = ' ';
+    for (shift = 28; shift >= 0; shift -= 4) {
+        *p++ = hex[(val >> shift) & 0xf];
+    }
+
+    return p;
+}
+
+/**
+ * Removes one record from the ring.
+ *
+ * @return                      The number of words copied to rec; 0 if the
+ *                                  ring is empty.
+ */
+static int
+qlog_pop(uint32_t *rec)
+{
+    uint32_t sr;
+    int num;
+    int i;
+
+    OS_ENTER_CRITICAL(sr);
+    if (qlog_head == qlog_tail) {
+        OS_EXIT_CRITICAL(sr);
+        return 0;
+    }
+
+    num = QLOG_HDR_WORDS +
+          QLOG_HDR_NARGS(qlog_ring[qlog_tail & QLOG_RING_MASK]);
+    for (i = 0; i < num; i++) {
+        rec[i] = qlog_ring[qlog_tail++ & QLOG_RING_MASK];
+    }
+    OS_EXIT_CRITICAL(sr);
+
+    return num;
+}
+
+static void
+qlog_emit(const char *line, int len)
+{
+    while (qcons_room() < len) {
+        os_time_delay(QLOG_BACKOFF_TICKS);
+    }
+    qcons_write(line, len);
+}
+
+/**
+ * Writes everything in the ring to the console, then sleeps until there is
+ * more.  Runs forever; call from a low-priority task.  Rather than have
+ * qcons drop lines, the drain waits for the UART to make room; records pile
+ * up in the ring meanwhile.
+ */
+void
+qlog_drain(void)
+{
+    uint32_t rec[QLOG_HDR_WORDS + QLOG_MAX_ARGS];
+    char line[3 + 9 * (QLOG_HDR_WORDS + QLOG_MAX_ARGS) + 1];
+    uint32_t dropped;
+    uint32_t sr;
+    char *p;
+    int num;
+    int i;
+
+    while (1) {
+        os_sem_pend(&qlog_sem, OS_TIMEOUT_NEVER);
+
+        while ((num = qlog_pop(rec)) != 0) {
+            p = line;
+            *p++ = '~';
+            *p++ = 'Q';
+            p = qlog_put_hex(p, rec[1]);
+            p = qlog_put_hex(p, rec[0]);
+            for (i = QLOG_HDR_WORDS; i < num; i++) {
+                p = qlog_put_hex(p, rec[i]);
+            }
+            *p++ = '\n';
+            qlog_emit(line, p - line);
+        }
+
+        OS_ENTER_CRITICAL(sr);
+        dropped = qlog_dropped;
+        qlog_dropped = 0;
+        OS_EXIT_CRITICAL(sr);
+
+        if (dropped != 0) {
+            p = line;
+            *p++ = '~';
+            *p++ = 'Q';
+            *p++ = '!';
+            p = qlog_put_hex(p, dropped);
+            *p++ = '\n';
+            qlog_emit(line, p - line);
+        }
+    }
+}
+
+void
+qlog_init(void)
+{
+    os_sem_init(&qlog_sem, 0);
+}
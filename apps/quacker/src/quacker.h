@@ -20,12 +20,15 @@
 #ifndef H_QUACKER_
 #define H_QUACKER_
 
+#include <stddef.h>
+
 #include "log/log.h"
 
 enum orientation_t {
     NONE = 0, FLAT, UPRIGHT, RUBBER,
 };
 extern enum orientation_t orientation;
+void set_orientation(enum orientation_t o);
 
 extern struct log quacker_log;
 
@@ -38,12 +41,229 @@ extern uint8_t quacker_gatt_service_changed[4];
 
 extern char quacker_orientation[sizeof("UPRIGHT")];
 
+void quacker_activity(void);
+
+/* NFFS is mounted; after a warm boot, not until advertising is up. */
+extern int quacker_fs_ready;
+void quacker_fs_wait(void);
+
 /* quacker uses the first "peruser" log module. */
 #define QUACKER_LOG_MODULE  (LOG_MODULE_PERUSER + 0)
 
+/* Build-time log level, LOG_LEVEL_DEBUG through LOG_LEVEL_CRITICAL.  Calls
+ * below it are still type-checked but compile to nothing, format string
+ * included.  The target sets this in its cflags.
+ */
+#ifndef QUACKER_LOG_LEVEL
+#define QUACKER_LOG_LEVEL   LOG_LEVEL_DEBUG
+#endif
+
 /* Convenience macro for logging to the quacker module. */
-#define QUACKER_LOG(lvl, ...) \
-    LOG_ ## lvl(&quacker_log, QUACKER_LOG_MODULE, __VA_ARGS__)
+#define QUACKER_LOG(lvl, ...) do {                                      \
+    if (LOG_LEVEL_ ## lvl >= QUACKER_LOG_LEVEL) {                       \
+        LOG_ ## lvl(&quacker_log, QUACKER_LOG_MODULE, __VA_ARGS__);     \
+    }                                                                   \
+} while (0)
+
+/** Deferred binary log; see qlog.c.  Takes up to QLOG_MAX_ARGS 32-bit
+ * arguments; the format string must be a literal.
+ */
+#define QLOG_MAX_ARGS       8
+
+/* Counts up to 16 arguments; 9 through 16 come out as QLOG_TOO_MANY, which
+ * QLOG_NARGS_CHECK() rejects.  Past 16 the "count" is the 17th argument,
+ * rejected unless it happens to be a small constant.
+ */
+#define QLOG_TOO_MANY       (-1)
+
+#define QLOG_NARGS(...)                                                 \
+    QLOG_NARGS_(0, ##__VA_ARGS__,                                       \
+                QLOG_TOO_MANY, QLOG_TOO_MANY, QLOG_TOO_MANY,            \
+                QLOG_TOO_MANY, QLOG_TOO_MANY, QLOG_TOO_MANY,            \
+                QLOG_TOO_MANY, QLOG_TOO_MANY,                           \
+                8, 7, 6, 5, 4, 3, 2, 1, 0)
+#define QLOG_NARGS_(_0, _1, _2, _3, _4, _5, _6, _7, _8, _9, _10, _11,   \
+                    _12, _13, _14, _15, _16, n, ...) n
+
+/* Fails to compile unless n is a constant from 0 to QLOG_MAX_ARGS. */
+#define QLOG_NARGS_CHECK(n)                                             \
+    ((void)sizeof(struct {                                              \
+        int qlog_too_many_args : (n) >= 0 && (n) <= QLOG_MAX_ARGS ? 1 : -1; \
+    }))
+
+/* With QLOG_FMT_SECTION, format strings go in .qlog_fmt, which the linker
+ * script keeps in the ELF but out of flash; the address is just an ID for
+ * the decoder.
+ */
+#ifdef QLOG_FMT_SECTION
+#define QLOG_FMT(fmt) ({                                                \
+    static const char qlog_fmt_[]                                       \
+        __attribute__((section(".qlog_fmt"))) = fmt;                    \
+    qlog_fmt_;                                                          \
+})
+#else
+#define QLOG_FMT(fmt)       (fmt)
+#endif
+
+/* Logs at INFO level. */
+#define QUACKER_LOG_FAST(fmt, ...) do {                                 \
+    QLOG_NARGS_CHECK(QLOG_NARGS(__VA_ARGS__));                          \
+    if (LOG_LEVEL_INFO >= QUACKER_LOG_LEVEL) {                          \
+        qlog_write(QLOG_FMT(fmt), QLOG_NARGS(__VA_ARGS__),              \
+                   ##__VA_ARGS__);                                      \
+    }                                                                   \
+} while (0)
+
+void qlog_init(void);
+void qlog_write(const char *fmt, int nargs, ...);
+void qlog_drain(void);
+
+/** Non-blocking console. */
+struct qcons_stats {
+    uint32_t lines;
+    uint32_t bytes;
+    uint32_t dropped;
+    uint32_t high_water;
+};
+
+struct log_handler;
+int qcons_init(void);
+int qcons_write(const char *data, int len);
+int qcons_room(void);
+void qcons_get_stats(struct qcons_stats *stats);
+int qcons_log_handler_init(struct log_handler *handler);
+
+/** Event tracer; see trace.c. */
+enum trace_id {
+    TRACE_GPIO_EDGE = 1,        /* GPIO DETECT interrupt. */
+    TRACE_DEBOUNCE,             /* Button accepted; arg = button << 4 | down. */
+    TRACE_REPORT_QUEUED,        /* HID report written; arg = key code. */
+    TRACE_CHR_UPDATED,          /* Report handed to the host stack. */
+    TRACE_REPORT_READ,          /* Report notified to the host. */
+    TRACE_FLASH_BEGIN,          /* Flash write; arg = trace_flash_file. */
+    TRACE_FLASH_END,
+    TRACE_LED_FRAME,            /* LED matrix redrawn. */
+};
+
+enum trace_flash_file {
+    TRACE_FLASH_ORIENTATION = 0,
+    TRACE_FLASH_KEYSTORE,
+    TRACE_FLASH_GATT_DB,
+    TRACE_FLASH_OTA,            /* Image slot, not NFFS. */
+};
+
+#ifdef QUACKER_TRACE
+#define TRACE(id, arg)      trace_event(TRACE_ ## id, (arg))
+
+struct os_eventq;
+void trace_init(struct os_eventq *evq);
+void trace_event(uint8_t id, uint8_t arg);
+int trace_control(uint8_t cmd);
+const void *trace_data(uint16_t *len);
+#else
+#define TRACE(id, arg)      ((void)0)
+#endif
+
+/** Runtime counters; see stats.c.  This is also the layout of the stats
+ * characteristic value (little endian).  A notification carries only the
+ * first MTU - 3 bytes, so the busiest counters come first.
+ */
+#define QUACKER_STATS_MAX_TASKS     8
+
+struct quacker_stats {
+    uint8_t version;
+    uint8_t num_tasks;
+    uint32_t uptime;            /* Seconds. */
+    uint32_t keypresses;
+    uint32_t notify_sent;       /* Reports notified to the host. */
+    uint32_t notify_dropped;    /* Reports the stack didn't take. */
+    uint16_t reconnects;
+    uint32_t last_reconnect;    /* Uptime at the last reconnect. */
+    uint16_t flash_writes;
+    uint16_t mbuf_low_water;    /* Fewest free mbufs seen. */
+    uint16_t conn_itvl;         /* 1.25 ms units; 0 when not connected. */
+    uint16_t conn_latency;
+    uint32_t notify_suppressed; /* Reports identical to the last one sent. */
+    uint8_t fault_cause;        /* FAULT_*, of the last reset. */
+    uint8_t fault_task;         /* Priority of the task it hit. */
+    uint16_t fault_line;        /* Of a failed QUACKER_ASSERT. */
+    uint32_t fault_pc;
+    uint32_t fault_lr;
+    uint32_t fault_recover_usec;    /* Fault to connectable. */
+    uint16_t stack_free[QUACKER_STATS_MAX_TASKS];   /* Words never touched. */
+} __attribute__((packed));
+
+extern struct quacker_stats quacker_stats;
+
+struct os_eventq;
+struct os_mempool;
+struct os_task;
+struct ble_gap_conn_desc;
+void stats_init(struct os_eventq *evq, struct os_mempool *mbuf_pool);
+void stats_task_register(struct os_task *task);
+void stats_sample(void);
+void stats_conn(uint16_t conn_itvl, uint16_t conn_latency);
+void stats_set_chr_handle(uint16_t def_handle);
+
+/** Crash recovery; see fault.c.  The last fault is kept in RAM that
+ * survives the reset and reported in the stats.
+ */
+#define FAULT_NONE          0
+#define FAULT_HARDFAULT     1
+#define FAULT_ASSERT        2   /* QUACKER_ASSERT. */
+#define FAULT_WATCHDOG      3
+#define FAULT_LOCKUP        4   /* A fault in the fault handler. */
+#define FAULT_SYSRESET      5   /* A library assert(), most likely. */
+#define FAULT_PLANNED       6   /* fault_reset(); not a fault. */
+
+/* Unlike assert(), records where it failed before resetting. */
+#define QUACKER_ASSERT(x) do {                                          \
+    if (!(x)) {                                                         \
+        fault_assert(__LINE__);                                         \
+    }                                                                   \
+} while (0)
+
+int fault_init(uint32_t resetreas);
+void fault_start(uint32_t wdt_msec);
+void fault_report(void);
+void fault_connectable(uint32_t usec);
+uint32_t fault_count(void);
+void fault_assert(int line) __attribute__((noreturn));
+void fault_reset(void) __attribute__((noreturn));
+
+/** Warm-boot state; see retain.c. */
+#define RETAIN_KEYSTORE_LEN 196     /* The keystore file; see keystore.c. */
+
+struct retain_peer {
+    uint8_t valid;
+    uint8_t bonded;             /* ediv and rand_num name the bond. */
+    uint8_t addr_type;
+    uint8_t addr[6];
+    uint16_t ediv;
+    uint64_t rand_num;
+    uint16_t conn_itvl;
+    uint16_t conn_latency;
+    uint16_t supervision_timeout;
+};
+
+struct retain_state {
+    uint8_t keystore[RETAIN_KEYSTORE_LEN];
+    enum orientation_t orientation;
+    uint8_t local_irk[16];      /* All zeros until QUACKER_PRIVACY makes one. */
+    struct retain_peer peer;    /* The last host to connect. */
+    uint32_t cold_adv_usec;     /* Reset to connectable, last cold boot. */
+    uint32_t cold_faults;       /* fault_count() at the last cold boot. */
+};
+
+/* Copies *src over a field of the retained state. */
+#define RETAIN_SET(field, src)                                          \
+    retain_update(offsetof(struct retain_state, field), (src),          \
+                  sizeof ((struct retain_state *)0)->field)
+
+int retain_init(int keep);
+void retain_seal(void);
+const struct retain_state *retain_get(void);
+void retain_update(int off, const void *src, int len);
 
 /** GATT server. */
 #define GATT_SVR_SVC_DEVICE_INFORMATION_UUID  0x180A
@@ -62,14 +282,139 @@ extern char quacker_orientation[sizeof("UPRIGHT")];
 #define GATT_SVR_DSC_DESCRIPTION              0x2901
 #define GATT_SVR_DSC_REPORT_REFERENCE         0x2908
 
+/** Hosts served at once.  The controller must be built for at least as
+ * many (NIMBLE_OPT_MAX_CONNECTIONS); see targets/slide_quacker.
+ */
+#ifndef QUACKER_MAX_CONNS
+#define QUACKER_MAX_CONNS                     2
+#endif
+
 void gatt_svr_init(void);
+void gatt_svr_db_check(void);
+int gatt_svr_report_notify(int which, const void *data, int len);
+void gatt_svr_conn_up(struct ble_gap_conn_desc *desc, int identified,
+                      uint16_t ediv, uint64_t rand_num);
+void gatt_svr_conn_updated(struct ble_gap_conn_desc *desc);
+int gatt_svr_conn_identity(uint16_t conn_handle, uint16_t *out_ediv,
+                           uint64_t *out_rand_num);
+int gatt_svr_conn_down(uint16_t conn_handle);
+int gatt_svr_next_target(void);
+uint16_t gatt_svr_active_conn(void);
+void gatt_svr_conn_ltk(uint16_t conn_handle, uint16_t ediv, uint64_t rand_num);
+void gatt_svr_conn_encrypted(uint16_t conn_handle);
+void gatt_svr_conn_bonded(uint16_t conn_handle, uint16_t ediv,
+                          uint64_t rand_num);
+void gatt_svr_conn_irk(uint16_t conn_handle, const uint8_t *irk);
+
+/** HID report engine; see hid.c. */
+typedef int hid_sink_fn(int which, const void *data, int len);
+typedef int hid_switch_fn(void);
+
+void hid_button(int button, int down);
+int hid_button_waits(int button);
+int hid_poll(int msec);
+void hid_key(uint8_t code, int down);
+void hid_conn_reset(void);
+void hid_set_sink(hid_sink_fn *sink);
+void hid_set_switch(hid_switch_fn *fn);
+
+/** Link-layer connection timing; see llconn.c. */
+int llconn_timing(uint16_t conn_handle, uint32_t *out_anchor,
+                  uint32_t *out_itvl);
+int llconn_since_anchor(uint16_t conn_handle, uint32_t t,
+                        uint32_t *out_usec);
+
+/** Connection-event timing for reports; see anchor.c. */
+int anchor_confirm_early(int press, uint32_t stable_usec, uint32_t left_usec,
+                         uint32_t poll_usec);
+void anchor_edge(uint32_t edge_time, uint32_t late_usec);
 
 /** Keystore. */
+#define KEYSTORE_F_SUBSCRIBED       0x01    /* Host enabled input reports. */
+#define KEYSTORE_F_DB_STALE         0x02    /* Owed a Service Changed. */
+
 int keystore_init(void);
+int keystore_restore(void);
+void keystore_verify(void);
 int keystore_lookup(uint16_t ediv, uint64_t rand_num,
                     void *out_ltk, int *out_authenticated);
 int keystore_add(uint16_t ediv, uint64_t rand_num, uint8_t *key,
                  int authenticated);
+int keystore_get_flags(uint16_t ediv, uint64_t rand_num, uint8_t *out_flags);
+int keystore_set_flags(uint16_t ediv, uint64_t rand_num, uint8_t set,
+                       uint8_t clear);
+int keystore_set_flags_all(uint8_t set);
+int keystore_set_irk(uint16_t ediv, uint64_t rand_num, const uint8_t *irk);
+int keystore_get_irk(int n, uint8_t *out_irk, uint16_t *out_ediv,
+                     uint64_t *out_rand_num);
+
+/** Resolvable private addresses; see rpa.c. */
+int rpa_is_resolvable(uint8_t addr_type, const uint8_t *addr);
+int rpa_resolve(const uint8_t *addr, uint16_t *out_ediv,
+                uint64_t *out_rand_num);
+int rpa_local_addr(uint8_t *out_addr);
+
+/** Over-the-air update; see ota.c.  Control characteristic writes start
+ * with an OTA_OP_* byte; reads and notifications return struct ota_status
+ * (little endian).
+ */
+#define OTA_OP_START        1       /* u32 size, SHA-256 of the image. */
+#define OTA_OP_FINISH       2       /* u8 OTA_FINISH_F_* flags. */
+#define OTA_OP_ABORT        3
+#define OTA_OP_RESET        4
+#define OTA_OP_START_DELTA  5       /* u32 patch size, u32 image size,
+                                       SHA-256 of the image, SHA-256 of
+                                       the running image it patches. */
+#define OTA_OP_BENCH        6       /* QUACKER_BENCH only: run the OTA
+                                       throughput pass; rewrites the slot. */
+
+#define OTA_FINISH_F_TEST   0x01    /* Mark the image for the bootloader. */
+
+enum ota_state {
+    OTA_IDLE = 0,
+    OTA_RECEIVING,
+    OTA_VERIFYING,
+    OTA_DONE,
+    OTA_FAILED,
+};
+
+enum ota_error {
+    OTA_E_NONE = 0,
+    OTA_E_SIZE,                 /* Image doesn't fit the slot. */
+    OTA_E_BUSY,                 /* Still programming; retry. */
+    OTA_E_FLASH,
+    OTA_E_HASH,
+    OTA_E_IMAGE,                /* Bad image header. */
+    OTA_E_STATE,                /* Request out of order. */
+    OTA_E_BASE,                 /* Patch is for another running image. */
+    OTA_E_PATCH,                /* Malformed patch. */
+    OTA_E_SIGNATURE,            /* Unsigned, or not by ota_key.h's key. */
+};
+
+struct ota_status {
+    uint8_t state;
+    uint8_t error;              /* Of the last request. */
+    uint16_t window;            /* Bytes allowed in flight beyond acked. */
+    uint32_t offset;            /* Next byte expected. */
+    uint32_t acked;             /* Bytes programmed. */
+    uint32_t size;
+} __attribute__((packed));
+
+struct os_eventq;
+void ota_init(struct os_eventq *evq);
+void ota_run(void);
+int ota_ctrl(const void *data, int len);
+void ota_data(const void *data, int len);
+void ota_conn_down(void);
+const struct ota_status *ota_get_status(void);
+void ota_set_chr_handle(uint16_t def_handle);
+int ota_program(uint32_t off, const void *data, uint32_t len);
+
+int delta_base_hash(uint8_t *out_hash, uint32_t *out_size);
+int delta_base_check(const uint8_t *hash, uint32_t *out_size);
+void delta_start(uint32_t base_size, uint32_t out_size);
+int delta_feed(const uint8_t *data, int len);
+int delta_finish(void);
 
 /** LEDs. */
 void led_init(void);
@@ -78,4 +423,67 @@ void led_static(char *message);
 void led_spinner(void);
 void led_spinner_pairing(void);
 
+/** Entropy pool; see entropy.c. */
+struct entropy_stats {
+    uint32_t generated;         /* Bytes the RNG delivered. */
+    uint32_t read;              /* Bytes handed to readers. */
+    uint32_t short_reads;       /* Reads the pool could not fill. */
+    uint32_t fill_bytes;        /* Bytes delivered by completed refills, */
+    uint32_t fill_usec;         /* and the time they took. */
+    uint32_t host_waits;        /* Host requests that waited for the RNG, */
+    uint32_t host_timeouts;     /* and that gave up. */
+};
+
+void entropy_init(void);
+int entropy_read(void *buf, int len);
+void entropy_reseed(void);
+const struct entropy_stats *entropy_get_stats(void);
+
+/** GPIO sense wakeups. */
+struct os_sem;
+void sense_init(void);
+void sense_wait(struct os_sem *sem, const int *pins, const int *level,
+                int num);
+void sense_system_off(const int *pins, const int *level, int num);
+
+/** Accelerometer. */
+struct accel_sample {
+    int8_t x;
+    int8_t y;
+    int8_t z;
+    uint8_t tilt;
+};
+
+int accel_init(void);
+int accel_set_streaming(int streaming);
+int accel_read(struct accel_sample *sample);
+int accel_sleep(void);
+
+/** Orientation classifier. */
+#define ORIENT_BUDGET_NSEC  10000
+
+void orient_init(void);
+void orient_reset(const struct accel_sample *sample);
+enum orientation_t orient_update(const struct accel_sample *sample);
+
+#ifdef ACCEL_MOCK
+extern int accel_mock_transactions;
+extern int accel_mock_int;
+void accel_mock_push(int8_t x, int8_t y, int8_t z, uint8_t tilt);
+#endif
+
+/** Benchmarks. */
+#ifdef QUACKER_BENCH
+struct os_eventq;
+void bench_init(struct os_eventq *evq);
+int bench_button_read(int pin);
+void bench_report_sent(const uint8_t *report);
+void bench_conn_up(void);
+void bench_att_request(void);
+void bench_report_read(const uint8_t *report);
+void bench_ltk_found(void);
+void bench_encrypted(void);
+void bench_ota_request(void);
+#endif
+
 #endif
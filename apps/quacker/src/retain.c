@@ -0,0 +1,161 @@
+/**
+ * Copyright 2016 ICE9 Consulting
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+/**
+ * Warm-boot state.
+ *
+ * What the badge would otherwise read from NFFS before it can advertise
+ * (the keystore, the orientation, its own IRK) is mirrored here as it is
+ * saved, along with the last peer and its connection parameters.  The block
+ * sits in RAM that a reset leaves alone (.noinit) and carries a CRC-32.  A
+ * reset that kept RAM (a fault, the watchdog, the reset pin) finds it
+ * intact, and main() takes the state from it, advertises, and only then
+ * mounts NFFS and checks the files against it.  RAM is written before
+ * flash, so it is never the older of the two.  A power cycle or a wakeup
+ * from System OFF loses RAM, fails the check, and boots cold.  So does the
+ * reset into a new image, which might lay the state out differently.
+ *
+ * A cold boot clears the block and marks it valid (retain_seal()) only
+ * once everything has been read from flash, so a reset partway through
+ * boots cold again.  Updates come from more than one task and hold a mutex;
+ * a reset in the middle of one leaves the CRC wrong.
+ */
+
+#include <stdint.h>
+#include <string.h>
+
+#include "os/os.h"
+#include "bsp/bsp.h"
+#include "hal/hal_cputime.h"
+
+#include "quacker.h"
+
+#define RETAIN_MAGIC    0x51525431      /* "QRT1" */
+
+struct retain_block {
+    uint32_t magic;             /* 0 until sealed. */
+    uint32_t len;               /* sizeof(struct retain_state). */
+    uint32_t crc;               /* CRC-32 of state. */
+    struct retain_state state;
+};
+
+static struct retain_block retain_block sec_noinit;
+static struct os_mutex retain_mutex;
+
+/** CRC-32 (IEEE 802.3), four bits at a time. */
+static const uint32_t retain_crc_tab[16] = {
+    0x00000000, 0x1db71064, 0x3b6e20c8, 0x26d930ac,
+    0x76dc4190, 0x6b6b51f4, 0x4db26158, 0x5005713c,
+    0xedb88320, 0xf00f9344, 0xd6d6a3e8, 0xcb61b38c,
+    0x9b64c2b0, 0x86d3d2d4, 0xa00ae278, 0xbdbdf21c,
+};
+
+static uint32_t
+retain_crc(const void *data, int len)
+{
+    const uint8_t *p;
+    uint32_t crc;
+
+    p = data;
+    crc = 0xffffffff;
+    while (len-- > 0) {
+        crc ^= *p++;
+        crc = (crc >> 4) ^ retain_crc_tab[crc & 0x0f];
+        crc = (crc >> 4) ^ retain_crc_tab[crc & 0x0f];
+    }
+
+    return ~crc;
+}
+
+/**
+ * Checks the block left by the last reset.  Called in main() before
+ * anything is read from flash.
+ *
+ * @param keep                  0 to clear it regardless.
+ *
+ * @return                      1 if it is intact and the state in it can be
+ *                                  used; 0 if it was cleared for a cold boot.
+ */
+int
+retain_init(int keep)
+{
+    uint32_t start;
+    int warm;
+
+    os_mutex_init(&retain_mutex);
+
+    start = cputime_get32();
+    warm = keep && retain_block.magic == RETAIN_MAGIC &&
+           retain_block.len == sizeof retain_block.state &&
+           retain_block.crc == retain_crc(&retain_block.state,
+                                          sizeof retain_block.state);
+    if (!warm) {
+        memset(&retain_block, 0, sizeof retain_block);
+        retain_block.len = sizeof retain_block.state;
+        retain_block.crc = retain_crc(&retain_block.state,
+                                      sizeof retain_block.state);
+    }
+
+    QUACKER_LOG(INFO, "retain: %d byte block %s; checked in %lu usec\n",
+                (int)sizeof retain_block, warm ? "intact" : "cleared",
+                (unsigned long)(cputime_get32() - start));
+    return warm;
+}
+
+/**
+ * Marks the block valid once a cold boot has filled it in.
+ */
+void
+retain_seal(void)
+{
+    os_mutex_pend(&retain_mutex, OS_TIMEOUT_NEVER);
+    retain_block.magic = RETAIN_MAGIC;
+    os_mutex_release(&retain_mutex);
+}
+
+/**
+ * The retained state.  Read it directly; change it with RETAIN_SET().
+ */
+const struct retain_state *
+retain_get(void)
+{
+    return &retain_block.state;
+}
+
+/**
+ * Replaces len bytes of the retained state at offset off.
+ */
+void
+retain_update(int off, const void *src, int len)
+{
+    uint8_t *dst;
+
+    os_mutex_pend(&retain_mutex, OS_TIMEOUT_NEVER);
+
+    dst = (uint8_t *)&retain_block.state + off;
+    if (memcmp(dst, src, len) != 0) {
+        memcpy(dst, src, len);
+        retain_block.crc = retain_crc(&retain_block.state,
+                                      sizeof retain_block.state);
+    }
+
+    os_mutex_release(&retain_mutex);
+}
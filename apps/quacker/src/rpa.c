@@ -0,0 +1,287 @@
+/**
+ * Copyright 2016 ICE9 Consulting
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+/**
+ * Resolvable private addresses.
+ *
+ * A host that pairs hands over its identity resolving key (IRK), which the
+ * keystore keeps with the bond.  A resolvable private address (RPA) is
+ * three random bytes (prand) and a 24-bit hash of them under the owner's
+ * IRK, so telling which bond an incoming RPA belongs to costs one AES-128
+ * block per stored IRK.  Those run on the ECB peripheral through the
+ * controller's ble_hw_encrypt_block().  The AAR would do the whole list in
+ * one go, but it shares its registers with the CCM that the controller
+ * drives for every encrypted connection event, and this controller version
+ * does not arbitrate between them.
+ *
+ * A host keeps its RPA for minutes at a time and reconnects often, so the
+ * last few RPAs resolved are cached with the bond they belong to; a hit
+ * costs a compare and a keystore lookup to check the bond is still there.
+ *
+ * With QUACKER_PRIVACY, the badge also advertises from an RPA of its own,
+ * made from an IRK kept in NFFS and replaced every QUACKER_RPA_SEC.  This
+ * version of the host cannot be given that IRK to distribute when pairing,
+ * so a bonded host cannot resolve the badge and will not reconnect on its
+ * own; it is left off until the host can.
+ */
+
+#include <assert.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "os/os.h"
+#include "hal/hal_cputime.h"
+#include "fs/fsutil.h"
+#include "nimble/ble.h"
+#include "controller/ble_hw.h"
+#include "host/ble_hs.h"
+
+#include "quacker.h"
+
+#define RPA_CACHE_SIZE          4
+
+#define RPA_IRK_FILE            "/irk.bin"
+
+struct rpa_cache_entry {
+    uint8_t addr[BLE_DEV_ADDR_LEN];
+    uint16_t ediv;
+    uint64_t rand_num;
+};
+
+static struct rpa_cache_entry rpa_cache[RPA_CACHE_SIZE];
+static int rpa_cache_next;
+
+#ifdef QUACKER_PRIVACY
+static uint8_t rpa_local_irk[16];
+static int rpa_local_irk_valid;
+#endif
+
+/**
+ * Computes the 24-bit hash of an RPA's prand (addr[3..5]) under irk, as
+ * the three low bytes of addr.  Addresses and IRKs are little-endian, as
+ * they go over the air; the ECB wants the most significant byte first.
+ */
+static int
+rpa_hash(const uint8_t *irk, const uint8_t *prand, uint8_t *out_hash)
+{
+    struct ble_encryption_block ecb;
+    os_sr_t sr;
+    int rc;
+    int i;
+
+    for (i = 0; i < 16; i++) {
+        ecb.key[i] = irk[15 - i];
+    }
+    memset(ecb.plain_text, 0, sizeof ecb.plain_text);
+    ecb.plain_text[13] = prand[2];
+    ecb.plain_text[14] = prand[1];
+    ecb.plain_text[15] = prand[0];
+
+    /* The link layer uses the ECB for session keys from its own task. */
+    OS_ENTER_CRITICAL(sr);
+    rc = ble_hw_encrypt_block(&ecb);
+    OS_EXIT_CRITICAL(sr);
+    if (rc != 0) {
+        return rc;
+    }
+
+    out_hash[0] = ecb.cipher_text[15];
+    out_hash[1] = ecb.cipher_text[14];
+    out_hash[2] = ecb.cipher_text[13];
+    return 0;
+}
+
+/**
+ * Says whether a random address is resolvable: its two top bits are 01.
+ */
+int
+rpa_is_resolvable(uint8_t addr_type, const uint8_t *addr)
+{
+    return addr_type == BLE_ADDR_TYPE_RANDOM && (addr[5] & 0xc0) == 0x40;
+}
+
+static struct rpa_cache_entry *
+rpa_cache_find(const uint8_t *addr)
+{
+    int i;
+
+    for (i = 0; i < RPA_CACHE_SIZE; i++) {
+        if (memcmp(rpa_cache[i].addr, addr, BLE_DEV_ADDR_LEN) == 0) {
+            return rpa_cache + i;
+        }
+    }
+
+    return NULL;
+}
+
+/**
+ * Finds the bond a resolvable private address belongs to, logging what
+ * that cost.
+ *
+ * @return                      0 on success, with the bond's key in
+ *                                  *out_ediv and *out_rand_num;
+ *                                  BLE_HS_ENOENT if no stored IRK matches.
+ */
+int
+rpa_resolve(const uint8_t *addr, uint16_t *out_ediv, uint64_t *out_rand_num)
+{
+    struct rpa_cache_entry *entry;
+    uint64_t rand_num;
+    uint16_t ediv;
+    uint8_t irk[16];
+    uint8_t hash[3];
+    uint8_t flags;
+    uint32_t start;
+    int found;
+    int i;
+
+    start = cputime_get32();
+
+    entry = rpa_cache_find(addr);
+    if (entry != NULL &&
+        keystore_get_flags(entry->ediv, entry->rand_num, &flags) == 0) {
+
+        *out_ediv = entry->ediv;
+        *out_rand_num = entry->rand_num;
+        QUACKER_LOG_FAST("rpa: resolved from cache in %lu usec\n",
+                         (unsigned long)(cputime_get32() - start));
+        return 0;
+    }
+
+    found = 0;
+    for (i = 0; !found && keystore_get_irk(i, irk, &ediv, &rand_num) == 0;
+         i++) {
+
+        found = rpa_hash(irk, addr + 3, hash) == 0 &&
+                memcmp(hash, addr, sizeof hash) == 0;
+    }
+    memset(irk, 0, sizeof irk);
+
+    QUACKER_LOG_FAST("rpa: %s after %d irks in %lu usec\n",
+                     found ? "resolved" : "unresolved", i,
+                     (unsigned long)(cputime_get32() - start));
+    if (!found) {
+        return BLE_HS_ENOENT;
+    }
+
+    /* Reuse a stale entry for the same address, if there was one. */
+    if (entry == NULL) {
+        entry = rpa_cache + rpa_cache_next;
+        rpa_cache_next = (rpa_cache_next + 1) % RPA_CACHE_SIZE;
+    }
+    memcpy(entry->addr, addr, BLE_DEV_ADDR_LEN);
+    entry->ediv = ediv;
+    entry->rand_num = rand_num;
+
+    *out_ediv = ediv;
+    *out_rand_num = rand_num;
+    return 0;
+}
+
+#ifdef QUACKER_PRIVACY
+/**
+ * Reads the local IRK, making one if there is none yet.  After a warm boot
+ * it comes from the retained state, since NFFS isn't mounted yet.
+ *
+ * @return                      0 on success; BLE_HS_EAGAIN if the entropy
+ *                                  pool could not supply a new one yet, or
+ *                                  NFFS is not mounted.
+ */
+static int
+rpa_local_irk_load(void)
+{
+    static const uint8_t none[16];
+    const struct retain_state *rs;
+    uint32_t len;
+    int rc;
+
+    if (rpa_local_irk_valid) {
+        return 0;
+    }
+
+    rs = retain_get();
+    if (memcmp(rs->local_irk, none, sizeof none) != 0) {
+        memcpy(rpa_local_irk, rs->local_irk, sizeof rpa_local_irk);
+        rpa_local_irk_valid = 1;
+        return 0;
+    }
+    if (!quacker_fs_ready) {
+        return BLE_HS_EAGAIN;
+    }
+
+    rc = fsutil_read_file(RPA_IRK_FILE, 0, sizeof rpa_local_irk,
+                          rpa_local_irk, &len);
+    if (rc != 0 || len != sizeof rpa_local_irk) {
+        if (entropy_read(rpa_local_irk, sizeof rpa_local_irk) !=
+            sizeof rpa_local_irk) {
+
+            return BLE_HS_EAGAIN;
+        }
+
+        rc = fsutil_write_file(RPA_IRK_FILE, rpa_local_irk,
+                               sizeof rpa_local_irk);
+        quacker_stats.flash_writes++;
+        if (rc != 0) {
+            QUACKER_LOG(ERROR, "error saving irk; rc=%d\n", rc);
+        }
+    }
+
+    RETAIN_SET(local_irk, rpa_local_irk);
+    rpa_local_irk_valid = 1;
+    return 0;
+}
+
+/**
+ * Makes a fresh RPA for advertising.
+ *
+ * @return                      0 on success; nonzero if there is no local
+ *                                  IRK yet, in which case the caller falls
+ *                                  back to the public address.
+ */
+int
+rpa_local_addr(uint8_t *out_addr)
+{
+    int rc;
+
+    rc = rpa_local_irk_load();
+    if (rc != 0) {
+        return rc;
+    }
+
+    /* prand: two top bits 01, and the rest neither all zeros nor all
+     * ones.
+     */
+    do {
+        if (entropy_read(out_addr + 3, 3) != 3) {
+            out_addr[3] = rand();
+            out_addr[4] = rand();
+            out_addr[5] = rand();
+        }
+        out_addr[5] = (out_addr[5] & 0x3f) | 0x40;
+    } while ((out_addr[3] == 0x00 && out_addr[4] == 0x00 &&
+              out_addr[5] == 0x40) ||
+             (out_addr[3] == 0xff && out_addr[4] == 0xff &&
+              out_addr[5] == 0x7f));
+
+    return rpa_hash(rpa_local_irk, out_addr + 3, out_addr);
+}
+#endif
@@ -0,0 +1,189 @@
+/**
+ * Copyright 2016 ICE9 Consulting
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+/**
+ * Pin-change wakeups built on the GPIO DETECT signal.
+ *
+ * The nRF51 ORs the SENSE result of every pin into one DETECT signal and
+ * raises the GPIOTE PORT event on its rising edge.  Unlike a GPIOTE IN
+ * channel this works without the 16 MHz clock, which is what we want for
+ * things that sit idle most of the day (buttons, accelerometer interrupt).
+ *
+ * Because there is only one event for all pins, the interrupt handler drops
+ * SENSE on every armed pin and wakes every waiter.  Each waiter then checks
+ * its own pins and re-arms if nothing it cares about changed.  Dropping all
+ * SENSE bits lets DETECT fall, so re-arming produces a fresh edge if a pin
+ * already matches and no change is lost while another pin holds DETECT high.
+ */
+
+#include <assert.h>
+#include <stdint.h>
+
+#include "os/os.h"
+#include "hal/hal_gpio.h"
+#include "bsp/cmsis_nvic.h"
+#include "mcu/nrf51.h"
+#include "mcu/nrf51_bitfields.h"
+
+#include "quacker.h"
+
+#define SENSE_MAX_WAITERS   4
+
+static struct os_sem *sense_waiters[SENSE_MAX_WAITERS];
+static uint32_t sense_armed;
+
+static void
+sense_set(int pin, uint32_t sense)
+{
+    NRF_GPIO->PIN_CNF[pin] =
+        (NRF_GPIO->PIN_CNF[pin] & ~GPIO_PIN_CNF_SENSE_Msk) |
+        (sense << GPIO_PIN_CNF_SENSE_Pos);
+}
+
+static void
+sense_irq_handler(void)
+{
+    int pin;
+    int i;
+
+    NRF_GPIOTE->EVENTS_PORT = 0;
+    TRACE(GPIO_EDGE, 0);
+
+    for (pin = 0; pin < 32; pin++) {
+        if (sense_armed & (1UL << pin)) {
+            sense_set(pin, GPIO_PIN_CNF_SENSE_Disabled);
+        }
+    }
+    sense_armed = 0;
+
+    for (i = 0; i < SENSE_MAX_WAITERS; i++) {
+        if (sense_waiters[i] != NULL) {
+            os_sem_release(sense_waiters[i]);
+        }
+    }
+}
+
+void
+sense_init(void)
+{
+    NRF_GPIOTE->EVENTS_PORT = 0;
+    NRF_GPIOTE->INTENSET = GPIOTE_INTENSET_PORT_Msk;
+    NVIC_SetVector(GPIOTE_IRQn, (uint32_t)sense_irq_handler);
+    NVIC_EnableIRQ(GPIOTE_IRQn);
+}
+
+/**
+ * Sleeps until any of the specified pins leaves the specified level, or until
+ * some other waiter's pin fires.  Wakeups can also be spurious (a release
+ * that raced with an early return is left on the semaphore).  Callers
+ * re-check their inputs on return and call again if nothing changed.
+ *
+ * @param sem                   A semaphore owned by the calling task,
+ *                                  initialized to 0.
+ * @param pins                  The pins to watch.
+ * @param level                 The current (idle) level of each pin.
+ * @param num                   The number of pins.
+ */
+void
+sense_wait(struct os_sem *sem, const int *pins, const int *level, int num)
+{
+    uint32_t mask;
+    uint32_t sr;
+    int slot;
+    int i;
+
+    mask = 0;
+    for (i = 0; i < num; i++) {
+        mask |= 1UL << pins[i];
+    }
+
+    OS_ENTER_CRITICAL(sr);
+    for (slot = 0; slot < SENSE_MAX_WAITERS; slot++) {
+        if (sense_waiters[slot] == NULL) {
+            sense_waiters[slot] = sem;
+            break;
+        }
+    }
+    assert(slot < SENSE_MAX_WAITERS);
+
+    for (i = 0; i < num; i++) {
+        sense_set(pins[i], level[i] ? GPIO_PIN_CNF_SENSE_Low
+                                    : GPIO_PIN_CNF_SENSE_High);
+    }
+    sense_armed |= mask;
+    OS_EXIT_CRITICAL(sr);
+
+    /* Don't sleep through an edge that happened while we were arming. */
+    for (i = 0; i < num; i++) {
+        if (hal_gpio_read(pins[i]) != level[i]) {
+            break;
+        }
+    }
+    if (i == num) {
+        os_sem_pend(sem, OS_TIMEOUT_NEVER);
+    }
+
+    OS_ENTER_CRITICAL(sr);
+    sense_waiters[slot] = NULL;
+    for (i = 0; i < num; i++) {
+        if (sense_armed & (1UL << pins[i])) {
+            sense_set(pins[i], GPIO_PIN_CNF_SENSE_Disabled);
+        }
+    }
+    sense_armed &= ~mask;
+    OS_EXIT_CRITICAL(sr);
+}
+
+/**
+ * Enters System OFF.  The chip resets (with RESETREAS.OFF set) when any of
+ * the specified pins leaves the specified level.  Does not return.
+ *
+ * @param pins                  The wakeup pins.
+ * @param level                 The current (idle) level of each pin.
+ * @param num                   The number of pins.
+ */
+void
+sense_system_off(const int *pins, const int *level, int num)
+{
+    int pin;
+    int i;
+
+    /* Never re-enabled; the chip resets on the way out of System OFF. */
+    __disable_irq();
+
+    /* Only the wakeup pins may drive DETECT from here on. */
+    NVIC_DisableIRQ(GPIOTE_IRQn);
+    for (pin = 0; pin < 32; pin++) {
+        if (sense_armed & (1UL << pin)) {
+            sense_set(pin, GPIO_PIN_CNF_SENSE_Disabled);
+        }
+    }
+    sense_armed = 0;
+
+    for (i = 0; i < num; i++) {
+        sense_set(pins[i], level[i] ? GPIO_PIN_CNF_SENSE_Low
+                                    : GPIO_PIN_CNF_SENSE_High);
+    }
+
+    NRF_POWER->SYSTEMOFF = 1;
+    while (1) {
+    }
+}
@@ -0,0 +1,210 @@
+/**
+ * Copyright 2016 ICE9 Consulting
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+/**
+ * Runtime counters, exposed as the stats characteristic in the quacker
+ * service so badges can be watched over the air.
+ *
+ * Most counters are bumped directly in quacker_stats by the code that owns
+ * the event.  The mbuf low-water mark is taken on every msys allocation:
+ * the app links with --wrap for os_msys_get() and os_msys_get_pkthdr() (see
+ * pkg.yml), so the host's and the controller's allocations come through
+ * here.  Values that only have to be current when shown (uptime, stack
+ * usage) are refreshed by stats_sample() whenever the characteristic is
+ * read or notified.  While connected, the characteristic is notified every
+ * STATS_NOTIFY_SEC; a notification carries as much of the struct as fits in
+ * the ATT MTU, and the busiest counters come first.
+ */
+
+#include <assert.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "os/os.h"
+#include "bsp/bsp.h"
+#include "host/ble_hs.h"
+
+#include "quacker.h"
+
+#define STATS_VERSION       3
+#define STATS_NOTIFY_SEC    10
+
+#ifndef OS_STACK_PATTERN
+#define OS_STACK_PATTERN    (0xdeadbeef)
+#endif
+
+struct quacker_stats quacker_stats;
+
+static struct os_task *stats_tasks[QUACKER_STATS_MAX_TASKS];
+static struct os_mempool *stats_mbuf_pool;
+
+static struct os_callout_func stats_notify_callout;
+static uint16_t stats_chr_handle;
+static int stats_notifying;
+
+/**
+ * Adds a task to the stack usage report.  Tasks are reported in the order
+ * they are registered.
+ */
+void
+stats_task_register(struct os_task *task)
+{
+    assert(quacker_stats.num_tasks < QUACKER_STATS_MAX_TASKS);
+    stats_tasks[quacker_stats.num_tasks++] = task;
+}
+
+/**
+ * Counts the words at the bottom of a task's stack that still hold the
+ * fill pattern os_task_init() wrote.
+ */
+static uint16_t
+stats_stack_free(struct os_task *task)
+{
+    os_stack_t *bottom;
+    uint16_t i;
+
+    bottom = task->t_stacktop - task->t_stacksize;
+    for (i = 0; i < task->t_stacksize; i++) {
+        if (bottom[i] != OS_STACK_PATTERN) {
+            break;
+        }
+    }
+
+    return i;
+}
+
+/**
+ * Refreshes the measured values.
+ */
+void
+stats_sample(void)
+{
+    int i;
+
+    quacker_stats.version = STATS_VERSION;
+    quacker_stats.uptime = os_time_get() / OS_TICKS_PER_SEC;
+
+    for (i = 0; i < quacker_stats.num_tasks; i++) {
+        quacker_stats.stack_free[i] = stats_stack_free(stats_tasks[i]);
+    }
+}
+
+/**
+ * Updates the mbuf low-water mark after an allocation.  Runs in whatever
+ * context allocated, including the link layer's interrupt.
+ */
+static void
+stats_mbuf_sample(void)
+{
+    uint16_t num_free;
+    os_sr_t sr;
+
+    if (stats_mbuf_pool == NULL) {
+        return;
+    }
+
+    OS_ENTER_CRITICAL(sr);
+    num_free = stats_mbuf_pool->mp_num_free;
+    if (num_free < quacker_stats.mbuf_low_water) {
+        quacker_stats.mbuf_low_water = num_free;
+    }
+    OS_EXIT_CRITICAL(sr);
+}
+
+struct os_mbuf *__real_os_msys_get(uint16_t dsize, uint16_t leadingspace);
+struct os_mbuf *__real_os_msys_get_pkthdr(uint16_t dsize,
+                                          uint16_t user_hdr_len);
+
+struct os_mbuf *
+__wrap_os_msys_get(uint16_t dsize, uint16_t leadingspace)
+{
+    struct os_mbuf *om;
+
+    om = __real_os_msys_get(dsize, leadingspace);
+    stats_mbuf_sample();
+    return om;
+}
+
+struct os_mbuf *
+__wrap_os_msys_get_pkthdr(uint16_t dsize, uint16_t user_hdr_len)
+{
+    struct os_mbuf *om;
+
+    om = __real_os_msys_get_pkthdr(dsize, user_hdr_len);
+    stats_mbuf_sample();
+    return om;
+}
+
+/**
+ * Records the parameters of the active connection; a conn_itvl of 0 means
+ * there is none.
+ */
+void
+stats_conn(uint16_t conn_itvl, uint16_t conn_latency)
+{
+    if (conn_itvl == 0) {
+        quacker_stats.conn_itvl = 0;
+        quacker_stats.conn_latency = 0;
+        os_callout_stop(&stats_notify_callout.cf_c);
+        stats_notifying = 0;
+        return;
+    }
+
+    quacker_stats.conn_itvl = conn_itvl;
+    quacker_stats.conn_latency = conn_latency;
+
+    if (!stats_notifying && stats_chr_handle != 0) {
+        stats_notifying = 1;
+        os_callout_reset(&stats_notify_callout.cf_c,
+                         bsp_coalesce_ticks(STATS_NOTIFY_SEC *
+                                            OS_TICKS_PER_SEC));
+    }
+}
+
+/**
+ * Called by the GATT server when the characteristic is registered.
+ */
+void
+stats_set_chr_handle(uint16_t def_handle)
+{
+    stats_chr_handle = def_handle;
+}
+
+static void
+stats_notify(void *arg)
+{
+    /* The stack only sends this if the peer subscribed; the read callback
+     * refreshes the values.
+     */
+    ble_gatts_chr_updated(stats_chr_handle);
+
+    os_callout_reset(&stats_notify_callout.cf_c,
+                     bsp_coalesce_ticks(STATS_NOTIFY_SEC * OS_TICKS_PER_SEC));
+}
+
+void
+stats_init(struct os_eventq *evq, struct os_mempool *mbuf_pool)
+{
+    stats_mbuf_pool = mbuf_pool;
+    quacker_stats.mbuf_low_water = mbuf_pool->mp_num_free;
+
+    os_callout_func_init(&stats_notify_callout, evq, stats_notify, NULL);
+}
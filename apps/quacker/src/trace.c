@@ -0,0 +1,215 @@
+/**
+ * Copyright 2016 ICE9 Consulting
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+/**
+ * Hot-path event tracer.
+ *
+ * Built with QUACKER_TRACE, TRACE(id, arg) stores a cputime timestamp (1 usec)
+ * and an event ID in a ring of the last TRACE_NUM_EVENTS events; otherwise
+ * it compiles to nothing.  Each event also records how long after the active
+ * connection's latest anchor point it happened, read from the link layer
+ * (llconn.c), so events line up with the connection events that carry
+ * them.  The ring can be read whole through the trace characteristic in the
+ * quacker service, or dumped to the console as
+ * "~T <usec> <id> <arg> <anchor>" lines.  tools/trace_timeline.py renders
+ * either as a timeline.
+ *
+ * Writing to the trace characteristic controls the tracer; it takes an
+ * encrypted link:
+ *
+ *     0   Clear the ring and start recording.
+ *     1   Freeze the ring so it can be read consistently.
+ *     2   Freeze the ring and dump it to the console.
+ */
+
+#ifdef QUACKER_TRACE
+
+#include <assert.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "os/os.h"
+#include "hal/hal_cputime.h"
+
+#include "quacker.h"
+
+/* The whole ring must fit in one ATT attribute (512 bytes). */
+#define TRACE_NUM_EVENTS    63
+
+/* Anchor offset when there is no connection, or past what 16 bits hold. */
+#define TRACE_ANCHOR_NONE   0xffff
+
+/* How long the console dump waits for the UART to make room. */
+#define TRACE_DUMP_TICKS    (OS_TICKS_PER_SEC / 100)
+
+struct trace_event {
+    uint32_t usec;
+    uint8_t id;
+    uint8_t arg;
+    uint16_t anchor;    /* usec since the last anchor point. */
+} __attribute__((packed));
+
+/* This is also the layout of the characteristic value (little endian). */
+struct trace_ring {
+    uint16_t head;
+    uint16_t count;
+    struct trace_event ev[TRACE_NUM_EVENTS];
+} __attribute__((packed));
+
+static struct trace_ring trace_ring;
+static int trace_frozen;
+
+static struct os_callout_func trace_dump_callout;
+static int trace_dump_pos;
+
+void
+trace_event(uint8_t id, uint8_t arg)
+{
+    struct trace_event *ev;
+    uint32_t anchor;
+    uint32_t usec;
+    uint32_t sr;
+
+    usec = cputime_get32();
+    if (llconn_since_anchor(gatt_svr_active_conn(), usec, &anchor) != 0 ||
+        anchor >= TRACE_ANCHOR_NONE) {
+
+        anchor = TRACE_ANCHOR_NONE;
+    }
+
+    OS_ENTER_CRITICAL(sr);
+    if (!trace_frozen) {
+        ev = trace_ring.ev + trace_ring.head;
+        ev->usec = usec;
+        ev->id = id;
+        ev->arg = arg;
+        ev->anchor = anchor;
+
+        if (++trace_ring.head == TRACE_NUM_EVENTS) {
+            trace_ring.head = 0;
+        }
+        if (trace_ring.count < TRACE_NUM_EVENTS) {
+            trace_ring.count++;
+        }
+    }
+    OS_EXIT_CRITICAL(sr);
+}
+
+static char *
+trace_put_hex(char *p, uint32_t val, int digits)
+{
+    static const char hex[] = "0123456789abcdef";
+
+    *p++ = ' ';
+    while (digits-- > 0) {
+        *p++ = hex[(val >> (digits * 4)) & 0xf];
+    }
+
+    return p;
+}
+
+/**
+ * Writes as much of the frozen ring to the console as fits, oldest first,
+ * and comes back for the rest.
+ */
+static void
+trace_dump_step(void *arg)
+{
+    struct trace_event *ev;
+    char line[24];
+    char *p;
+    int idx;
+
+    while (trace_dump_pos < trace_ring.count) {
+        idx = (trace_ring.head + TRACE_NUM_EVENTS - trace_ring.count +
+               trace_dump_pos) % TRACE_NUM_EVENTS;
+        ev = trace_ring.ev + idx;
+
+        p = line;
+        *p++ = '~';
+        *p++ = 'T';
+        p = trace_put_hex(p, ev->usec, 8);
+        p = trace_put_hex(p, ev->id, 2);
+        p = trace_put_hex(p, ev->arg, 2);
+        p = trace_put_hex(p, ev->anchor, 4);
+        *p++ = '\n';
+
+        if (qcons_room() < p - line) {
+            os_callout_reset(&trace_dump_callout.cf_c, TRACE_DUMP_TICKS);
+            return;
+        }
+        qcons_write(line, p - line);
+        trace_dump_pos++;
+    }
+}
+
+/**
+ * Handles a write to the trace characteristic.
+ *
+ * @return                      0 on success; nonzero on a bad command.
+ */
+int
+trace_control(uint8_t cmd)
+{
+    uint32_t sr;
+
+    switch (cmd) {
+    case 0:
+        OS_ENTER_CRITICAL(sr);
+        trace_ring.head = 0;
+        trace_ring.count = 0;
+        trace_frozen = 0;
+        OS_EXIT_CRITICAL(sr);
+        return 0;
+
+    case 1:
+        trace_frozen = 1;
+        return 0;
+
+    case 2:
+        trace_frozen = 1;
+        trace_dump_pos = 0;
+        trace_dump_step(NULL);
+        return 0;
+
+    default:
+        return -1;
+    }
+}
+
+/**
+ * Returns the ring in the characteristic's wire layout.  Freeze it first
+ * for a consistent read.
+ */
+const void *
+trace_data(uint16_t *len)
+{
+    *len = sizeof trace_ring;
+    return &trace_ring;
+}
+
+void
+trace_init(struct os_eventq *evq)
+{
+    os_callout_func_init(&trace_dump_callout, evq, trace_dump_step, NULL);
+}
+
+#endif /* QUACKER_TRACE */
@@ -0,0 +1,48 @@
+/**
+ * Copyright 2016 ICE9 Consulting
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+/* Host stand-in for the MCU hal_i2c interface; accel_mock.c implements it. */
+
+#ifndef H_TEST_HAL_I2C_
+#define H_TEST_HAL_I2C_
+
+#include <stdint.h>
+
+#include "bsp/bsp_sysid.h"
+
+struct hal_i2c;
+
+struct hal_i2c_master_data {
+    uint8_t address;
+    uint16_t len;
+    uint8_t *buffer;
+};
+
+struct hal_i2c *hal_i2c_init(enum system_device_id sysid);
+int hal_i2c_master_write(struct hal_i2c *i2c,
+                         struct hal_i2c_master_data *pdata);
+int hal_i2c_master_read(struct hal_i2c *i2c,
+                        struct hal_i2c_master_data *pdata);
+int hal_i2c_master_probe(struct hal_i2c *i2c, uint8_t address);
+int hal_i2c_master_begin(struct hal_i2c *i2c);
+int hal_i2c_master_end(struct hal_i2c *i2c);
+
+#endif
@@ -0,0 +1,53 @@
+#!/bin/sh
+#
+# Copyright 2016 ICE9 Consulting
+#
+# Licensed to the Apache Software Foundation (ASF) under one
+# or more contributor license agreements.  See the NOTICE file
+# distributed with this work for additional information
+# regarding copyright ownership.  The ASF licenses this file
+# to you under the Apache License, Version 2.0 (the
+# "License"); you may not use this file except in compliance
+# with the License.  You may obtain a copy of the License at
+#
+#  http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing,
+# software distributed under the License is distributed on an
+# "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+# KIND, either express or implied.  See the License for the
+# specific language governing permissions and limitations
+# under the License.
+#
+
+# Builds and runs the host tests for the hardware-independent parts of the
+# app with the host compiler.  include/ holds stand-ins for the few Mynewt
+# headers those sources pull in.  newt never sees this directory.
+#
+# Run from anywhere; CC overrides the compiler.
+
+set -e
+
+HERE=$(cd "$(dirname "$0")" && pwd)
+SRC=$HERE/../src
+CC=${CC:-cc}
+CFLAGS="-std=gnu99 -Wall -Werror -Wno-sign-compare -g -I$HERE/include -I$SRC"
+OUT=$(mktemp -d)
+trap 'rm -rf "$OUT"' EXIT
+
+# run_test <name> <sources...>
+run_test() {
+    name=$1
+    shift
+    $CC $CFLAGS -o "$OUT/$name" "$@"
+    "$OUT/$name"
+}
+
+run_test test_accel -DACCEL_MOCK \
+    "$HERE/test_accel.c" "$SRC/accel.c" "$SRC/accel_mock.c"
+
+run_test test_orient \
+    "$HERE/test_orient.c" "$SRC/orient.c"
+
+run_test test_hid \
+    "$HERE/test_hid.c" "$SRC/hid.c"
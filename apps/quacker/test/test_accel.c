@@ -0,0 +1,122 @@
+/**
+ * Copyright 2016 ICE9 Consulting
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+/**
+ * Host test for accel.c against the fake part in accel_mock.c.  Checks the
+ * driver's bus traffic as well as the values it returns: one transaction
+ * per sample, a re-read when a register is caught mid-update, and that
+ * each read acknowledges the interrupt.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "quacker.h"
+
+static int test_failures;
+
+#define TEST_CHECK(cond) do {                                           \
+    if (!(cond)) {                                                      \
+        fprintf(stderr, "%s:%d: check failed: %s\n",                    \
+                __FILE__, __LINE__, #cond);                             \
+        test_failures++;                                                \
+    }                                                                   \
+} while (0)
+
+/* TILT: register was being updated when read. */
+#define TEST_ALERT      0x40
+
+static void
+test_accel_init(void)
+{
+    TEST_CHECK(accel_init() == 0);
+    TEST_CHECK(accel_mock_int == 0);
+}
+
+static void
+test_accel_sample(void)
+{
+    struct accel_sample s;
+    int before;
+
+    accel_mock_push(5, -3, 21, 0x11);
+    accel_mock_push(-32, 31, 0, 0x02);
+    TEST_CHECK(accel_mock_int);
+
+    before = accel_mock_transactions;
+    TEST_CHECK(accel_read(&s) == 0);
+    TEST_CHECK(accel_mock_transactions == before + 1);
+    TEST_CHECK(s.x == 5 && s.y == -3 && s.z == 21 && s.tilt == 0x11);
+    TEST_CHECK(accel_mock_int);
+
+    TEST_CHECK(accel_read(&s) == 0);
+    TEST_CHECK(accel_mock_transactions == before + 2);
+    TEST_CHECK(s.x == -32 && s.y == 31 && s.z == 0 && s.tilt == 0x02);
+    TEST_CHECK(accel_mock_int == 0);
+}
+
+static void
+test_accel_alert(void)
+{
+    struct accel_sample s;
+    int before;
+
+    /* The first burst is caught mid-update; the driver must read again. */
+    accel_mock_push(1, 1, 1, 0x05 | TEST_ALERT);
+    accel_mock_push(2, 2, 2, 0x06);
+
+    before = accel_mock_transactions;
+    TEST_CHECK(accel_read(&s) == 0);
+    TEST_CHECK(accel_mock_transactions == before + 2);
+    TEST_CHECK(s.x == 2 && s.tilt == 0x06);
+    TEST_CHECK(accel_mock_int == 0);
+}
+
+static void
+test_accel_modes(void)
+{
+    int before;
+
+    /* Standby, three config registers, then MODE again. */
+    before = accel_mock_transactions;
+    TEST_CHECK(accel_set_streaming(1) == 0);
+    TEST_CHECK(accel_mock_transactions == before + 5);
+
+    before = accel_mock_transactions;
+    TEST_CHECK(accel_sleep() == 0);
+    TEST_CHECK(accel_mock_transactions == before + 1);
+}
+
+int
+main(void)
+{
+    test_accel_init();
+    test_accel_sample();
+    test_accel_alert();
+    test_accel_modes();
+
+    if (test_failures != 0) {
+        printf("test_accel: %d failed\n", test_failures);
+        return EXIT_FAILURE;
+    }
+    printf("test_accel: ok\n");
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,345 @@
+/**
+ * Copyright 2016 ICE9 Consulting
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+/**
+ * Host test for hid.c.  Feeds scripted button edges, hold time and key
+ * changes to the HID engine and checks the exact reports it hands to the
+ * sink, how many it suppressed as repeats and how many host switches it
+ * asked for.  Also checks that a report the sink refuses is counted as
+ * dropped and sent again next time rather than suppressed.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "quacker.h"
+#include "hid_map.h"
+
+struct quacker_stats quacker_stats;
+
+static int test_failures;
+
+#define TEST_CHECK(cond) do {                                           \
+    if (!(cond)) {                                                      \
+        fprintf(stderr, "%s:%d: check failed: %s\n",                    \
+                __FILE__, __LINE__, #cond);                             \
+        test_failures++;                                                \
+    }                                                                   \
+} while (0)
+
+/* hid.c's defaults; every test replaces them. */
+int
+gatt_svr_report_notify(int which, const void *data, int len)
+{
+    return 0;
+}
+
+int
+gatt_svr_next_target(void)
+{
+    return 0;
+}
+
+/**
+ * A script is a list of steps fed to the HID engine and the reports it
+ * must produce, in order.
+ */
+enum test_hid_op {
+    TEST_HID_BUTTON,            /* hid_button(arg, val) */
+    TEST_HID_POLL,              /* hid_poll(val) */
+    TEST_HID_KEY,               /* hid_key(arg, val) */
+};
+
+struct test_hid_step {
+    uint8_t op;
+    uint8_t arg;
+    uint16_t val;
+};
+
+struct test_hid_report {
+    uint8_t which;
+    uint8_t data[HID_MAX_SIZE];
+};
+
+#define TEST_HID_MAX_STEPS      16
+#define TEST_HID_MAX_REPORTS    16
+
+struct test_hid_script {
+    const char *name;
+    struct test_hid_step steps[TEST_HID_MAX_STEPS];
+    int num_steps;
+    struct test_hid_report reports[TEST_HID_MAX_REPORTS];
+    int num_reports;
+    int suppressed;
+    int switches;
+};
+
+#define TEST_HID_K(...)     { HID_KEYBOARD, { __VA_ARGS__ } }
+#define TEST_HID_C(...)     { HID_CONSUMER, { __VA_ARGS__ } }
+#define TEST_HID_V(...)     { HID_VENDOR, { __VA_ARGS__ } }
+
+static const struct test_hid_script test_hid_scripts[] = {
+    {
+        /* Left has a hold action, so its arrow waits for the release. */
+        .name = "tap",
+        .steps = { { TEST_HID_BUTTON, 0, 1 }, { TEST_HID_POLL, 0, 100 },
+                   { TEST_HID_BUTTON, 0, 0 } },
+        .num_steps = 3,
+        .reports = { TEST_HID_K(0, 0, HID_KEY_LEFT), TEST_HID_K(0) },
+        .num_reports = 2,
+    },
+    {
+        /* Right has none; its arrow goes out on the press. */
+        .name = "press",
+        .steps = { { TEST_HID_BUTTON, 1, 1 }, { TEST_HID_POLL, 0, 1000 },
+                   { TEST_HID_BUTTON, 1, 0 } },
+        .num_steps = 3,
+        .reports = { TEST_HID_K(0, 0, HID_KEY_RIGHT), TEST_HID_K(0) },
+        .num_reports = 2,
+    },
+    {
+        .name = "hold",
+        .steps = { { TEST_HID_BUTTON, 0, 1 }, { TEST_HID_POLL, 0, 400 },
+                   { TEST_HID_POLL, 0, 400 }, { TEST_HID_POLL, 0, 400 },
+                   { TEST_HID_BUTTON, 0, 0 } },
+        .num_steps = 5,
+        .reports = { TEST_HID_V(HID_VENDOR_BLANK), TEST_HID_V(0) },
+        .num_reports = 2,
+    },
+    {
+        /* A held button turns presses of the other into volume steps. */
+        .name = "volume",
+        .steps = { { TEST_HID_BUTTON, 0, 1 }, { TEST_HID_POLL, 0, 1000 },
+                   { TEST_HID_BUTTON, 1, 1 }, { TEST_HID_BUTTON, 1, 0 },
+                   { TEST_HID_BUTTON, 1, 1 }, { TEST_HID_BUTTON, 1, 0 },
+                   { TEST_HID_BUTTON, 0, 0 } },
+        .num_steps = 7,
+        .reports = { TEST_HID_C(HID_CONSUMER_VOLUME_UP), TEST_HID_C(0),
+                     TEST_HID_C(HID_CONSUMER_VOLUME_UP), TEST_HID_C(0) },
+        .num_reports = 4,
+    },
+    {
+        /* The chord cancels the waiting arrow and goes out on release. */
+        .name = "chord",
+        .steps = { { TEST_HID_BUTTON, 0, 1 }, { TEST_HID_BUTTON, 1, 1 },
+                   { TEST_HID_POLL, 0, 1000 }, { TEST_HID_BUTTON, 1, 0 },
+                   { TEST_HID_BUTTON, 0, 0 } },
+        .num_steps = 5,
+        .reports = { TEST_HID_V(HID_VENDOR_LASER), TEST_HID_V(0) },
+        .num_reports = 2,
+    },
+    {
+        /* Right first has already sent its arrow; left is then a tap. */
+        .name = "no chord",
+        .steps = { { TEST_HID_BUTTON, 1, 1 }, { TEST_HID_BUTTON, 0, 1 },
+                   { TEST_HID_BUTTON, 0, 0 }, { TEST_HID_BUTTON, 1, 0 } },
+        .num_steps = 4,
+        .reports = { TEST_HID_K(0, 0, HID_KEY_RIGHT), TEST_HID_K(0),
+                     TEST_HID_K(0, 0, HID_KEY_LEFT), TEST_HID_K(0) },
+        .num_reports = 4,
+    },
+    {
+        /* Holding the chord switches hosts instead, and sends nothing. */
+        .name = "switch",
+        .steps = { { TEST_HID_BUTTON, 0, 1 }, { TEST_HID_BUTTON, 1, 1 },
+                   { TEST_HID_POLL, 0, 2500 }, { TEST_HID_BUTTON, 1, 0 },
+                   { TEST_HID_BUTTON, 0, 0 } },
+        .num_steps = 5,
+        .num_reports = 0,
+        .switches = 1,
+    },
+    {
+        /* Overlapping keys share a report; repeats are not resent. */
+        .name = "rollover",
+        .steps = { { TEST_HID_KEY, HID_KEY_LEFT, 1 },
+                   { TEST_HID_KEY, HID_KEY_LEFT, 1 },
+                   { TEST_HID_KEY, HID_KEY_RIGHT, 1 },
+                   { TEST_HID_KEY, HID_KEY_LEFT, 0 },
+                   { TEST_HID_KEY, HID_KEY_RIGHT, 0 },
+                   { TEST_HID_KEY, HID_KEY_RIGHT, 0 } },
+        .num_steps = 6,
+        .reports = { TEST_HID_K(0, 0, HID_KEY_LEFT),
+                     TEST_HID_K(0, 0, HID_KEY_LEFT, HID_KEY_RIGHT),
+                     TEST_HID_K(0, 0, HID_KEY_RIGHT), TEST_HID_K(0) },
+        .num_reports = 4,
+        .suppressed = 2,
+    },
+    {
+        /*
+         * Six keys fit in a report; a seventh is ignored, so its press and
+         * release both repeat the report before them.
+         */
+        .name = "6kro",
+        .steps = { { TEST_HID_KEY, 0x04, 1 }, { TEST_HID_KEY, 0x05, 1 },
+                   { TEST_HID_KEY, 0x06, 1 }, { TEST_HID_KEY, 0x07, 1 },
+                   { TEST_HID_KEY, 0x08, 1 }, { TEST_HID_KEY, 0x09, 1 },
+                   { TEST_HID_KEY, 0x0a, 1 }, { TEST_HID_KEY, 0x04, 0 },
+                   { TEST_HID_KEY, 0x05, 0 }, { TEST_HID_KEY, 0x06, 0 },
+                   { TEST_HID_KEY, 0x07, 0 }, { TEST_HID_KEY, 0x08, 0 },
+                   { TEST_HID_KEY, 0x09, 0 }, { TEST_HID_KEY, 0x0a, 0 } },
+        .num_steps = 14,
+        .reports = { TEST_HID_K(0, 0, 0x04),
+                     TEST_HID_K(0, 0, 0x04, 0x05),
+                     TEST_HID_K(0, 0, 0x04, 0x05, 0x06),
+                     TEST_HID_K(0, 0, 0x04, 0x05, 0x06, 0x07),
+                     TEST_HID_K(0, 0, 0x04, 0x05, 0x06, 0x07, 0x08),
+                     TEST_HID_K(0, 0, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09),
+                     TEST_HID_K(0, 0, 0x05, 0x06, 0x07, 0x08, 0x09),
+                     TEST_HID_K(0, 0, 0x06, 0x07, 0x08, 0x09),
+                     TEST_HID_K(0, 0, 0x07, 0x08, 0x09),
+                     TEST_HID_K(0, 0, 0x08, 0x09),
+                     TEST_HID_K(0, 0, 0x09),
+                     TEST_HID_K(0) },
+        .num_reports = 12,
+        .suppressed = 2,
+    },
+};
+#define TEST_HID_NUM_SCRIPTS \
+    (sizeof test_hid_scripts / sizeof test_hid_scripts[0])
+
+static struct test_hid_report test_hid_got[TEST_HID_MAX_REPORTS];
+static int test_hid_num_got;
+static int test_hid_switches;
+static int test_hid_refuse;
+
+static int
+test_hid_capture(int which, const void *data, int len)
+{
+    if (test_hid_refuse) {
+        return 1;
+    }
+
+    if (test_hid_num_got < TEST_HID_MAX_REPORTS) {
+        test_hid_got[test_hid_num_got].which = which;
+        memcpy(test_hid_got[test_hid_num_got].data, data, len);
+    }
+    test_hid_num_got++;
+
+    return 0;
+}
+
+static int
+test_hid_switch(void)
+{
+    test_hid_switches++;
+    return 0;
+}
+
+static void
+test_hid_reset(void)
+{
+    hid_set_sink(test_hid_capture);
+    hid_set_switch(test_hid_switch);
+    memset(&quacker_stats, 0, sizeof quacker_stats);
+    test_hid_num_got = 0;
+    test_hid_switches = 0;
+    test_hid_refuse = 0;
+}
+
+static void
+test_hid_scripts_run(void)
+{
+    const struct test_hid_script *script;
+    const struct test_hid_step *step;
+    const struct test_hid_report *want;
+    int match;
+    int i;
+    int j;
+
+    for (i = 0; i < TEST_HID_NUM_SCRIPTS; i++) {
+        script = test_hid_scripts + i;
+        test_hid_reset();
+
+        for (j = 0; j < script->num_steps; j++) {
+            step = script->steps + j;
+            switch (step->op) {
+            case TEST_HID_BUTTON:
+                hid_button(step->arg, step->val);
+                break;
+            case TEST_HID_POLL:
+                hid_poll(step->val);
+                break;
+            case TEST_HID_KEY:
+                hid_key(step->arg, step->val);
+                break;
+            }
+        }
+
+        match = test_hid_num_got == script->num_reports &&
+                quacker_stats.notify_suppressed == script->suppressed &&
+                test_hid_switches == script->switches;
+        for (j = 0; match && j < script->num_reports; j++) {
+            want = script->reports + j;
+            match = test_hid_got[j].which == want->which &&
+                    memcmp(test_hid_got[j].data, want->data,
+                           hid_report_size(want->which)) == 0;
+        }
+
+        if (!match) {
+            fprintf(stderr, "script %s: reports=%d/%d suppressed=%lu/%d "
+                            "switches=%d/%d\n",
+                    script->name, test_hid_num_got, script->num_reports,
+                    (unsigned long)quacker_stats.notify_suppressed,
+                    script->suppressed, test_hid_switches,
+                    script->switches);
+            test_failures++;
+        }
+    }
+}
+
+static void
+test_hid_dropped(void)
+{
+    test_hid_reset();
+
+    /* Refused, so the host never had it and it isn't a repeat. */
+    test_hid_refuse = 1;
+    hid_key(HID_KEY_RIGHT, 1);
+    TEST_CHECK(quacker_stats.notify_dropped == 1);
+    TEST_CHECK(test_hid_num_got == 0);
+
+    test_hid_refuse = 0;
+    hid_key(HID_KEY_RIGHT, 1);
+    TEST_CHECK(quacker_stats.notify_suppressed == 0);
+    TEST_CHECK(test_hid_num_got == 1);
+
+    /* A new connection has seen nothing. */
+    hid_conn_reset();
+    hid_key(HID_KEY_RIGHT, 1);
+    TEST_CHECK(test_hid_num_got == 2);
+    hid_key(HID_KEY_RIGHT, 0);
+    TEST_CHECK(test_hid_num_got == 3);
+}
+
+int
+main(void)
+{
+    test_hid_scripts_run();
+    test_hid_dropped();
+
+    if (test_failures != 0) {
+        printf("test_hid: %d failed\n", test_failures);
+        return EXIT_FAILURE;
+    }
+    printf("test_hid: ok\n");
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,135 @@
+/**
+ * Copyright 2016 ICE9 Consulting
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+/**
+ * Host test for orient.c.  Replays the fixed traces in orient_traces.h,
+ * which the QUACKER_BENCH build also times on the badge, and checks the
+ * stable result of each.  Also checks that nothing is reported before a
+ * posture has held for a second, and that orient_reset() keeps the last
+ * stable result.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "quacker.h"
+#include "orient_traces.h"
+
+static int test_failures;
+
+#define TEST_CHECK(cond) do {                                           \
+    if (!(cond)) {                                                      \
+        fprintf(stderr, "%s:%d: check failed: %s\n",                    \
+                __FILE__, __LINE__, #cond);                             \
+        test_failures++;                                                \
+    }                                                                   \
+} while (0)
+
+/* Streaming samples in one second; see ORIENT_STABLE_SAMPLES. */
+#define TEST_STABLE_SAMPLES 16
+
+static enum orientation_t
+test_replay(const struct orient_trace *trace)
+{
+    enum orientation_t result;
+    int i;
+
+    result = NONE;
+    for (i = 0; i < trace->num_samples; i++) {
+        result = orient_update(trace->samples + i);
+    }
+
+    return result;
+}
+
+static void
+test_orient_traces(void)
+{
+    const struct orient_trace *trace;
+    enum orientation_t result;
+    int i;
+
+    for (i = 0; i < ORIENT_NUM_TRACES; i++) {
+        trace = orient_traces + i;
+        orient_init();
+        result = test_replay(trace);
+        if (result != trace->expect) {
+            fprintf(stderr, "trace %s: got=%d expect=%d\n",
+                    trace->name, result, trace->expect);
+            test_failures++;
+        }
+    }
+}
+
+static void
+test_orient_settle(void)
+{
+    const struct orient_trace *trace;
+    int i;
+
+    trace = orient_traces + 0;
+    TEST_CHECK(trace->num_samples > TEST_STABLE_SAMPLES);
+
+    orient_init();
+    for (i = 0; i < TEST_STABLE_SAMPLES; i++) {
+        TEST_CHECK(orient_update(trace->samples + i) == NONE);
+    }
+}
+
+static void
+test_orient_reset(void)
+{
+    const struct orient_trace *flat;
+    const struct orient_trace *upright;
+    int i;
+
+    flat = orient_traces + 0;
+    upright = orient_traces + 1;
+    TEST_CHECK(flat->expect == FLAT && upright->expect == UPRIGHT);
+
+    orient_init();
+    TEST_CHECK(test_replay(flat) == FLAT);
+
+    /* Restarting on a new posture reports the old one until it settles. */
+    orient_reset(upright->samples + 0);
+    for (i = 1; i < TEST_STABLE_SAMPLES; i++) {
+        TEST_CHECK(orient_update(upright->samples + i) == FLAT);
+    }
+    TEST_CHECK(test_replay(upright) == UPRIGHT);
+
+    orient_init();
+    TEST_CHECK(orient_update(upright->samples + 0) == NONE);
+}
+
+int
+main(void)
+{
+    test_orient_traces();
+    test_orient_settle();
+    test_orient_reset();
+
+    if (test_failures != 0) {
+        printf("test_orient: %d failed\n", test_failures);
+        return EXIT_FAILURE;
+    }
+    printf("test_orient: ok\n");
+    return EXIT_SUCCESS;
+}
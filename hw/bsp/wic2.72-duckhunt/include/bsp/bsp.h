@@ -20,6 +20,8 @@
 #ifndef H_BSP_H
 #define H_BSP_H
 
+#include <inttypes.h>
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -31,6 +33,9 @@ extern "C" {
 /* More convenient section placement macros. */
 #define bssnz_t
 
+/* Survives a reset; contents are garbage after power-on. */
+#define sec_noinit      __attribute__((section(".noinit")))
+
 /* LED pins */
 #define LED_BLINK_PIN   (14)
 
@@ -57,11 +62,36 @@ extern "C" {
 #define BUTTON1         (29)
 #define BUTTON2         (28)
 
+/*
+ * MMA7660FC accelerometer (U1) on TWI0 (I2C0); INT is push-pull, active
+ * low.  SCL and SDA have 2.2k pull-ups on the board (R4, R3).
+ */
+#define ACCEL_SCL       (21)
+#define ACCEL_SDA       (22)
+#define ACCEL_INT       (25)
+
 /* UART info */
 #define CONSOLE_UART    0
 
 int bsp_imgr_current_slot(void);
 
+/*
+ * Tickless idle.  Timers that can tolerate some slack round their deadlines
+ * up to a multiple of BSP_COALESCE_TICKS (1/32 s) so they expire together.
+ */
+#define BSP_COALESCE_TICKS  (OS_TICKS_PER_SEC / 32)
+
+uint32_t bsp_coalesce_ticks(uint32_t ticks);
+uint32_t bsp_idle_wakeups_per_min(void);
+
+/*
+ * Watchdog, reloaded from the idle task.  A soft reset leaves it running;
+ * only its own, a pin or a power-on reset stops it.
+ */
+void bsp_watchdog_init(uint32_t msec, void (*timeout_isr)(void));
+void bsp_watchdog_checkin(uint32_t ticks);
+uint32_t bsp_watchdog_msec(void);
+
 #define NFFS_AREA_MAX    (8)
 
 
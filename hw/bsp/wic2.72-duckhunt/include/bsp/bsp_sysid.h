@@ -27,6 +27,7 @@ extern "C" {
 enum system_device_id  
 {
     RESERVED,
+    I2C0,
 };
 
 #ifdef __cplusplus
@@ -19,7 +19,12 @@
 
 #include <stdint.h>
 #include <stddef.h>
+#include "bsp/bsp.h"
+#include "bsp/bsp_sysid.h"
+#include "hal/hal_i2c_int.h"
 #include "mcu/nrf51_hal.h"
+#include "mcu/nrf51_bitfields.h"
+#include "hal_i2c_twi.h"
 
 static const struct nrf51_uart_cfg uart_cfg = {
     .suc_pin_tx = 23,
@@ -33,6 +38,23 @@ const struct nrf51_uart_cfg *bsp_uart_config(void)
     return &uart_cfg;
 }
 
+static const struct hal_i2c_twi_cfg i2c0_cfg = {
+    .scl_pin = ACCEL_SCL,
+    .sda_pin = ACCEL_SDA,
+    .frequency = TWI_FREQUENCY_FREQUENCY_K400
+};
+
+struct hal_i2c *
+bsp_get_hal_i2c_driver(enum system_device_id sysid)
+{
+    switch (sysid) {
+    case I2C0:
+        return hal_i2c_twi_init(&i2c0_cfg);
+    default:
+        return NULL;
+    }
+}
+
 const struct hal_flash *
 bsp_flash_dev(uint8_t id)
 {
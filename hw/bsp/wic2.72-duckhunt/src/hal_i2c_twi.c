@@ -0,0 +1,326 @@
+/**
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+/*
+ * hal_i2c driver for the nRF51's TWI0, polled.
+ *
+ * The MCU package has no TWI driver for this HAL, so the BSP carries one.
+ * Transfers are short register accesses, a few bytes at 400 kHz, so the
+ * caller spins on the TWI events instead of taking an interrupt.
+ *
+ * hal_i2c_master_write() leaves the bus held (no STOP), so a read that
+ * follows in the same begin/end pair goes out as a repeated START, as
+ * register reads on most parts expect.  hal_i2c_master_read() ends with a
+ * STOP, and hal_i2c_master_end() sends one if a write left the bus held.
+ *
+ * A reset in the middle of a read can leave the slave driving SDA low.
+ * Init clocks SCL until it lets go.  After a bus error or a timeout the
+ * peripheral is power cycled, which is the only way out of some of its
+ * stuck states (nRF51 errata).
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include "hal/hal_i2c.h"
+#include "hal/hal_i2c_int.h"
+#include "mcu/nrf51.h"
+#include "mcu/nrf51_bitfields.h"
+#include "hal_i2c_twi.h"
+
+#define TWI                 NRF_TWI0
+
+/* Polls per event; far longer than a byte takes at 100 kHz. */
+#define TWI_TIMEOUT         10000
+
+/* SCL pulses that free any slave stuck mid-byte. */
+#define TWI_RECOVER_CLOCKS  9
+
+struct hal_i2c_twi {
+    struct hal_i2c parent;
+    const struct hal_i2c_twi_cfg *cfg;
+    int held;                   /* A write left the bus without a STOP. */
+};
+
+static struct hal_i2c_twi hal_i2c_twi_dev;
+
+static void
+twi_pin_cfg(int pin, uint32_t dir)
+{
+    /* Open drain; the board has external pull-ups. */
+    NRF_GPIO->PIN_CNF[pin] =
+        (GPIO_PIN_CNF_SENSE_Disabled << GPIO_PIN_CNF_SENSE_Pos) |
+        (GPIO_PIN_CNF_DRIVE_S0D1 << GPIO_PIN_CNF_DRIVE_Pos) |
+        (GPIO_PIN_CNF_PULL_Disabled << GPIO_PIN_CNF_PULL_Pos) |
+        (GPIO_PIN_CNF_INPUT_Connect << GPIO_PIN_CNF_INPUT_Pos) |
+        (dir << GPIO_PIN_CNF_DIR_Pos);
+}
+
+static void
+twi_delay(void)
+{
+    volatile int i;
+
+    /* About 5 usec at 16 MHz: half an SCL period at 100 kHz. */
+    for (i = 0; i < 20; i++) {
+    }
+}
+
+/**
+ * Clocks SCL by hand until SDA is released, then sends a STOP.
+ */
+static void
+twi_recover(const struct hal_i2c_twi_cfg *cfg)
+{
+    int i;
+
+    NRF_GPIO->OUTSET = (1UL << cfg->scl_pin) | (1UL << cfg->sda_pin);
+    twi_pin_cfg(cfg->scl_pin, GPIO_PIN_CNF_DIR_Output);
+    twi_pin_cfg(cfg->sda_pin, GPIO_PIN_CNF_DIR_Output);
+
+    for (i = 0; i < TWI_RECOVER_CLOCKS; i++) {
+        if (NRF_GPIO->IN & (1UL << cfg->sda_pin)) {
+            break;
+        }
+        NRF_GPIO->OUTCLR = 1UL << cfg->scl_pin;
+        twi_delay();
+        NRF_GPIO->OUTSET = 1UL << cfg->scl_pin;
+        twi_delay();
+    }
+
+    /* STOP: SDA rises while SCL is high. */
+    NRF_GPIO->OUTCLR = 1UL << cfg->sda_pin;
+    twi_delay();
+    NRF_GPIO->OUTSET = 1UL << cfg->sda_pin;
+    twi_delay();
+
+    twi_pin_cfg(cfg->scl_pin, GPIO_PIN_CNF_DIR_Input);
+    twi_pin_cfg(cfg->sda_pin, GPIO_PIN_CNF_DIR_Input);
+}
+
+static void
+twi_enable(const struct hal_i2c_twi_cfg *cfg)
+{
+    TWI->ENABLE = TWI_ENABLE_ENABLE_Disabled << TWI_ENABLE_ENABLE_Pos;
+    TWI->PSELSCL = cfg->scl_pin;
+    TWI->PSELSDA = cfg->sda_pin;
+    TWI->FREQUENCY = cfg->frequency;
+    TWI->SHORTS = 0;
+    TWI->EVENTS_RXDREADY = 0;
+    TWI->EVENTS_TXDSENT = 0;
+    TWI->EVENTS_STOPPED = 0;
+    TWI->EVENTS_ERROR = 0;
+    TWI->EVENTS_BB = 0;
+    TWI->ENABLE = TWI_ENABLE_ENABLE_Enabled << TWI_ENABLE_ENABLE_Pos;
+}
+
+/**
+ * Gives up on a transfer: power cycles the peripheral and frees the bus.
+ */
+static int
+twi_fail(struct hal_i2c_twi *dev)
+{
+    TWI->ERRORSRC = TWI->ERRORSRC;
+    TWI->POWER = 0;
+    TWI->POWER = 1;
+    twi_recover(dev->cfg);
+    twi_enable(dev->cfg);
+    dev->held = 0;
+
+    return -1;
+}
+
+/**
+ * Waits for the specified event, or an error.
+ *
+ * @return                      0 once it fired; -1 on an error or timeout.
+ */
+static int
+twi_wait(volatile uint32_t *event)
+{
+    int i;
+
+    for (i = 0; i < TWI_TIMEOUT; i++) {
+        if (TWI->EVENTS_ERROR) {
+            return -1;
+        }
+        if (*event) {
+            *event = 0;
+            return 0;
+        }
+    }
+
+    return -1;
+}
+
+static int
+twi_stop(struct hal_i2c_twi *dev)
+{
+    TWI->EVENTS_STOPPED = 0;
+    TWI->TASKS_STOP = 1;
+    if (twi_wait(&TWI->EVENTS_STOPPED) != 0) {
+        return twi_fail(dev);
+    }
+    dev->held = 0;
+
+    return 0;
+}
+
+static int
+hal_i2c_twi_write(struct hal_i2c *pi2c, struct hal_i2c_master_data *ppkt)
+{
+    struct hal_i2c_twi *dev;
+    int i;
+
+    dev = (struct hal_i2c_twi *)pi2c;
+    if (ppkt->len == 0) {
+        return -1;
+    }
+
+    TWI->ADDRESS = ppkt->address;
+    TWI->SHORTS = 0;
+    TWI->EVENTS_TXDSENT = 0;
+    TWI->EVENTS_ERROR = 0;
+    TWI->TXD = ppkt->buffer[0];
+    TWI->TASKS_STARTTX = 1;
+
+    for (i = 1; ; i++) {
+        if (twi_wait(&TWI->EVENTS_TXDSENT) != 0) {
+            return twi_fail(dev);
+        }
+        if (i == ppkt->len) {
+            break;
+        }
+        TWI->TXD = ppkt->buffer[i];
+    }
+    dev->held = 1;
+
+    return 0;
+}
+
+static int
+hal_i2c_twi_read(struct hal_i2c *pi2c, struct hal_i2c_master_data *ppkt)
+{
+    struct hal_i2c_twi *dev;
+    int i;
+
+    dev = (struct hal_i2c_twi *)pi2c;
+    if (ppkt->len == 0) {
+        return -1;
+    }
+
+    /* Each byte suspends the TWI at its BB event; the last one stops it
+     * instead, so it is NACKed and the STOP follows.
+     */
+    TWI->ADDRESS = ppkt->address;
+    TWI->EVENTS_RXDREADY = 0;
+    TWI->EVENTS_STOPPED = 0;
+    TWI->EVENTS_ERROR = 0;
+    TWI->SHORTS = ppkt->len == 1 ? TWI_SHORTS_BB_STOP_Msk
+                                 : TWI_SHORTS_BB_SUSPEND_Msk;
+    TWI->TASKS_STARTRX = 1;
+
+    for (i = 0; i < ppkt->len; i++) {
+        if (twi_wait(&TWI->EVENTS_RXDREADY) != 0) {
+            return twi_fail(dev);
+        }
+        ppkt->buffer[i] = TWI->RXD;
+
+        if (i + 1 < ppkt->len) {
+            if (i + 2 == ppkt->len) {
+                TWI->SHORTS = TWI_SHORTS_BB_STOP_Msk;
+            }
+            /* Too soon after RXDREADY and the resume is lost (PAN 56). */
+            twi_delay();
+            TWI->TASKS_RESUME = 1;
+        }
+    }
+
+    if (twi_wait(&TWI->EVENTS_STOPPED) != 0) {
+        return twi_fail(dev);
+    }
+    TWI->SHORTS = 0;
+    dev->held = 0;
+
+    return 0;
+}
+
+/**
+ * Reads a byte; the slave is there if it ACKs its address.
+ */
+static int
+hal_i2c_twi_probe(struct hal_i2c *pi2c, uint8_t address)
+{
+    struct hal_i2c_master_data data;
+    uint8_t byte;
+
+    data.address = address;
+    data.len = 1;
+    data.buffer = &byte;
+
+    return hal_i2c_twi_read(pi2c, &data);
+}
+
+static int
+hal_i2c_twi_begin(struct hal_i2c *pi2c)
+{
+    return 0;
+}
+
+static int
+hal_i2c_twi_end(struct hal_i2c *pi2c)
+{
+    struct hal_i2c_twi *dev;
+
+    dev = (struct hal_i2c_twi *)pi2c;
+    if (dev->held) {
+        return twi_stop(dev);
+    }
+
+    return 0;
+}
+
+static const struct hal_i2c_funcs hal_i2c_twi_funcs = {
+    .hi2cm_write_data = hal_i2c_twi_write,
+    .hi2cm_read_data = hal_i2c_twi_read,
+    .hi2cm_probe = hal_i2c_twi_probe,
+    .hi2cm_start = hal_i2c_twi_begin,
+    .hi2cm_stop = hal_i2c_twi_end,
+};
+
+/**
+ * Routes TWI0 to the specified pins and frees the bus.  There is only the
+ * one TWI device; a second call reconfigures it.
+ */
+struct hal_i2c *
+hal_i2c_twi_init(const struct hal_i2c_twi_cfg *cfg)
+{
+    struct hal_i2c_twi *dev;
+
+    dev = &hal_i2c_twi_dev;
+    dev->parent.driver_api = &hal_i2c_twi_funcs;
+    dev->cfg = cfg;
+    dev->held = 0;
+
+    twi_pin_cfg(cfg->scl_pin, GPIO_PIN_CNF_DIR_Input);
+    twi_pin_cfg(cfg->sda_pin, GPIO_PIN_CNF_DIR_Input);
+    twi_recover(cfg);
+    twi_enable(cfg);
+
+    return &dev->parent;
+}
@@ -0,0 +1,36 @@
+/**
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#ifndef H_HAL_I2C_TWI_
+#define H_HAL_I2C_TWI_
+
+#include <stdint.h>
+
+struct hal_i2c;
+
+/* One TWI peripheral and the pins it is routed to. */
+struct hal_i2c_twi_cfg {
+    uint8_t scl_pin;
+    uint8_t sda_pin;
+    uint32_t frequency;         /* TWI_FREQUENCY_FREQUENCY_*. */
+};
+
+struct hal_i2c *hal_i2c_twi_init(const struct hal_i2c_twi_cfg *cfg);
+
+#endif
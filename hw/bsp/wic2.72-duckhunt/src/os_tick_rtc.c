@@ -0,0 +1,318 @@
+/**
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+/*
+ * OS tick on RTC1, clocked from the 32.768 kHz crystal (X2).
+ *
+ * While tasks are running the RTC interrupts once per OS tick.  When the idle
+ * task runs it passes the number of ticks until the next real deadline; the
+ * compare register is pushed out that far and the CPU sleeps in WFI until
+ * then.  The OS time is caught up from the RTC counter on wakeup.  Unlike a
+ * TIMER-based tick this keeps working with the 16 MHz clock stopped: idle
+ * drops from about 0.5 mA (16 MHz crystal and TIMER1 kept running) to the
+ * datasheet's 2.6 uA for System ON with the RTC on LFCLK.
+ *
+ * This replaces hal_os_tick.c in the nrf51xxx MCU package, which the BSP's
+ * pkg.yml leaves out of the build (pkg.ign_files).
+ *
+ * OS_TICKS_PER_SEC does not divide 32768, so the remainder of each
+ * conversion is carried forward in os_tick_rem (in units of
+ * 1/(32768 * OS_TICKS_PER_SEC) seconds) and no time is lost.
+ *
+ * The watchdog is reloaded here too, on the way into WFI: a task that never
+ * blocks keeps the idle task from running and lets it expire.  Idle periods
+ * are capped at half its timeout.
+ */
+
+#include <assert.h>
+#include <stdint.h>
+#include "os/os.h"
+#include "bsp/bsp.h"
+#include "bsp/cmsis_nvic.h"
+#include "mcu/nrf51.h"
+#include "mcu/nrf51_bitfields.h"
+
+#define OS_TICK_RTC         NRF_RTC1
+#define OS_TICK_IRQ         RTC1_IRQn
+#define OS_TICK_CMPREG      0
+
+#define RTC_FREQ            32768
+#define RTC_FREQ_SHIFT      15
+#define RTC_COUNTER_MASK    0x00ffffff
+
+/* The compare register must be at least two counts ahead of COUNTER. */
+#define RTC_MIN_CMP         2
+
+/*
+ * Longest idle period in RTC counts.  Keeps delta * OS_TICKS_PER_SEC within
+ * 32 bits and well inside the 24-bit counter.
+ */
+#define RTC_MAX_IDLE        (1UL << 21)
+#define OS_TICK_MAX_IDLE    (RTC_MAX_IDLE / RTC_FREQ * OS_TICKS_PER_SEC)
+
+/* Window over which wakeups are counted. */
+#define WAKEUP_WINDOW       (60UL * RTC_FREQ)
+
+static uint32_t os_tick_lastcnt;
+static uint32_t os_tick_rem;
+
+static uint32_t bsp_wakeups;
+static uint32_t bsp_wakeups_window;
+static uint32_t bsp_wakeups_last_min;
+
+static os_time_t wdt_max_idle;      /* 0 if the watchdog isn't ours. */
+static os_time_t wdt_deadline;
+
+static inline uint32_t
+rtc_delta(uint32_t from, uint32_t to)
+{
+    return (to - from) & RTC_COUNTER_MASK;
+}
+
+static void
+rtc_set_ocmp(uint32_t cnt)
+{
+    uint32_t now;
+
+    OS_TICK_RTC->EVENTS_COMPARE[OS_TICK_CMPREG] = 0;
+
+    now = OS_TICK_RTC->COUNTER;
+    if (rtc_delta(now, cnt) < RTC_MIN_CMP ||
+        rtc_delta(now, cnt) > RTC_MAX_IDLE) {
+        cnt = now + RTC_MIN_CMP;
+    }
+    OS_TICK_RTC->CC[OS_TICK_CMPREG] = cnt & RTC_COUNTER_MASK;
+}
+
+/**
+ * Number of RTC counts after os_tick_lastcnt at which 'ticks' OS ticks will
+ * have elapsed.
+ */
+static uint32_t
+rtc_counts_for(os_time_t ticks)
+{
+    uint32_t need;
+
+    need = (uint32_t)ticks * RTC_FREQ - os_tick_rem;
+    return (need + OS_TICKS_PER_SEC - 1) / OS_TICKS_PER_SEC;
+}
+
+/**
+ * Advances OS time by however many ticks the RTC has counted since the last
+ * call.
+ */
+static void
+os_tick_account(void)
+{
+    uint32_t delta;
+    uint32_t acc;
+    uint32_t cnt;
+
+    cnt = OS_TICK_RTC->COUNTER;
+    delta = rtc_delta(os_tick_lastcnt, cnt);
+    os_tick_lastcnt = cnt;
+
+    acc = delta * OS_TICKS_PER_SEC + os_tick_rem;
+    os_tick_rem = acc & (RTC_FREQ - 1);
+
+    bsp_wakeups_window += delta;
+    if (bsp_wakeups_window >= WAKEUP_WINDOW) {
+        bsp_wakeups_window -= WAKEUP_WINDOW;
+        bsp_wakeups_last_min = bsp_wakeups;
+        bsp_wakeups = 0;
+    }
+
+    os_time_advance(acc >> RTC_FREQ_SHIFT);
+}
+
+static void
+rtc_irq_handler(void)
+{
+    os_tick_account();
+    rtc_set_ocmp(os_tick_lastcnt + rtc_counts_for(1));
+}
+
+/**
+ * Reloads the watchdog, unless the last check-in has lapsed.
+ */
+static void
+wdt_feed(void)
+{
+    if ((int32_t)(wdt_deadline - os_time_get()) > 0) {
+        NRF_WDT->RR[0] = WDT_RR_RR_Reload;
+    }
+}
+
+void
+os_tick_idle(os_time_t ticks)
+{
+    if (wdt_max_idle != 0) {
+        wdt_feed();
+        if (ticks > wdt_max_idle) {
+            ticks = wdt_max_idle;
+        }
+    }
+
+    if (ticks > 0) {
+        if (ticks > OS_TICK_MAX_IDLE) {
+            ticks = OS_TICK_MAX_IDLE;
+        }
+        rtc_set_ocmp(os_tick_lastcnt + rtc_counts_for(ticks));
+    }
+
+    __DSB();
+    __WFI();
+    bsp_wakeups++;
+
+    if (ticks > 0) {
+        /* Catch up OS time before anything else looks at it. */
+        rtc_irq_handler();
+    }
+}
+
+void
+os_tick_init(uint32_t os_ticks_per_sec, int prio)
+{
+    uint32_t sr;
+
+    assert(os_ticks_per_sec == OS_TICKS_PER_SEC);
+
+    /* Start the low frequency crystal if nobody has yet. */
+    if ((NRF_CLOCK->LFCLKSTAT & CLOCK_LFCLKSTAT_STATE_Msk) == 0) {
+        NRF_CLOCK->LFCLKSRC = CLOCK_LFCLKSRC_SRC_Xtal;
+        NRF_CLOCK->EVENTS_LFCLKSTARTED = 0;
+        NRF_CLOCK->TASKS_LFCLKSTART = 1;
+        while (NRF_CLOCK->EVENTS_LFCLKSTARTED == 0) {
+        }
+    }
+
+    OS_ENTER_CRITICAL(sr);
+
+    NVIC_SetPriority(OS_TICK_IRQ, prio);
+    NVIC_SetVector(OS_TICK_IRQ, (uint32_t)rtc_irq_handler);
+    NVIC_EnableIRQ(OS_TICK_IRQ);
+
+    OS_TICK_RTC->TASKS_STOP = 1;
+    OS_TICK_RTC->TASKS_CLEAR = 1;
+    OS_TICK_RTC->PRESCALER = 0;
+    OS_TICK_RTC->EVTENSET = RTC_EVTEN_COMPARE0_Msk;
+    OS_TICK_RTC->INTENSET = RTC_INTENSET_COMPARE0_Msk;
+
+    os_tick_lastcnt = 0;
+    os_tick_rem = 0;
+    OS_TICK_RTC->CC[OS_TICK_CMPREG] = rtc_counts_for(1);
+    OS_TICK_RTC->TASKS_START = 1;
+
+    OS_EXIT_CRITICAL(sr);
+}
+
+/**
+ * Rounds a delay up so that the wakeup lands on the next coalescing boundary.
+ * Tasks that can tolerate up to BSP_COALESCE_TICKS of slack use this so that
+ * their timers expire together and the CPU wakes once instead of several
+ * times.
+ */
+uint32_t
+bsp_coalesce_ticks(uint32_t ticks)
+{
+    os_time_t deadline;
+    os_time_t now;
+
+    now = os_time_get();
+    deadline = now + ticks + BSP_COALESCE_TICKS - 1;
+    deadline -= deadline % BSP_COALESCE_TICKS;
+
+    return deadline - now;
+}
+
+/**
+ * Number of times the CPU left WFI during the last complete minute.
+ */
+uint32_t
+bsp_idle_wakeups_per_min(void)
+{
+    return bsp_wakeups_last_min;
+}
+
+/**
+ * Starts the watchdog with a timeout of msec, or adopts it if it survived a
+ * soft reset (its timeout can't be changed until it stops).  It runs while
+ * the CPU sleeps and pauses while a debugger has it halted.
+ *
+ * @param timeout_isr           If not NULL, called at the highest priority
+ *                                  two 32 kHz cycles before the reset.
+ */
+void
+bsp_watchdog_init(uint32_t msec, void (*timeout_isr)(void))
+{
+    uint32_t sr;
+
+    OS_ENTER_CRITICAL(sr);
+
+    if ((NRF_WDT->RUNSTATUS & WDT_RUNSTATUS_RUNSTATUS_Msk) == 0) {
+        NRF_WDT->CONFIG = (WDT_CONFIG_SLEEP_Run << WDT_CONFIG_SLEEP_Pos) |
+                          (WDT_CONFIG_HALT_Pause << WDT_CONFIG_HALT_Pos);
+        NRF_WDT->CRV = msec * RTC_FREQ / 1000;
+        NRF_WDT->RREN = WDT_RREN_RR0_Msk;
+        NRF_WDT->TASKS_START = 1;
+    } else {
+        msec = bsp_watchdog_msec();
+    }
+
+    if (timeout_isr != NULL) {
+        NRF_WDT->EVENTS_TIMEOUT = 0;
+        NVIC_SetPriority(WDT_IRQn, 0);
+        NVIC_SetVector(WDT_IRQn, (uint32_t)timeout_isr);
+        NVIC_EnableIRQ(WDT_IRQn);
+        NRF_WDT->INTENSET = WDT_INTENSET_TIMEOUT_Msk;
+    }
+
+    /* Reloaded for one timeout; after that, only while the app checks in. */
+    wdt_max_idle = msec / 2 * OS_TICKS_PER_SEC / 1000;
+    wdt_deadline = os_time_get() + msec * OS_TICKS_PER_SEC / 1000;
+    NRF_WDT->RR[0] = WDT_RR_RR_Reload;
+
+    OS_EXIT_CRITICAL(sr);
+}
+
+/**
+ * Keeps the idle task reloading the watchdog for the next 'ticks' ticks.
+ * A task that stops calling this gets the badge reset one timeout after
+ * its last deadline, even though the idle task still runs.
+ */
+void
+bsp_watchdog_checkin(uint32_t ticks)
+{
+    wdt_deadline = os_time_get() + ticks;
+}
+
+/**
+ * The running watchdog's timeout; 0 if it isn't running.
+ */
+uint32_t
+bsp_watchdog_msec(void)
+{
+    uint32_t crv;
+
+    if ((NRF_WDT->RUNSTATUS & WDT_RUNSTATUS_RUNSTATUS_Msk) == 0) {
+        return 0;
+    }
+    crv = NRF_WDT->CRV + 1;
+    return crv / RTC_FREQ * 1000 + crv % RTC_FREQ * 1000 / RTC_FREQ;
+}
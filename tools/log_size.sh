@@ -0,0 +1,72 @@
+#!/bin/sh
+#
+# Copyright 2016 ICE9 Consulting
+#
+# Licensed to the Apache Software Foundation (ASF) under one
+# or more contributor license agreements.  See the NOTICE file
+# distributed with this work for additional information
+# regarding copyright ownership.  The ASF licenses this file
+# to you under the Apache License, Version 2.0 (the
+# "License"); you may not use this file except in compliance
+# with the License.  You may obtain a copy of the License at
+#
+#  http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing,
+# software distributed under the License is distributed on an
+# "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+# KIND, either express or implied.  See the License for the
+# specific language governing permissions and limitations
+# under the License.
+#
+
+# Rebuilds the slide_quacker target at each QUACKER_LOG_LEVEL, with and
+# without QLOG_FMT_SECTION, and reports the flash used (text + data) and
+# the bytes saved relative to a DEBUG build with format strings in flash.
+#
+# Run from the project root.  The target's pkg.yml is restored afterwards.
+
+set -e
+
+TARGET=slide_quacker
+PKG=targets/$TARGET/pkg.yml
+ELF=bin/$TARGET/apps/quacker/quacker.elf
+SIZE=${SIZE:-arm-none-eabi-size}
+
+cp "$PKG" "$PKG.orig"
+trap 'mv "$PKG.orig" "$PKG"' EXIT
+
+# Prints the flash bytes used by a build with the given cflags.
+# Only the log flags are replaced; the target's other cflags stay.
+flash_bytes() {
+    flags=""
+    for flag in "$@"; do
+        flags="$flags    - \"$flag\"\n"
+    done
+    grep -v -e '-DQUACKER_LOG_LEVEL=' -e '-DQLOG_FMT_SECTION' "$PKG.orig" |
+        awk -v flags="$flags" '
+            { print }
+            /^pkg.cflags:/ { printf "%s", flags; done = 1 }
+            END { if (!done) printf "pkg.cflags:\n%s", flags }' > "$PKG"
+
+    newt clean "$TARGET" > /dev/null
+    newt build "$TARGET" > /dev/null
+    $SIZE "$ELF" | awk 'NR == 2 { print $1 + $2 }'
+}
+
+base=$(flash_bytes -DQUACKER_LOG_LEVEL=LOG_LEVEL_DEBUG)
+
+printf '%-10s %-10s %8s %8s\n' level fmt flash saved
+for level in DEBUG INFO WARN ERROR CRITICAL; do
+    for fmt in flash section; do
+        if [ $fmt = section ]; then
+            bytes=$(flash_bytes -DQUACKER_LOG_LEVEL=LOG_LEVEL_$level \
+                                -DQLOG_FMT_SECTION)
+        elif [ $level = DEBUG ]; then
+            bytes=$base
+        else
+            bytes=$(flash_bytes -DQUACKER_LOG_LEVEL=LOG_LEVEL_$level)
+        fi
+        printf '%-10s %-10s %8d %8d\n' $level $fmt $bytes $((base - bytes))
+    done
+done
@@ -0,0 +1,146 @@
+#!/usr/bin/env python3
+#
+# Copyright 2016 ICE9 Consulting
+#
+# Licensed to the Apache Software Foundation (ASF) under one
+# or more contributor license agreements.  See the NOTICE file
+# distributed with this work for additional information
+# regarding copyright ownership.  The ASF licenses this file
+# to you under the Apache License, Version 2.0 (the
+# "License"); you may not use this file except in compliance
+# with the License.  You may obtain a copy of the License at
+#
+#  http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing,
+# software distributed under the License is distributed on an
+# "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+# KIND, either express or implied.  See the License for the
+# specific language governing permissions and limitations
+# under the License.
+#
+
+"""Generate the orientation classifier's test vectors.
+
+Each trace below is a list of (x, y, z, count) segments in MMA7660 counts
+(21 per g).  Every segment is expanded to count samples with +/-2 counts of
+noise from a fixed-seed generator, so the output never changes unless the
+traces do.  The result is written as a C header that the host test
+(apps/quacker/test) and the QUACKER_BENCH timing run both replay.
+
+These are synthetic postures, not captures from a badge.
+
+    orient_traces.py > apps/quacker/src/orient_traces.h
+"""
+
+import sys
+
+# (name, expected class, segments, comment)
+TRACES = [
+    ('flat', 'FLAT', [(0, 0, 21, 40)], None),
+    ('upright', 'UPRIGHT', [(1, -21, 2, 40)], None),
+    ('flip', 'RUBBER', [(0, 0, -21, 20), (0, 21, 0, 40)], None),
+    ('wobble', 'UPRIGHT',
+     [(0, -21, 0, 30), (0, -15, 15, 4), (0, -17, 12, 4), (0, -15, 15, 4),
+      (0, -17, 12, 4), (0, -15, 15, 4), (0, -17, 12, 4), (0, -16, 14, 4)],
+     'Swaying around 45 degrees must not leave UPRIGHT.'),
+    ('jolt', 'UPRIGHT', [(0, -21, 0, 30), (21, 0, 0, 5), (0, -21, 0, 30)],
+     'A short jolt sideways must not register.'),
+]
+
+SEED = 0x2016
+
+
+class Noise:
+    """xorshift32, so the vectors don't depend on Python's generator."""
+
+    def __init__(self, seed):
+        self.state = seed
+
+    def next(self):
+        x = self.state
+        x ^= (x << 13) & 0xffffffff
+        x ^= x >> 17
+        x ^= (x << 5) & 0xffffffff
+        self.state = x
+        return x % 5 - 2
+
+
+HEADER = """/**
+ * Copyright 2016 ICE9 Consulting
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+/* Generated by tools/orient_traces.py; edit the traces there. */
+
+#ifndef H_ORIENT_TRACES_
+#define H_ORIENT_TRACES_
+
+/**
+ * Fixed accelerometer traces for the orientation classifier, with the
+ * stable result each must end on.  Synthetic: each posture is held with
+ * +/-2 counts of seeded noise.  Included by the host test and by the
+ * QUACKER_BENCH timing run only.
+ */
+struct orient_trace {
+    const char *name;
+    const struct accel_sample *samples;
+    int num_samples;
+    enum orientation_t expect;
+};
+"""
+
+
+def main():
+    noise = Noise(SEED)
+    out = [HEADER.rstrip('\n')]
+
+    for name, expect, segs, comment in TRACES:
+        out.append('')
+        if comment:
+            out.append('/* %s */' % comment)
+        out.append('static const struct accel_sample orient_trace_%s[] = {'
+                   % name)
+        for x, y, z, count in segs:
+            for _ in range(count):
+                out.append('    { %d, %d, %d, 0 },' %
+                           (x + noise.next(), y + noise.next(),
+                            z + noise.next()))
+        out.append('};')
+
+    out.append('')
+    out.append('#define ORIENT_TRACE(name, expect)                                       \\')
+    out.append('    { #name, orient_trace_##name,                                       \\')
+    out.append('      sizeof orient_trace_##name / sizeof orient_trace_##name[0],       \\')
+    out.append('      (expect) }')
+    out.append('')
+    out.append('static const struct orient_trace orient_traces[] = {')
+    for name, expect, _, _ in TRACES:
+        out.append('    ORIENT_TRACE(%s, %s),' % (name, expect))
+    out.append('};')
+    out.append('#define ORIENT_NUM_TRACES \\')
+    out.append('    (sizeof orient_traces / sizeof orient_traces[0])')
+    out.append('')
+    out.append('#endif')
+
+    sys.stdout.write('\n'.join(out) + '\n')
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,107 @@
+#!/usr/bin/env python3
+#
+# Copyright 2016 ICE9 Consulting
+#
+# Licensed to the Apache Software Foundation (ASF) under one
+# or more contributor license agreements.  See the NOTICE file
+# distributed with this work for additional information
+# regarding copyright ownership.  The ASF licenses this file
+# to you under the Apache License, Version 2.0 (the
+# "License"); you may not use this file except in compliance
+# with the License.  You may obtain a copy of the License at
+#
+#  http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing,
+# software distributed under the License is distributed on an
+# "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+# KIND, either express or implied.  See the License for the
+# specific language governing permissions and limitations
+# under the License.
+
+"""Generate the OTA signing key header.
+
+The badge only marks an uploaded image for the bootloader if it carries an
+ECDSA-224 signature TLV made with this key; see ota.c.  Sign images with the
+same key:
+
+    newt create-image slide_quacker <version> key.pem
+
+and build its public half into the firmware:
+
+    ota_key.py key.pem > apps/quacker/src/ota_key.h
+
+With no argument the header has no key, and no image can be marked.
+"""
+
+import subprocess
+import sys
+
+# Uncompressed secp224r1 point: 0x04, X, Y.
+POINT_LEN = 1 + 2 * 28
+
+HEADER = '''/**
+ * Copyright 2016 ICE9 Consulting
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+/* Generated by tools/ota_key.py. */
+
+#ifndef H_OTA_KEY_
+#define H_OTA_KEY_
+
+/**
+ * Public half of the key OTA images are signed with, as an uncompressed
+ * secp224r1 point.  OTA_KEY_LEN is 0 when no key is built in.
+ */
+'''
+
+
+def public_point(pem):
+    der = subprocess.run(['openssl', 'ec', '-in', pem, '-pubout',
+                          '-outform', 'DER', '-conv_form', 'uncompressed'],
+                         stdout=subprocess.PIPE, stderr=subprocess.DEVNULL,
+                         check=True).stdout
+    # The point is the BIT STRING that ends the SubjectPublicKeyInfo.
+    point = der[-POINT_LEN:]
+    if point[0] != 0x04 or b'\x06\x05\x2b\x81\x04\x00\x21' not in der:
+        sys.exit('%s: not a secp224r1 key' % pem)
+    return point
+
+
+def main():
+    if len(sys.argv) > 2:
+        sys.exit('usage: ota_key.py [key.pem]')
+
+    out = [HEADER]
+    if len(sys.argv) == 1:
+        out.append('#define OTA_KEY_LEN 0\n')
+        out.append('#define OTA_KEY { 0 }\n')
+    else:
+        point = public_point(sys.argv[1])
+        out.append('#define OTA_KEY_LEN %d\n' % len(point))
+        out.append('#define OTA_KEY {%s \\\n}\n' % ''.join(
+            ' \\\n   ' * (i % 8 == 0) + ' 0x%02x,' % b
+            for i, b in enumerate(point)))
+    out.append('\n#endif\n')
+    sys.stdout.write(''.join(out))
+
+
+if __name__ == '__main__':
+    main()
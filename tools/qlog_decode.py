@@ -0,0 +1,172 @@
+#!/usr/bin/env python3
+#
+# Copyright 2016 ICE9 Consulting
+#
+# Licensed to the Apache Software Foundation (ASF) under one
+# or more contributor license agreements.  See the NOTICE file
+# distributed with this work for additional information
+# regarding copyright ownership.  The ASF licenses this file
+# to you under the Apache License, Version 2.0 (the
+# "License"); you may not use this file except in compliance
+# with the License.  You may obtain a copy of the License at
+#
+#  http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing,
+# software distributed under the License is distributed on an
+# "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+# KIND, either express or implied.  See the License for the
+# specific language governing permissions and limitations
+# under the License.
+#
+
+"""Decode quacker's deferred binary log (QUACKER_LOG_FAST).
+
+Reads console output on stdin (or from a file) and the firmware ELF.  Lines
+of the form "~Q <usec> <header> <args...>" are rebuilt into text using the
+format strings in the ELF; everything else is passed through unchanged.
+
+    qlog_decode.py bin/slide_quacker/apps/quacker/quacker.elf < console.log
+"""
+
+import argparse
+import re
+import struct
+import sys
+
+SHT_PROGBITS = 1
+SHF_ALLOC = 0x2
+
+# Flash addresses on the nRF51 fit in the low 24 bits of the header.
+ADDR_MASK = 0x00ffffff
+
+CONV_RE = re.compile(r'%([-+ #0]*)(\d*)(?:\.(\d+))?(hh|h|ll|l|z|j|t)?([diouxXcsp%])')
+
+
+class Elf:
+    """Just enough of an ELF32 little-endian reader to fetch strings.
+
+    Format strings are either in flash or, with QLOG_FMT_SECTION, in the
+    non-loaded .qlog_fmt section.  Flash sections are allocated, and .text
+    sits at address 0 in a no_boot build; .qlog_fmt isn't allocated but has
+    an address.  Debug sections are neither, and are skipped.
+    """
+
+    def __init__(self, path):
+        with open(path, 'rb') as f:
+            self.data = f.read()
+        if self.data[:4] != b'\x7fELF' or self.data[4] != 1:
+            raise ValueError('%s: not a 32-bit ELF file' % path)
+
+        (e_shoff,) = struct.unpack_from('<I', self.data, 0x20)
+        e_shentsize, e_shnum = struct.unpack_from('<HH', self.data, 0x2e)
+
+        self.sections = []
+        for i in range(e_shnum):
+            off = e_shoff + i * e_shentsize
+            (_, sh_type, sh_flags, sh_addr, sh_offset,
+             sh_size) = struct.unpack_from('<IIIIII', self.data, off)
+            if (sh_type == SHT_PROGBITS and sh_size and
+                    (sh_flags & SHF_ALLOC or sh_addr)):
+                self.sections.append((sh_addr, sh_offset, sh_size))
+
+    def string(self, addr):
+        for sh_addr, sh_offset, sh_size in self.sections:
+            if (sh_addr & ADDR_MASK) <= addr < (sh_addr & ADDR_MASK) + sh_size:
+                start = sh_offset + addr - (sh_addr & ADDR_MASK)
+                end = self.data.index(b'\0', start)
+                return self.data[start:end].decode('latin-1')
+        return None
+
+
+def signed32(v):
+    return v - (1 << 32) if v & 0x80000000 else v
+
+
+def format_record(elf, fmt, args):
+    """printf() for a list of 32-bit words."""
+    out = []
+    pos = 0
+    args = list(args)
+
+    def take():
+        return args.pop(0) if args else 0
+
+    for m in CONV_RE.finditer(fmt):
+        out.append(fmt[pos:m.start()])
+        pos = m.end()
+
+        flags, width, prec, length, conv = m.groups()
+        if conv == '%':
+            out.append('%')
+            continue
+
+        val = take()
+        if length == 'll':
+            val |= take() << 32
+
+        spec = '%' + flags + width + ('.' + prec if prec else '')
+        if conv in 'di':
+            if length == 'll':
+                val = val - (1 << 64) if val & (1 << 63) else val
+            else:
+                val = signed32(val)
+            out.append((spec + 'd') % val)
+        elif conv == 'u':
+            out.append((spec + 'd') % val)
+        elif conv in 'oxX':
+            out.append((spec + conv) % val)
+        elif conv == 'c':
+            out.append((spec + 'c') % chr(val & 0xff))
+        elif conv == 's':
+            s = elf.string(val & ADDR_MASK)
+            out.append((spec + 's') % (s if s is not None else
+                                       '<0x%08x>' % val))
+        elif conv == 'p':
+            out.append('0x%08x' % val)
+
+    out.append(fmt[pos:])
+    return ''.join(out)
+
+
+def decode_line(elf, line):
+    """Returns the text for one line of console output."""
+    if line.startswith('~Q!'):
+        n = int(line.split()[1], 16)
+        return '[qlog: %d records dropped]\n' % n
+
+    if not line.startswith('~Q '):
+        return line
+
+    try:
+        words = [int(w, 16) for w in line.split()[1:]]
+    except ValueError:
+        return line
+    if len(words) < 2:
+        return line
+
+    ts, hdr, args = words[0], words[1], words[2:]
+    fmt = elf.string(hdr & ADDR_MASK)
+    if fmt is None:
+        text = '<unknown format 0x%06x> %s\n' % (
+            hdr & ADDR_MASK, ' '.join('%08x' % a for a in args))
+    else:
+        text = format_record(elf, fmt, args)
+
+    return '[%10.6f] %s' % (ts / 1e6, text)
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument('elf', help='firmware ELF the log came from')
+    parser.add_argument('log', nargs='?', type=argparse.FileType('r'),
+                        default=sys.stdin, help='console capture')
+    args = parser.parse_args()
+
+    elf = Elf(args.elf)
+    for line in args.log:
+        sys.stdout.write(decode_line(elf, line))
+
+
+if __name__ == '__main__':
+    main()
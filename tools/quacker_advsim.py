@@ -0,0 +1,290 @@
+#!/usr/bin/env python3
+#
+# Copyright 2016 ICE9 Consulting
+#
+# Licensed to the Apache Software Foundation (ASF) under one
+# or more contributor license agreements.  See the NOTICE file
+# distributed with this work for additional information
+# regarding copyright ownership.  The ASF licenses this file
+# to you under the Apache License, Version 2.0 (the
+# "License"); you may not use this file except in compliance
+# with the License.  You may obtain a copy of the License at
+#
+#  http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing,
+# software distributed under the License is distributed on an
+# "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+# KIND, either express or implied.  See the License for the
+# specific language governing permissions and limitations
+# under the License.
+#
+
+
+"""Simulate a room full of badges advertising and time how long one takes
+to find.
+
+Every badge at the con runs quacker_advertise() with the same parameters,
+so they all share the three advertising channels.  This models N of them
+and one host looking for a target badge among them.  A PDU reaches the host
+only if the host is scanning its channel for the whole PDU and no other
+badge's PDU on that channel overlaps it (--capture lets a fraction through
+anyway).  Two times are reported for each N:
+
+  discover   the host starts scanning while the target advertises slowly,
+             as it does once it has been up a while; done when one of the
+             target's PDUs gets through.
+  reconnect  the target's host drops and the target starts advertising
+             fast, with the host already initiating; done when a PDU gets
+             through and the CONNECT_IND sent back gets through too.
+
+The other badges advertise fast with probability --fast-frac, each with a
+random part of QUACKER_ADV_FAST_SEC left, and slowly otherwise.  Badges
+that are connected don't advertise, so leave them out of N.
+
+Advertising parameters and the advertising data are read from
+apps/quacker/src/main.c, so an edit there can be tried before it is
+flashed; --fast-ms, --slow-ms and --fast-sec override them.
+
+    quacker_advsim.py
+    quacker_advsim.py --badges 1,100,400 --trials 200
+    quacker_advsim.py --slow-ms 500 --fast-frac 0.3
+"""
+
+import argparse
+import bisect
+import os
+import random
+import re
+import sys
+
+CHANNELS = (37, 38, 39)
+
+T_IFS_US = 150
+# The controller listens for a SCAN_REQ or CONNECT_IND after each PDU before
+# moving to the next channel.
+PDU_GAP_US = T_IFS_US + 176 + 50
+ADV_DELAY_MAX_US = 10000
+CONNECT_IND_US = (1 + 4 + 2 + 34 + 3) * 8
+# CONNECT_IND to the first connection event, with the minimum window offset.
+CONN_SETUP_US = 1250 + 1250
+
+CHUNK_US = 1000000
+
+MAIN_C = os.path.join(os.path.dirname(os.path.abspath(__file__)), '..',
+                      'apps', 'quacker', 'src', 'main.c')
+
+
+def read_params(path):
+    """Returns (fast_us, slow_us, fast_sec, pdu_us) from main.c."""
+    src = open(path).read()
+
+    def define(name):
+        m = re.search(r'#define\s+%s\s+([^\n]+)' % name, src)
+        if m is None:
+            raise ValueError('%s not found in %s' % (name, path))
+        expr = m.group(1).split('/*')[0].replace('BLE_HCI_ADV_ITVL', '625')
+        return eval(expr.replace('/', '//'), {'__builtins__': {}})
+
+    m = re.search(r'quacker_device_name\s*=\s*"([^"]*)"', src)
+    name = m.group(1) if m else ''
+
+    # Flags, complete name, one 16-bit UUID and appearance, as
+    # quacker_advertise() sets them.
+    adv_data = 3 + 2 + len(name) + 2 + 2 + 2 + 2
+    pdu_us = (1 + 4 + 2 + 6 + adv_data + 3) * 8
+
+    return (define('QUACKER_ADV_ITVL_FAST') * 625,
+            define('QUACKER_ADV_ITVL_SLOW') * 625,
+            define('QUACKER_ADV_FAST_SEC'), pdu_us)
+
+
+class Badge:
+    """One badge's advertising events: every interval plus a random 0-10 ms,
+    fast until fast_until and slowly after."""
+
+    def __init__(self, rng, cfg, start, fast_until):
+        self.rng = rng
+        self.cfg = cfg
+        self.fast_until = fast_until
+        self.next = start
+
+    def itvl(self, t):
+        return self.cfg.fast_us if t < self.fast_until else self.cfg.slow_us
+
+    def events(self, end):
+        while self.next < end:
+            t = self.next
+            self.next = t + self.itvl(t) + \
+                self.rng.randrange(ADV_DELAY_MAX_US + 1)
+            yield t
+
+
+class Air:
+    """Start times of the other badges' PDUs on each channel."""
+
+    def __init__(self, cfg, badges):
+        self.cfg = cfg
+        self.badges = badges
+        self.start = {ch: [] for ch in CHANNELS}
+        self.end = 0
+
+    def fill(self, end):
+        # Queries trail the generated horizon by a few hops at most.
+        keep = self.end - 10 * self.cfg.hop_us
+        for ch in CHANNELS:
+            lst = self.start[ch]
+            self.start[ch] = lst[bisect.bisect_left(lst, keep):]
+        for b in self.badges:
+            for t in b.events(end):
+                for i, ch in enumerate(CHANNELS):
+                    self.start[ch].append(t + i * self.cfg.hop_us)
+        for ch in CHANNELS:
+            self.start[ch].sort()
+        self.end = end
+
+    def clear(self, ch, t, dur):
+        """Whether nothing else is on ch during [t, t + dur)."""
+        while self.end < t + dur + self.cfg.hop_us * 3:
+            self.fill(self.end + CHUNK_US)
+        lst = self.start[ch]
+        i = bisect.bisect_right(lst, t - self.cfg.pdu_us)
+        return i == len(lst) or lst[i] >= t + dur
+
+
+class Scanner:
+    """A host scanning for scan_win of every scan_itvl, moving to the next
+    channel each interval."""
+
+    def __init__(self, rng, cfg, start):
+        self.cfg = cfg
+        self.start = start
+        self.ch0 = rng.randrange(3)
+
+    def hears(self, ch, t, dur):
+        if t < self.start:
+            return False
+        k, off = divmod(t - self.start, self.cfg.scan_itvl_us)
+        return (off + dur <= self.cfg.scan_win_us and
+                CHANNELS[(k + self.ch0) % 3] == ch)
+
+
+def others(rng, cfg, n):
+    badges = []
+    for _ in range(n):
+        if rng.random() < cfg.fast_frac:
+            left = rng.uniform(0, cfg.fast_sec * 1e6)
+            phase = rng.randrange(cfg.fast_us)
+        else:
+            left = 0
+            phase = rng.randrange(cfg.slow_us)
+        badges.append(Badge(rng, cfg, phase, left))
+    return badges
+
+
+def passes(rng, cfg, air, ch, t, dur):
+    return air.clear(ch, t, dur) or rng.random() < cfg.capture
+
+
+def trial(rng, cfg, n, reconnect):
+    """Returns microseconds to discover or reconnect, or None on timeout."""
+    air = Air(cfg, others(rng, cfg, n - 1))
+    timeout = cfg.timeout_sec * 1e6
+
+    if reconnect:
+        # The host was initiating already; the target just started fast.
+        scanner = Scanner(rng, cfg, -rng.randrange(cfg.scan_itvl_us))
+        target = Badge(rng, cfg, 0, cfg.fast_sec * 1e6)
+        t0 = 0
+    else:
+        target = Badge(rng, cfg, rng.randrange(cfg.slow_us), 0)
+        t0 = rng.randrange(cfg.slow_us)
+        scanner = Scanner(rng, cfg, t0)
+
+    for te in target.events(t0 + timeout):
+        for i, ch in enumerate(CHANNELS):
+            t = te + i * cfg.hop_us
+            if not scanner.hears(ch, t, cfg.pdu_us):
+                continue
+            if not passes(rng, cfg, air, ch, t, cfg.pdu_us):
+                continue
+            done = t + cfg.pdu_us
+            if not reconnect:
+                return done - t0
+            ci = done + T_IFS_US
+            if passes(rng, cfg, air, ch, ci, CONNECT_IND_US):
+                return ci + CONNECT_IND_US + CONN_SETUP_US - t0
+            # The target missed it and carries on advertising.
+            break
+    return None
+
+
+def summary(times):
+    ok = sorted(t / 1000.0 for t in times if t is not None)
+    lost = len(times) - len(ok)
+    if not ok:
+        return '%8s %8s %8s %5d' % ('-', '-', '-', lost)
+
+    def pct(p):
+        return ok[min(len(ok) - 1, int(p * len(ok)))]
+
+    return '%8.0f %8.0f %8.0f %5d' % (pct(0.5), pct(0.9), ok[-1], lost)
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument('--badges', default='1,25,50,100,200,400',
+                        help='comma-separated numbers of badges in the room')
+    parser.add_argument('--trials', type=int, default=50,
+                        help='runs per number of badges (default 50)')
+    parser.add_argument('--main-c', default=MAIN_C,
+                        help='read advertising parameters from here')
+    parser.add_argument('--fast-ms', type=float,
+                        help='fast advertising interval')
+    parser.add_argument('--slow-ms', type=float,
+                        help='slow advertising interval')
+    parser.add_argument('--fast-sec', type=float,
+                        help='how long fast advertising lasts')
+    parser.add_argument('--fast-frac', type=float, default=0.1,
+                        help='fraction of the other badges advertising fast '
+                             '(default 0.1)')
+    parser.add_argument('--scan-itvl-ms', type=float, default=60,
+                        help="host's scan interval (default 60)")
+    parser.add_argument('--scan-win-ms', type=float, default=30,
+                        help="host's scan window (default 30)")
+    parser.add_argument('--capture', type=float, default=0,
+                        help='chance a PDU survives a collision (default 0)')
+    parser.add_argument('--timeout-sec', type=float, default=30,
+                        help='give up after this long (default 30)')
+    parser.add_argument('--seed', type=int, default=1)
+    cfg = parser.parse_args()
+
+    try:
+        fast_us, slow_us, fast_sec, cfg.pdu_us = read_params(cfg.main_c)
+    except (OSError, ValueError) as e:
+        sys.exit(str(e))
+    cfg.fast_us = int(cfg.fast_ms * 1000) if cfg.fast_ms else fast_us
+    cfg.slow_us = int(cfg.slow_ms * 1000) if cfg.slow_ms else slow_us
+    cfg.fast_sec = cfg.fast_sec if cfg.fast_sec is not None else fast_sec
+    cfg.scan_itvl_us = int(cfg.scan_itvl_ms * 1000)
+    cfg.scan_win_us = int(cfg.scan_win_ms * 1000)
+    cfg.hop_us = cfg.pdu_us + PDU_GAP_US
+
+    print('advertising %.1f ms fast for %g s, then %.1f ms; %d us PDUs; '
+          'host scans %g/%g ms' %
+          (cfg.fast_us / 1000.0, cfg.fast_sec, cfg.slow_us / 1000.0,
+           cfg.pdu_us, cfg.scan_win_ms, cfg.scan_itvl_ms))
+    print('%6s | %-33s | %-33s' % ('', 'discover ms', 'reconnect ms'))
+    print('%6s | %8s %8s %8s %5s | %8s %8s %8s %5s' %
+          (('badges',) + ('p50', 'p90', 'max', 'lost') * 2))
+
+    rng = random.Random(cfg.seed)
+    for n in (int(x) for x in cfg.badges.split(',')):
+        disc = [trial(rng, cfg, n, False) for _ in range(cfg.trials)]
+        reconn = [trial(rng, cfg, n, True) for _ in range(cfg.trials)]
+        print('%6d | %s | %s' % (n, summary(disc), summary(reconn)))
+        sys.stdout.flush()
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,245 @@
+#!/usr/bin/env python3
+#
+# Copyright 2016 ICE9 Consulting
+#
+# Licensed to the Apache Software Foundation (ASF) under one
+# or more contributor license agreements.  See the NOTICE file
+# distributed with this work for additional information
+# regarding copyright ownership.  The ASF licenses this file
+# to you under the Apache License, Version 2.0 (the
+# "License"); you may not use this file except in compliance
+# with the License.  You may obtain a copy of the License at
+#
+#  http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing,
+# software distributed under the License is distributed on an
+# "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+# KIND, either express or implied.  See the License for the
+# specific language governing permissions and limitations
+# under the License.
+#
+
+"""Make a delta patch between two firmware images.
+
+Takes the image a badge is running and the one to send it, and writes a
+patch in the format apps/quacker/src/delta.c applies.  Prints the patch
+size against the full image and, given the link's throughput in KB/s
+(--rate; `ota verified ...` in the badge's log has it), the transfer time
+of each.  The patch is applied here first to check it rebuilds the new
+image exactly.  Give it two real `newt build` images; what it saves
+depends entirely on the pair.
+
+    quacker_delta.py old.img new.img
+    quacker_delta.py -o update.qdp --rate 5 old.img new.img
+
+tools/quacker_ota.py --base old.img does the same thing on the fly.
+"""
+
+import argparse
+import struct
+import sys
+
+# Must match enum delta_op in apps/quacker/src/delta.c.
+DELTA_ADD = 0
+DELTA_COPY = 1
+DELTA_RUN = 2
+
+BLOCK = 16          # Match seed length.
+MIN_COPY = 16       # Shorter matches cost about as much as a literal.
+MIN_RUN = 8
+MAX_CANDIDATES = 8
+
+IMAGE_MAGIC = 0x96f3b83c
+IMAGE_HDR_FMT = '<IHBBHHII'
+IMAGE_TLV_FMT = '<BBH'
+IMAGE_TLV_SHA256 = 1
+
+
+def image_info(img):
+    """Returns (size, sha256) of a newt image: the bytes the badge holds in
+    its slot (header, body and TLVs) and the hash from its SHA-256 TLV."""
+    magic, tlv_size, _, _, hdr_size, _, img_size, _ = \
+        struct.unpack_from(IMAGE_HDR_FMT, img)
+    if magic != IMAGE_MAGIC:
+        raise ValueError('not a newt image')
+
+    off = hdr_size + img_size
+    end = off + tlv_size
+    while off + 4 <= end:
+        kind, _, length = struct.unpack_from(IMAGE_TLV_FMT, img, off)
+        off += 4
+        if kind == IMAGE_TLV_SHA256 and length == 32:
+            return end, bytes(img[off:off + 32])
+        off += length
+    raise ValueError('image has no SHA-256 TLV')
+
+
+def varint(n):
+    out = bytearray()
+    while True:
+        b = n & 0x7f
+        n >>= 7
+        if n:
+            out.append(b | 0x80)
+        else:
+            out.append(b)
+            return out
+
+
+def zigzag(n):
+    return (n << 1) if n >= 0 else ((-n << 1) - 1)
+
+
+def match_len(a, i, b, j):
+    n = 0
+    m = min(len(a) - i, len(b) - j)
+    step = 64
+    while n + step <= m and a[i + n:i + n + step] == b[j + n:j + n + step]:
+        n += step
+    while n < m and a[i + n] == b[j + n]:
+        n += 1
+    return n
+
+
+def emit_literal(out, lit):
+    """ADD the literal, pulling long runs out as RUN commands."""
+    i = 0
+    start = 0
+    while i < len(lit):
+        j = i
+        while j < len(lit) and lit[j] == lit[i]:
+            j += 1
+        if j - i >= MIN_RUN:
+            if i > start:
+                out += varint((i - start) << 2 | DELTA_ADD) + lit[start:i]
+            out += varint((j - i) << 2 | DELTA_RUN) + bytes([lit[i]])
+            start = j
+        i = j
+    if len(lit) > start:
+        out += varint((len(lit) - start) << 2 | DELTA_ADD) + lit[start:]
+
+
+def diff(old, new):
+    index = {}
+    for i in range(len(old) - BLOCK + 1):
+        cands = index.setdefault(old[i:i + BLOCK], [])
+        if len(cands) < MAX_CANDIDATES:
+            cands.append(i)
+
+    out = bytearray()
+    lit = bytearray()
+    shift = 0
+    i = 0
+    while i < len(new):
+        best_len = 0
+        best_src = 0
+        for src in index.get(new[i:i + BLOCK], ()):
+            n = match_len(old, src, new, i)
+            # Prefer the source nearest the last one; it encodes shortest.
+            if n > best_len or (n == best_len and
+                                abs(src - i - shift) <
+                                abs(best_src - i - shift)):
+                best_len = n
+                best_src = src
+
+        if best_len < MIN_COPY:
+            lit.append(new[i])
+            i += 1
+            continue
+
+        emit_literal(out, lit)
+        lit = bytearray()
+        out += varint(best_len << 2 | DELTA_COPY)
+        out += varint(zigzag(best_src - i))
+        shift = best_src - i
+        i += best_len
+
+    emit_literal(out, lit)
+    return bytes(out)
+
+
+def read_varint(patch, i):
+    n = 0
+    shift = 0
+    while True:
+        b = patch[i]
+        i += 1
+        n |= (b & 0x7f) << shift
+        shift += 7
+        if not b & 0x80:
+            return n, i
+
+
+def apply(old, patch):
+    out = bytearray()
+    i = 0
+    while i < len(patch):
+        cmd, i = read_varint(patch, i)
+        op, n = cmd & 3, cmd >> 2
+        if op == DELTA_ADD:
+            out += patch[i:i + n]
+            i += n
+        elif op == DELTA_COPY:
+            z, i = read_varint(patch, i)
+            src = len(out) + ((z >> 1) ^ -(z & 1))
+            if src < 0 or src + n > len(old):
+                raise ValueError('COPY out of range')
+            out += old[src:src + n]
+        elif op == DELTA_RUN:
+            out += bytes([patch[i]]) * n
+            i += 1
+        else:
+            raise ValueError('bad op %d' % op)
+    return bytes(out)
+
+
+def make_patch(old_img, new_img):
+    """Returns (patch, base_sha256) for sending new_img to a badge running
+    old_img."""
+    base_size, base_hash = image_info(old_img)
+    old = old_img[:base_size]
+    patch = diff(old, new_img)
+    if apply(old, patch) != new_img:
+        raise AssertionError('patch does not rebuild the image')
+    return patch, base_hash
+
+
+def report(image_len, patch_len, rate=None):
+    msg = ('image %d bytes, patch %d bytes (%.1f%% smaller)' %
+           (image_len, patch_len, 100 - 100.0 * patch_len / image_len))
+    if rate:
+        full = image_len / 1024 / rate
+        delta = patch_len / 1024 / rate
+        msg += ('; at %.1f KB/s %.1f s -> %.1f s, %.1f s saved' %
+                (rate, full, delta, full - delta))
+    return msg
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument('old', type=argparse.FileType('rb'),
+                        help='image the badge is running')
+    parser.add_argument('new', type=argparse.FileType('rb'),
+                        help='image to send')
+    parser.add_argument('-o', '--output', type=argparse.FileType('wb'),
+                        help='write the patch here')
+    parser.add_argument('--rate', type=float,
+                        help='link throughput in KB/s, for a time estimate')
+    args = parser.parse_args()
+
+    old_img = args.old.read()
+    new_img = args.new.read()
+    try:
+        image_info(new_img)
+        patch, _ = make_patch(old_img, new_img)
+    except ValueError as e:
+        sys.exit(str(e))
+
+    if args.output is not None:
+        args.output.write(patch)
+    print(report(len(new_img), len(patch), args.rate))
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,259 @@
+#!/usr/bin/env python3
+#
+# Copyright 2016 ICE9 Consulting
+#
+# Licensed to the Apache Software Foundation (ASF) under one
+# or more contributor license agreements.  See the NOTICE file
+# distributed with this work for additional information
+# regarding copyright ownership.  The ASF licenses this file
+# to you under the Apache License, Version 2.0 (the
+# "License"); you may not use this file except in compliance
+# with the License.  You may obtain a copy of the License at
+#
+#  http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing,
+# software distributed under the License is distributed on an
+# "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+# KIND, either express or implied.  See the License for the
+# specific language governing permissions and limitations
+# under the License.
+#
+
+"""Upload a firmware image to a badge over BLE.
+
+Streams a newt image (the .img file, header included) to the OTA
+characteristics in the quacker service, keeping within the window the badge
+advertises, then has the badge verify it and mark it for the bootloader.
+A dropped connection is retried and the upload resumes where the badge left
+off.  The badge must already be bonded with this host.
+
+With --base, the image the badge is running, only a delta patch is sent
+(see quacker_delta.py); if the badge turns out to be running something else
+the full image is sent instead.
+
+The badge only marks an image signed with the key built into it (see
+ota_key.py).  --bench has a QUACKER_BENCH build run its OTA throughput
+pass instead of uploading anything; that rewrites the second image slot.
+
+    quacker_ota.py AA:BB:CC:DD:EE:FF bin/slide_quacker/apps/quacker/quacker.img
+    quacker_ota.py --no-reset AA:BB:CC:DD:EE:FF quacker.img
+    quacker_ota.py --base old.img AA:BB:CC:DD:EE:FF quacker.img
+    quacker_ota.py --bench AA:BB:CC:DD:EE:FF
+
+Needs the bleak package.
+"""
+
+import argparse
+import asyncio
+import hashlib
+import struct
+import sys
+import time
+
+import quacker_delta
+
+OTA_CTRL_UUID = '9d41f6b2-3c8e-4a57-8e19-c2b7d05a64f3'
+OTA_DATA_UUID = '9d41f6b3-3c8e-4a57-8e19-c2b7d05a64f3'
+
+# Must match apps/quacker/src/quacker.h.
+OP_START = 1
+OP_FINISH = 2
+OP_ABORT = 3
+OP_RESET = 4
+OP_START_DELTA = 5
+OP_BENCH = 6
+FINISH_F_TEST = 0x01
+
+STATES = ('idle', 'receiving', 'verifying', 'done', 'failed')
+ERRORS = ('none', 'size', 'busy', 'flash', 'hash', 'image', 'state', 'base',
+          'patch', 'signature')
+E_BUSY = 2
+E_BASE = 7
+
+STATUS_FMT = '<BBHIII'
+STATUS_FIELDS = ('state', 'error', 'window', 'offset', 'acked', 'size')
+
+IMAGE_MAGIC = 0x96f3b83c
+
+RETRIES = 5
+
+
+def decode_status(data):
+    return dict(zip(STATUS_FIELDS, struct.unpack_from(STATUS_FMT, data)))
+
+
+class BaseMismatch(Exception):
+    pass
+
+
+class Upload:
+    def __init__(self, image, patch=None, base_hash=None):
+        self.image = image
+        self.digest = hashlib.sha256(image).digest()
+        # What is streamed: the image, or a patch that rebuilds it.
+        self.stream = image if patch is None else patch
+        if patch is None:
+            self.start_req = struct.pack('<BI', OP_START, len(image)) + \
+                self.digest
+        else:
+            self.start_req = struct.pack('<BII', OP_START_DELTA, len(patch),
+                                         len(image)) + self.digest + base_hash
+        self.status = None
+        self.changed = asyncio.Event()
+        self.sent = 0
+        self.start = time.monotonic()
+
+    def on_status(self, sender, data):
+        self.status = decode_status(data)
+        self.changed.set()
+
+    async def wait_status(self, pred, timeout=10):
+        while self.status is None or not pred(self.status):
+            self.changed.clear()
+            await asyncio.wait_for(self.changed.wait(), timeout)
+        return self.status
+
+    def progress(self):
+        elapsed = time.monotonic() - self.start
+        rate = self.status['acked'] / 1024 / elapsed if elapsed else 0
+        sys.stderr.write('\r%6d / %d bytes  %5.2f KB/s' %
+                         (self.status['acked'], len(self.stream), rate))
+
+    async def run(self, client):
+        await client.start_notify(OTA_CTRL_UUID, self.on_status)
+        self.status = decode_status(await client.read_gatt_char(OTA_CTRL_UUID))
+
+        while True:
+            self.status = None
+            await client.write_gatt_char(OTA_CTRL_UUID, self.start_req,
+                                         response=True)
+            st = await self.wait_status(lambda s: True)
+            if st['error'] != E_BUSY:
+                break
+            await asyncio.sleep(0.2)
+        if st['error'] == E_BASE:
+            raise BaseMismatch()
+        if st['state'] != STATES.index('receiving'):
+            raise RuntimeError('badge refused the image: %s' %
+                               ERRORS[st['error']])
+        self.sent = st['offset']
+
+        # Each write carries a 32-bit offset; ATT takes 3 bytes.
+        chunk = client.mtu_size - 3 - 4
+        while self.status['acked'] < len(self.stream):
+            st = self.status
+            if st['state'] != STATES.index('receiving'):
+                raise RuntimeError('upload failed: %s' % ERRORS[st['error']])
+            if st['offset'] < self.sent:
+                self.sent = st['offset']
+
+            limit = min(len(self.stream), st['acked'] + st['window'])
+            if self.sent >= limit:
+                self.changed.clear()
+                await asyncio.wait_for(self.changed.wait(), 10)
+                self.progress()
+                continue
+
+            n = min(chunk, limit - self.sent)
+            pkt = struct.pack('<I', self.sent) + \
+                self.stream[self.sent:self.sent + n]
+            await client.write_gatt_char(OTA_DATA_UUID, pkt, response=False)
+            self.sent += n
+        self.progress()
+        sys.stderr.write('\n')
+
+    async def finish(self, client, mark):
+        elapsed = time.monotonic() - self.start
+        print('%d bytes in %.1f s = %.2f KB/s' %
+              (len(self.stream), elapsed, len(self.stream) / 1024 / elapsed))
+
+        await client.write_gatt_char(
+            OTA_CTRL_UUID, bytes([OP_FINISH, FINISH_F_TEST if mark else 0]),
+            response=True)
+        st = await self.wait_status(
+            lambda s: s['state'] != STATES.index('verifying'), timeout=30)
+        if st['state'] != STATES.index('done'):
+            raise RuntimeError('verify failed: %s' % ERRORS[st['error']])
+        print('verified' + (' and marked for test' if mark else ''))
+
+
+async def bench(args):
+    from bleak import BleakClient
+
+    async with BleakClient(args.address) as client:
+        await client.write_gatt_char(OTA_CTRL_UUID, bytes([OP_BENCH]),
+                                     response=True)
+    print("bench started; see the badge's log for bench: ota ...")
+
+
+async def upload(args, image, patch, base_hash):
+    from bleak import BleakClient
+    from bleak.exc import BleakError
+
+    up = Upload(image, patch, base_hash)
+    for attempt in range(RETRIES):
+        try:
+            async with BleakClient(args.address) as client:
+                try:
+                    await up.run(client)
+                except BaseMismatch:
+                    print('badge is not running the base image; '
+                          'sending the full image')
+                    up = Upload(image)
+                    await up.run(client)
+                await up.finish(client, not args.no_mark)
+                if not args.no_reset and not args.no_mark:
+                    await client.write_gatt_char(
+                        OTA_CTRL_UUID, bytes([OP_RESET]), response=True)
+                    print('badge resetting into the new image')
+                return
+        except (BleakError, asyncio.TimeoutError) as e:
+            sys.stderr.write('\n%s; reconnecting\n' % e)
+            await asyncio.sleep(1)
+    raise RuntimeError('giving up after %d attempts' % RETRIES)
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument('address', help='badge address')
+    parser.add_argument('image', type=argparse.FileType('rb'), nargs='?',
+                        help='image file from newt create-image')
+    parser.add_argument('--base', type=argparse.FileType('rb'),
+                        help='image the badge is running; send a delta')
+    parser.add_argument('--no-mark', action='store_true',
+                        help='verify only; leave the boot vector alone')
+    parser.add_argument('--no-reset', action='store_true',
+                        help="don't reset the badge afterwards")
+    parser.add_argument('--bench', action='store_true',
+                        help='run the OTA benchmark on a QUACKER_BENCH build')
+    args = parser.parse_args()
+
+    if args.bench:
+        asyncio.run(bench(args))
+        return
+    if args.image is None:
+        parser.error('an image is required')
+
+    image = args.image.read()
+    if len(image) < 4 or struct.unpack_from('<I', image)[0] != IMAGE_MAGIC:
+        sys.exit('%s is not a newt image' % args.image.name)
+
+    patch = None
+    base_hash = None
+    if args.base is not None:
+        try:
+            patch, base_hash = quacker_delta.make_patch(args.base.read(),
+                                                        image)
+        except ValueError as e:
+            sys.exit('%s: %s' % (args.base.name, e))
+        print(quacker_delta.report(len(image), len(patch)))
+
+    try:
+        asyncio.run(upload(args, image, patch, base_hash))
+    except RuntimeError as e:
+        sys.exit(str(e))
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,188 @@
+#!/usr/bin/env python3
+#
+# Copyright 2016 ICE9 Consulting
+#
+# Licensed to the Apache Software Foundation (ASF) under one
+# or more contributor license agreements.  See the NOTICE file
+# distributed with this work for additional information
+# regarding copyright ownership.  The ASF licenses this file
+# to you under the Apache License, Version 2.0 (the
+# "License"); you may not use this file except in compliance
+# with the License.  You may obtain a copy of the License at
+#
+#  http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing,
+# software distributed under the License is distributed on an
+# "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+# KIND, either express or implied.  See the License for the
+# specific language governing permissions and limitations
+# under the License.
+#
+
+"""Poll the quacker stats characteristic and print or plot it.
+
+Connects to a badge by address, reads the stats characteristic every
+--interval seconds and prints one line per sample.  --csv also appends the
+samples to a file, and --plot draws the counters live (needs matplotlib).
+--hex decodes a value captured some other way instead of connecting.
+
+    quacker_stats.py AA:BB:CC:DD:EE:FF
+    quacker_stats.py --interval 5 --csv stats.csv --plot AA:BB:CC:DD:EE:FF
+    quacker_stats.py --hex 01061e000000...
+
+Connecting needs the bleak package.
+"""
+
+import argparse
+import asyncio
+import re
+import struct
+import sys
+import time
+
+STATS_UUID = '4c0b8e2a-7d15-4f63-b9a1-6e2d5c3f8a17'
+
+# Must match struct quacker_stats in apps/quacker/src/quacker.h.
+STATS_FMT = '<BBIIIIHIHHHHIBBHIII'
+STATS_FIELDS = ('version', 'num_tasks', 'uptime', 'keypresses', 'notify_sent',
+                'notify_dropped', 'reconnects', 'last_reconnect',
+                'flash_writes', 'mbuf_low_water', 'conn_itvl', 'conn_latency',
+                'notify_suppressed', 'fault_cause', 'fault_task', 'fault_line',
+                'fault_pc', 'fault_lr', 'fault_recover_usec')
+STATS_VERSION = 3
+
+# FAULT_* in quacker.h.
+FAULTS = ('none', 'hardfault', 'assert', 'watchdog', 'lockup', 'sysreset',
+          'planned')
+
+# Registration order in main().
+TASKS = ('quacker', 'button', 'led', 'power_led', 'accel', 'qlog', 'ota')
+
+PLOT_FIELDS = ('keypresses', 'notify_sent', 'notify_dropped',
+               'notify_suppressed', 'reconnects', 'flash_writes',
+               'mbuf_low_water')
+
+
+def decode(data):
+    fixed = struct.calcsize(STATS_FMT)
+    if len(data) < fixed:
+        raise ValueError('short stats value (%d bytes)' % len(data))
+    stats = dict(zip(STATS_FIELDS, struct.unpack_from(STATS_FMT, data)))
+    if stats['version'] != STATS_VERSION:
+        raise ValueError('unknown stats version %d' % stats['version'])
+
+    num = min(stats['num_tasks'], (len(data) - fixed) // 2)
+    free = struct.unpack_from('<%dH' % num, data, fixed)
+    for i, words in enumerate(free):
+        name = TASKS[i] if i < len(TASKS) else 'task%d' % i
+        stats['stack_' + name] = words * 4
+    return stats
+
+
+def format_header(stats):
+    return ' '.join('%10s' % k[:10] for k in stats if k not in
+                    ('version', 'num_tasks'))
+
+
+def format_row(stats):
+    out = []
+    for k, v in stats.items():
+        if k in ('version', 'num_tasks'):
+            continue
+        if k == 'conn_itvl':
+            out.append('%8.2fms' % (v * 1.25))
+        elif k == 'fault_cause':
+            out.append('%10s' % (FAULTS[v] if v < len(FAULTS) else v))
+        elif k in ('fault_pc', 'fault_lr'):
+            out.append('0x%08x' % v)
+        else:
+            out.append('%10d' % v)
+    return ' '.join(out)
+
+
+class Plot:
+    def __init__(self):
+        import matplotlib.pyplot as plt
+        self.plt = plt
+        self.fig, (self.counters, self.stacks) = plt.subplots(2, 1)
+        self.t = []
+        self.series = {}
+        plt.ion()
+
+    def add(self, stats):
+        self.t.append(stats['uptime'])
+        for k, v in stats.items():
+            if k in PLOT_FIELDS or k.startswith('stack_'):
+                self.series.setdefault(k, []).append(v)
+
+        self.counters.clear()
+        self.stacks.clear()
+        for k, v in self.series.items():
+            ax = self.stacks if k.startswith('stack_') else self.counters
+            ax.plot(self.t[-len(v):], v, label=k)
+        self.counters.set_ylabel('count')
+        self.stacks.set_ylabel('stack bytes free')
+        self.stacks.set_xlabel('uptime (s)')
+        self.counters.legend(loc='upper left', fontsize='small')
+        self.stacks.legend(loc='upper left', fontsize='small')
+        self.plt.pause(0.01)
+
+
+async def poll(args, emit):
+    from bleak import BleakClient
+
+    async with BleakClient(args.address) as client:
+        while True:
+            emit(decode(await client.read_gatt_char(STATS_UUID)))
+            await asyncio.sleep(args.interval)
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument('address', nargs='?', help='badge address')
+    parser.add_argument('--interval', type=float, default=10,
+                        help='seconds between reads (default 10)')
+    parser.add_argument('--csv', type=argparse.FileType('a'),
+                        help='append samples to this file')
+    parser.add_argument('--plot', action='store_true',
+                        help='plot the counters as they arrive')
+    parser.add_argument('--hex', help='decode this value and exit')
+    args = parser.parse_args()
+
+    if args.hex is not None:
+        stats = decode(bytes.fromhex(re.sub(r'[^0-9a-fA-F]', '', args.hex)))
+        for k, v in stats.items():
+            print('%-16s %d' % (k, v))
+        return
+
+    if args.address is None:
+        parser.error('an address is required unless --hex is given')
+
+    plot = Plot() if args.plot else None
+    header = [False]
+
+    def emit(stats):
+        if not header[0]:
+            print(format_header(stats))
+            if args.csv is not None:
+                args.csv.write('time,' + ','.join(stats) + '\n')
+            header[0] = True
+        print(format_row(stats))
+        if args.csv is not None:
+            args.csv.write('%d,' % time.time() +
+                           ','.join(str(v) for v in stats.values()) + '\n')
+            args.csv.flush()
+        if plot is not None:
+            plot.add(stats)
+
+    try:
+        asyncio.run(poll(args, emit))
+    except KeyboardInterrupt:
+        pass
+    except ValueError as e:
+        sys.exit(str(e))
+
+
+if __name__ == '__main__':
+    main()
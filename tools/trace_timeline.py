@@ -0,0 +1,148 @@
+#!/usr/bin/env python3
+#
+# Copyright 2016 ICE9 Consulting
+#
+# Licensed to the Apache Software Foundation (ASF) under one
+# or more contributor license agreements.  See the NOTICE file
+# distributed with this work for additional information
+# regarding copyright ownership.  The ASF licenses this file
+# to you under the Apache License, Version 2.0 (the
+# "License"); you may not use this file except in compliance
+# with the License.  You may obtain a copy of the License at
+#
+#  http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing,
+# software distributed under the License is distributed on an
+# "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+# KIND, either express or implied.  See the License for the
+# specific language governing permissions and limitations
+# under the License.
+#
+
+"""Render a quacker event trace (QUACKER_TRACE) as a timeline.
+
+Input is either a console capture containing "~T <usec> <id> <arg> <anchor>"
+lines (write 2 to the trace characteristic to produce one), or with --hex,
+the trace characteristic value as hex.  Any hex dump works; non-hex
+characters are ignored.
+
+The anchor column is how long after the active connection's last anchor
+point each event happened, in usec; blank when there was no connection.
+
+    trace_timeline.py console.log
+    trace_timeline.py --hex trace.txt
+"""
+
+import argparse
+import re
+import struct
+import sys
+
+# Must match enum trace_id in apps/quacker/src/quacker.h.
+EVENTS = {
+    1: 'gpio_edge',
+    2: 'debounce',
+    3: 'report_queued',
+    4: 'chr_updated',
+    5: 'report_read',
+    6: 'flash_begin',
+    7: 'flash_end',
+    8: 'led_frame',
+}
+
+FLASH_FILES = {0: 'orientation', 1: 'keystore', 2: 'gatt_db', 3: 'ota'}
+
+EVENT_FMT = '<IBBH'
+ANCHOR_NONE = 0xffff
+EVENT_SIZE = struct.calcsize(EVENT_FMT)
+
+BAR_USEC = 500      # One bar character per this many usec of gap.
+BAR_MAX = 40
+
+
+def parse_console(f):
+    events = []
+    for line in f:
+        m = re.match(r'~T ([0-9a-f]{8}) ([0-9a-f]{2}) ([0-9a-f]{2}) '
+                     r'([0-9a-f]{4})', line)
+        if m:
+            events.append(tuple(int(g, 16) for g in m.groups()))
+    return events
+
+
+def parse_hex(f):
+    """Unpacks struct trace_ring: head, count, then the raw ring."""
+    data = bytes.fromhex(re.sub(r'[^0-9a-fA-F]', '', f.read()))
+    head, count = struct.unpack_from('<HH', data)
+    num = (len(data) - 4) // EVENT_SIZE
+    ring = [struct.unpack_from(EVENT_FMT, data, 4 + i * EVENT_SIZE)
+            for i in range(num)]
+    return [ring[(head - count + i) % num] for i in range(count)]
+
+
+def describe(ev_id, arg):
+    name = EVENTS.get(ev_id, 'event_%d' % ev_id)
+    if ev_id == 2:
+        return '%s button=%d %s' % (name, arg >> 4,
+                                    'down' if arg & 1 else 'up')
+    if ev_id in (3, 5):
+        return '%s key=0x%02x' % (name, arg)
+    if ev_id in (6, 7):
+        return '%s %s' % (name, FLASH_FILES.get(arg, arg))
+    return '%s %d' % (name, arg)
+
+
+def press_latencies(events):
+    """Time from the first edge of a press to the report being read."""
+    out = []
+    edge = None
+    queued = None
+    for usec, ev_id, arg, _ in events:
+        if ev_id == 1 and edge is None:
+            edge = usec
+        elif ev_id == 3 and arg != 0 and edge is not None:
+            queued = usec
+        elif ev_id == 5 and arg != 0 and queued is not None:
+            out.append(((queued - edge) & 0xffffffff,
+                        (usec - queued) & 0xffffffff))
+            edge = queued = None
+        elif ev_id == 2 and not arg & 1:
+            edge = queued = None
+    return out
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument('--hex', action='store_true',
+                        help='input is the characteristic value in hex')
+    parser.add_argument('input', nargs='?', type=argparse.FileType('r'),
+                        default=sys.stdin)
+    args = parser.parse_args()
+
+    events = parse_hex(args.input) if args.hex else parse_console(args.input)
+    if not events:
+        sys.exit('no trace events found')
+
+    start = events[0][0]
+    prev = start
+    print('%10s %10s %8s  %s' % ('ms', '+usec', 'anchor+', 'event'))
+    for usec, ev_id, arg, anchor in events:
+        delta = (usec - prev) & 0xffffffff
+        bar = '|' * min(BAR_MAX, delta // BAR_USEC)
+        print('%10.3f %10d %8s  %-40s %s' % (
+            ((usec - start) & 0xffffffff) / 1e3, delta,
+            '' if anchor == ANCHOR_NONE else anchor,
+            describe(ev_id, arg), bar))
+        prev = usec
+
+    presses = press_latencies(events)
+    if presses:
+        print()
+        print('press: edge->queued  queued->read (usec)')
+        for debounce, notify in presses:
+            print('       %12d  %12d' % (debounce, notify))
+
+
+if __name__ == '__main__':
+    main()